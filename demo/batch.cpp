@@ -0,0 +1,366 @@
+#include "batch.hpp"
+#include "batch_kernel.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+uint8_t LaneBus::read(uint16_t addr) {
+	return b.peek(lane, addr);
+}
+
+void LaneBus::write(uint16_t addr, uint8_t v) {
+	b.poke(lane, addr, v);
+}
+
+static const batch::Kernels *best_kernels() {
+#if __GNUC__ && (defined(__x86_64__) || defined(__i386__))
+	if (__builtin_cpu_supports("avx2") && batch::avx2())
+		return batch::avx2();
+#endif
+
+	return kernels<Scalar>();
+}
+
+Batch::Batch(const std::array<uint8_t, 0x10000> &image, size_t lanes)
+	: stride((lanes + 31) & ~(size_t)31)
+	, a(stride), x(stride), y(stride), sp(stride), carry(stride), zero(stride), no_irq(stride), dec(stride), of(stride), neg(stride)
+	, pc_lo(stride), pc_hi(stride), active(stride), cycles(stride)
+	, lockstep(true), stats(), n(lanes), image(image), zp(512 * stride), mask(stride)
+	, page_of(lanes * 256), pool(), copies(), k(best_kernels()), bus(*this), cpu(bus)
+{
+	reset();
+}
+
+bool Batch::avx2() const noexcept {
+	return k != kernels<Scalar>();
+}
+
+void Batch::reset() {
+	for (size_t i = 0; i < stride; ++i) {
+		a[i] = x[i] = y[i] = 0;
+		sp[i] = 0xfd;
+		carry[i] = zero[i] = dec[i] = of[i] = neg[i] = 0;
+		no_irq[i] = 1;
+		pc_lo[i] = image[0xfffc];
+		pc_hi[i] = image[0xfffd];
+		active[i] = i < n ? 0xff : 0;
+		cycles[i] = 0;
+	}
+
+	for (unsigned addr = 0; addr < 512; ++addr)
+		memset(&zp[addr * stride], image[addr], stride);
+
+	if (!pool.empty()) {
+		std::fill(page_of.begin(), page_of.end(), 0);
+		pool.clear();
+		copies.fill(0);
+	}
+
+	stats = Stats();
+}
+
+uint8_t Batch::peek(size_t lane, uint16_t addr) const noexcept {
+	if (addr < 0x200)
+		return zp[addr * stride + lane];
+
+	uint32_t p = page_of[lane * 256 + (addr >> 8)];
+
+	return p ? pool[p - 1][addr & 0xff] : image[addr];
+}
+
+void Batch::poke(size_t lane, uint16_t addr, uint8_t v) {
+	if (addr < 0x200) {
+		zp[addr * stride + lane] = v;
+		return;
+	}
+
+	uint32_t &p = page_of[lane * 256 + (addr >> 8)];
+
+	if (!p) {
+		pool.emplace_back();
+		memcpy(pool.back().data(), &image[addr & 0xff00], 256);
+		p = (uint32_t)pool.size();
+		++copies[addr >> 8];
+	}
+
+	pool[p - 1][addr & 0xff] = v;
+}
+
+/*
+ * Decode instruction at \a pc for lockstep execution. Fails for everything
+ * that needs the interpreter: stack and indexed accesses, stores outside the
+ * zero page, undocumented opcodes and code or data on pages that differ
+ * between lanes.
+ */
+bool Batch::decode(uint16_t pc, batch::Insn &in) const {
+	using batch::Op;
+	using batch::Src;
+
+	static const std::pair<const char*, Op> names[] = {
+		{ "LDA", Op::lda }, { "LDX", Op::ldx }, { "LDY", Op::ldy }, { "STA", Op::sta }, { "STX", Op::stx }, { "STY", Op::sty },
+		{ "AND", Op::and_ }, { "ORA", Op::ora }, { "EOR", Op::eor }, { "ADC", Op::adc }, { "SBC", Op::sbc },
+		{ "CMP", Op::cmp }, { "CPX", Op::cpx }, { "CPY", Op::cpy }, { "BIT", Op::bit }, { "INC", Op::inc }, { "DEC", Op::dec },
+		{ "ASL", Op::asl }, { "LSR", Op::lsr }, { "ROL", Op::rol }, { "ROR", Op::ror },
+		{ "TAX", Op::tax }, { "TAY", Op::tay }, { "TXA", Op::txa }, { "TYA", Op::tya },
+		{ "INX", Op::inx }, { "INY", Op::iny }, { "DEX", Op::dex }, { "DEY", Op::dey },
+		{ "CLC", Op::clc }, { "SEC", Op::sec }, { "CLD", Op::cld }, { "SED", Op::sed }, { "CLV", Op::clv }, { "NOP", Op::nop },
+		{ "JMP", Op::jmp },
+		{ "BCC", Op::branch }, { "BCS", Op::branch }, { "BNE", Op::branch }, { "BEQ", Op::branch },
+		{ "BVC", Op::branch }, { "BVS", Op::branch }, { "BPL", Op::branch }, { "BMI", Op::branch },
+	};
+	// flag tested by the branches above, the second of each pair branches if it is set
+	static const uint8_t branch_flags[] = { batch::Lanes::c, batch::Lanes::z, batch::Lanes::v, batch::Lanes::n };
+	constexpr int first_branch = sizeof names / sizeof names[0] - 8;
+
+	auto plain = [this](uint16_t addr) { return addr >= 0x200 && !copies[addr >> 8]; };
+
+	if (!plain(pc))
+		return false;
+
+	const CPU::Opcode &o = CPU::table[image[pc]];
+	unsigned len = CPU::length(o.mode);
+	uint16_t arg = image[(uint16_t)(pc + 1)] | (image[(uint16_t)(pc + 2)] << 8);
+
+	if (!plain(pc + len - 1))
+		return false;
+
+	// index in names by opcode, or -1
+	static const std::array<int8_t, 256> index = [] {
+		std::array<int8_t, 256> v;
+
+		v.fill(-1);
+
+		for (unsigned op = 0; op < 256; ++op)
+			for (unsigned i = 0; i < sizeof names / sizeof names[0]; ++i)
+				if (!CPU::table[op].illegal && !strcmp(CPU::table[op].name, names[i].first))
+					v[op] = (int8_t)i;
+
+		return v;
+	}();
+
+	int i = index[image[pc]];
+
+	if (i < 0)
+		return false;
+
+	in.op = names[i].second;
+	in.src = Src::none;
+	in.val = in.addr = 0;
+	in.cycles = o.cycles;
+	in.taken = in.flag = in.want = 0;
+	in.next = pc + len;
+	in.target = 0;
+
+	bool store = in.op == Op::sta || in.op == Op::stx || in.op == Op::sty;
+	bool rmw = in.op == Op::inc || in.op == Op::dec || in.op == Op::asl || in.op == Op::lsr || in.op == Op::rol || in.op == Op::ror;
+
+	switch (o.mode) {
+	case CPU::imp:
+		return true;
+	case CPU::acc:
+		in.src = Src::acc;
+		return true;
+	case CPU::imm:
+		in.src = Src::imm;
+		in.val = (uint8_t)arg;
+		return true;
+	case CPU::zp:
+		in.src = Src::zp;
+		in.addr = (uint8_t)arg;
+		return true;
+	case CPU::abs:
+		if (in.op == Op::jmp) {
+			in.target = arg;
+			return true;
+		}
+
+		// same value in every lane, so it is just like an immediate
+		if (store || rmw || !plain(arg))
+			return false;
+
+		in.src = Src::imm;
+		in.val = image[arg];
+		return true;
+	case CPU::rel:
+		in.target = in.next + (int8_t)arg;
+		in.taken = (in.next ^ in.target) & 0xff00 ? 2 : 1;
+		in.flag = branch_flags[(i - first_branch) / 2];
+		in.want = (i - first_branch) & 1;
+		return true;
+	default:
+		return false;
+	}
+}
+
+unsigned Batch::step_lane(size_t lane) {
+	MOS6510 &r = cpu.r;
+
+	bus.lane = lane;
+	r.acc = a[lane];
+	r.x = x[lane];
+	r.y = y[lane];
+	r.sp = sp[lane];
+	r.carry = carry[lane];
+	r.zero = zero[lane];
+	r.no_irq = no_irq[lane];
+	r.dec = dec[lane];
+	r.brk = 0;
+	r.of = of[lane];
+	r.neg = neg[lane];
+	r.pc = pc(lane);
+	cpu.jammed = false;
+
+	unsigned took = cpu.step();
+
+	cycles[lane] += took;
+
+	a[lane] = r.acc;
+	x[lane] = r.x;
+	y[lane] = r.y;
+	sp[lane] = r.sp;
+	carry[lane] = r.carry;
+	zero[lane] = r.zero;
+	no_irq[lane] = r.no_irq;
+	dec[lane] = r.dec;
+	of[lane] = r.of;
+	neg[lane] = r.neg;
+	set_pc(lane, r.pc);
+
+	if (cpu.jammed)
+		active[lane] = 0;
+
+	return took;
+}
+
+void Batch::run(uint32_t max_cycles) {
+	if (!lockstep) {
+		for (size_t i = 0; i < n; ++i) {
+			for (; active[i] && cycles[i] < max_cycles; ++stats.scalar)
+				step_lane(i);
+
+			active[i] = 0;
+		}
+
+		return;
+	}
+
+	batch::Lanes l{
+		a.data(), x.data(), y.data(), sp.data(),
+		{ carry.data(), zero.data(), no_irq.data(), dec.data(), of.data(), neg.data() },
+		pc_lo.data(), pc_hi.data(), active.data(), mask.data(), cycles.data(), zp.data(), stride,
+	};
+
+	// upper bound of the cycles of all lanes, to check the limit only when needed
+	uint32_t most = max_cycles;
+
+	for (;;) {
+		if (most >= max_cycles) {
+			most = 0;
+
+			for (size_t i = 0; i < n; ++i) {
+				if (cycles[i] >= max_cycles)
+					active[i] = 0;
+				else if (active[i] && cycles[i] > most)
+					most = cycles[i];
+			}
+		}
+
+		uint16_t pc;
+		size_t count = k->select(l, pc);
+		batch::Insn in;
+
+		if (!count)
+			break;
+
+		if (decode(pc, in) && !((in.op == batch::Op::adc || in.op == batch::Op::sbc) && k->any(l, dec.data()))) {
+			k->execute(l, in);
+			most += in.cycles + in.taken;
+			stats.vector += count;
+			++stats.groups;
+			continue;
+		}
+
+		unsigned longest = 0;
+
+		for (size_t i = 0; i < n; ++i)
+			if (mask[i])
+				longest = std::max(longest, step_lane(i));
+
+		most += longest;
+		stats.scalar += count;
+	}
+}
+
+/*
+ * Multiply $02 by $03 with shift and add into $05:$04 and jam, every lane
+ * with other factors. The branch depends on the data, so lanes split and
+ * join again in every iteration.
+ */
+static const uint8_t mul[] = {
+	0xa9,0x00,0x85,0x04,0xa2,0x08,0x46,0x03,0x90,0x03,0x18,0x65,0x02,0x6a,0x66,0x04,
+	0xca,0xd0,0xf3,0x85,0x05,0x02,
+};
+
+void batch_bench(double seconds) {
+	auto image = std::make_unique<std::array<uint8_t, 0x10000>>();
+
+	image->fill(0);
+	memcpy(&(*image)[0x1000], mul, sizeof mul);
+	(*image)[0xfffd] = 0x10;
+
+	for (size_t lanes : { 1, 32, 256, 4096 }) {
+		auto b = std::make_unique<Batch>(*image, lanes);
+		std::vector<uint32_t> expect; // cycles of every lane must match too
+		double mhz[2], vector = 0;
+		bool ok = true;
+
+		for (int lockstep = 1; lockstep >= 0; --lockstep) {
+			uint64_t cycles = 0;
+			double s = 0;
+
+			b->lockstep = lockstep;
+
+			do {
+				b->reset();
+
+				for (size_t i = 0; i < lanes; ++i) {
+					b->poke(i, 2, (uint8_t)(i * 7));
+					b->poke(i, 3, (uint8_t)(i >> 3 ^ i));
+				}
+
+				// only time the run, not the setup
+				auto start = std::chrono::steady_clock::now();
+
+				b->run(10000);
+				s += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+				if (expect.empty())
+					expect = b->cycles;
+
+				ok &= b->cycles == expect;
+
+				for (size_t i = 0; i < lanes; ++i) {
+					int want = (uint8_t)(i * 7) * (uint8_t)(i >> 3 ^ i);
+
+					ok &= !b->active[i] && (b->peek(i, 4) | (b->peek(i, 5) << 8)) == want;
+					cycles += b->cycles[i];
+				}
+			} while (s < seconds);
+
+			mhz[lockstep] = cycles / s / 1e6;
+
+			if (lockstep)
+				vector = 100.0 * b->stats.vector / (b->stats.vector + b->stats.scalar);
+		}
+
+		printf("batch    %5zu lanes %8.1f MHz lockstep %8.1f MHz interpreter %6.2fx  %3.0f%% vector%s%s\n",
+			lanes, mhz[1], mhz[0], mhz[1] / mhz[0],
+			vector,
+			b->avx2() ? "  avx2" : "", ok ? "" : "  WRONG RESULT");
+	}
+}
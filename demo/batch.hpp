@@ -0,0 +1,107 @@
+#pragma once
+
+#include "cpu.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <vector>
+
+class Batch;
+
+namespace batch {
+
+class Insn;
+class Kernels;
+
+}
+
+/** Bus of one lane of a Batch, for the interpreter. */
+class LaneBus final : public Bus {
+public:
+	Batch &b;
+	size_t lane;
+
+	explicit LaneBus(Batch &b) : b(b), lane(0) {}
+
+	uint8_t read(uint16_t addr) override;
+	void write(uint16_t addr, uint8_t v) override;
+};
+
+/*
+ * Many independent 6510s running the same code on different data, e.g. to
+ * test a routine with thousands of inputs. Registers, flags and PCs are
+ * stored as structure of arrays, one byte per lane, and so are the zero page
+ * and the stack page of every lane. All other memory starts as the shared
+ * image and a lane gets a private copy of a page when it writes to it.
+ *
+ * run() repeatedly selects the lanes with the lowest PC. If the instruction
+ * there is simple enough, it is executed for all selected lanes at once with
+ * vector instructions, 32 lanes per AVX2 instruction where available. All
+ * other instructions, and code on pages a lane has written to, are executed
+ * one lane at a time by the interpreter. Lanes that branch differently thus
+ * run separately until their PCs meet again.
+ */
+class Batch final {
+public:
+	class Stats final {
+	public:
+		uint64_t vector; // lane instructions executed in lockstep
+		uint64_t scalar; // lane instructions executed by the interpreter
+		uint64_t groups; // vector instructions issued
+	};
+
+	/** Padded number of lanes, a multiple of 32. */
+	const size_t stride;
+
+	// registers of every lane, flags are 0 or 1
+	std::vector<uint8_t> a, x, y, sp, carry, zero, no_irq, dec, of, neg;
+	std::vector<uint8_t> pc_lo, pc_hi;
+	/** 0xff while the lane runs, 0 once it has jammed or used up its cycles. */
+	std::vector<uint8_t> active;
+	std::vector<uint32_t> cycles;
+	/** If false, run every lane on its own with the interpreter, for comparison. */
+	bool lockstep;
+	Stats stats;
+private:
+	friend class LaneBus;
+
+	size_t n;
+	std::array<uint8_t, 0x10000> image;
+	std::vector<uint8_t> zp; // pages 0 and 1, stride bytes per address
+	std::vector<uint8_t> mask;
+	std::vector<uint32_t> page_of; // private page + 1 of lane * 256 + page, or 0
+	std::vector<std::array<uint8_t, 256>> pool;
+	std::array<uint32_t, 256> copies; // lanes with a private copy of page
+	const batch::Kernels *k;
+	LaneBus bus;
+	CPU cpu;
+
+	bool decode(uint16_t pc, batch::Insn &in) const;
+	unsigned step_lane(size_t lane);
+public:
+	/** \a lanes lanes with memory \a image, reset. */
+	Batch(const std::array<uint8_t, 0x10000> &image, size_t lanes);
+
+	Batch(const Batch&) = delete;
+	Batch &operator=(const Batch&) = delete;
+
+	size_t size() const noexcept { return n; }
+	/** Reset registers, cycles, stats and memory of all lanes and jump through the reset vector. */
+	void reset();
+	/** Whether vector kernels use AVX2. */
+	bool avx2() const noexcept;
+
+	uint16_t pc(size_t lane) const noexcept { return pc_lo[lane] | (pc_hi[lane] << 8); }
+	void set_pc(size_t lane, uint16_t addr) noexcept { pc_lo[lane] = (uint8_t)addr; pc_hi[lane] = addr >> 8; }
+
+	uint8_t peek(size_t lane, uint16_t addr) const noexcept;
+	void poke(size_t lane, uint16_t addr, uint8_t v);
+
+	/** Run all active lanes until they jam or have run at least \a max_cycles cycles in total. */
+	void run(uint32_t max_cycles);
+};
+
+/** Measure batch throughput for several lane counts, with and without lockstep. */
+void batch_bench(double seconds);
@@ -0,0 +1,82 @@
+/*
+ * AVX2 kernels of Batch. This file is built with -mavx2, so nothing in it
+ * may run before the caller has checked that the CPU supports AVX2.
+ */
+
+#include "batch_kernel.hpp"
+
+#if __AVX2__
+
+#include <immintrin.h>
+
+namespace {
+
+/** 32 lanes in one AVX2 register. */
+class Avx2 final {
+public:
+	static constexpr size_t width = 32;
+
+	__m256i v;
+
+	static Avx2 set(uint8_t b) { return Avx2{ _mm256_set1_epi8((char)b) }; }
+	static Avx2 load(const uint8_t *p) { return Avx2{ _mm256_loadu_si256((const __m256i*)p) }; }
+	static void store(uint8_t *p, Avx2 a) { _mm256_storeu_si256((__m256i*)p, a.v); }
+
+	friend Avx2 operator+(Avx2 a, Avx2 b) { return Avx2{ _mm256_add_epi8(a.v, b.v) }; }
+	friend Avx2 operator-(Avx2 a, Avx2 b) { return Avx2{ _mm256_sub_epi8(a.v, b.v) }; }
+	friend Avx2 operator&(Avx2 a, Avx2 b) { return Avx2{ _mm256_and_si256(a.v, b.v) }; }
+	friend Avx2 operator|(Avx2 a, Avx2 b) { return Avx2{ _mm256_or_si256(a.v, b.v) }; }
+	friend Avx2 operator^(Avx2 a, Avx2 b) { return Avx2{ _mm256_xor_si256(a.v, b.v) }; }
+
+	static Avx2 eq(Avx2 a, Avx2 b) { return Avx2{ _mm256_cmpeq_epi8(a.v, b.v) }; }
+	static Avx2 ge(Avx2 a, Avx2 b) { return eq(Avx2{ _mm256_max_epu8(a.v, b.v) }, a); }
+	static Avx2 andnot(Avx2 m, Avx2 a) { return Avx2{ _mm256_andnot_si256(m.v, a.v) }; }
+	static Avx2 blend(Avx2 old, Avx2 v, Avx2 m) { return Avx2{ _mm256_blendv_epi8(old.v, v.v, m.v) }; }
+	static Avx2 adds(Avx2 a, Avx2 b) { return Avx2{ _mm256_adds_epu8(a.v, b.v) }; }
+	static Avx2 min(Avx2 a, Avx2 b) { return Avx2{ _mm256_min_epu8(a.v, b.v) }; }
+
+	// there are no byte shifts, so shift words and clear the bits from the neighbour
+	static Avx2 shl(Avx2 a, unsigned n) {
+		return Avx2{ _mm256_sll_epi16(a.v, _mm_cvtsi32_si128(n)) } & set(0xff << n);
+	}
+
+	static Avx2 shr(Avx2 a, unsigned n) {
+		return Avx2{ _mm256_srl_epi16(a.v, _mm_cvtsi32_si128(n)) } & set(0xff >> n);
+	}
+
+	static bool any(Avx2 m) { return !_mm256_testz_si256(m.v, m.v); }
+	static size_t count(Avx2 m) { return __builtin_popcount(_mm256_movemask_epi8(m.v)); }
+
+	static uint8_t hmin(Avx2 a) {
+		__m128i m = _mm_min_epu8(_mm256_castsi256_si128(a.v), _mm256_extracti128_si256(a.v, 1));
+
+		// minpos works on words, so fold bytes into zero extended words first
+		m = _mm_min_epu8(m, _mm_srli_epi16(m, 8));
+		m = _mm_minpos_epu16(_mm_and_si128(m, _mm_set1_epi16(0xff)));
+		return (uint8_t)_mm_cvtsi128_si32(m);
+	}
+
+	static void add_cycles(uint32_t *c, Avx2 n) {
+		for (unsigned i = 0; i < 4; ++i) {
+			__m128i part = i < 2 ? _mm256_castsi256_si128(n.v) : _mm256_extracti128_si256(n.v, 1);
+			__m256i w = _mm256_cvtepu8_epi32(i & 1 ? _mm_srli_si128(part, 8) : part);
+			__m256i *p = (__m256i*)(c + 8 * i);
+
+			_mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p), w));
+		}
+	}
+};
+
+}
+
+const batch::Kernels *batch::avx2() {
+	return kernels<Avx2>();
+}
+
+#else
+
+const batch::Kernels *batch::avx2() {
+	return nullptr;
+}
+
+#endif
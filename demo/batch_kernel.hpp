@@ -0,0 +1,268 @@
+#pragma once
+
+/*
+ * Lockstep kernels of Batch, written once for any vector type V. Included by
+ * batch.cpp with a scalar V and by batch_avx2.cpp with 32 byte AVX2 vectors.
+ * All code has internal linkage, because both files are built for different
+ * instruction sets.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+namespace batch {
+
+enum class Op : uint8_t {
+	lda, ldx, ldy, sta, stx, sty, and_, ora, eor, adc, sbc, cmp, cpx, cpy, bit,
+	inc, dec, asl, lsr, rol, ror, tax, tay, txa, tya, inx, iny, dex, dey,
+	clc, sec, cld, sed, clv, nop, branch, jmp,
+};
+
+enum class Src : uint8_t {
+	none,
+	imm, // val, also for absolute reads from shared memory
+	zp,  // zero page row addr
+	acc, // accumulator of shifts
+};
+
+/** Decoded instruction that all selected lanes execute. */
+class Insn final {
+public:
+	Op op;
+	Src src;
+	uint8_t val;
+	uint8_t addr;
+	uint8_t cycles;
+	uint8_t taken; // extra cycles of a taken branch
+	uint8_t flag;  // branch condition, index in Lanes::flags
+	uint8_t want;  // branch is taken if flag has this value
+	uint16_t next, target;
+};
+
+/** Structure of arrays of all lanes, stride bytes per row. */
+class Lanes final {
+public:
+	enum { c, z, i, d, v, n };
+
+	uint8_t *a, *x, *y, *sp;
+	uint8_t *flags[6];
+	uint8_t *lo, *hi;
+	uint8_t *active, *mask; // 0xff or 0
+	uint32_t *cycles;
+	uint8_t *zp;
+	size_t stride;
+};
+
+/** Kernels for one vector type. */
+class Kernels final {
+public:
+	size_t (*select)(const Lanes &l, uint16_t &pc);
+	bool (*any)(const Lanes &l, const uint8_t *flag);
+	void (*execute)(const Lanes &l, const Insn &in);
+};
+
+/** AVX2 kernels, or nullptr if not built with AVX2. Check that the CPU has AVX2 first. */
+const Kernels *avx2();
+
+}
+
+namespace {
+
+using namespace batch;
+
+/**
+ * Select lanes with the lowest PC among active ones into mask. Running the
+ * lowest PC first lets lanes that skipped code catch up with the others.
+ * Returns number of selected lanes.
+ */
+template<class V> size_t select(const Lanes &l, uint16_t &pc) {
+	const V ones = V::set(0xff);
+	V mh = ones;
+
+	for (size_t i = 0; i < l.stride; i += V::width)
+		mh = V::min(mh, V::blend(ones, V::load(l.hi + i), V::load(l.active + i)));
+
+	V hi = V::set(V::hmin(mh)), ml = ones;
+
+	for (size_t i = 0; i < l.stride; i += V::width)
+		ml = V::min(ml, V::blend(ones, V::load(l.lo + i), V::load(l.active + i) & V::eq(V::load(l.hi + i), hi)));
+
+	V lo = V::set(V::hmin(ml));
+	size_t count = 0;
+
+	for (size_t i = 0; i < l.stride; i += V::width) {
+		V m = V::load(l.active + i) & V::eq(V::load(l.hi + i), hi) & V::eq(V::load(l.lo + i), lo);
+
+		V::store(l.mask + i, m);
+		count += V::count(m);
+	}
+
+	pc = V::hmin(hi) << 8 | V::hmin(lo);
+	return count;
+}
+
+/** Whether any selected lane has \a flag set. */
+template<class V> bool any(const Lanes &l, const uint8_t *flag) {
+	V acc = V::set(0);
+
+	for (size_t i = 0; i < l.stride; i += V::width)
+		acc = acc | (V::load(flag + i) & V::load(l.mask + i));
+
+	return V::any(acc);
+}
+
+/** Execute \a in on all selected lanes. */
+template<class V> void execute(const Lanes &l, const Insn &in) {
+	const V zero = V::set(0), one = V::set(1), ones = V::set(0xff);
+	uint8_t *row = l.zp + in.addr * l.stride;
+
+	for (size_t i = 0; i < l.stride; i += V::width) {
+		V m = V::load(l.mask + i);
+
+		if (!V::any(m))
+			continue;
+
+		auto get = [&](const uint8_t *p) { return V::load(p + i); };
+		auto put = [&](uint8_t *p, V v) { V::store(p + i, V::blend(V::load(p + i), v, m)); };
+		auto nz = [&](V r) { put(l.flags[Lanes::z], V::eq(r, zero) & one); put(l.flags[Lanes::n], V::shr(r, 7)); };
+
+		V val = in.src == Src::imm ? V::set(in.val) : in.src == Src::zp ? get(row) : in.src == Src::acc ? get(l.a) : zero;
+		uint8_t *dst = in.src == Src::zp ? row : l.a;
+		V cycles = V::set(in.cycles) & m, r;
+		uint16_t next = in.next;
+
+		switch (in.op) {
+		case Op::lda: put(l.a, val); nz(val); break;
+		case Op::ldx: put(l.x, val); nz(val); break;
+		case Op::ldy: put(l.y, val); nz(val); break;
+		case Op::sta: put(row, get(l.a)); break;
+		case Op::stx: put(row, get(l.x)); break;
+		case Op::sty: put(row, get(l.y)); break;
+		case Op::and_: r = get(l.a) & val; put(l.a, r); nz(r); break;
+		case Op::ora: r = get(l.a) | val; put(l.a, r); nz(r); break;
+		case Op::eor: r = get(l.a) ^ val; put(l.a, r); nz(r); break;
+		case Op::adc: {
+			V a = get(l.a), c = get(l.flags[Lanes::c]), t = a + val;
+			V c1 = V::andnot(V::eq(V::adds(a, val), t), ones), c2 = V::eq(t, ones) & V::eq(c, one);
+
+			r = t + c;
+			put(l.flags[Lanes::c], (c1 | c2) & one);
+			put(l.flags[Lanes::v], V::shr((a ^ r) & (val ^ r), 7));
+			put(l.a, r);
+			nz(r);
+			break;
+		}
+		case Op::sbc: {
+			V a = get(l.a), b = get(l.flags[Lanes::c]) ^ one, t = a - val;
+			V b1 = V::andnot(V::ge(a, val), ones), b2 = V::eq(t, zero) & V::eq(b, one);
+
+			r = t - b;
+			put(l.flags[Lanes::c], V::andnot(b1 | b2, one));
+			put(l.flags[Lanes::v], V::shr((a ^ val) & (a ^ r), 7));
+			put(l.a, r);
+			nz(r);
+			break;
+		}
+		case Op::cmp:
+		case Op::cpx:
+		case Op::cpy: {
+			V reg = get(in.op == Op::cmp ? l.a : in.op == Op::cpx ? l.x : l.y);
+
+			put(l.flags[Lanes::c], V::ge(reg, val) & one);
+			nz(reg - val);
+			break;
+		}
+		case Op::bit:
+			put(l.flags[Lanes::z], V::eq(get(l.a) & val, zero) & one);
+			put(l.flags[Lanes::n], V::shr(val, 7));
+			put(l.flags[Lanes::v], V::shr(val, 6) & one);
+			break;
+		case Op::inc: r = val + one; put(row, r); nz(r); break;
+		case Op::dec: r = val - one; put(row, r); nz(r); break;
+		case Op::asl: r = V::shl(val, 1); put(l.flags[Lanes::c], V::shr(val, 7)); put(dst, r); nz(r); break;
+		case Op::lsr: r = V::shr(val, 1); put(l.flags[Lanes::c], val & one); put(dst, r); nz(r); break;
+		case Op::rol:
+			r = V::shl(val, 1) | get(l.flags[Lanes::c]);
+			put(l.flags[Lanes::c], V::shr(val, 7));
+			put(dst, r);
+			nz(r);
+			break;
+		case Op::ror:
+			r = V::shr(val, 1) | V::shl(get(l.flags[Lanes::c]), 7);
+			put(l.flags[Lanes::c], val & one);
+			put(dst, r);
+			nz(r);
+			break;
+		case Op::tax: r = get(l.a); put(l.x, r); nz(r); break;
+		case Op::tay: r = get(l.a); put(l.y, r); nz(r); break;
+		case Op::txa: r = get(l.x); put(l.a, r); nz(r); break;
+		case Op::tya: r = get(l.y); put(l.a, r); nz(r); break;
+		case Op::inx: r = get(l.x) + one; put(l.x, r); nz(r); break;
+		case Op::iny: r = get(l.y) + one; put(l.y, r); nz(r); break;
+		case Op::dex: r = get(l.x) - one; put(l.x, r); nz(r); break;
+		case Op::dey: r = get(l.y) - one; put(l.y, r); nz(r); break;
+		case Op::clc: put(l.flags[Lanes::c], zero); break;
+		case Op::sec: put(l.flags[Lanes::c], one); break;
+		case Op::cld: put(l.flags[Lanes::d], zero); break;
+		case Op::sed: put(l.flags[Lanes::d], one); break;
+		case Op::clv: put(l.flags[Lanes::v], zero); break;
+		case Op::nop: break;
+		case Op::jmp: next = in.target; break;
+		case Op::branch: {
+			V f = get(l.flags[in.flag]);
+			V taken = V::eq(f, in.want ? one : zero) & m;
+
+			// not taken lanes go to next, taken ones are redirected below
+			put(l.lo, V::set(next));
+			put(l.hi, V::set(next >> 8));
+			V::store(l.lo + i, V::blend(get(l.lo), V::set(in.target), taken));
+			V::store(l.hi + i, V::blend(get(l.hi), V::set(in.target >> 8), taken));
+			V::add_cycles(l.cycles + i, cycles + (taken & V::set(in.taken)));
+			continue;
+		}
+		}
+
+		put(l.lo, V::set(next));
+		put(l.hi, V::set(next >> 8));
+		V::add_cycles(l.cycles + i, cycles);
+	}
+}
+
+/** One lane at a time, for any CPU. */
+class Scalar final {
+public:
+	static constexpr size_t width = 1;
+
+	uint8_t v;
+
+	static Scalar set(uint8_t b) { return Scalar{ b }; }
+	static Scalar load(const uint8_t *p) { return Scalar{ *p }; }
+	static void store(uint8_t *p, Scalar a) { *p = a.v; }
+
+	friend Scalar operator+(Scalar a, Scalar b) { return set(a.v + b.v); }
+	friend Scalar operator-(Scalar a, Scalar b) { return set(a.v - b.v); }
+	friend Scalar operator&(Scalar a, Scalar b) { return set(a.v & b.v); }
+	friend Scalar operator|(Scalar a, Scalar b) { return set(a.v | b.v); }
+	friend Scalar operator^(Scalar a, Scalar b) { return set(a.v ^ b.v); }
+
+	static Scalar eq(Scalar a, Scalar b) { return set(a.v == b.v ? 0xff : 0); }
+	static Scalar ge(Scalar a, Scalar b) { return set(a.v >= b.v ? 0xff : 0); }
+	static Scalar andnot(Scalar m, Scalar a) { return set(~m.v & a.v); }
+	static Scalar blend(Scalar old, Scalar v, Scalar m) { return set((old.v & ~m.v) | (v.v & m.v)); }
+	static Scalar adds(Scalar a, Scalar b) { return set(a.v + b.v > 0xff ? 0xff : a.v + b.v); }
+	static Scalar min(Scalar a, Scalar b) { return a.v < b.v ? a : b; }
+	static Scalar shl(Scalar a, unsigned n) { return set(a.v << n); }
+	static Scalar shr(Scalar a, unsigned n) { return set(a.v >> n); }
+
+	static bool any(Scalar m) { return m.v != 0; }
+	static size_t count(Scalar m) { return m.v != 0; }
+	static uint8_t hmin(Scalar a) { return a.v; }
+	static void add_cycles(uint32_t *c, Scalar n) { *c += n.v; }
+};
+
+template<class V> const Kernels *kernels() {
+	static const Kernels k{ select<V>, any<V>, execute<V> };
+	return &k;
+}
+
+}
@@ -0,0 +1,217 @@
+#include "breakpoints.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include <stdexcept>
+
+Breakpoints::Breakpoints() : bits(), points(), any(), stopped(false), last{ 0, exec, 0, 0, 0, ~(uint64_t)0 } {}
+
+void Breakpoints::rebuild() {
+	for (auto &b : bits)
+		b.fill(0);
+
+	any.fill(false);
+
+	for (const Point &p : points) {
+		if (!p.enabled)
+			continue;
+
+		for (unsigned addr = p.from; addr <= p.to; ++addr)
+			bits[p.kind][addr >> 6] |= (uint64_t)1 << (addr & 63);
+
+		any[p.kind] = true;
+	}
+}
+
+bool Breakpoints::test(Kind k, uint16_t from, uint16_t to) const noexcept {
+	if (to < from)
+		return test(k, from, 0xffff) || test(k, 0, to);
+
+	for (unsigned i = from >> 6; i <= (unsigned)to >> 6; ++i) {
+		uint64_t m = bits[k][i];
+
+		if (i == from >> 6)
+			m &= ~(uint64_t)0 << (from & 63);
+		if (i == to >> 6)
+			m &= ~(uint64_t)0 >> (63 - (to & 63));
+		if (m)
+			return true;
+	}
+
+	return false;
+}
+
+size_t Breakpoints::add(Kind k, uint16_t from, uint16_t to, const std::string &cond) {
+	if (from > to)
+		throw std::runtime_error("breakpoints: empty address range");
+
+	points.emplace_back(Point{ k, from, to, parse(cond), cond, 0, true });
+	rebuild();
+
+	return points.size() - 1;
+}
+
+void Breakpoints::remove(size_t i) {
+	points.erase(points.begin() + i);
+	rebuild();
+}
+
+void Breakpoints::enable(size_t i, bool on) {
+	points.at(i).enabled = on;
+	rebuild();
+}
+
+void Breakpoints::clear() {
+	points.clear();
+	rebuild();
+}
+
+static bool holds(const Breakpoints::Term &t, const MOS6510 &r, uint16_t pc, uint8_t value, uint64_t hits) {
+	uint64_t v = 0;
+
+	switch (t.lhs) {
+	case Breakpoints::Term::a: v = r.acc; break;
+	case Breakpoints::Term::x: v = r.x; break;
+	case Breakpoints::Term::y: v = r.y; break;
+	case Breakpoints::Term::sp: v = r.sp; break;
+	case Breakpoints::Term::pc: v = pc; break;
+	case Breakpoints::Term::value: v = value; break;
+	case Breakpoints::Term::hits: v = hits; break;
+	}
+
+	switch (t.op) {
+	case Breakpoints::Term::eq: return v == t.rhs;
+	case Breakpoints::Term::ne: return v != t.rhs;
+	case Breakpoints::Term::lt: return v < t.rhs;
+	case Breakpoints::Term::le: return v <= t.rhs;
+	case Breakpoints::Term::gt: return v > t.rhs;
+	case Breakpoints::Term::ge: return v >= t.rhs;
+	}
+
+	return false;
+}
+
+bool Breakpoints::hit(Kind k, uint16_t addr, uint8_t value, const MOS6510 &r, uint16_t pc, uint64_t cycles) {
+	// going on from a breakpoint executes the instruction it stopped at
+	if (k == exec && last.kind == exec && last.addr == addr && last.cycles == cycles)
+		return false;
+
+	bool stop = false;
+
+	for (size_t i = 0; i < points.size(); ++i) {
+		Point &p = points[i];
+
+		if (p.kind != k || !p.enabled || addr < p.from || addr > p.to)
+			continue;
+
+		++p.hits;
+
+		bool all = true;
+
+		for (const Term &t : p.cond)
+			all = all && holds(t, r, pc, value, p.hits);
+
+		// the first one to stop is reported, but all count their hits
+		if (all && !stop) {
+			stop = true;
+			last = Stop{ i, k, pc, addr, value, cycles };
+		}
+	}
+
+	stopped |= stop;
+	return stop;
+}
+
+std::vector<Breakpoints::Term> Breakpoints::parse(const std::string &cond) {
+	static const std::pair<const char*, Term::Lhs> names[] = {
+		{ "a", Term::a }, { "x", Term::x }, { "y", Term::y }, { "sp", Term::sp },
+		{ "pc", Term::pc }, { "value", Term::value }, { "hits", Term::hits },
+	};
+
+	// longest first, so <= is not taken for <
+	static const std::pair<const char*, Term::Op> ops[] = {
+		{ "==", Term::eq }, { "!=", Term::ne }, { "<=", Term::le }, { ">=", Term::ge },
+		{ "<", Term::lt }, { ">", Term::gt }, { "=", Term::eq },
+	};
+
+	std::vector<Term> terms;
+	const char *s = cond.c_str();
+
+	auto skip = [&s]() {
+		while (isspace((unsigned char)*s))
+			++s;
+	};
+
+	skip();
+
+	if (!*s)
+		return terms;
+
+	for (;;) {
+		Term t{};
+		std::string name;
+
+		while (isalpha((unsigned char)*s))
+			name += (char)tolower((unsigned char)*s++);
+
+		bool found = false;
+
+		for (const auto &n : names)
+			if (name == n.first) {
+				t.lhs = n.second;
+				found = true;
+			}
+
+		if (!found)
+			throw std::runtime_error("breakpoints: unknown name \"" + name + "\" in \"" + cond + "\"");
+
+		skip();
+		found = false;
+
+		for (const auto &o : ops)
+			if (!found && !strncmp(s, o.first, strlen(o.first))) {
+				t.op = o.second;
+				s += strlen(o.first);
+				found = true;
+			}
+
+		if (!found)
+			throw std::runtime_error("breakpoints: missing comparison in \"" + cond + "\"");
+
+		skip();
+
+		int base = 10;
+
+		if (*s == '$') {
+			base = 16;
+			++s;
+		} else if (*s == '%') {
+			base = 2;
+			++s;
+		} else if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+			base = 16;
+			s += 2;
+		}
+
+		char *end;
+		t.rhs = strtoull(s, &end, base);
+
+		if (end == s)
+			throw std::runtime_error("breakpoints: missing number in \"" + cond + "\"");
+
+		s = end;
+		terms.emplace_back(t);
+		skip();
+
+		if (!*s)
+			return terms;
+
+		if (s[0] != '&' || s[1] != '&')
+			throw std::runtime_error("breakpoints: expected && in \"" + cond + "\"");
+
+		s += 2;
+		skip();
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "mos6510.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <string>
+#include <vector>
+
+/*
+ * Breakpoints and watchpoints of a CPU. The addresses that have any are kept
+ * in three bitmaps of 8K each, for execution, reads and writes, so the CPU
+ * checks an address with a single bit test. Only on a hit does it call hit(),
+ * which looks up the points in the side table, counts their hits and
+ * evaluates their conditions.
+ *
+ * A condition is a list of terms joined with &&, like "A == $FF && hits > 10".
+ * A term compares A, X, Y, SP, PC, VALUE or HITS with a number in decimal,
+ * $hex, 0xhex or %binary using ==, !=, <, <=, > or >=. PC is the address of
+ * the instruction, VALUE the byte read or written or the opcode, and HITS
+ * counts the hits of the point including this one.
+ */
+class Breakpoints final {
+public:
+	enum Kind : uint8_t {
+		exec,
+		read,
+		write,
+	};
+
+	class Term final {
+	public:
+		enum Lhs : uint8_t { a, x, y, sp, pc, value, hits } lhs;
+		enum Op : uint8_t { eq, ne, lt, le, gt, ge } op;
+		uint64_t rhs;
+	};
+
+	class Point final {
+	public:
+		Kind kind;
+		uint16_t from, to;
+		/** All must be true to stop, none means always. */
+		std::vector<Term> cond;
+		std::string text;
+		uint64_t hits;
+		bool enabled;
+	};
+
+	/** Where the CPU stopped. */
+	class Stop final {
+	public:
+		size_t point;
+		Kind kind;
+		uint16_t pc, addr;
+		uint8_t value;
+		uint64_t cycles;
+	};
+private:
+	std::array<std::array<uint64_t, 0x10000 / 64>, 3> bits;
+	std::vector<Point> points;
+	std::array<bool, 3> any; // enabled points of each kind
+	bool stopped;
+	Stop last;
+
+	void rebuild();
+public:
+	Breakpoints();
+
+	/** Add point for \a from to \a to inclusive. Throws if \a cond is not a valid condition. */
+	size_t add(Kind k, uint16_t from, uint16_t to, const std::string &cond="");
+	void remove(size_t i);
+	void enable(size_t i, bool on);
+	void clear();
+
+	const std::vector<Point> &list() const noexcept { return points; }
+
+	// called by CPU
+	bool test(Kind k, uint16_t addr) const noexcept { return bits[k][addr >> 6] >> (addr & 63) & 1; }
+	/** Whether any address from \a from to \a to inclusive has a point of kind \a k. Wraps at $FFFF. */
+	bool test(Kind k, uint16_t from, uint16_t to) const noexcept;
+	bool has(Kind k) const noexcept { return any[k]; }
+	/** Whether any point is enabled, the CPU only needs the points then. */
+	bool active() const noexcept { return any[exec] || any[read] || any[write]; }
+	/**
+	 * Count hit of \a addr by the instruction at \a pc and return whether it
+	 * stops. The CPU stops before executing a breakpoint, so going on from
+	 * there does not hit it again.
+	 */
+	bool hit(Kind k, uint16_t addr, uint8_t value, const MOS6510 &r, uint16_t pc, uint64_t cycles);
+
+	/** Whether a point stopped the CPU since the last resume(). */
+	bool pending() const noexcept { return stopped; }
+	void resume() noexcept { stopped = false; }
+	/** Last stop. Only valid once pending() was true. */
+	const Stop &stop() const noexcept { return last; }
+
+	/** Parse condition. Throws on syntax errors. */
+	static std::vector<Term> parse(const std::string &cond);
+};
@@ -0,0 +1,474 @@
+#include "c64.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+C64Bus::C64Bus()
+	: ram(), color(), cpu(nullptr), rd(), wr(), chips(), regs(), basic_rom(), kernal_rom(), roml_rom(), romh_rom(), char_rom()
+	, open(), sink(), loaded(), ddr(ddr_init), port(port_init), exrom(true), game(true), config(-1), remaps(0)
+{
+	open.fill(0xff);
+	remap();
+}
+
+void C64Bus::remap() {
+	uint8_t bits = port_value();
+	int now = (bits & 7) | exrom << 3 | game << 4;
+
+	// $00 and $01 read the port, the zero page is read from RAM
+	ram[0] = ddr;
+	ram[1] = bits;
+
+	if (now == config)
+		return;
+
+	std::array<uint8_t*, 256> before;
+
+	for (unsigned page = 0; page < 256; ++page)
+		before[page] = direct(page);
+
+	config = now;
+	++remaps;
+
+	for (unsigned page = 0; page < 256; ++page)
+		rd[page] = wr[page] = &ram[page << 8];
+
+	// ROMs are only seen by reads, writes go to the RAM below
+	auto rom = [this](unsigned page, Rom r) {
+		size_t size;
+		const uint8_t *data = image(r, size);
+
+		if (loaded[r])
+			for (unsigned i = 0; i < size >> 8; ++i)
+				rd[page + i] = data + (i << 8);
+	};
+
+	auto io = [this]() {
+		for (unsigned page = 0xd0; page < 0xe0; ++page)
+			rd[page] = wr[page] = nullptr;
+
+		for (unsigned page = 0xd8; page < 0xdc; ++page)
+			rd[page] = wr[page] = &color[(page - 0xd8) << 8];
+	};
+
+	bool loram = bits & 1, hiram = bits & 2, charen = bits & 4;
+
+	if (exrom && !game) {
+		// ultimax: only the lowest 4K of RAM, the cartridge and I/O
+		for (unsigned page = 0x10; page < 0x100; ++page)
+			if (page < 0x80 || (page >= 0xa0 && page < 0xd0)) {
+				rd[page] = open.data();
+				wr[page] = sink.data();
+			}
+
+		rom(0x80, roml);
+		rom(0xe0, romh);
+		io();
+	} else {
+		if (loram && hiram && !exrom)
+			rom(0x80, roml);
+
+		if (hiram && !exrom && !game)
+			rom(0xa0, romh);
+		else if (loram && hiram)
+			rom(0xa0, basic);
+
+		if (loram || hiram) {
+			if (charen)
+				io();
+			else
+				rom(0xd0, chargen);
+		}
+
+		if (hiram)
+			rom(0xe0, kernal);
+	}
+
+	wr[0] = nullptr;
+
+	if (!cpu)
+		return;
+
+	for (unsigned page = 0; page < 256; ++page)
+		if (before[page] != direct(page)) {
+			cpu->flush();
+			return;
+		}
+}
+
+uint8_t C64Bus::io_read(uint16_t addr, bool peek) {
+	if (addr < 0xd000 || addr >= 0xe000)
+		return ram[addr];
+
+	Bus *chip = chips[(addr >> 8) - 0xd0];
+
+	if (!chip)
+		return regs[addr & 0xfff];
+
+	return peek ? chip->peek(addr) : chip->read(addr);
+}
+
+void C64Bus::io_write(uint16_t addr, uint8_t v) {
+	if (addr < 0x100) {
+		if (addr > 1) {
+			ram[addr] = v;
+			return;
+		}
+
+		if (addr)
+			port = v;
+		else
+			ddr = v;
+
+		remap();
+		return;
+	}
+
+	Bus *chip = chips[(addr >> 8) - 0xd0];
+
+	if (chip)
+		chip->write(addr, v);
+	else
+		regs[addr & 0xfff] = v;
+}
+
+uint8_t *C64Bus::image(Rom r, size_t &size) {
+	size = r == chargen ? char_rom.size() : 0x2000;
+
+	switch (r) {
+	case basic: return basic_rom.data();
+	case kernal: return kernal_rom.data();
+	case chargen: return char_rom.data();
+	case roml: return roml_rom.data();
+	default: return romh_rom.data();
+	}
+}
+
+void C64Bus::load_rom(Rom r, const std::string &path) {
+	std::ifstream in(path, std::ios::binary);
+
+	if (!in)
+		throw std::runtime_error(std::string("c64: cannot open \"") + path + "\"");
+
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+	load_rom(r, data.data(), data.size());
+}
+
+void C64Bus::load_rom(Rom r, const uint8_t *data, size_t size) {
+	size_t want;
+	uint8_t *dst = image(r, want);
+
+	if (size != want)
+		throw std::runtime_error("c64: ROM image has " + std::to_string(size) + " bytes instead of " + std::to_string(want));
+
+	std::copy(data, data + size, dst);
+	loaded[r] = true;
+	config = -1;
+	remap();
+}
+
+void C64Bus::load_roms(const std::string &dir) {
+	load_rom(basic, dir + "/basic");
+	load_rom(kernal, dir + "/kernal");
+	load_rom(chargen, dir + "/chargen");
+}
+
+void C64Bus::unload_rom(Rom r) {
+	loaded[r] = false;
+	config = -1;
+	remap();
+}
+
+void C64Bus::cartridge(bool exrom, bool game) {
+	this->exrom = exrom;
+	this->game = game;
+	remap();
+}
+
+void C64Bus::attach(uint8_t page, Bus *chip) {
+	if (page < 0xd0 || page > 0xdf)
+		throw std::runtime_error("c64: chips can only be attached to pages $D0 to $DF");
+
+	chips[page - 0xd0] = chip;
+}
+
+void C64Bus::reset() {
+	ddr = ddr_init;
+	port = port_init;
+	remap();
+}
+
+void C64Bus::restore(const State &s) {
+	color = s.color;
+	regs = s.regs;
+	ddr = s.ddr;
+	port = s.port;
+	exrom = s.exrom;
+	game = s.game;
+	remap();
+}
+
+void C64Bus::load(uint16_t addr, const uint8_t *data, size_t size) {
+	for (size_t i = 0; i < size; ++i)
+		ram[(uint16_t)(addr + i)] = data[i];
+
+	// may have overwritten the port
+	ram[0] = ddr;
+	ram[1] = port_value();
+}
+
+Machine::Machine(C64Bus &bus, CPU &cpu) : bus(bus), cpu(cpu), sched(), cia1(sched, cpu.cycles), cia2(sched, cpu.cycles), vic(sched, cpu.cycles), recorder(*this), nmi_line(false) {
+	sched.cpu = &cpu;
+
+	for (unsigned page = 0xd0; page < 0xd4; ++page)
+		bus.attach(page, &vic);
+
+	bus.attach(0xdc, &cia1);
+	bus.attach(0xdd, &cia2);
+}
+
+Machine::~Machine() {
+	for (unsigned page = 0xd0; page < 0xd4; ++page)
+		bus.attach(page, nullptr);
+
+	bus.attach(0xdc, nullptr);
+	bus.attach(0xdd, nullptr);
+}
+
+void Machine::interrupts() {
+	if (cia1.irq() || vic.irq())
+		cpu.irq();
+
+	// NMI is edge triggered, and the line may have dropped and risen again since the last look
+	bool nmi = cia2.irq();
+
+	if (cia2.released())
+		nmi_line = false;
+
+	if (nmi && !nmi_line)
+		cpu.nmi();
+
+	nmi_line = nmi;
+}
+
+uint64_t Machine::run(uint64_t n) {
+	uint64_t start = cpu.cycles, end = start + n;
+
+	if (cpu.breaks)
+		cpu.breaks->resume();
+
+	while (cpu.cycles < end && !cpu.jammed && !(cpu.breaks && cpu.breaks->pending())) {
+		sched.fire(cpu.cycles);
+		interrupts();
+
+		uint64_t stop = std::min(end, sched.next());
+
+		// a masked interrupt is taken once I is cleared, which is only seen between instructions
+		if (cpu.r.no_irq && (cia1.irq() || vic.irq()))
+			stop = cpu.cycles + 1;
+
+		cpu.run(stop > cpu.cycles ? stop - cpu.cycles : 1);
+	}
+
+	return cpu.cycles - start;
+}
+
+unsigned Machine::step() {
+	sched.fire(cpu.cycles);
+	interrupts();
+
+	return cpu.step();
+}
+
+void Machine::reset() {
+	recorder.change(cpu.cycles);
+	bus.reset();
+	cia1.reset();
+	cia2.reset();
+	vic.reset();
+	nmi_line = false;
+	cpu.reset();
+}
+
+MachineState Machine::state() const {
+	return MachineState{ bus.state(), cia1.state(), cia2.state(), vic.state(), nmi_line };
+}
+
+void Machine::restore(const MachineState &s) {
+	bus.restore(s.bus);
+	cia1.restore(s.cia1);
+	cia2.restore(s.cia2);
+	vic.restore(s.vic);
+	nmi_line = s.nmi_line;
+
+	// after the registers, so a frame begun because the clock went back starts with them
+	recorder.change(cpu.cycles);
+}
+
+void machine_bench(double seconds) {
+	static const std::pair<CPU::Dispatch, const char*> dispatchers[] = {
+		{ CPU::Dispatch::switched, "switch" },
+		{ CPU::Dispatch::blocks, "blocks" },
+		{ CPU::Dispatch::jit, "jit" },
+	};
+
+	/*
+	 * Copy loop with a CIA 1 timer interrupt every PAL frame, whose handler
+	 * acknowledges it and counts it in $FB/$FC.
+	 */
+	static const uint8_t code[] = {
+		0x78, 0xa9,0x31, 0x8d,0xfe,0xff, 0xa9,0x10, 0x8d,0xff,0xff,
+		0xa9,0x7f, 0x8d,0x0d,0xdc, 0xa9,0xc7, 0x8d,0x04,0xdc, 0xa9,0x4c, 0x8d,0x05,0xdc,
+		0xa9,0x81, 0x8d,0x0d,0xdc, 0xa9,0x11, 0x8d,0x0e,0xdc, 0x58,
+		0xbd,0x00,0x20, 0x9d,0x00,0x30, 0xe8, 0xd0,0xf7, 0x4c,0x25,0x10,
+		0x48, 0xad,0x0d,0xdc, 0xe6,0xfb, 0xd0,0x02, 0xe6,0xfc, 0x68, 0x40,
+	};
+
+	for (const auto &d : dispatchers) {
+		double mhz[2];
+		uint64_t irqs = 0, expect = 0;
+
+		// first the bare CPU, which never sees the interrupt
+		for (int events = 0; events < 2; ++events) {
+			auto bus = std::make_unique<C64Bus>();
+			CPU cpu(*bus);
+			Machine m(*bus, cpu);
+
+			bus->cpu = &cpu;
+			bus->load(0x1000, code, sizeof code);
+			cpu.dispatch = d.first;
+			cpu.r.pc = 0x1000;
+
+			uint64_t cycles = 0;
+			auto start = std::chrono::steady_clock::now();
+			double s;
+
+			do {
+				cycles += events ? m.run(1000000) : cpu.run(1000000);
+				s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			} while (s < seconds);
+
+			mhz[events] = cycles / s / 1e6;
+			// the count wraps at 16 bits, and the start of the timer is only about known
+			irqs = bus->ram[0xfb] | bus->ram[0xfc] << 8;
+			expect = cpu.cycles / 0x4cc8;
+		}
+
+		printf("machine  %-8s %8.1f MHz bare %8.1f MHz %6.2fx  %5u of %5u irqs%s\n",
+			d.second, mhz[1], mhz[0], mhz[1] / mhz[0], (unsigned)irqs, (unsigned)(expect & 0xffff),
+			(uint16_t)(irqs - expect + 1) <= 2 ? "" : "  WRONG IRQ COUNT");
+	}
+
+	/*
+	 * The same loop with the timer on CIA 2, whose handler acknowledges the
+	 * NMI inside a burst. Every period must be a new edge.
+	 */
+	static const uint8_t nmi[] = {
+		0x78, 0xa9,0x31, 0x8d,0xfa,0xff, 0xa9,0x10, 0x8d,0xfb,0xff,
+		0xa9,0x7f, 0x8d,0x0d,0xdd, 0xa9,0xc7, 0x8d,0x04,0xdd, 0xa9,0x4c, 0x8d,0x05,0xdd,
+		0xa9,0x81, 0x8d,0x0d,0xdd, 0xa9,0x11, 0x8d,0x0e,0xdd, 0xea,
+		0xbd,0x00,0x20, 0x9d,0x00,0x30, 0xe8, 0xd0,0xf7, 0x4c,0x25,0x10,
+		0x48, 0xad,0x0d,0xdd, 0xe6,0xfb, 0xd0,0x02, 0xe6,0xfc, 0x68, 0x40,
+	};
+
+	for (const auto &d : dispatchers) {
+		auto bus = std::make_unique<C64Bus>();
+		CPU cpu(*bus);
+		Machine m(*bus, cpu);
+
+		bus->cpu = &cpu;
+		bus->load(0x1000, nmi, sizeof nmi);
+		cpu.dispatch = d.first;
+		cpu.r.pc = 0x1000;
+
+		while (cpu.cycles < 0x4cc8 * 200)
+			m.run(100000);
+
+		uint64_t nmis = bus->ram[0xfb] | bus->ram[0xfc] << 8, expect = cpu.cycles / 0x4cc8;
+
+		printf("machine  nmi      %-8s %5u of %5u nmis%s\n",
+			d.second, (unsigned)nmis, (unsigned)expect, nmis + 1 >= expect && nmis <= expect ? "" : "  WRONG NMI COUNT");
+	}
+
+	/*
+	 * Store the CIA 1 timer A low byte 256 times from a loop, which must give
+	 * the same bytes with every dispatcher. This sees whether the clock is up
+	 * to date when compiled code reads I/O.
+	 */
+	static const uint8_t timer[] = {
+		0x78, 0xa9,0x7f, 0x8d,0x0d,0xdc, 0xa9,0x11, 0x8d,0x0e,0xdc, 0xa2,0x00, 0xa0,0x00,
+		0xb9,0x04,0xdc, 0x9d,0x00,0x20, 0xe8, 0xd0,0xf7, 0x02,
+	};
+	std::vector<uint8_t> expect;
+
+	for (const auto &d : dispatchers) {
+		auto bus = std::make_unique<C64Bus>();
+		CPU cpu(*bus);
+		Machine m(*bus, cpu);
+
+		bus->cpu = &cpu;
+		bus->load(0x1000, timer, sizeof timer);
+		cpu.dispatch = d.first;
+		cpu.r.pc = 0x1000;
+
+		while (!cpu.jammed && cpu.cycles < 1000000)
+			m.run(100000);
+
+		std::vector<uint8_t> got(bus->ram.begin() + 0x2000, bus->ram.begin() + 0x2100);
+
+		if (expect.empty())
+			expect = got;
+
+		printf("machine  timer    %-8s stores %02x %02x %02x %02x %02x %02x%s\n",
+			d.second, got[0], got[1], got[2], got[3], got[4], got[5], got == expect ? "" : "  STATE MISMATCH");
+	}
+
+	/*
+	 * Poll the CIA 2 interrupt control register with LDA $DD00,Y while its
+	 * timer raises an NMI that the handler does not acknowledge. The poll
+	 * schedules the next NMI, so compiled code must leave the block after it.
+	 * The handler stores X at each NMI to $2100 on.
+	 */
+	static const uint8_t poll[] = {
+		0xa9,0x00, 0x8d,0xfa,0xff, 0xa9,0x11, 0x8d,0xfb,0xff,
+		0xa9,0x7f, 0x8d,0x0d,0xdd, 0xa9,0x47, 0x8d,0x04,0xdd, 0xa9,0x00, 0x8d,0x05,0xdd,
+		0xa9,0x81, 0x8d,0x0d,0xdd, 0xa9,0x11, 0x8d,0x0e,0xdd, 0xa0,0x0d, 0xa2,0x00,
+		0xb9,0x00,0xdd, 0x9d,0x00,0x20, 0xe8, 0xd0,0xf7, 0xc6,0xfc, 0xd0,0xf3, 0x02,
+	};
+	static const uint8_t store[] = {
+		0x48, 0x98, 0x48, 0xa4,0xfb, 0x8a, 0x99,0x00,0x21, 0xe6,0xfb, 0x68, 0xa8, 0x68, 0x40,
+	};
+
+	expect.clear();
+
+	for (const auto &d : dispatchers) {
+		auto bus = std::make_unique<C64Bus>();
+		CPU cpu(*bus);
+		Machine m(*bus, cpu);
+
+		bus->cpu = &cpu;
+		bus->load(0x1000, poll, sizeof poll);
+		bus->load(0x1100, store, sizeof store);
+		cpu.dispatch = d.first;
+		cpu.r.pc = 0x1000;
+
+		while (!cpu.jammed && cpu.cycles < 2000000)
+			m.run(100000);
+
+		std::vector<uint8_t> got(bus->ram.begin() + 0x2100, bus->ram.begin() + 0x2200);
+
+		if (expect.empty())
+			expect = got;
+
+		printf("machine  poll     %-8s nmi at x %02x %02x %02x %02x %02x %02x%s\n",
+			d.second, got[0], got[1], got[2], got[3], got[4], got[5], got == expect ? "" : "  STATE MISMATCH");
+	}
+}
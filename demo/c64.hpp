@@ -0,0 +1,181 @@
+#pragma once
+
+#include "chips.hpp"
+#include "cpu.hpp"
+#include "events.hpp"
+#include "raster.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <string>
+
+/*
+ * C64 memory map. The processor port at $00 and $01 and the cartridge lines
+ * EXROM and GAME select what is visible where, which is resolved into a read
+ * and a write table of 256 pages whenever one of them changes. A page points
+ * to RAM, ROM or colour RAM, so every access to it is one indexed load, or is
+ * nullptr if a handler has to look at it: the chips at $D000 to $DFFF, the
+ * port in the zero page and areas that are not connected in ultimax mode.
+ *
+ * Chips are attached as a Bus per I/O page. Pages without one are plain
+ * registers that read back what was written. ROMs that have not been loaded
+ * leave the RAM below them visible, so code runs without any images.
+ */
+class C64Bus final : public Bus {
+public:
+	enum Rom : uint8_t {
+		basic,
+		kernal,
+		chargen,
+		roml, // cartridge at $8000
+		romh, // cartridge at $A000 or $E000 in ultimax mode
+	};
+
+	/** Power up values of the port. */
+	static constexpr uint8_t ddr_init = 0x2f, port_init = 0x37;
+
+	std::array<uint8_t, 0x10000> ram;
+	/** Only the low nybbles are used by the VIC. */
+	std::array<uint8_t, 0x400> color;
+	/** Flushed when the direct pages change, may be nullptr. */
+	CPU *cpu;
+private:
+	std::array<const uint8_t*, 256> rd;
+	std::array<uint8_t*, 256> wr;
+	std::array<Bus*, 16> chips; // $D000 to $DFFF
+	std::array<uint8_t, 0x1000> regs; // I/O pages without a chip
+	std::array<uint8_t, 0x2000> basic_rom, kernal_rom, roml_rom, romh_rom;
+	std::array<uint8_t, 0x1000> char_rom;
+	std::array<uint8_t, 256> open, sink; // unconnected pages read $FF and ignore writes
+	std::array<bool, 5> loaded;
+	uint8_t ddr, port;
+	bool exrom, game; // cartridge lines, active low
+	int config; // inputs of the last remap(), -1 if none
+	unsigned remaps;
+
+	void remap();
+	uint8_t *image(Rom r, size_t &size);
+	uint8_t io_read(uint16_t addr, bool peek);
+	void io_write(uint16_t addr, uint8_t v);
+public:
+	C64Bus();
+	C64Bus(const C64Bus&) = delete;
+
+	uint8_t read(uint16_t addr) override {
+		const uint8_t *p = rd[addr >> 8];
+		return p ? p[addr & 0xff] : io_read(addr, false);
+	}
+
+	void write(uint16_t addr, uint8_t v) override {
+		uint8_t *p = wr[addr >> 8];
+
+		if (p)
+			p[addr & 0xff] = v;
+		else
+			io_write(addr, v);
+	}
+
+	uint8_t peek(uint16_t addr) override {
+		const uint8_t *p = rd[addr >> 8];
+		return p ? p[addr & 0xff] : io_read(addr, true);
+	}
+
+	/** RAM pages that are both read and written, which excludes the zero page because of the port. */
+	uint8_t *direct(uint8_t page) override { return rd[page] == wr[page] ? wr[page] : nullptr; }
+
+	/** Load ROM image \a r from \a path. Throws if it cannot be read or has the wrong size. */
+	void load_rom(Rom r, const std::string &path);
+	/** Copy ROM image \a r, which must be exactly as large as the ROM. */
+	void load_rom(Rom r, const uint8_t *data, size_t size);
+	/** Load BASIC, KERNAL and character ROM from the files basic, kernal and chargen in \a dir, as VICE names them. */
+	void load_roms(const std::string &dir);
+	/** Forget ROM image \a r, leaving the RAM below visible. */
+	void unload_rom(Rom r);
+	bool has_rom(Rom r) const noexcept { return loaded[r]; }
+	/** Character ROM for the VIC, nullptr if not loaded. */
+	const uint8_t *char_image() const noexcept { return loaded[chargen] ? char_rom.data() : nullptr; }
+
+	/** Set cartridge lines. Both high is no cartridge, EXROM low 8K, both low 16K and GAME low ultimax mode. */
+	void cartridge(bool exrom, bool game);
+
+	/** Attach \a chip to I/O page \a page ($D0 to $DF), or detach it if nullptr. */
+	void attach(uint8_t page, Bus *chip);
+
+	/** Reset the port to its power up values. RAM is kept. */
+	void reset();
+
+	/** Port, cartridge lines, colour RAM and I/O pages without a chip, for snapshots. RAM and ROMs are not included. */
+	class State final {
+	public:
+		std::array<uint8_t, 0x400> color;
+		std::array<uint8_t, 0x1000> regs;
+		uint8_t ddr, port;
+		bool exrom, game;
+	};
+
+	State state() const { return State{ color, regs, ddr, port, exrom, game }; }
+	/** Go back to \a s. Flushes the CPU if that changes the direct pages. */
+	void restore(const State &s);
+
+	uint8_t port_ddr() const noexcept { return ddr; }
+	/** What $01 reads as: the port where it is an output, pulled up inputs elsewhere. */
+	uint8_t port_value() const noexcept { return (port & ddr) | (0x17 & ~ddr); }
+	/** Times the tables were rebuilt. */
+	unsigned remap_count() const noexcept { return remaps; }
+
+	/** Copy \a size bytes to RAM at \a addr. Wraps around at $FFFF. */
+	void load(uint16_t addr, const uint8_t *data, size_t size);
+};
+
+/** What a snapshot of a Machine needs besides the CPU and RAM. Not nested, so the journal can declare it. */
+class MachineState final {
+public:
+	C64Bus::State bus;
+	Cia::State cia1, cia2;
+	VicII::State vic;
+	bool nmi_line;
+};
+
+/*
+ * C64 made of a CPU on a C64Bus with two CIAs and the raster interrupt of the
+ * VIC-II. run() lets the CPU run in bursts up to the next event and handles
+ * events and interrupts in between, so code that does not touch the chips
+ * runs at the speed of the dispatcher. CIA 1 and the VIC raise IRQ, CIA 2
+ * raises NMI.
+ */
+class Machine final {
+public:
+	C64Bus &bus;
+	CPU &cpu;
+	Scheduler sched;
+	Cia cia1, cia2;
+	VicII vic;
+	/** Off until given a Pipeline. */
+	Recorder recorder;
+private:
+	bool nmi_line;
+
+	void interrupts();
+public:
+	/** Attach the chips to \a bus, which \a cpu runs on. */
+	Machine(C64Bus &bus, CPU &cpu);
+	Machine(const Machine&) = delete;
+	~Machine();
+
+	/** Run at least \a n cycles, until the CPU jams or a breakpoint stops. Returns cycles executed. */
+	uint64_t run(uint64_t n);
+	/** Execute one instruction after events and interrupts that are due. */
+	unsigned step();
+
+	/** Reset chips, port and CPU. */
+	void reset();
+
+	MachineState state() const;
+	/** Go back to \a s. CPU::cycles must already be back at the cycle \a s was taken. */
+	void restore(const MachineState &s);
+};
+
+/** Measure CPU speed through Machine against the bare CPU. */
+void machine_bench(double seconds);
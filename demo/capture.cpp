@@ -0,0 +1,281 @@
+#include "capture.hpp"
+#include "net.hpp"
+#include "sched.hpp"
+#include "ultimate.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <chrono>
+#include <map>
+#include <stdexcept>
+#include <thread>
+
+static uint64_t now_us() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CaptureWriter::CaptureWriter(const std::string &path) : f(fopen(path.c_str(), "ab")), path(path), last(0), left(0), records(0), err() {
+	if (!f)
+		throw std::runtime_error(std::string("capture: cannot open \"") + path + "\": " + strerror(errno));
+
+	// new or empty file, write magic. existing captures are appended to
+	fseek(f, 0, SEEK_END);
+
+	if (!ftell(f) && fwrite(capture::magic, sizeof capture::magic, 1, f) != 1) {
+		fclose(f);
+		throw std::runtime_error(std::string("capture: cannot write \"") + path + "\"");
+	}
+}
+
+CaptureWriter::~CaptureWriter() {
+	fclose(f);
+}
+
+void CaptureWriter::put(const void *ptr, size_t size) {
+	if (!err.empty() || !size)
+		return;
+
+	if (fwrite(ptr, size, 1, f) != 1)
+		err = std::string("capture: cannot write \"") + path + "\": " + strerror(errno);
+}
+
+void CaptureWriter::put_varint(uint64_t v) {
+	uint8_t buf[10];
+	unsigned n = 0;
+
+	do {
+		buf[n] = v & 0x7f;
+		v >>= 7;
+		if (v)
+			buf[n] |= 0x80;
+		++n;
+	} while (v);
+
+	put(buf, n);
+}
+
+void CaptureWriter::begin(uint64_t t, uint16_t op, size_t size) {
+	if (left)
+		throw std::logic_error("capture: previous record incomplete");
+
+	if (!records++)
+		last = t;
+
+	put_varint(t - last);
+	last = t;
+
+	uint8_t code[2] = { (uint8_t)(op & 0xff), (uint8_t)(op >> 8) };
+	put(code, sizeof code);
+
+	put_varint(size);
+	left = size;
+}
+
+void CaptureWriter::append(const uint8_t *ptr, size_t size) {
+	if (size > left)
+		throw std::logic_error("capture: payload too big");
+
+	put(ptr, size);
+	left -= size;
+}
+
+void CaptureWriter::flush() {
+	if (fflush(f) && err.empty())
+		err = std::string("capture: cannot write \"") + path + "\": " + strerror(errno);
+}
+
+CaptureReader::CaptureReader(const std::string &path) : f(fopen(path.c_str(), "rb")), t(0), end(0) {
+	if (!f)
+		throw std::runtime_error(std::string("capture: cannot open \"") + path + "\": " + strerror(errno));
+
+	char hdr[sizeof capture::magic];
+
+	if (fread(hdr, sizeof hdr, 1, f) != 1 || memcmp(hdr, capture::magic, sizeof hdr)) {
+		fclose(f);
+		throw std::runtime_error(std::string("capture: \"") + path + "\" is not a capture file");
+	}
+
+	long pos = ftell(f);
+
+	if (fseek(f, 0, SEEK_END) || (end = ftell(f), fseek(f, pos, SEEK_SET))) {
+		fclose(f);
+		throw std::runtime_error(std::string("capture: cannot seek in \"") + path + "\"");
+	}
+}
+
+CaptureReader::~CaptureReader() {
+	fclose(f);
+}
+
+bool CaptureReader::get_varint(uint64_t &v) {
+	v = 0;
+
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		int ch = fgetc(f);
+
+		if (ch == EOF)
+			return false;
+
+		v |= (uint64_t)(ch & 0x7f) << shift;
+
+		if (!(ch & 0x80))
+			return true;
+	}
+
+	throw std::runtime_error("capture: bad varint");
+}
+
+bool CaptureReader::next(Record &r) {
+	uint64_t delta, size;
+	uint8_t code[2];
+
+	if (!get_varint(delta))
+		return false;
+
+	// a truncated record means the capture was interrupted while writing, treat as end of file
+	if (fread(code, sizeof code, 1, f) != 1 || !get_varint(size))
+		return false;
+
+	// more than the rest of the file is a truncated or corrupt record, which is not allocated
+	if (size > end - (uint64_t)ftell(f))
+		return false;
+
+	r.data.resize(size);
+
+	if (size && fread(r.data.data(), size, 1, f) != 1)
+		return false;
+
+	t += delta;
+	r.t = t;
+	r.op = code[0] | (code[1] << 8);
+
+	return true;
+}
+
+int replay_main(int argc, char **argv) {
+	bool fast = false;
+	std::vector<const char*> args;
+
+	for (int i = 2; i < argc; ++i) {
+		if (!strcmp(argv[i], "--fast"))
+			fast = true;
+		else
+			args.emplace_back(argv[i]);
+	}
+
+	if (args.size() < 2) {
+		fprintf(stderr, "usage: %s --replay FILE DEVICE_IP [DEVICE_PORT] [--fast]\n", argv[0]);
+		return 1;
+	}
+
+	try {
+		Net net;
+		CaptureReader in(args[0]);
+		TcpSocket sock;
+
+		sock.connect(args[1], args.size() > 2 ? atoi(args[2]) : 64);
+		sock.nodelay(true);
+
+		CaptureReader::Record r;
+		std::vector<uint8_t> buf;
+		SchedStats timing;
+		uint64_t frames = 0, bytes = 0, start = now_us();
+
+		while (in.next(r)) {
+			uint64_t due = start + r.t;
+
+			if (!fast) {
+				uint64_t now = now_us();
+
+				if (due > now + 1000)
+					std::this_thread::sleep_for(std::chrono::microseconds(due - now - 1000));
+
+				while (now_us() < due)
+					;
+			}
+
+			Command cmd(r.op, std::move(r.data));
+
+			buf.clear();
+			cmd.frame(buf);
+			sock.send_fully(buf.data(), buf.size());
+
+			if (!fast)
+				timing.add(due - start, now_us() - start);
+
+			++frames;
+			bytes += buf.size();
+		}
+
+		double s = (now_us() - start) / 1e6;
+
+		printf("replay: %llu frames, %llu bytes in %.3f s (%.0f frames/s, %.1f KiB/s)\n",
+			(unsigned long long)frames, (unsigned long long)bytes, s,
+			s > 0 ? frames / s : 0.0, s > 0 ? bytes / 1024.0 / s : 0.0);
+
+		if (timing.fired)
+			printf("replay: late min %lld us, max %lld us, mean %.1f us, stddev %.1f us\n",
+				(long long)timing.min_late, (long long)timing.max_late, timing.mean(), timing.stddev());
+	} catch (const std::runtime_error &e) {
+		fprintf(stderr, "%s: %s\n", __func__, e.what());
+		return 1;
+	}
+
+	return 0;
+}
+
+int sink_main(int argc, char **argv) {
+	uint16_t port = argc > 2 ? atoi(argv[2]) : 64;
+	const char *address = argc > 3 ? argv[3] : "127.0.0.1";
+
+	try {
+		Net net;
+		TcpSocket listener;
+
+		listener.bind(address, port);
+		listener.listen();
+		printf("sink: listening on %s:%u\n", address, port);
+		fflush(stdout);
+
+		std::vector<uint8_t> buf(64 * 1024), frame;
+
+		while (true) {
+			std::unique_ptr<TcpSocket> c(listener.accept());
+			FrameParser parser;
+			std::map<uint16_t, std::pair<uint64_t, uint64_t>> ops; // frames and bytes per opcode
+			uint64_t frames = 0, bytes = 0, start = now_us();
+			uint16_t op;
+			int in;
+
+			while ((in = c->try_recv(buf.data(), buf.size(), 1)) > 0) {
+				parser.feed(buf.data(), in);
+
+				while (parser.next(frame, op)) {
+					auto &o = ops[op];
+					++o.first;
+					o.second += frame.size();
+					++frames;
+					bytes += frame.size();
+				}
+			}
+
+			double s = (now_us() - start) / 1e6;
+
+			printf("sink: %llu frames, %llu bytes in %.3f s (%.0f frames/s, %.1f KiB/s), %zu bytes incomplete\n",
+				(unsigned long long)frames, (unsigned long long)bytes, s,
+				s > 0 ? frames / s : 0.0, s > 0 ? bytes / 1024.0 / s : 0.0, parser.pending());
+
+			for (const auto &kv : ops)
+				printf("  $%04X: %llu frames, %llu bytes\n", kv.first, (unsigned long long)kv.second.first, (unsigned long long)kv.second.second);
+
+			fflush(stdout);
+		}
+	} catch (const std::runtime_error &e) {
+		fprintf(stderr, "%s: %s\n", __func__, e.what());
+		return 1;
+	}
+
+	return 0;
+}
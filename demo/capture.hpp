@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+#include <string>
+#include <vector>
+
+/*
+ * Append-only session capture of every frame sent to the device.
+ *
+ * The file starts with the 8 byte magic "C64MCAP\1", followed by records:
+ *
+ *   varint   microseconds since previous record
+ *   u16 le   opcode
+ *   varint   payload length
+ *   ...      payload
+ *
+ * Varints are little endian base 128 (7 bits per byte, high bit set if more
+ * bytes follow), so a typical poke takes 10 bytes.
+ */
+namespace capture {
+	constexpr char magic[8] = { 'C', '6', '4', 'M', 'C', 'A', 'P', 1 };
+}
+
+/*
+ * A write that fails is remembered and makes all later writes do nothing, so
+ * the caller checks ok() once per record instead of handling every call.
+ */
+class CaptureWriter final {
+	FILE *f;
+	std::string path;
+	uint64_t last;
+	size_t left; // payload bytes still expected for current record
+	uint64_t records;
+	std::string err;
+
+	void put(const void *ptr, size_t size);
+	void put_varint(uint64_t v);
+public:
+	explicit CaptureWriter(const std::string &path);
+	CaptureWriter(const CaptureWriter&) = delete;
+	~CaptureWriter();
+
+	/** Start record at \a t microseconds with payload of \a size bytes. Payload must follow using append. */
+	void begin(uint64_t t, uint16_t op, size_t size);
+	void append(const uint8_t *ptr, size_t size);
+
+	void write(uint64_t t, uint16_t op, const uint8_t *ptr, size_t size) {
+		begin(t, op, size);
+		append(ptr, size);
+	}
+
+	uint64_t count() const noexcept { return records; }
+	void flush();
+
+	/** Whether every write so far succeeded. */
+	bool ok() const noexcept { return err.empty(); }
+	/** Why a write failed, empty if ok(). */
+	const std::string &error() const noexcept { return err; }
+};
+
+class CaptureReader final {
+	FILE *f;
+	uint64_t t;
+	uint64_t end; // file size, no record reaches beyond it
+
+	bool get_varint(uint64_t &v);
+public:
+	class Record final {
+	public:
+		uint64_t t; // microseconds since first record
+		uint16_t op;
+		std::vector<uint8_t> data;
+	};
+
+	explicit CaptureReader(const std::string &path);
+	CaptureReader(const CaptureReader&) = delete;
+	~CaptureReader();
+
+	/** Read next record. Returns false at end of file. */
+	bool next(Record &r);
+};
+
+/** Entry point for `c64mon --replay`. */
+int replay_main(int argc, char **argv);
+/** Entry point for `c64mon --sink`: stand-in server that parses and counts frames. */
+int sink_main(int argc, char **argv);
@@ -0,0 +1,271 @@
+#include "chips.hpp"
+#include "raster.hpp"
+
+#include <algorithm>
+
+bool Cia::Timer::sync(uint64_t now) {
+	if (now <= stamp)
+		return false;
+
+	uint64_t elapsed = now - stamp;
+
+	stamp = now;
+
+	if (!running)
+		return false;
+
+	if (elapsed <= value) {
+		value -= (uint16_t)elapsed;
+		return false;
+	}
+
+	// it underflows once value has passed zero and then every latch + 1 cycles
+	elapsed -= value + 1u;
+
+	if (oneshot) {
+		value = latch;
+		running = false;
+	} else {
+		value = (uint16_t)(latch - elapsed % (latch + 1u));
+	}
+
+	return true;
+}
+
+Cia::Cia(Scheduler &sched, const uint64_t &clock) : sched(sched), id(sched.add(this)), clock(clock), regs(), timers(), flags(0), mask(0), fell(false), rec(nullptr) {}
+
+void Cia::sync(uint64_t now) {
+	for (unsigned t = 0; t < timers.size(); ++t)
+		if (timers[t].sync(now))
+			flags |= 1 << t;
+}
+
+void Cia::reschedule() {
+	uint64_t due = Scheduler::never;
+
+	// underflows only need an event if they raise an interrupt that is not already raised
+	for (unsigned t = 0; t < timers.size(); ++t)
+		if ((mask & ~flags) >> t & 1)
+			due = std::min(due, timers[t].due());
+
+	sched.schedule(id, due);
+}
+
+void Cia::control(unsigned t, uint8_t v) {
+	Timer &tm = timers[t];
+
+	if (v & 0x10)
+		tm.value = tm.latch;
+
+	tm.running = v & 1;
+	tm.oneshot = v & 8;
+}
+
+uint8_t Cia::read(uint16_t addr) {
+	unsigned r = addr & 0xf;
+	uint64_t now = clock;
+
+	switch (r) {
+	case 0x0:
+		return regs[0x0] | ~regs[0x2];
+	case 0x1:
+		return regs[0x1] | ~regs[0x3];
+	case 0x4: case 0x5: case 0x6: case 0x7: {
+		sync(now);
+
+		const Timer &t = timers[(r - 4) >> 1];
+		return r & 1 ? t.value >> 8 : t.value & 0xff;
+	}
+	case 0xd: {
+		sync(now);
+
+		uint8_t v = flags | (irq() ? 0x80 : 0);
+
+		// reading acknowledges
+		fell |= irq();
+		flags = 0;
+		reschedule();
+		return v;
+	}
+	case 0xe: case 0xf:
+		sync(now);
+		return (regs[r] & ~1) | timers[r - 0xe].running;
+	default:
+		return regs[r];
+	}
+}
+
+uint8_t Cia::peek(uint16_t addr) {
+	if ((addr & 0xf) != 0xd)
+		return read(addr);
+
+	sync(clock);
+	return flags | (irq() ? 0x80 : 0);
+}
+
+void Cia::write(uint16_t addr, uint8_t v) {
+	unsigned r = addr & 0xf;
+	uint64_t now = clock;
+	bool was = irq();
+
+	sync(now);
+
+	switch (r) {
+	case 0x0: case 0x2:
+		// the VIC bank
+		if (rec)
+			rec->change(now);
+		break;
+	case 0x4: case 0x5: case 0x6: case 0x7: {
+		Timer &t = timers[(r - 4) >> 1];
+
+		if (r & 1) {
+			t.latch = (t.latch & 0xff) | v << 8;
+
+			// writing the high byte of a stopped timer loads it
+			if (!t.running)
+				t.value = t.latch;
+		} else {
+			t.latch = (t.latch & 0xff00) | v;
+		}
+		break;
+	}
+	case 0xd:
+		if (v & 0x80)
+			mask |= v & 0x1f;
+		else
+			mask &= ~v & 0x1f;
+		break;
+	case 0xe: case 0xf:
+		control(r - 0xe, v);
+		v &= ~0x10; // force load is a strobe
+		break;
+	}
+
+	regs[r] = v;
+	reschedule();
+
+	// enabling an interrupt that already occurred raises it right away
+	if (!was && irq())
+		sched.schedule(id, now);
+
+	fell |= was && !irq();
+}
+
+void Cia::event(uint64_t now) {
+	sync(now);
+	reschedule();
+}
+
+void Cia::restore(const State &s) {
+	regs = s.regs;
+	timers = s.timers;
+	flags = s.flags;
+	mask = s.mask;
+	fell = s.fell;
+	reschedule();
+}
+
+void Cia::reset() {
+	regs.fill(0);
+	timers.fill(Timer());
+	flags = mask = 0;
+	fell = false;
+	sched.schedule(id, Scheduler::never);
+}
+
+VicII::VicII(Scheduler &sched, const uint64_t &clock) : sched(sched), id(sched.add(this)), clock(clock), regs(), flags(0), mask(0), seen(0), rec(nullptr) {}
+
+uint64_t VicII::match(uint64_t c) const noexcept {
+	uint16_t line = compare();
+
+	if (line >= lines)
+		return Scheduler::never;
+
+	uint64_t m = c / frame_cycles * frame_cycles + line * line_cycles;
+	return m >= c ? m : m + frame_cycles;
+}
+
+void VicII::sync(uint64_t now) {
+	if (now < seen)
+		return;
+
+	if (match(seen) <= now)
+		flags |= 1;
+
+	seen = now + 1;
+}
+
+void VicII::reschedule() {
+	sched.schedule(id, mask & ~flags & 1 ? match(seen) : Scheduler::never);
+}
+
+uint8_t VicII::read(uint16_t addr) {
+	unsigned r = addr & 0x3f;
+
+	switch (r) {
+	case 0x11:
+		return (regs[0x11] & 0x7f) | (raster(clock) & 0x100) >> 1;
+	case 0x12:
+		return raster(clock) & 0xff;
+	case 0x19:
+		sync(clock);
+		return flags | (irq() ? 0x80 : 0) | 0x70;
+	case 0x1a:
+		return mask | 0xf0;
+	default:
+		if (r >= 0x2f)
+			return 0xff;
+
+		// colour registers only have 4 bits
+		return r >= 0x20 ? regs[r] | 0xf0 : regs[r];
+	}
+}
+
+void VicII::write(uint16_t addr, uint8_t v) {
+	unsigned r = addr & 0x3f;
+	bool was = irq();
+
+	sync(clock);
+
+	switch (r) {
+	case 0x19:
+		// writing 1 acknowledges
+		flags &= ~v & 0xf;
+		break;
+	case 0x1a:
+		mask = v & 0xf;
+		break;
+	default:
+		if (rec && r < 0x2f)
+			rec->change(clock);
+
+		regs[r] = v;
+		break;
+	}
+
+	reschedule();
+
+	if (!was && irq())
+		sched.schedule(id, clock);
+}
+
+void VicII::event(uint64_t now) {
+	sync(now);
+	reschedule();
+}
+
+void VicII::restore(const State &s) {
+	regs = s.regs;
+	flags = s.flags;
+	mask = s.mask;
+	seen = s.seen;
+	reschedule();
+}
+
+void VicII::reset() {
+	regs.fill(0);
+	flags = mask = 0;
+	seen = clock;
+	sched.schedule(id, Scheduler::never);
+}
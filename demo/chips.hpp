@@ -0,0 +1,150 @@
+#pragma once
+
+#include "cpu.hpp"
+#include "events.hpp"
+
+#include <cstdint>
+
+#include <array>
+
+class Recorder;
+
+/*
+ * MOS 6526 CIA with its two interval timers and interrupt control. A timer
+ * is only brought up to date from the clock when one of its registers is
+ * accessed, so a running timer costs nothing until its interrupt is due, and
+ * only then does it have an event.
+ *
+ * Timer B only counts cycles, the ports read back their outputs with pulled
+ * up inputs, TOD and the serial port are plain registers, and the one or two
+ * cycle delays of the real chip are left out. Registers repeat every 16
+ * bytes of the page.
+ */
+class Cia final : public Bus, public Scheduler::Device {
+public:
+	class Timer final {
+	public:
+		uint16_t latch, value;
+		uint64_t stamp; // cycle value is for
+		bool running, oneshot;
+
+		Timer() : latch(0xffff), value(0xffff), stamp(0), running(false), oneshot(false) {}
+
+		/** Advance to \a now. Returns whether it underflowed on the way. */
+		bool sync(uint64_t now);
+		/** Cycle of the next underflow, never if stopped. Only valid right after sync(). */
+		uint64_t due() const noexcept { return running ? stamp + value + 1 : Scheduler::never; }
+	};
+private:
+	Scheduler &sched;
+	unsigned id;
+	const uint64_t &clock;
+	std::array<uint8_t, 16> regs;
+	std::array<Timer, 2> timers;
+	uint8_t flags, mask; // occurred and enabled interrupts
+	bool fell; // interrupt output went inactive since released()
+
+	void sync(uint64_t now);
+	void reschedule();
+	void control(unsigned t, uint8_t v);
+public:
+	/** \a clock is the CPU cycle counter. */
+	Cia(Scheduler &sched, const uint64_t &clock);
+	Cia(const Cia&) = delete;
+
+	/** Told before the port A registers change, nullptr if not recording. */
+	Recorder *rec;
+
+	uint8_t read(uint16_t addr) override;
+	void write(uint16_t addr, uint8_t v) override;
+	uint8_t peek(uint16_t addr) override;
+	void event(uint64_t now) override;
+
+	/** Whether the interrupt output is active. */
+	bool irq() const noexcept { return flags & mask & 0x1f; }
+	/**
+	 * Whether the interrupt output went inactive since the last call. An
+	 * edge triggered input needs this, because a handler acknowledges in the
+	 * middle of a burst and the output is only looked at in between.
+	 */
+	bool released() noexcept {
+		bool v = fell;
+		fell = false;
+		return v;
+	}
+	const Timer &timer(unsigned t) const noexcept { return timers[t]; }
+	/** Port A as seen from outside, with inputs pulled up. */
+	uint8_t port_a() const noexcept { return regs[0x0] | ~regs[0x2]; }
+
+	/** Everything but the scheduler, for snapshots. */
+	class State final {
+	public:
+		std::array<uint8_t, 16> regs;
+		std::array<Timer, 2> timers;
+		uint8_t flags, mask;
+		bool fell;
+	};
+
+	State state() const { return State{ regs, timers, flags, mask, fell }; }
+	/** Go back to \a s, taken when the clock had the value it has now. */
+	void restore(const State &s);
+
+	void reset();
+};
+
+/*
+ * Raster counter and raster interrupt of a PAL MOS 6569 VIC-II. The raster
+ * line is computed from the clock when $D011 or $D012 are read, and the only
+ * event is the raster compare match while its interrupt is enabled. The
+ * other registers are plain and repeat every 64 bytes. Bad lines and sprites
+ * do not stall the CPU.
+ */
+class VicII final : public Bus, public Scheduler::Device {
+public:
+	static constexpr unsigned line_cycles = 63, lines = 312;
+	static constexpr uint64_t frame_cycles = line_cycles * lines;
+private:
+	Scheduler &sched;
+	unsigned id;
+	const uint64_t &clock;
+	std::array<uint8_t, 64> regs;
+	uint8_t flags, mask; // $D019 and $D01A
+	uint64_t seen; // compare matches before this cycle are in flags
+
+	uint16_t compare() const noexcept { return (regs[0x11] & 0x80) << 1 | regs[0x12]; }
+	/** First cycle at or after \a c that starts the compare line. */
+	uint64_t match(uint64_t c) const noexcept;
+	void sync(uint64_t now);
+	void reschedule();
+public:
+	/** \a clock is the CPU cycle counter. */
+	VicII(Scheduler &sched, const uint64_t &clock);
+	VicII(const VicII&) = delete;
+
+	/** Told before the registers the picture is drawn with change, nullptr if not recording. */
+	Recorder *rec;
+
+	uint8_t read(uint16_t addr) override;
+	void write(uint16_t addr, uint8_t v) override;
+	void event(uint64_t now) override;
+
+	static unsigned raster(uint64_t c) noexcept { return c / line_cycles % lines; }
+
+	bool irq() const noexcept { return flags & mask & 0xf; }
+	/** Registers as written. */
+	const std::array<uint8_t, 64> &registers() const noexcept { return regs; }
+
+	/** Everything but the scheduler, for snapshots. */
+	class State final {
+	public:
+		std::array<uint8_t, 64> regs;
+		uint8_t flags, mask;
+		uint64_t seen;
+	};
+
+	State state() const { return State{ regs, flags, mask, seen }; }
+	/** Go back to \a s, taken when the clock had the value it has now. */
+	void restore(const State &s);
+
+	void reset();
+};
@@ -0,0 +1,292 @@
+#include "container.hpp"
+#include "d64.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+static bool has_ext(const std::string &path, const char *ext) {
+	size_t n = strlen(ext);
+
+	if (path.size() < n)
+		return false;
+
+	for (size_t i = 0; i < n; ++i)
+		if (tolower((unsigned char)path[path.size() - n + i]) != ext[i])
+			return false;
+
+	return true;
+}
+
+static std::string ascii_name(const uint8_t *src, unsigned max) {
+	std::string s;
+
+	for (unsigned i = 0; i < max; ++i) {
+		uint8_t ch = src[i];
+
+		// names are padded with shifted spaces on disk and with zeros in some tape images
+		if (ch == 0xa0 || ch == 0)
+			break;
+
+		if (ch >= 0xc1 && ch <= 0xda)
+			ch -= 0x80;
+
+		s += ch >= ' ' && ch < 0x7f ? (char)ch : '?';
+	}
+
+	// tape images often pad with spaces
+	while (!s.empty() && s.back() == ' ')
+		s.pop_back();
+
+	return s;
+}
+
+Container::Container(const std::string &path) : path(path), img(Bytes::map_file(path)), dir() {}
+
+std::unique_ptr<Container> Container::open(const std::string &path) {
+	if (has_ext(path, ".t64"))
+		return std::unique_ptr<Container>(new T64Image(path));
+
+	if (has_ext(path, ".crt"))
+		return std::unique_ptr<Container>(new CrtImage(path));
+
+	if (has_ext(path, ".d64") && disk_type(path) == DiskType::d64)
+		return std::unique_ptr<Container>(new D64Image(path));
+
+	return nullptr;
+}
+
+bool Container::split(const std::string &path, std::string &image, std::string &name) {
+	static const char *exts[] = { ".d64:", ".t64:", ".crt:" };
+
+	std::string lower(path);
+	std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+	for (const char *ext : exts) {
+		size_t pos = lower.find(ext);
+
+		if (pos == std::string::npos)
+			continue;
+
+		image = path.substr(0, pos + 4);
+		name = path.substr(pos + 5);
+		return true;
+	}
+
+	return false;
+}
+
+void Container::load(PRG &prg, const std::string &path) {
+	std::string image, name;
+
+	if (!split(path, image, name)) {
+		prg.load(path);
+		return;
+	}
+
+	std::unique_ptr<Container> c(open(image));
+
+	if (!c)
+		throw std::runtime_error(std::string("container: not a supported image: \"") + image + "\"");
+
+	prg = c->extract(name);
+}
+
+PRG Container::extract(const std::string &name) const {
+	for (size_t i = 0; i < dir.size(); ++i)
+		if (dir[i].name == name)
+			return extract(i);
+
+	throw std::runtime_error(std::string("container: no file \"") + name + "\" in \"" + path + "\"");
+}
+
+static const char *cbm_type(uint8_t type) {
+	static const char *names[] = { "DEL", "SEQ", "PRG", "USR", "REL" };
+	return (type & 7) < 5 ? names[type & 7] : "???";
+}
+
+D64Image::D64Image(const std::string &path) : Container(path), tracks(d64::tracks) {
+	if (img.size() >= 196608)
+		tracks = 40;
+
+	std::bitset<1024> seen;
+	unsigned t = d64::dir_track, s = 1;
+
+	while (t) {
+		size_t lba = d64::offset(t, s) / d64::sector_size;
+
+		// corrupt images may link directory sectors in a loop
+		if (seen[lba])
+			break;
+		seen[lba] = true;
+
+		const uint8_t *blk = sector(t, s);
+
+		for (unsigned i = 0; i < 8; ++i) {
+			const uint8_t *e = &blk[32 * i];
+
+			if (!(e[2] & 7) || !(e[2] & 0x80))
+				continue; // scratched or not closed
+
+			unsigned blocks = e[0x1e] | (e[0x1f] << 8);
+			dir.emplace_back(ContainerEntry{ ascii_name(&e[5], 16), cbm_type(e[2]), blocks * 254u, (size_t)e[3] << 8 | e[4] });
+		}
+
+		t = blk[0];
+		s = blk[1];
+	}
+}
+
+const uint8_t *D64Image::sector(unsigned track, unsigned sector) const {
+	if (track < 1 || track > tracks)
+		throw std::runtime_error(std::string("d64: bad track ") + std::to_string(track) + " in \"" + path + "\"");
+
+	size_t pos = d64::offset(track, sector);
+
+	if (pos + d64::sector_size > img.size())
+		throw std::runtime_error(std::string("d64: truncated image \"") + path + "\"");
+
+	return img.data() + pos;
+}
+
+PRG D64Image::extract(size_t i) const {
+	const ContainerEntry &e = dir.at(i);
+
+	std::vector<uint8_t> data;
+	std::bitset<1024> seen;
+	unsigned t = e.pos >> 8, s = e.pos & 0xff;
+
+	data.reserve(e.size);
+
+	while (t) {
+		size_t lba = d64::offset(t, s) / d64::sector_size;
+
+		if (seen[lba])
+			throw std::runtime_error(std::string("d64: circular sector chain for \"") + e.name + "\"");
+		seen[lba] = true;
+
+		const uint8_t *blk = sector(t, s);
+
+		t = blk[0];
+		s = blk[1];
+
+		// last block: second byte is index of last used byte
+		size_t n = t ? 254 : s >= 2 ? s - 1 : 0;
+		data.insert(data.end(), &blk[2], &blk[2] + n);
+
+		if (data.size() > PRG::max_prg_size)
+			throw std::runtime_error(std::string("d64: file too big: \"") + e.name + "\"");
+	}
+
+	return PRG(entry_path(i), Bytes(std::move(data)));
+}
+
+T64Image::T64Image(const std::string &path) : Container(path) {
+	if (img.size() < 0x40 || memcmp(img.data(), "C64", 3))
+		throw std::runtime_error(std::string("t64: bad signature in \"") + path + "\"");
+
+	const uint8_t *hdr = img.data();
+	unsigned max = hdr[0x22] | (hdr[0x23] << 8);
+
+	std::vector<size_t> ends;
+
+	// used entry count is unreliable, so scan the whole table
+	for (unsigned i = 0; i < max && 0x40 + 32 * (i + 1) <= img.size(); ++i) {
+		const uint8_t *e = &hdr[0x40 + 32 * i];
+
+		if (e[0] != 1)
+			continue; // free or snapshot
+
+		size_t pos = e[8] | (e[9] << 8) | (e[10] << 16) | ((size_t)e[11] << 24);
+		unsigned start = e[2] | (e[3] << 8), end = e[4] | (e[5] << 8);
+
+		if (pos >= img.size())
+			continue;
+
+		dir.emplace_back(ContainerEntry{ ascii_name(&e[0x10], 16), cbm_type(e[1] ? e[1] : 0x82), end > start ? end - start : 0, pos });
+		ends.emplace_back(pos);
+	}
+
+	ends.emplace_back(img.size());
+	std::sort(ends.begin(), ends.end());
+
+	// many tools write a bogus end address, so never go past the next file
+	for (ContainerEntry &e : dir) {
+		size_t avail = *std::upper_bound(ends.begin(), ends.end(), e.pos) - e.pos;
+
+		if (!e.size || e.size > avail)
+			e.size = avail;
+	}
+}
+
+PRG T64Image::extract(size_t i) const {
+	const ContainerEntry &e = dir.at(i);
+	const uint8_t *entry = img.data() + 0x40;
+
+	// locate table entry again for the load address
+	for (;; entry += 32) {
+		if (entry + 32 > img.end())
+			throw std::runtime_error(std::string("t64: no entry for \"") + e.name + "\"");
+
+		size_t pos = entry[8] | (entry[9] << 8) | (entry[10] << 16) | ((size_t)entry[11] << 24);
+
+		if (entry[0] == 1 && pos == e.pos)
+			break;
+	}
+
+	std::vector<uint8_t> data;
+
+	data.reserve(e.size + 2);
+	data.emplace_back(entry[2]);
+	data.emplace_back(entry[3]);
+	data.insert(data.end(), img.data() + e.pos, img.data() + e.pos + e.size);
+
+	return PRG(entry_path(i), Bytes(std::move(data)));
+}
+
+static unsigned be16(const uint8_t *p) { return p[0] << 8 | p[1]; }
+static size_t be32(const uint8_t *p) { return (size_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+CrtImage::CrtImage(const std::string &path) : Container(path), title(), hw_type(0) {
+	if (img.size() < 0x40 || memcmp(img.data(), "C64 CARTRIDGE   ", 16))
+		throw std::runtime_error(std::string("crt: bad signature in \"") + path + "\"");
+
+	const uint8_t *hdr = img.data();
+
+	title = ascii_name(&hdr[0x20], 32);
+	hw_type = be16(&hdr[0x16]);
+
+	size_t pos = be32(&hdr[0x10]);
+
+	while (pos + 0x10 <= img.size() && !memcmp(&hdr[pos], "CHIP", 4)) {
+		const uint8_t *chip = &hdr[pos];
+		size_t len = be32(&chip[4]);
+		unsigned size = be16(&chip[0xe]);
+
+		if (len < 0x10 || pos + 0x10 + size > img.size())
+			break;
+
+		char name[32];
+		snprintf(name, sizeof name, "BANK %u $%04X", be16(&chip[0xa]), be16(&chip[0xc]));
+
+		dir.emplace_back(ContainerEntry{ name, be16(&chip[8]) ? "RAM" : "ROM", size, pos });
+		pos += len;
+	}
+}
+
+PRG CrtImage::extract(size_t i) const {
+	const ContainerEntry &e = dir.at(i);
+	const uint8_t *chip = img.data() + e.pos;
+
+	std::vector<uint8_t> data;
+
+	data.reserve(e.size + 2);
+	data.emplace_back(chip[0xd]);
+	data.emplace_back(chip[0xc]);
+	data.insert(data.end(), chip + 0x10, chip + 0x10 + e.size);
+
+	return PRG(entry_path(i), Bytes(std::move(data)));
+}
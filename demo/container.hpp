@@ -0,0 +1,96 @@
+#pragma once
+
+#include "mmap.hpp"
+#include "prg.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/** File stored in a disk, tape or cartridge image. */
+class ContainerEntry final {
+public:
+	std::string name; // converted to ASCII
+	const char *type;
+	size_t size; // in bytes, estimated from block count for disk images
+	size_t pos; // where the file starts in the image, meaning depends on image type
+};
+
+/*
+ * Read-only view on a D64, T64 or CRT image. The image is mapped and only the
+ * directory is read on open. Files are decoded when extract() is called, so
+ * picking one file only touches the sectors or bytes that file occupies.
+ */
+class Container {
+protected:
+	std::string path;
+	Bytes img;
+	std::vector<ContainerEntry> dir;
+
+	explicit Container(const std::string &path);
+public:
+	virtual ~Container() {}
+
+	/** Open image at \a path. Returns null if the file is not a supported image. */
+	static std::unique_ptr<Container> open(const std::string &path);
+
+	/**
+	 * Split a path as returned by entry_path() in the image path and the file
+	 * name. Returns false if \a path does not refer to a file in an image.
+	 */
+	static bool split(const std::string &path, std::string &image, std::string &name);
+
+	/** Load file \a path from an image or from disk if it is a plain PRG. */
+	static void load(PRG &prg, const std::string &path);
+
+	virtual const char *kind() const noexcept = 0;
+
+	const std::string &image_path() const noexcept { return path; }
+	const std::vector<ContainerEntry> &entries() const noexcept { return dir; }
+
+	/** Path that refers to entry \a i and can be passed to load(). */
+	std::string entry_path(size_t i) const { return path + ":" + dir.at(i).name; }
+
+	/** Decode entry \a i. Throws if the entry is damaged. */
+	virtual PRG extract(size_t i) const = 0;
+	/** Decode first entry named \a name. */
+	PRG extract(const std::string &name) const;
+};
+
+/** 1541 disk image. Files are read by following their sector chains. */
+class D64Image final : public Container {
+	unsigned tracks;
+
+	const uint8_t *sector(unsigned track, unsigned sector) const;
+public:
+	explicit D64Image(const std::string &path);
+
+	const char *kind() const noexcept override { return "D64"; }
+	PRG extract(size_t i) const override;
+};
+
+/** Tape image. Files are stored contiguously and located through the entry table. */
+class T64Image final : public Container {
+public:
+	explicit T64Image(const std::string &path);
+
+	const char *kind() const noexcept override { return "T64"; }
+	PRG extract(size_t i) const override;
+};
+
+/** Cartridge image. Every CHIP packet is listed as a ROM image loaded at its bank address. */
+class CrtImage final : public Container {
+	std::string title;
+	uint16_t hw_type;
+public:
+	explicit CrtImage(const std::string &path);
+
+	const char *kind() const noexcept override { return "CRT"; }
+	PRG extract(size_t i) const override;
+
+	const std::string &name() const noexcept { return title; }
+	uint16_t hardware() const noexcept { return hw_type; }
+};
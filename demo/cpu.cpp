@@ -0,0 +1,1446 @@
+#include "cpu.hpp"
+#include "batch.hpp"
+#include "c64.hpp"
+#include "jit.hpp"
+#include "raster.hpp"
+#include "render.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+void RamBus::load(uint16_t addr, const uint8_t *data, size_t size) {
+	for (size_t i = 0; i < size; ++i)
+		ram[(uint16_t)(addr + i)] = data[i];
+}
+
+// magic constant for the unstable ANE and LXA opcodes, $EE on most C64s
+static constexpr uint8_t ane_magic = 0xee;
+
+/** Opcode implementations. \a ea is the effective address computed by CPU::operand. */
+class Ops final {
+public:
+	/**
+	 * Read operand for mode \a M and advance PC. Returns the operand byte or
+	 * word, the address of an immediate value or the target of a branch.
+	 */
+	template<CPU::Mode M> static uint16_t fetch(CPU &c) {
+		if constexpr (M == CPU::imp || M == CPU::acc) {
+			return 0;
+		} else if constexpr (M == CPU::imm) {
+			return c.r.pc++;
+		} else if constexpr (M == CPU::abs || M == CPU::abx || M == CPU::aby || M == CPU::ind) {
+			uint16_t v = c.read16(c.r.pc);
+			c.r.pc += 2;
+			return v;
+		} else if constexpr (M == CPU::rel) {
+			int8_t off = c.read(c.r.pc++);
+			return c.r.pc + off;
+		} else {
+			return c.read(c.r.pc++);
+		}
+	}
+
+	/** Effective address for mode \a M and operand \a arg. Adds page crossing penalty to extra if \a penalty is set. */
+	template<CPU::Mode M> static uint16_t ea(CPU &c, uint16_t arg, bool penalty) {
+		if constexpr (M == CPU::zpx) {
+			return (uint8_t)(arg + c.r.x);
+		} else if constexpr (M == CPU::zpy) {
+			return (uint8_t)(arg + c.r.y);
+		} else if constexpr (M == CPU::ind) {
+			// the high byte is read from the same page as the low byte
+			return c.read(arg) | (c.read((arg & 0xff00) | ((arg + 1) & 0xff)) << 8);
+		} else if constexpr (M == CPU::izx) {
+			uint8_t zp = arg + c.r.x;
+			return c.read(zp) | (c.read((uint8_t)(zp + 1)) << 8);
+		} else if constexpr (M == CPU::abx || M == CPU::aby || M == CPU::izy) {
+			if constexpr (M == CPU::izy)
+				c.base = c.read(arg) | (c.read((uint8_t)(arg + 1)) << 8);
+			else
+				c.base = arg;
+
+			uint16_t ea = c.base + (M == CPU::abx ? c.r.x : c.r.y);
+
+			if (penalty && ((ea ^ c.base) & 0xff00))
+				++c.extra;
+
+			return ea;
+		} else {
+			return arg;
+		}
+	}
+
+	/**
+	 * Handler for opcode \a OP. The operation is a compile time constant, so
+	 * it is inlined together with its addressing mode and only updates the
+	 * flags that this instruction changes.
+	 */
+	template<uint8_t OP> static void insn(CPU &c);
+
+	/**
+	 * Same as insn, but with the operand predecoded in \a u. The write of the
+	 * instruction may drop the block that holds \a u, so it must not be used
+	 * after executing.
+	 */
+	template<uint8_t OP> static void uop(CPU &c, const MicroOp &u);
+private:
+	static void nz(CPU &c, uint8_t v) {
+		c.r.zero = v == 0;
+		c.r.neg = v >> 7;
+	}
+
+	static void branch(CPU &c, uint16_t ea, bool cond) {
+		if (!cond)
+			return;
+
+		// one cycle for taking the branch and one more if it crosses a page
+		c.extra += 1 + ((ea ^ c.r.pc) >> 8 != 0);
+		c.r.pc = ea;
+	}
+
+	static void compare(CPU &c, uint8_t reg, uint8_t v) {
+		c.r.carry = reg >= v;
+		nz(c, reg - v);
+	}
+
+	static void add(CPU &c, uint8_t v) {
+		unsigned a = c.r.acc, carry = c.r.carry;
+
+		if (!c.r.dec) {
+			unsigned sum = a + v + carry;
+
+			c.r.carry = sum > 0xff;
+			c.r.of = (~(a ^ v) & (a ^ sum) & 0x80) != 0;
+			nz(c, sum);
+			c.r.acc = sum;
+			return;
+		}
+
+		// NMOS decimal mode: Z comes from the binary sum, N and V from the intermediate result
+		unsigned lo = (a & 0x0f) + (v & 0x0f) + carry;
+
+		if (lo > 9)
+			lo += 6;
+
+		unsigned hi = (a >> 4) + (v >> 4) + (lo > 0x0f);
+
+		c.r.zero = ((a + v + carry) & 0xff) == 0;
+		c.r.neg = (hi >> 3) & 1;
+		c.r.of = (~(a ^ v) & (a ^ (hi << 4)) & 0x80) != 0;
+
+		if (hi > 9)
+			hi += 6;
+
+		c.r.carry = hi > 0x0f;
+		c.r.acc = (hi << 4) | (lo & 0x0f);
+	}
+
+	static void sub(CPU &c, uint8_t v) {
+		unsigned a = c.r.acc, borrow = !c.r.carry;
+		unsigned diff = a - v - borrow;
+
+		// flags are always set as in binary mode
+		c.r.carry = diff < 0x100;
+		c.r.of = ((a ^ v) & (a ^ diff) & 0x80) != 0;
+		nz(c, diff);
+
+		if (!c.r.dec) {
+			c.r.acc = diff;
+			return;
+		}
+
+		int lo = (a & 0x0f) - (v & 0x0f) - (int)borrow, hi = (a >> 4) - (v >> 4);
+
+		if (lo & 0x10) {
+			lo -= 6;
+			--hi;
+		}
+
+		if (hi & 0x10)
+			hi -= 6;
+
+		c.r.acc = (hi << 4) | (lo & 0x0f);
+	}
+
+	// read-modify-write: the old value is written back first
+	static uint8_t rmw_begin(CPU &c, uint16_t ea) {
+		uint8_t v = c.read(ea);
+		c.write(ea, v);
+		return v;
+	}
+
+	static uint8_t do_asl(CPU &c, uint8_t v) { c.r.carry = v >> 7; v <<= 1; nz(c, v); return v; }
+	static uint8_t do_lsr(CPU &c, uint8_t v) { c.r.carry = v & 1; v >>= 1; nz(c, v); return v; }
+	static uint8_t do_rol(CPU &c, uint8_t v) { uint8_t n = (v << 1) | c.r.carry; c.r.carry = v >> 7; nz(c, n); return n; }
+	static uint8_t do_ror(CPU &c, uint8_t v) { uint8_t n = (v >> 1) | (c.r.carry << 7); c.r.carry = v & 1; nz(c, n); return n; }
+
+	// value for SHA, SHX, SHY and TAS. if indexing crossed a page, the high byte of the address is garbled too
+	static void store_high(CPU &c, uint16_t ea, uint8_t v) {
+		v &= (c.base >> 8) + 1;
+
+		if ((ea ^ c.base) & 0xff00)
+			ea = (ea & 0xff) | (v << 8);
+
+		c.write(ea, v);
+	}
+public:
+	static void adc(CPU &c, uint16_t ea) { add(c, c.read(ea)); }
+	static void and_(CPU &c, uint16_t ea) { nz(c, c.r.acc &= c.read(ea)); }
+	static void asl(CPU &c, uint16_t ea) { c.write(ea, do_asl(c, rmw_begin(c, ea))); }
+	static void asl_a(CPU &c, uint16_t) { c.r.acc = do_asl(c, c.r.acc); }
+	static void bcc(CPU &c, uint16_t ea) { branch(c, ea, !c.r.carry); }
+	static void bcs(CPU &c, uint16_t ea) { branch(c, ea, c.r.carry); }
+	static void beq(CPU &c, uint16_t ea) { branch(c, ea, c.r.zero); }
+	static void bmi(CPU &c, uint16_t ea) { branch(c, ea, c.r.neg); }
+	static void bne(CPU &c, uint16_t ea) { branch(c, ea, !c.r.zero); }
+	static void bpl(CPU &c, uint16_t ea) { branch(c, ea, !c.r.neg); }
+	static void bvc(CPU &c, uint16_t ea) { branch(c, ea, !c.r.of); }
+	static void bvs(CPU &c, uint16_t ea) { branch(c, ea, c.r.of); }
+
+	static void bit(CPU &c, uint16_t ea) {
+		uint8_t v = c.read(ea);
+
+		c.r.zero = (c.r.acc & v) == 0;
+		c.r.neg = v >> 7;
+		c.r.of = (v >> 6) & 1;
+	}
+
+	static void brk(CPU &c, uint16_t) {
+		++c.r.pc; // skip padding byte
+		c.interrupt(0xfffe, true);
+	}
+
+	static void clc(CPU &c, uint16_t) { c.r.carry = 0; }
+	static void cld(CPU &c, uint16_t) { c.r.dec = 0; }
+	static void cli(CPU &c, uint16_t) { c.r.no_irq = 0; }
+	static void clv(CPU &c, uint16_t) { c.r.of = 0; }
+	static void cmp(CPU &c, uint16_t ea) { compare(c, c.r.acc, c.read(ea)); }
+	static void cpx(CPU &c, uint16_t ea) { compare(c, c.r.x, c.read(ea)); }
+	static void cpy(CPU &c, uint16_t ea) { compare(c, c.r.y, c.read(ea)); }
+	static void dec(CPU &c, uint16_t ea) { uint8_t v = rmw_begin(c, ea) - 1; nz(c, v); c.write(ea, v); }
+	static void dex(CPU &c, uint16_t) { nz(c, --c.r.x); }
+	static void dey(CPU &c, uint16_t) { nz(c, --c.r.y); }
+	static void eor(CPU &c, uint16_t ea) { nz(c, c.r.acc ^= c.read(ea)); }
+	static void inc(CPU &c, uint16_t ea) { uint8_t v = rmw_begin(c, ea) + 1; nz(c, v); c.write(ea, v); }
+	static void inx(CPU &c, uint16_t) { nz(c, ++c.r.x); }
+	static void iny(CPU &c, uint16_t) { nz(c, ++c.r.y); }
+	static void jmp(CPU &c, uint16_t ea) { c.r.pc = ea; }
+
+	static void jsr(CPU &c, uint16_t ea) {
+		uint16_t ret = c.r.pc - 1;
+
+		c.push(ret >> 8);
+		c.push(ret & 0xff);
+		c.r.pc = ea;
+	}
+
+	static void lda(CPU &c, uint16_t ea) { nz(c, c.r.acc = c.read(ea)); }
+	static void ldx(CPU &c, uint16_t ea) { nz(c, c.r.x = c.read(ea)); }
+	static void ldy(CPU &c, uint16_t ea) { nz(c, c.r.y = c.read(ea)); }
+	static void lsr(CPU &c, uint16_t ea) { c.write(ea, do_lsr(c, rmw_begin(c, ea))); }
+	static void lsr_a(CPU &c, uint16_t) { c.r.acc = do_lsr(c, c.r.acc); }
+	static void nop(CPU&, uint16_t) {}
+	static void ora(CPU &c, uint16_t ea) { nz(c, c.r.acc |= c.read(ea)); }
+	static void pha(CPU &c, uint16_t) { c.push(c.r.acc); }
+	static void php(CPU &c, uint16_t) { c.push(c.r.psw() | 0x10); }
+	static void pla(CPU &c, uint16_t) { nz(c, c.r.acc = c.pull()); }
+	static void plp(CPU &c, uint16_t) { c.r.set_psw(c.pull() & ~0x10); }
+	static void rol(CPU &c, uint16_t ea) { c.write(ea, do_rol(c, rmw_begin(c, ea))); }
+	static void rol_a(CPU &c, uint16_t) { c.r.acc = do_rol(c, c.r.acc); }
+	static void ror(CPU &c, uint16_t ea) { c.write(ea, do_ror(c, rmw_begin(c, ea))); }
+	static void ror_a(CPU &c, uint16_t) { c.r.acc = do_ror(c, c.r.acc); }
+
+	static void rti(CPU &c, uint16_t) {
+		c.r.set_psw(c.pull() & ~0x10);
+		c.r.pc = c.pull();
+		c.r.pc |= c.pull() << 8;
+	}
+
+	static void rts(CPU &c, uint16_t) {
+		uint16_t pc = c.pull();
+		pc |= c.pull() << 8;
+		c.r.pc = pc + 1;
+	}
+
+	static void sbc(CPU &c, uint16_t ea) { sub(c, c.read(ea)); }
+	static void sec(CPU &c, uint16_t) { c.r.carry = 1; }
+	static void sed(CPU &c, uint16_t) { c.r.dec = 1; }
+	static void sei(CPU &c, uint16_t) { c.r.no_irq = 1; }
+	static void sta(CPU &c, uint16_t ea) { c.write(ea, c.r.acc); }
+	static void stx(CPU &c, uint16_t ea) { c.write(ea, c.r.x); }
+	static void sty(CPU &c, uint16_t ea) { c.write(ea, c.r.y); }
+	static void tax(CPU &c, uint16_t) { nz(c, c.r.x = c.r.acc); }
+	static void tay(CPU &c, uint16_t) { nz(c, c.r.y = c.r.acc); }
+	static void tsx(CPU &c, uint16_t) { nz(c, c.r.x = c.r.sp); }
+	static void txa(CPU &c, uint16_t) { nz(c, c.r.acc = c.r.x); }
+	static void txs(CPU &c, uint16_t) { c.r.sp = c.r.x; }
+	static void tya(CPU &c, uint16_t) { nz(c, c.r.acc = c.r.y); }
+
+	// undocumented opcodes, see "No More Secrets" by groepaz
+	static void alr(CPU &c, uint16_t ea) { c.r.acc = do_lsr(c, c.r.acc & c.read(ea)); }
+
+	static void anc(CPU &c, uint16_t ea) {
+		nz(c, c.r.acc &= c.read(ea));
+		c.r.carry = c.r.neg;
+	}
+
+	static void ane(CPU &c, uint16_t ea) { nz(c, c.r.acc = (c.r.acc | ane_magic) & c.r.x & c.read(ea)); }
+
+	static void arr(CPU &c, uint16_t ea) {
+		uint8_t t = c.r.acc & c.read(ea);
+		uint8_t v = (t >> 1) | (c.r.carry << 7);
+
+		if (!c.r.dec) {
+			nz(c, v);
+			c.r.carry = (v >> 6) & 1;
+			c.r.of = ((v >> 6) ^ (v >> 5)) & 1;
+			c.r.acc = v;
+			return;
+		}
+
+		c.r.neg = c.r.carry;
+		c.r.zero = v == 0;
+		c.r.of = ((t ^ v) >> 6) & 1;
+
+		if ((t & 0x0f) + (t & 0x01) > 5)
+			v = (v & 0xf0) | ((v + 6) & 0x0f);
+
+		c.r.carry = (t & 0xf0) + (t & 0x10) > 0x50;
+
+		if (c.r.carry)
+			v += 0x60;
+
+		c.r.acc = v;
+	}
+
+	static void dcp(CPU &c, uint16_t ea) {
+		uint8_t v = rmw_begin(c, ea) - 1;
+		c.write(ea, v);
+		compare(c, c.r.acc, v);
+	}
+
+	static void isc(CPU &c, uint16_t ea) {
+		uint8_t v = rmw_begin(c, ea) + 1;
+		c.write(ea, v);
+		sub(c, v);
+	}
+
+	static void jam(CPU &c, uint16_t) {
+		--c.r.pc;
+		c.jammed = true;
+	}
+
+	static void las(CPU &c, uint16_t ea) { nz(c, c.r.acc = c.r.x = c.r.sp = c.read(ea) & c.r.sp); }
+	static void lax(CPU &c, uint16_t ea) { nz(c, c.r.acc = c.r.x = c.read(ea)); }
+	static void lxa(CPU &c, uint16_t ea) { nz(c, c.r.acc = c.r.x = (c.r.acc | ane_magic) & c.read(ea)); }
+
+	static void rla(CPU &c, uint16_t ea) {
+		uint8_t v = do_rol(c, rmw_begin(c, ea));
+		c.write(ea, v);
+		nz(c, c.r.acc &= v);
+	}
+
+	static void rra(CPU &c, uint16_t ea) {
+		uint8_t v = do_ror(c, rmw_begin(c, ea));
+		c.write(ea, v);
+		add(c, v);
+	}
+
+	static void sax(CPU &c, uint16_t ea) { c.write(ea, c.r.acc & c.r.x); }
+
+	static void sbx(CPU &c, uint16_t ea) {
+		uint8_t v = c.read(ea), ax = c.r.acc & c.r.x;
+
+		c.r.carry = ax >= v;
+		nz(c, c.r.x = ax - v);
+	}
+
+	static void sha(CPU &c, uint16_t ea) { store_high(c, ea, c.r.acc & c.r.x); }
+	static void shx(CPU &c, uint16_t ea) { store_high(c, ea, c.r.x); }
+	static void shy(CPU &c, uint16_t ea) { store_high(c, ea, c.r.y); }
+
+	static void slo(CPU &c, uint16_t ea) {
+		uint8_t v = do_asl(c, rmw_begin(c, ea));
+		c.write(ea, v);
+		nz(c, c.r.acc |= v);
+	}
+
+	static void sre(CPU &c, uint16_t ea) {
+		uint8_t v = do_lsr(c, rmw_begin(c, ea));
+		c.write(ea, v);
+		nz(c, c.r.acc ^= v);
+	}
+
+	static void tas(CPU &c, uint16_t ea) {
+		c.r.sp = c.r.acc & c.r.x;
+		store_high(c, ea, c.r.sp);
+	}
+};
+
+static constexpr std::array<CPU::Opcode, 256> opcodes{{
+	{ "BRK", CPU::imp, 7, false, false, Ops::brk }, // 00
+	{ "ORA", CPU::izx, 6, false, false, Ops::ora }, // 01
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // 02
+	{ "SLO", CPU::izx, 8, false, true, Ops::slo }, // 03
+	{ "NOP", CPU::zp, 3, false, true, Ops::nop }, // 04
+	{ "ORA", CPU::zp, 3, false, false, Ops::ora }, // 05
+	{ "ASL", CPU::zp, 5, false, false, Ops::asl }, // 06
+	{ "SLO", CPU::zp, 5, false, true, Ops::slo }, // 07
+	{ "PHP", CPU::imp, 3, false, false, Ops::php }, // 08
+	{ "ORA", CPU::imm, 2, false, false, Ops::ora }, // 09
+	{ "ASL", CPU::acc, 2, false, false, Ops::asl_a }, // 0A
+	{ "ANC", CPU::imm, 2, false, true, Ops::anc }, // 0B
+	{ "NOP", CPU::abs, 4, false, true, Ops::nop }, // 0C
+	{ "ORA", CPU::abs, 4, false, false, Ops::ora }, // 0D
+	{ "ASL", CPU::abs, 6, false, false, Ops::asl }, // 0E
+	{ "SLO", CPU::abs, 6, false, true, Ops::slo }, // 0F
+	{ "BPL", CPU::rel, 2, false, false, Ops::bpl }, // 10
+	{ "ORA", CPU::izy, 5, true, false, Ops::ora }, // 11
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // 12
+	{ "SLO", CPU::izy, 8, false, true, Ops::slo }, // 13
+	{ "NOP", CPU::zpx, 4, false, true, Ops::nop }, // 14
+	{ "ORA", CPU::zpx, 4, false, false, Ops::ora }, // 15
+	{ "ASL", CPU::zpx, 6, false, false, Ops::asl }, // 16
+	{ "SLO", CPU::zpx, 6, false, true, Ops::slo }, // 17
+	{ "CLC", CPU::imp, 2, false, false, Ops::clc }, // 18
+	{ "ORA", CPU::aby, 4, true, false, Ops::ora }, // 19
+	{ "NOP", CPU::imp, 2, false, true, Ops::nop }, // 1A
+	{ "SLO", CPU::aby, 7, false, true, Ops::slo }, // 1B
+	{ "NOP", CPU::abx, 4, true, true, Ops::nop }, // 1C
+	{ "ORA", CPU::abx, 4, true, false, Ops::ora }, // 1D
+	{ "ASL", CPU::abx, 7, false, false, Ops::asl }, // 1E
+	{ "SLO", CPU::abx, 7, false, true, Ops::slo }, // 1F
+	{ "JSR", CPU::abs, 6, false, false, Ops::jsr }, // 20
+	{ "AND", CPU::izx, 6, false, false, Ops::and_ }, // 21
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // 22
+	{ "RLA", CPU::izx, 8, false, true, Ops::rla }, // 23
+	{ "BIT", CPU::zp, 3, false, false, Ops::bit }, // 24
+	{ "AND", CPU::zp, 3, false, false, Ops::and_ }, // 25
+	{ "ROL", CPU::zp, 5, false, false, Ops::rol }, // 26
+	{ "RLA", CPU::zp, 5, false, true, Ops::rla }, // 27
+	{ "PLP", CPU::imp, 4, false, false, Ops::plp }, // 28
+	{ "AND", CPU::imm, 2, false, false, Ops::and_ }, // 29
+	{ "ROL", CPU::acc, 2, false, false, Ops::rol_a }, // 2A
+	{ "ANC", CPU::imm, 2, false, true, Ops::anc }, // 2B
+	{ "BIT", CPU::abs, 4, false, false, Ops::bit }, // 2C
+	{ "AND", CPU::abs, 4, false, false, Ops::and_ }, // 2D
+	{ "ROL", CPU::abs, 6, false, false, Ops::rol }, // 2E
+	{ "RLA", CPU::abs, 6, false, true, Ops::rla }, // 2F
+	{ "BMI", CPU::rel, 2, false, false, Ops::bmi }, // 30
+	{ "AND", CPU::izy, 5, true, false, Ops::and_ }, // 31
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // 32
+	{ "RLA", CPU::izy, 8, false, true, Ops::rla }, // 33
+	{ "NOP", CPU::zpx, 4, false, true, Ops::nop }, // 34
+	{ "AND", CPU::zpx, 4, false, false, Ops::and_ }, // 35
+	{ "ROL", CPU::zpx, 6, false, false, Ops::rol }, // 36
+	{ "RLA", CPU::zpx, 6, false, true, Ops::rla }, // 37
+	{ "SEC", CPU::imp, 2, false, false, Ops::sec }, // 38
+	{ "AND", CPU::aby, 4, true, false, Ops::and_ }, // 39
+	{ "NOP", CPU::imp, 2, false, true, Ops::nop }, // 3A
+	{ "RLA", CPU::aby, 7, false, true, Ops::rla }, // 3B
+	{ "NOP", CPU::abx, 4, true, true, Ops::nop }, // 3C
+	{ "AND", CPU::abx, 4, true, false, Ops::and_ }, // 3D
+	{ "ROL", CPU::abx, 7, false, false, Ops::rol }, // 3E
+	{ "RLA", CPU::abx, 7, false, true, Ops::rla }, // 3F
+	{ "RTI", CPU::imp, 6, false, false, Ops::rti }, // 40
+	{ "EOR", CPU::izx, 6, false, false, Ops::eor }, // 41
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // 42
+	{ "SRE", CPU::izx, 8, false, true, Ops::sre }, // 43
+	{ "NOP", CPU::zp, 3, false, true, Ops::nop }, // 44
+	{ "EOR", CPU::zp, 3, false, false, Ops::eor }, // 45
+	{ "LSR", CPU::zp, 5, false, false, Ops::lsr }, // 46
+	{ "SRE", CPU::zp, 5, false, true, Ops::sre }, // 47
+	{ "PHA", CPU::imp, 3, false, false, Ops::pha }, // 48
+	{ "EOR", CPU::imm, 2, false, false, Ops::eor }, // 49
+	{ "LSR", CPU::acc, 2, false, false, Ops::lsr_a }, // 4A
+	{ "ALR", CPU::imm, 2, false, true, Ops::alr }, // 4B
+	{ "JMP", CPU::abs, 3, false, false, Ops::jmp }, // 4C
+	{ "EOR", CPU::abs, 4, false, false, Ops::eor }, // 4D
+	{ "LSR", CPU::abs, 6, false, false, Ops::lsr }, // 4E
+	{ "SRE", CPU::abs, 6, false, true, Ops::sre }, // 4F
+	{ "BVC", CPU::rel, 2, false, false, Ops::bvc }, // 50
+	{ "EOR", CPU::izy, 5, true, false, Ops::eor }, // 51
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // 52
+	{ "SRE", CPU::izy, 8, false, true, Ops::sre }, // 53
+	{ "NOP", CPU::zpx, 4, false, true, Ops::nop }, // 54
+	{ "EOR", CPU::zpx, 4, false, false, Ops::eor }, // 55
+	{ "LSR", CPU::zpx, 6, false, false, Ops::lsr }, // 56
+	{ "SRE", CPU::zpx, 6, false, true, Ops::sre }, // 57
+	{ "CLI", CPU::imp, 2, false, false, Ops::cli }, // 58
+	{ "EOR", CPU::aby, 4, true, false, Ops::eor }, // 59
+	{ "NOP", CPU::imp, 2, false, true, Ops::nop }, // 5A
+	{ "SRE", CPU::aby, 7, false, true, Ops::sre }, // 5B
+	{ "NOP", CPU::abx, 4, true, true, Ops::nop }, // 5C
+	{ "EOR", CPU::abx, 4, true, false, Ops::eor }, // 5D
+	{ "LSR", CPU::abx, 7, false, false, Ops::lsr }, // 5E
+	{ "SRE", CPU::abx, 7, false, true, Ops::sre }, // 5F
+	{ "RTS", CPU::imp, 6, false, false, Ops::rts }, // 60
+	{ "ADC", CPU::izx, 6, false, false, Ops::adc }, // 61
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // 62
+	{ "RRA", CPU::izx, 8, false, true, Ops::rra }, // 63
+	{ "NOP", CPU::zp, 3, false, true, Ops::nop }, // 64
+	{ "ADC", CPU::zp, 3, false, false, Ops::adc }, // 65
+	{ "ROR", CPU::zp, 5, false, false, Ops::ror }, // 66
+	{ "RRA", CPU::zp, 5, false, true, Ops::rra }, // 67
+	{ "PLA", CPU::imp, 4, false, false, Ops::pla }, // 68
+	{ "ADC", CPU::imm, 2, false, false, Ops::adc }, // 69
+	{ "ROR", CPU::acc, 2, false, false, Ops::ror_a }, // 6A
+	{ "ARR", CPU::imm, 2, false, true, Ops::arr }, // 6B
+	{ "JMP", CPU::ind, 5, false, false, Ops::jmp }, // 6C
+	{ "ADC", CPU::abs, 4, false, false, Ops::adc }, // 6D
+	{ "ROR", CPU::abs, 6, false, false, Ops::ror }, // 6E
+	{ "RRA", CPU::abs, 6, false, true, Ops::rra }, // 6F
+	{ "BVS", CPU::rel, 2, false, false, Ops::bvs }, // 70
+	{ "ADC", CPU::izy, 5, true, false, Ops::adc }, // 71
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // 72
+	{ "RRA", CPU::izy, 8, false, true, Ops::rra }, // 73
+	{ "NOP", CPU::zpx, 4, false, true, Ops::nop }, // 74
+	{ "ADC", CPU::zpx, 4, false, false, Ops::adc }, // 75
+	{ "ROR", CPU::zpx, 6, false, false, Ops::ror }, // 76
+	{ "RRA", CPU::zpx, 6, false, true, Ops::rra }, // 77
+	{ "SEI", CPU::imp, 2, false, false, Ops::sei }, // 78
+	{ "ADC", CPU::aby, 4, true, false, Ops::adc }, // 79
+	{ "NOP", CPU::imp, 2, false, true, Ops::nop }, // 7A
+	{ "RRA", CPU::aby, 7, false, true, Ops::rra }, // 7B
+	{ "NOP", CPU::abx, 4, true, true, Ops::nop }, // 7C
+	{ "ADC", CPU::abx, 4, true, false, Ops::adc }, // 7D
+	{ "ROR", CPU::abx, 7, false, false, Ops::ror }, // 7E
+	{ "RRA", CPU::abx, 7, false, true, Ops::rra }, // 7F
+	{ "NOP", CPU::imm, 2, false, true, Ops::nop }, // 80
+	{ "STA", CPU::izx, 6, false, false, Ops::sta }, // 81
+	{ "NOP", CPU::imm, 2, false, true, Ops::nop }, // 82
+	{ "SAX", CPU::izx, 6, false, true, Ops::sax }, // 83
+	{ "STY", CPU::zp, 3, false, false, Ops::sty }, // 84
+	{ "STA", CPU::zp, 3, false, false, Ops::sta }, // 85
+	{ "STX", CPU::zp, 3, false, false, Ops::stx }, // 86
+	{ "SAX", CPU::zp, 3, false, true, Ops::sax }, // 87
+	{ "DEY", CPU::imp, 2, false, false, Ops::dey }, // 88
+	{ "NOP", CPU::imm, 2, false, true, Ops::nop }, // 89
+	{ "TXA", CPU::imp, 2, false, false, Ops::txa }, // 8A
+	{ "ANE", CPU::imm, 2, false, true, Ops::ane }, // 8B
+	{ "STY", CPU::abs, 4, false, false, Ops::sty }, // 8C
+	{ "STA", CPU::abs, 4, false, false, Ops::sta }, // 8D
+	{ "STX", CPU::abs, 4, false, false, Ops::stx }, // 8E
+	{ "SAX", CPU::abs, 4, false, true, Ops::sax }, // 8F
+	{ "BCC", CPU::rel, 2, false, false, Ops::bcc }, // 90
+	{ "STA", CPU::izy, 6, false, false, Ops::sta }, // 91
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // 92
+	{ "SHA", CPU::izy, 6, false, true, Ops::sha }, // 93
+	{ "STY", CPU::zpx, 4, false, false, Ops::sty }, // 94
+	{ "STA", CPU::zpx, 4, false, false, Ops::sta }, // 95
+	{ "STX", CPU::zpy, 4, false, false, Ops::stx }, // 96
+	{ "SAX", CPU::zpy, 4, false, true, Ops::sax }, // 97
+	{ "TYA", CPU::imp, 2, false, false, Ops::tya }, // 98
+	{ "STA", CPU::aby, 5, false, false, Ops::sta }, // 99
+	{ "TXS", CPU::imp, 2, false, false, Ops::txs }, // 9A
+	{ "TAS", CPU::aby, 5, false, true, Ops::tas }, // 9B
+	{ "SHY", CPU::abx, 5, false, true, Ops::shy }, // 9C
+	{ "STA", CPU::abx, 5, false, false, Ops::sta }, // 9D
+	{ "SHX", CPU::aby, 5, false, true, Ops::shx }, // 9E
+	{ "SHA", CPU::aby, 5, false, true, Ops::sha }, // 9F
+	{ "LDY", CPU::imm, 2, false, false, Ops::ldy }, // A0
+	{ "LDA", CPU::izx, 6, false, false, Ops::lda }, // A1
+	{ "LDX", CPU::imm, 2, false, false, Ops::ldx }, // A2
+	{ "LAX", CPU::izx, 6, false, true, Ops::lax }, // A3
+	{ "LDY", CPU::zp, 3, false, false, Ops::ldy }, // A4
+	{ "LDA", CPU::zp, 3, false, false, Ops::lda }, // A5
+	{ "LDX", CPU::zp, 3, false, false, Ops::ldx }, // A6
+	{ "LAX", CPU::zp, 3, false, true, Ops::lax }, // A7
+	{ "TAY", CPU::imp, 2, false, false, Ops::tay }, // A8
+	{ "LDA", CPU::imm, 2, false, false, Ops::lda }, // A9
+	{ "TAX", CPU::imp, 2, false, false, Ops::tax }, // AA
+	{ "LXA", CPU::imm, 2, false, true, Ops::lxa }, // AB
+	{ "LDY", CPU::abs, 4, false, false, Ops::ldy }, // AC
+	{ "LDA", CPU::abs, 4, false, false, Ops::lda }, // AD
+	{ "LDX", CPU::abs, 4, false, false, Ops::ldx }, // AE
+	{ "LAX", CPU::abs, 4, false, true, Ops::lax }, // AF
+	{ "BCS", CPU::rel, 2, false, false, Ops::bcs }, // B0
+	{ "LDA", CPU::izy, 5, true, false, Ops::lda }, // B1
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // B2
+	{ "LAX", CPU::izy, 5, true, true, Ops::lax }, // B3
+	{ "LDY", CPU::zpx, 4, false, false, Ops::ldy }, // B4
+	{ "LDA", CPU::zpx, 4, false, false, Ops::lda }, // B5
+	{ "LDX", CPU::zpy, 4, false, false, Ops::ldx }, // B6
+	{ "LAX", CPU::zpy, 4, false, true, Ops::lax }, // B7
+	{ "CLV", CPU::imp, 2, false, false, Ops::clv }, // B8
+	{ "LDA", CPU::aby, 4, true, false, Ops::lda }, // B9
+	{ "TSX", CPU::imp, 2, false, false, Ops::tsx }, // BA
+	{ "LAS", CPU::aby, 4, true, true, Ops::las }, // BB
+	{ "LDY", CPU::abx, 4, true, false, Ops::ldy }, // BC
+	{ "LDA", CPU::abx, 4, true, false, Ops::lda }, // BD
+	{ "LDX", CPU::aby, 4, true, false, Ops::ldx }, // BE
+	{ "LAX", CPU::aby, 4, true, true, Ops::lax }, // BF
+	{ "CPY", CPU::imm, 2, false, false, Ops::cpy }, // C0
+	{ "CMP", CPU::izx, 6, false, false, Ops::cmp }, // C1
+	{ "NOP", CPU::imm, 2, false, true, Ops::nop }, // C2
+	{ "DCP", CPU::izx, 8, false, true, Ops::dcp }, // C3
+	{ "CPY", CPU::zp, 3, false, false, Ops::cpy }, // C4
+	{ "CMP", CPU::zp, 3, false, false, Ops::cmp }, // C5
+	{ "DEC", CPU::zp, 5, false, false, Ops::dec }, // C6
+	{ "DCP", CPU::zp, 5, false, true, Ops::dcp }, // C7
+	{ "INY", CPU::imp, 2, false, false, Ops::iny }, // C8
+	{ "CMP", CPU::imm, 2, false, false, Ops::cmp }, // C9
+	{ "DEX", CPU::imp, 2, false, false, Ops::dex }, // CA
+	{ "SBX", CPU::imm, 2, false, true, Ops::sbx }, // CB
+	{ "CPY", CPU::abs, 4, false, false, Ops::cpy }, // CC
+	{ "CMP", CPU::abs, 4, false, false, Ops::cmp }, // CD
+	{ "DEC", CPU::abs, 6, false, false, Ops::dec }, // CE
+	{ "DCP", CPU::abs, 6, false, true, Ops::dcp }, // CF
+	{ "BNE", CPU::rel, 2, false, false, Ops::bne }, // D0
+	{ "CMP", CPU::izy, 5, true, false, Ops::cmp }, // D1
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // D2
+	{ "DCP", CPU::izy, 8, false, true, Ops::dcp }, // D3
+	{ "NOP", CPU::zpx, 4, false, true, Ops::nop }, // D4
+	{ "CMP", CPU::zpx, 4, false, false, Ops::cmp }, // D5
+	{ "DEC", CPU::zpx, 6, false, false, Ops::dec }, // D6
+	{ "DCP", CPU::zpx, 6, false, true, Ops::dcp }, // D7
+	{ "CLD", CPU::imp, 2, false, false, Ops::cld }, // D8
+	{ "CMP", CPU::aby, 4, true, false, Ops::cmp }, // D9
+	{ "NOP", CPU::imp, 2, false, true, Ops::nop }, // DA
+	{ "DCP", CPU::aby, 7, false, true, Ops::dcp }, // DB
+	{ "NOP", CPU::abx, 4, true, true, Ops::nop }, // DC
+	{ "CMP", CPU::abx, 4, true, false, Ops::cmp }, // DD
+	{ "DEC", CPU::abx, 7, false, false, Ops::dec }, // DE
+	{ "DCP", CPU::abx, 7, false, true, Ops::dcp }, // DF
+	{ "CPX", CPU::imm, 2, false, false, Ops::cpx }, // E0
+	{ "SBC", CPU::izx, 6, false, false, Ops::sbc }, // E1
+	{ "NOP", CPU::imm, 2, false, true, Ops::nop }, // E2
+	{ "ISC", CPU::izx, 8, false, true, Ops::isc }, // E3
+	{ "CPX", CPU::zp, 3, false, false, Ops::cpx }, // E4
+	{ "SBC", CPU::zp, 3, false, false, Ops::sbc }, // E5
+	{ "INC", CPU::zp, 5, false, false, Ops::inc }, // E6
+	{ "ISC", CPU::zp, 5, false, true, Ops::isc }, // E7
+	{ "INX", CPU::imp, 2, false, false, Ops::inx }, // E8
+	{ "SBC", CPU::imm, 2, false, false, Ops::sbc }, // E9
+	{ "NOP", CPU::imp, 2, false, false, Ops::nop }, // EA
+	{ "SBC", CPU::imm, 2, false, true, Ops::sbc }, // EB
+	{ "CPX", CPU::abs, 4, false, false, Ops::cpx }, // EC
+	{ "SBC", CPU::abs, 4, false, false, Ops::sbc }, // ED
+	{ "INC", CPU::abs, 6, false, false, Ops::inc }, // EE
+	{ "ISC", CPU::abs, 6, false, true, Ops::isc }, // EF
+	{ "BEQ", CPU::rel, 2, false, false, Ops::beq }, // F0
+	{ "SBC", CPU::izy, 5, true, false, Ops::sbc }, // F1
+	{ "JAM", CPU::imp, 2, false, true, Ops::jam }, // F2
+	{ "ISC", CPU::izy, 8, false, true, Ops::isc }, // F3
+	{ "NOP", CPU::zpx, 4, false, true, Ops::nop }, // F4
+	{ "SBC", CPU::zpx, 4, false, false, Ops::sbc }, // F5
+	{ "INC", CPU::zpx, 6, false, false, Ops::inc }, // F6
+	{ "ISC", CPU::zpx, 6, false, true, Ops::isc }, // F7
+	{ "SED", CPU::imp, 2, false, false, Ops::sed }, // F8
+	{ "SBC", CPU::aby, 4, true, false, Ops::sbc }, // F9
+	{ "NOP", CPU::imp, 2, false, true, Ops::nop }, // FA
+	{ "ISC", CPU::aby, 7, false, true, Ops::isc }, // FB
+	{ "NOP", CPU::abx, 4, true, true, Ops::nop }, // FC
+	{ "SBC", CPU::abx, 4, true, false, Ops::sbc }, // FD
+	{ "INC", CPU::abx, 7, false, false, Ops::inc }, // FE
+	{ "ISC", CPU::abx, 7, false, true, Ops::isc }, // FF
+}};
+
+const std::array<CPU::Opcode, 256> CPU::table = opcodes;
+
+template<uint8_t OP> void Ops::insn(CPU &c) {
+	constexpr CPU::Opcode o = opcodes[OP];
+	constexpr CPU::Exec exec = o.exec;
+
+	c.extra = 0;
+	exec(c, ea<o.mode>(c, fetch<o.mode>(c), o.penalty));
+	c.cycles += o.cycles + c.extra;
+}
+
+template<uint8_t OP> void Ops::uop(CPU &c, const MicroOp &u) {
+	constexpr CPU::Opcode o = opcodes[OP];
+	constexpr CPU::Exec exec = o.exec;
+
+	c.extra = 0;
+	c.r.pc = u.next;
+	exec(c, ea<o.mode>(c, u.arg, o.penalty));
+	c.cycles += o.cycles + c.extra;
+}
+
+unsigned CPU::length(Mode m) noexcept {
+	switch (m) {
+	case imp: case acc:
+		return 1;
+	case abs: case abx: case aby: case ind:
+		return 3;
+	default:
+		return 2;
+	}
+}
+
+CPU::CPU(Bus &bus) : r(), bus(&bus), cycles(0), jammed(false), dispatch(Dispatch::threaded), dirty(), journal(nullptr), profile(nullptr), trace(nullptr), breaks(nullptr), extra(0), pages(), base(0), blocks(), jit(), watch(nullptr), insn(0), limit(0), until(0) {
+	for (unsigned page = 0; page < pages.size(); ++page)
+		pages[page] = bus.direct(page);
+}
+
+CPU::~CPU() {}
+
+void CPU::reset() {
+	r.acc = r.x = r.y = 0;
+	r.sp = 0xfd;
+	r.set_psw(0x24);
+	r.pc = read16(0xfffc);
+	jammed = false;
+}
+
+uint16_t CPU::operand(const Opcode &o) {
+	switch (o.mode) {
+	case imp: return Ops::ea<imp>(*this, Ops::fetch<imp>(*this), o.penalty);
+	case acc: return Ops::ea<acc>(*this, Ops::fetch<acc>(*this), o.penalty);
+	case imm: return Ops::ea<imm>(*this, Ops::fetch<imm>(*this), o.penalty);
+	case zp:  return Ops::ea<zp>(*this, Ops::fetch<zp>(*this), o.penalty);
+	case zpx: return Ops::ea<zpx>(*this, Ops::fetch<zpx>(*this), o.penalty);
+	case zpy: return Ops::ea<zpy>(*this, Ops::fetch<zpy>(*this), o.penalty);
+	case abs: return Ops::ea<abs>(*this, Ops::fetch<abs>(*this), o.penalty);
+	case abx: return Ops::ea<abx>(*this, Ops::fetch<abx>(*this), o.penalty);
+	case aby: return Ops::ea<aby>(*this, Ops::fetch<aby>(*this), o.penalty);
+	case ind: return Ops::ea<ind>(*this, Ops::fetch<ind>(*this), o.penalty);
+	case izx: return Ops::ea<izx>(*this, Ops::fetch<izx>(*this), o.penalty);
+	case izy: return Ops::ea<izy>(*this, Ops::fetch<izy>(*this), o.penalty);
+	case rel: return Ops::ea<rel>(*this, Ops::fetch<rel>(*this), o.penalty);
+	}
+
+	return 0;
+}
+
+unsigned CPU::step() {
+	if (jammed)
+		return 0;
+
+	const Opcode &o = table[read(r.pc++)];
+
+	extra = 0;
+	o.exec(*this, operand(o));
+
+	unsigned n = o.cycles + extra;
+	cycles += n;
+	return n;
+}
+
+// expand X for every opcode as two hex digits
+#define OP_ROW(X, h) X(h##0) X(h##1) X(h##2) X(h##3) X(h##4) X(h##5) X(h##6) X(h##7) \
+	X(h##8) X(h##9) X(h##A) X(h##B) X(h##C) X(h##D) X(h##E) X(h##F)
+#define OP_ALL(X) OP_ROW(X, 0) OP_ROW(X, 1) OP_ROW(X, 2) OP_ROW(X, 3) OP_ROW(X, 4) OP_ROW(X, 5) OP_ROW(X, 6) OP_ROW(X, 7) \
+	OP_ROW(X, 8) OP_ROW(X, 9) OP_ROW(X, A) OP_ROW(X, B) OP_ROW(X, C) OP_ROW(X, D) OP_ROW(X, E) OP_ROW(X, F)
+
+template<bool Exec> void CPU::run_switch() {
+#define OP_CASE(n) case 0x##n: Ops::insn<0x##n>(*this); break;
+
+	while (cycles < limit && !jammed) {
+		if (Exec && breaks->test(Breakpoints::exec, r.pc) && stops(r.pc))
+			break;
+
+		switch (read(r.pc++)) {
+		OP_ALL(OP_CASE)
+		}
+	}
+
+#undef OP_CASE
+}
+
+template<bool Exec> void CPU::run_threaded() {
+#if __GNUC__
+#define OP_ADDR(n) &&op_##n,
+// every handler has its own copy of the dispatch, so each jump is predicted on its own
+#define OP_NEXT \
+	if (cycles >= limit || jammed) \
+		return; \
+	if (Exec && breaks->test(Breakpoints::exec, r.pc) && stops(r.pc)) \
+		return; \
+	goto *labels[read(r.pc++)];
+#define OP_LABEL(n) op_##n: Ops::insn<0x##n>(*this); OP_NEXT
+
+	static const void *const labels[256] = { OP_ALL(OP_ADDR) };
+
+	OP_NEXT
+	OP_ALL(OP_LABEL)
+
+#undef OP_ADDR
+#undef OP_NEXT
+#undef OP_LABEL
+#else
+	run_switch<Exec>();
+#endif
+}
+
+/**
+ * Bus between CPU and the real bus while it is traced or has read points.
+ * Records accesses in the trace and checks reads against the bitmap. Reads
+ * of the bytes of the current instruction are fetches, which are not
+ * watched. Direct pages are read in place through CPU::pages, which
+ * flush() keeps up to date when the banking changes, and saves a virtual
+ * call per read.
+ */
+class Tap final : public Bus {
+public:
+	Bus &bus;
+	const MOS6510 &r;
+	Trace *trace;
+	Breakpoints *breaks;
+	const std::array<const uint8_t*, 256> &mem;
+	uint64_t cycles; // when the instruction started
+	uint16_t pc;
+	unsigned len; // 0 until the opcode is read
+
+	Tap(Bus &bus, const CPU &cpu) : bus(bus), r(cpu.r), trace(cpu.trace), breaks(cpu.breaks), mem(cpu.pages), cycles(0), pc(0), len(0) {}
+
+	/** Start instruction at \a addr. */
+	void begin(uint16_t addr, uint64_t now) {
+		pc = addr;
+		cycles = now;
+		len = 0;
+	}
+
+	uint8_t read(uint16_t addr) override {
+		const uint8_t *m = mem[addr >> 8];
+		uint8_t v = m ? m[addr & 0xff] : bus.read(addr);
+		bool fetch = (uint16_t)(addr - pc) < len;
+
+		// the first read is the opcode
+		if (!len) {
+			len = CPU::length(CPU::table[v].mode);
+			fetch = true;
+		}
+
+		if (trace)
+			trace->access(fetch ? trace::fetch : trace::read, addr, v, cycles);
+
+		if (breaks && !fetch && breaks->test(Breakpoints::read, addr))
+			breaks->hit(Breakpoints::read, addr, v, r, pc, cycles);
+
+		return v;
+	}
+
+	void write(uint16_t addr, uint8_t v) override {
+		bus.write(addr, v);
+
+		if (trace)
+			trace->access(trace::write, addr, v, cycles);
+	}
+
+	uint8_t peek(uint16_t addr) override { return bus.peek(addr); }
+	// so flush() reads the pages of the real bus while the tap is in place
+	uint8_t *direct(uint8_t page) override { return bus.direct(page); }
+};
+
+void CPU::run_checked() {
+#define OP_CASE(n) case 0x##n: Ops::insn<0x##n>(*this); break;
+
+	Bus *real = bus;
+	std::unique_ptr<Tap> tap;
+
+	// reads can only be checked on their way to the bus, which costs a virtual call
+	if (trace || (breaks && breaks->has(Breakpoints::read))) {
+		tap.reset(new Tap(*bus, *this));
+		bus = tap.get();
+	}
+
+	// writes are checked by write(), only while here so the other dispatchers do not pay for it
+	if (breaks && breaks->has(Breakpoints::write))
+		watch = breaks;
+
+	while (cycles < limit && !jammed) {
+		uint16_t pc = r.pc;
+		uint64_t start = cycles;
+
+		if (breaks && breaks->test(Breakpoints::exec, pc) && breaks->hit(Breakpoints::exec, pc, real->peek(pc), r, pc, cycles))
+			break;
+
+		insn = pc;
+
+		if (tap)
+			tap->begin(pc, cycles);
+
+		switch (read(r.pc++)) {
+		OP_ALL(OP_CASE)
+		}
+
+		if (profile) {
+			++profile->count[pc];
+			profile->cycles[pc] += cycles - start;
+		}
+
+		// read and write points stop after the instruction
+		if (breaks && breaks->pending())
+			break;
+	}
+
+	bus = real;
+	watch = nullptr;
+
+#undef OP_CASE
+}
+
+void CPU::run_profiled() {
+#define OP_CASE(n) case 0x##n: Ops::insn<0x##n>(*this); break;
+
+	uint64_t *count = profile->count.data(), *spent = profile->cycles.data();
+
+	while (cycles < limit && !jammed) {
+		uint16_t pc = r.pc;
+		uint64_t start = cycles;
+
+		switch (read(r.pc++)) {
+		OP_ALL(OP_CASE)
+		}
+
+		++count[pc];
+		spent[pc] += cycles - start;
+	}
+
+#undef OP_CASE
+}
+
+static constexpr MicroOp::Exec uops[256] = {
+#define OP_UOP(n) Ops::uop<0x##n>,
+	OP_ALL(OP_UOP)
+#undef OP_UOP
+};
+
+#undef OP_ALL
+#undef OP_ROW
+
+Block &BlockCache::add(std::unique_ptr<Block> b) {
+	Block &blk = *b;
+
+	drop(blk.start);
+	pages[blk.start >> 8].emplace_back(blk.start);
+	code[blk.start >> 8] = 1;
+
+	if ((blk.last >> 8) != (blk.start >> 8)) {
+		pages[blk.last >> 8].emplace_back(blk.start);
+		code[blk.last >> 8] = 1;
+	}
+
+	at[blk.start] = std::move(b);
+	++count;
+	return blk;
+}
+
+void BlockCache::drop(uint16_t start) {
+	std::unique_ptr<Block> &b = at[start];
+
+	if (!b)
+		return;
+
+	for (unsigned page : { b->start >> 8, b->last >> 8 }) {
+		std::vector<uint16_t> &v = pages[page];
+		v.erase(std::remove(v.begin(), v.end(), start), v.end());
+		code[page] = !v.empty();
+	}
+
+	b.reset();
+	--count;
+}
+
+void BlockCache::invalidate(uint8_t page) {
+	// drop() changes the list, so work on a copy
+	std::vector<uint16_t> starts(pages[page]);
+
+	for (uint16_t start : starts)
+		drop(start);
+
+	++gen;
+}
+
+void BlockCache::clear() {
+	for (unsigned page = 0; page < pages.size(); ++page)
+		for (uint16_t start : pages[page])
+			at[start].reset();
+
+	for (std::vector<uint16_t> &v : pages)
+		v.clear();
+
+	code.fill(0);
+	count = 0;
+	++gen;
+}
+
+// whether opcode can change PC other than to the next instruction
+static bool ends_block(const CPU::Opcode &o) {
+	static const CPU::Exec jumps[] = { Ops::brk, Ops::jam, Ops::jmp, Ops::jsr, Ops::rti, Ops::rts };
+
+	return o.mode == CPU::rel || std::find(std::begin(jumps), std::end(jumps), o.exec) != std::end(jumps);
+}
+
+// returns nullptr if code is not in direct memory, as fetching it may have side effects
+Block *CPU::decode(uint16_t addr) {
+	std::unique_ptr<Block> b(new Block(addr));
+	uint16_t pc = addr;
+
+	for (unsigned i = 0; i < Block::max_ops; ++i) {
+		uint8_t op = bus->peek(pc), lo = bus->peek(pc + 1);
+		const Opcode &o = table[op];
+		unsigned len = length(o.mode);
+		uint16_t arg;
+
+		if (!bus->direct(pc >> 8) || !bus->direct((pc + len - 1) >> 8)) {
+			if (b->ops.empty())
+				return nullptr;
+
+			break;
+		}
+
+		switch (o.mode) {
+		case imp: case acc:
+			arg = 0;
+			break;
+		case imm:
+			arg = pc + 1;
+			break;
+		case abs: case abx: case aby: case ind:
+			arg = lo | (bus->peek(pc + 2) << 8);
+			break;
+		case rel:
+			arg = pc + 2 + (int8_t)lo;
+			break;
+		default:
+			arg = lo;
+			break;
+		}
+
+		b->last = pc + len - 1;
+		b->max_cycles += o.cycles + o.penalty + (o.mode == rel ? 2 : 0);
+		pc += len;
+		b->ops.push_back(MicroOp{ uops[op], arg, pc, op });
+
+		if (ends_block(o))
+			break;
+	}
+
+	return &blocks.add(std::move(b));
+}
+
+void CPU::run_ops(const Block &b) {
+	unsigned gen = blocks.gen;
+	bool check = checks(b);
+
+	for (const MicroOp &u : b.ops) {
+		// uops set PC to the next instruction, so it is where this one starts
+		if (check && breaks->test(Breakpoints::exec, r.pc) && stops(r.pc))
+			break;
+
+		u.exec(*this, u);
+
+		// stop if the block itself may have been overwritten
+		if (cycles >= limit || jammed || blocks.gen != gen)
+			break;
+	}
+}
+
+void CPU::run_blocks() {
+	while (cycles < limit && !jammed) {
+		Block *b = blocks.find(r.pc);
+
+		if (!b && !(b = decode(r.pc))) {
+			step();
+			continue;
+		}
+
+		run_ops(*b);
+	}
+}
+
+void CPU::run_jit() {
+	if (!jit)
+		jit.reset(new Jit(*this));
+
+	while (cycles < limit && !jammed) {
+		jit->collect();
+
+		Block *b = blocks.find(r.pc);
+
+		if (!b && !(b = decode(r.pc))) {
+			step();
+			continue;
+		}
+
+		if (!b->native && b->hits < Jit::threshold && ++b->hits == Jit::threshold) {
+			b->native = jit->compile(*b);
+
+			// start over with an empty code buffer
+			if (!b->native && jit->full()) {
+				flush();
+				continue;
+			}
+		}
+
+		// compiled code only checks the cycle limit between passes, and no execution points
+		if (b->native && cycles + b->max_cycles <= limit && !checks(*b))
+			b->native(this, limit);
+		else
+			run_ops(*b);
+	}
+}
+
+uint64_t CPU::run(uint64_t n) {
+	uint64_t start = cycles;
+
+	until = cycles + n;
+
+	if (breaks)
+		breaks->resume();
+
+	if (!journal) {
+		run_with(dispatch, until);
+		return cycles - start;
+	}
+
+	// compiled code writes memory in place, so that is left out
+	Dispatch d = dispatch == Dispatch::jit ? Dispatch::blocks : dispatch;
+
+	while (cycles < until && !jammed && !(breaks && breaks->pending())) {
+		journal->mark(*this);
+		run_with(d, cycles + Journal::interval);
+	}
+
+	return cycles - start;
+}
+
+// whether b has an execution point, so it is checked before each instruction
+bool CPU::checks(const Block &b) const noexcept {
+	return breaks && breaks->has(Breakpoints::exec) && breaks->test(Breakpoints::exec, b.start, b.last);
+}
+
+// count the hit of the execution point at pc, which is set, and stop there if it says so
+bool CPU::stops(uint16_t pc) {
+	if (!breaks->hit(Breakpoints::exec, pc, bus->peek(pc), r, pc, cycles))
+		return false;
+
+	yield(cycles);
+	return true;
+}
+
+void CPU::run_with(Dispatch d, uint64_t end) {
+	limit = std::min(end, until);
+
+	// only read and write points need the checking dispatcher, execution points are tested by all
+	bool exec = breaks && breaks->has(Breakpoints::exec);
+
+	if (trace || (breaks && (profile || breaks->has(Breakpoints::read) || breaks->has(Breakpoints::write)))) {
+		run_checked();
+		return;
+	}
+
+	if (profile) {
+		run_profiled();
+		return;
+	}
+
+	switch (d) {
+	case Dispatch::table:
+		while (cycles < limit && !jammed && !(exec && breaks->test(Breakpoints::exec, r.pc) && stops(r.pc)))
+			step();
+		break;
+	case Dispatch::switched:
+		exec ? run_switch<true>() : run_switch<false>();
+		break;
+	case Dispatch::threaded:
+		exec ? run_threaded<true>() : run_threaded<false>();
+		break;
+	case Dispatch::blocks:
+		run_blocks();
+		break;
+	case Dispatch::jit:
+		run_jit();
+		break;
+	}
+}
+
+void CPU::flush() {
+	blocks.clear();
+	dirty.fill(1);
+
+	// the bus calls this when its direct pages change
+	for (unsigned page = 0; page < pages.size(); ++page)
+		pages[page] = bus->direct(page);
+
+	if (jit)
+		jit->retire();
+}
+
+void CPU::changed(uint8_t page) {
+	if (blocks.has_code(page))
+		blocks.invalidate(page);
+
+	dirty[page] = 1;
+}
+
+void CPU::interrupt(uint16_t vector, bool brk) {
+	push(r.pc >> 8);
+	push(r.pc & 0xff);
+	push(r.psw() | (brk ? 0x10 : 0));
+
+	r.no_irq = 1;
+	r.pc = read16(vector);
+}
+
+bool CPU::irq() {
+	if (r.no_irq || jammed)
+		return false;
+
+	if (journal)
+		journal->mark(*this, true);
+
+	interrupt(0xfffe, false);
+	cycles += 7;
+
+	if (journal)
+		journal->mark(*this);
+
+	return true;
+}
+
+void CPU::nmi() {
+	if (jammed)
+		return;
+
+	if (journal)
+		journal->mark(*this, true);
+
+	interrupt(0xfffa, false);
+	cycles += 7;
+
+	if (journal)
+		journal->mark(*this);
+}
+
+std::string CPU::disasm(uint16_t addr, unsigned *len) const {
+	const Opcode &o = table[bus->peek(addr)];
+	uint8_t lo = bus->peek(addr + 1), hi = bus->peek(addr + 2);
+	uint16_t word = lo | (hi << 8);
+	char buf[32];
+
+	switch (o.mode) {
+	case imp: snprintf(buf, sizeof buf, "%s", o.name); break;
+	case acc: snprintf(buf, sizeof buf, "%s A", o.name); break;
+	case imm: snprintf(buf, sizeof buf, "%s #$%02X", o.name, lo); break;
+	case zp:  snprintf(buf, sizeof buf, "%s $%02X", o.name, lo); break;
+	case zpx: snprintf(buf, sizeof buf, "%s $%02X,X", o.name, lo); break;
+	case zpy: snprintf(buf, sizeof buf, "%s $%02X,Y", o.name, lo); break;
+	case abs: snprintf(buf, sizeof buf, "%s $%04X", o.name, word); break;
+	case abx: snprintf(buf, sizeof buf, "%s $%04X,X", o.name, word); break;
+	case aby: snprintf(buf, sizeof buf, "%s $%04X,Y", o.name, word); break;
+	case ind: snprintf(buf, sizeof buf, "%s ($%04X)", o.name, word); break;
+	case izx: snprintf(buf, sizeof buf, "%s ($%02X,X)", o.name, lo); break;
+	case izy: snprintf(buf, sizeof buf, "%s ($%02X),Y", o.name, lo); break;
+	case rel: snprintf(buf, sizeof buf, "%s $%04X", o.name, (uint16_t)(addr + 2 + (int8_t)lo)); break;
+	}
+
+	if (len)
+		*len = length(o.mode);
+
+	return buf;
+}
+
+/*
+ * Benchmark workloads, assembled at $1000. Every one loops forever, so they
+ * can run for any number of cycles.
+ */
+class Workload final {
+public:
+	const char *name;
+	std::vector<uint8_t> code;
+};
+
+static const Workload workloads[] = {
+	// copy 8K from $2000 to $4000 with LDA (zp),Y and STA (zp),Y
+	{ "copy", {
+		0xa9,0x00,0x85,0xfb,0x85,0xfd,0xa9,0x20,0x85,0xfc,0xa9,0x40,0x85,0xfe,0xa2,0x20,
+		0xa0,0x00,0xb1,0xfb,0x91,0xfd,0xc8,0xd0,0xf9,0xe6,0xfc,0xe6,0xfe,0xca,0xd0,0xf2,
+		0x4c,0x00,0x10,
+	} },
+	// CRC16-CCITT of $2000-$2FFF, bitwise with shifts and branches
+	{ "crc", {
+		0xa9,0xff,0x85,0x02,0x85,0x03,0xa9,0x00,0x85,0xfb,0xa9,0x20,0x85,0xfc,0xa2,0x10,
+		0xa0,0x00,0xb1,0xfb,0x45,0x03,0x85,0x03,0x8a,0x48,0xa2,0x08,0x06,0x02,0x26,0x03,
+		0x90,0x0c,0xa5,0x03,0x49,0x10,0x85,0x03,0xa5,0x02,0x49,0x21,0x85,0x02,0xca,0xd0,
+		0xeb,0x68,0xaa,0xc8,0xd0,0xdc,0xe6,0xfc,0xca,0xd0,0xd7,0x4c,0x00,0x10,
+	} },
+	// 8x8 bit shift-and-add multiply table and decimal mode counting
+	{ "mul", {
+		0xa2,0x00,0x86,0x02,0x86,0x03,0xa9,0x00,0xa0,0x08,0x46,0x03,0x90,0x03,0x18,0x65,
+		0x02,0x6a,0x66,0x04,0x88,0xd0,0xf3,0x9d,0x00,0x41,0xa5,0x04,0x9d,0x00,0x40,0xf8,
+		0x8a,0x69,0x01,0xd8,0xe8,0xd0,0xdb,0x4c,0x00,0x10,
+	} },
+};
+
+static void setup(RamBus &bus, CPU &cpu, uint16_t addr, const uint8_t *code, size_t size) {
+	bus.ram.fill(0);
+
+	// something to copy and checksum
+	uint32_t seed = 0x6510;
+
+	for (unsigned i = 0x2000; i < 0x4000; ++i) {
+		seed = seed * 1103515245 + 12345;
+		bus.ram[i] = seed >> 16;
+	}
+
+	bus.load(addr, code, size);
+	bus.ram[0xfffc] = addr & 0xff;
+	bus.ram[0xfffd] = addr >> 8;
+	cpu.reset();
+	cpu.flush();
+	cpu.cycles = 0;
+}
+
+static const std::pair<CPU::Dispatch, const char*> dispatchers[] = {
+	{ CPU::Dispatch::table, "table" },
+	{ CPU::Dispatch::switched, "switch" },
+	{ CPU::Dispatch::threaded, "threaded" },
+	{ CPU::Dispatch::blocks, "blocks" },
+	{ CPU::Dispatch::jit, "jit" },
+};
+
+// registers, cycles and memory after running a fixed number of cycles
+static std::vector<uint8_t> state(const RamBus &bus, const CPU &cpu) {
+	std::vector<uint8_t> v(bus.ram.begin(), bus.ram.end());
+	uint8_t regs[] = { cpu.r.acc, cpu.r.x, cpu.r.y, cpu.r.sp, (uint8_t)cpu.r.psw(), (uint8_t)cpu.r.pc, (uint8_t)(cpu.r.pc >> 8), cpu.jammed };
+
+	v.insert(v.end(), regs, regs + sizeof regs);
+	v.insert(v.end(), (const uint8_t*)&cpu.cycles, (const uint8_t*)(&cpu.cycles + 1));
+	return v;
+}
+
+/*
+ * Run program with every dispatcher for about \a seconds and print emulated
+ * speed. All dispatchers must also end up in the same state after the same
+ * number of cycles.
+ */
+static void bench(const char *name, RamBus &bus, CPU &cpu, uint16_t addr, const uint8_t *code, size_t size, double seconds) {
+	constexpr uint64_t chunk = 1000000, check = 10 * chunk;
+	constexpr double pal_mhz = 0.985248;
+
+	std::vector<uint8_t> expect;
+	double base_mhz = 0;
+	Journal journal;
+	Profile profile;
+	Breakpoints breaks;
+
+	// execution points that are never hit, so only the bit tests cost
+	breaks.add(Breakpoints::exec, 0xfff0, 0xfff0);
+	breaks.add(Breakpoints::exec, 0xfff8, 0xfff8);
+
+	/*
+	 * Once more with an undo journal, with a profile and with breakpoints, to
+	 * see what recording and checking costs. The profile dispatches like
+	 * switched, the breakpoints like threaded, which is the default. The
+	 * journal and the breakpoints are compared with runs without them in
+	 * between their own.
+	 */
+	for (size_t i = 0; i < std::size(dispatchers) + 3; ++i) {
+		bool record = i == std::size(dispatchers), profiling = i == std::size(dispatchers) + 1, checking = i == std::size(dispatchers) + 2;
+		const auto &d = dispatchers[checking ? 2 : record || profiling ? 0 : i];
+
+		cpu.dispatch = d.first;
+		cpu.journal = record ? &journal : nullptr;
+		cpu.profile = profiling ? &profile : nullptr;
+		cpu.breaks = checking ? &breaks : nullptr;
+
+		setup(bus, cpu, addr, code, size);
+		cpu.run(check);
+
+		std::vector<uint8_t> got(state(bus, cpu));
+		bool same = expect.empty() || got == expect;
+
+		if (expect.empty())
+			expect = std::move(got);
+
+		setup(bus, cpu, addr, code, size);
+
+		uint64_t cycles = 0, plain = 0;
+		double s = 0, plain_s = 0;
+		auto last = std::chrono::steady_clock::now();
+
+		// lap time since the last call
+		auto lap = [&last]() {
+			auto now = std::chrono::steady_clock::now();
+			double t = std::chrono::duration<double>(now - last).count();
+
+			last = now;
+			return t;
+		};
+
+		do {
+			// the journal and breakpoints alternate with plain runs, so both see the same load on the host
+			if (record || checking) {
+				cpu.journal = nullptr;
+				cpu.breaks = nullptr;
+				plain += cpu.run(chunk);
+				plain_s += lap();
+				cpu.journal = record ? &journal : nullptr;
+				cpu.breaks = checking ? &breaks : nullptr;
+			}
+
+			cycles += cpu.run(chunk);
+			s += lap();
+		} while (s + plain_s < seconds && !cpu.jammed);
+
+		double mhz = cycles / s / 1e6;
+
+		if (d.first == CPU::Dispatch::switched)
+			base_mhz = mhz;
+
+		printf("%-8s %-8s %8.1f MHz %7.0fx PAL", name, record ? "journal" : profiling ? "profile" : checking ? "breaks" : d.second, mhz, mhz / pal_mhz);
+
+		if (record || checking)
+			printf(" %+5.1f%% %s", 100 * (plain / plain_s / 1e6 / mhz - 1), d.second);
+		else if (base_mhz > 0)
+			printf(" %5.2fx switch", mhz / base_mhz);
+
+		printf("%s%s\n", cpu.jammed ? "  (jammed)" : "", same ? "" : "  STATE MISMATCH");
+	}
+
+	cpu.journal = nullptr;
+	cpu.profile = nullptr;
+	cpu.breaks = nullptr;
+}
+
+int cpu_bench_main(int argc, char **argv) {
+	const char *file = nullptr;
+	double seconds = 1;
+
+	for (int i = 2; i < argc; ++i) {
+		char *end;
+		double v = strtod(argv[i], &end);
+
+		if (!*end && end != argv[i])
+			seconds = v;
+		else
+			file = argv[i];
+	}
+
+	RamBus bus;
+	CPU cpu(bus);
+
+	if (file) {
+		std::ifstream in(file, std::ios::binary);
+		std::vector<uint8_t> data;
+
+		if (in)
+			data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+		if (data.size() < 3) {
+			fprintf(stderr, "%s: cannot read \"%s\"\n", __func__, file);
+			return 1;
+		}
+
+		bench(file, bus, cpu, data[0] | (data[1] << 8), data.data() + 2, data.size() - 2, seconds);
+		return 0;
+	}
+
+	for (const Workload &w : workloads) {
+		bench(w.name, bus, cpu, 0x1000, w.code.data(), w.code.size(), seconds);
+	}
+
+	batch_bench(seconds);
+	machine_bench(seconds);
+	render_bench(seconds);
+	raster_bench(seconds);
+	return 0;
+}
@@ -0,0 +1,296 @@
+#pragma once
+
+#include "breakpoints.hpp"
+#include "journal.hpp"
+#include "mos6510.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** Memory and I/O as seen by the CPU. */
+class Bus {
+public:
+	virtual ~Bus() {}
+
+	virtual uint8_t read(uint16_t addr) = 0;
+	virtual void write(uint16_t addr, uint8_t v) = 0;
+	/** Read without side effects, for disassembly and memory views. */
+	virtual uint8_t peek(uint16_t addr) { return read(addr); }
+	/**
+	 * Memory of \a page if it is plain RAM or ROM that read() and write()
+	 * access without side effects, or nullptr. Only code on these pages is
+	 * predecoded, and the JIT accesses them directly. Call CPU::flush() when
+	 * this changes.
+	 */
+	virtual uint8_t *direct(uint8_t) { return nullptr; }
+};
+
+/** Flat 64K of RAM without any I/O. */
+class RamBus final : public Bus {
+public:
+	std::array<uint8_t, 0x10000> ram;
+
+	RamBus() : ram() {}
+
+	uint8_t read(uint16_t addr) override { return ram[addr]; }
+	void write(uint16_t addr, uint8_t v) override { ram[addr] = v; }
+	uint8_t peek(uint16_t addr) override { return ram[addr]; }
+	uint8_t *direct(uint8_t page) override { return &ram[page << 8]; }
+
+	/** Copy \a size bytes to \a addr. Wraps around at $FFFF. */
+	void load(uint16_t addr, const uint8_t *data, size_t size);
+};
+
+class CPU;
+class Jit;
+
+/** Predecoded instruction. */
+class MicroOp final {
+public:
+	typedef void (*Exec)(CPU&, const MicroOp&);
+
+	Exec exec;
+	uint16_t arg; // operand as returned by Ops::fetch
+	uint16_t next; // address of next instruction
+	uint8_t op;
+};
+
+/** Straight line code up to and including the first jump, branch or return. */
+class Block final {
+public:
+	static constexpr unsigned max_ops = 32;
+
+	typedef void (*Native)(CPU*, uint64_t end);
+
+	uint16_t start, last; // address of first and last byte
+	std::vector<MicroOp> ops;
+	/** Most cycles one pass can take, with all penalties. */
+	unsigned max_cycles;
+	/** Times the block was entered, until it is compiled. */
+	unsigned hits;
+	/** Compiled code or nullptr. */
+	Native native;
+
+	Block(uint16_t start) : start(start), last(start), ops(), max_cycles(0), hits(0), native(nullptr) {}
+};
+
+/*
+ * Predecoded blocks by start address. Every page remembers the blocks that
+ * have code in it, so a write to that page drops exactly those and
+ * self-modifying code still works. A block spans at most two pages.
+ */
+class BlockCache final {
+	std::vector<std::unique_ptr<Block>> at;
+	std::array<std::vector<uint16_t>, 256> pages;
+	std::array<uint8_t, 256> code; // 1 if page has blocks
+	size_t count;
+public:
+	/** Changes whenever blocks are dropped, so a running block can tell if it is still valid. */
+	unsigned gen;
+
+	BlockCache() : at(0x10000), pages(), code(), count(0), gen(0) {}
+
+	bool has_code(uint8_t page) const noexcept { return code[page]; }
+	const uint8_t *code_map() const noexcept { return code.data(); }
+	Block *find(uint16_t addr) const noexcept { return at[addr].get(); }
+	size_t size() const noexcept { return count; }
+
+	Block &add(std::unique_ptr<Block> b);
+	/** Drop all blocks with code in \a page. */
+	void invalidate(uint8_t page);
+	void clear();
+private:
+	void drop(uint16_t start);
+};
+
+/*
+ * Instruction level MOS 6510 interpreter. Every opcode, including the
+ * undocumented ones, is described by an entry in table: its addressing mode,
+ * base cycle count and the function that executes it. Page crossing and
+ * taken branch penalties are added on top of the base cycles, so the cycle
+ * count matches a real 6510 for every instruction. Read-modify-write
+ * instructions write the old value back before the new one, like the real
+ * CPU does, which matters for I/O registers.
+ *
+ * run() can dispatch in three ways. The table dispatcher calls through the
+ * function pointers in table. The other two use handlers that are generated
+ * from templates for every opcode, with the addressing mode and operation
+ * inlined: the switch dispatcher jumps to them through one big switch, the
+ * threaded one with computed goto, so every handler jumps straight to the next
+ * and the branch predictor can learn common opcode sequences. The block
+ * dispatcher runs predecoded basic blocks from a BlockCache, which skips
+ * fetching and decoding in loops. The jit dispatcher also compiles hot
+ * blocks to native code where supported, see Jit.
+ */
+class CPU final {
+public:
+	enum Mode : uint8_t {
+		imp, // implied
+		acc, // accumulator
+		imm, // #$nn
+		zp,  // $nn
+		zpx, // $nn,X
+		zpy, // $nn,Y
+		abs, // $nnnn
+		abx, // $nnnn,X
+		aby, // $nnnn,Y
+		ind, // ($nnnn)
+		izx, // ($nn,X)
+		izy, // ($nn),Y
+		rel, // branch target
+	};
+
+	typedef void (*Exec)(CPU&, uint16_t ea);
+
+	enum class Dispatch {
+		table,
+		switched,
+		threaded, // same as switched if computed goto is not supported
+		blocks,
+		jit, // same as blocks if the JIT is not supported
+	};
+
+	class Opcode final {
+	public:
+		const char *name;
+		Mode mode;
+		uint8_t cycles;
+		bool penalty; // one more cycle if indexing crosses a page
+		bool illegal;
+		Exec exec;
+	};
+
+	static const std::array<Opcode, 256> table;
+
+	/** Instruction length in bytes for addressing mode \a m. */
+	static unsigned length(Mode m) noexcept;
+
+	MOS6510 r;
+	Bus *bus;
+	uint64_t cycles;
+	/** Set by a JAM opcode. The CPU does nothing until reset. */
+	bool jammed;
+	/** How run() dispatches opcodes. step() always uses table. */
+	Dispatch dispatch;
+	/**
+	 * 1 for every page written since it was last cleared, which only
+	 * snapshots do. flush() marks all pages.
+	 */
+	std::array<uint8_t, 256> dirty;
+	/** If set, writes are recorded and run() takes checkpoints. The jit dispatcher runs like blocks then. */
+	Journal *journal;
+	/** If set, run() counts instructions and cycles in it, dispatching like switched. */
+	Profile *profile;
+	/**
+	 * If set, run() records every memory access in it, dispatching like
+	 * switched. Accesses of interrupts are not recorded.
+	 */
+	Trace *trace;
+	/**
+	 * If set, run() returns early when a breakpoint or watchpoint stops.
+	 * Every dispatcher tests execution points, compiled code by leaving
+	 * blocks that have one to the interpreter. Read and write points make it
+	 * dispatch like switched. Check Breakpoints::pending() afterwards.
+	 */
+	Breakpoints *breaks;
+private:
+	friend class Ops;
+	friend class Jit;
+	friend class Tap;
+
+	unsigned extra; // penalty cycles of current instruction
+	std::array<const uint8_t*, 256> pages; // bus->direct() of every page, read again by flush()
+	uint16_t base; // address before indexing, used by SHA, SHX, SHY and TAS
+	BlockCache blocks;
+	std::unique_ptr<Jit> jit;
+	/** breaks while run_checked() runs with write points, nullptr otherwise. */
+	Breakpoints *watch;
+	uint16_t insn; // address of instruction run_checked() executes
+	uint64_t limit; // cycles the dispatcher runs to, lowered by yield()
+	uint64_t until; // end of run()
+
+	uint8_t read(uint16_t addr) { return bus->read(addr); }
+
+	void write(uint16_t addr, uint8_t v) {
+		if (journal && journal->wants(addr >> 8))
+			journal->save(addr >> 8, pages[addr >> 8], *bus);
+
+		bus->write(addr, v);
+		dirty[addr >> 8] = 1;
+
+		if (blocks.has_code(addr >> 8))
+			blocks.invalidate(addr >> 8);
+
+		if (watch && watch->test(Breakpoints::write, addr))
+			watch->hit(Breakpoints::write, addr, v, r, insn, cycles);
+	}
+
+	uint16_t read16(uint16_t addr) { return read(addr) | (read((uint16_t)(addr + 1)) << 8); }
+	void push(uint8_t v) { write(0x100 | r.sp--, v); }
+	uint8_t pull() { return read(0x100 | ++r.sp); }
+
+	uint16_t operand(const Opcode &o);
+	void interrupt(uint16_t vector, bool brk);
+
+	void run_with(Dispatch d, uint64_t end);
+	template<bool Exec> void run_switch();
+	template<bool Exec> void run_threaded();
+	void run_profiled();
+	void run_checked();
+	void run_blocks();
+	void run_jit();
+	void run_ops(const Block &b);
+	bool checks(const Block &b) const noexcept;
+	bool stops(uint16_t pc);
+	Block *decode(uint16_t addr);
+public:
+	explicit CPU(Bus &bus);
+	~CPU();
+
+	/** Reset registers and jump through the reset vector at $FFFC. */
+	void reset();
+	/** Execute one instruction and return the number of cycles it took. */
+	unsigned step();
+	/**
+	 * Execute instructions until at least \a n cycles have passed, the CPU
+	 * jams or a breakpoint stops. Returns cycles executed.
+	 */
+	uint64_t run(uint64_t n);
+	/**
+	 * Make run() return at \a c cycles if it would run longer, for devices
+	 * that schedule an event while it runs. The instruction that calls it is
+	 * still finished, compiled code stops at the next write to a page that
+	 * is not direct.
+	 */
+	void yield(uint64_t c) noexcept {
+		limit = std::min(limit, c);
+		until = std::min(until, c);
+	}
+
+	/**
+	 * Drop all predecoded blocks. Needed when memory is changed behind the
+	 * back of the CPU, e.g. by loading a PRG straight into the bus.
+	 */
+	void flush();
+	/** Like flush(), but only for code in \a page. */
+	void changed(uint8_t page);
+	const BlockCache &cache() const noexcept { return blocks; }
+
+	/** Take interrupt request if not masked. Returns whether it was taken. */
+	bool irq();
+	void nmi();
+
+	/** Disassemble instruction at \a addr without side effects. */
+	std::string disasm(uint16_t addr, unsigned *len=nullptr) const;
+};
+
+/** Measure interpreter throughput in emulated MHz. */
+int cpu_bench_main(int argc, char **argv);
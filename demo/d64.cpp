@@ -0,0 +1,307 @@
+#include "d64.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+// tracks ordered by distance to the directory track, like the 1541 DOS allocates them
+static constexpr uint8_t track_order[] = {
+	17, 19, 16, 20, 15, 21, 14, 22, 13, 23, 12, 24, 11, 25, 10, 26, 9, 27,
+	8, 28, 7, 29, 6, 30, 5, 31, 4, 32, 3, 33, 2, 34, 1, 35,
+};
+
+static constexpr unsigned file_interleave = 10;
+static constexpr unsigned dir_interleave = 3;
+
+namespace d64 {
+
+unsigned sectors_per_track(unsigned track) {
+	if (track < 1 || track > 40)
+		throw std::range_error(std::string("d64: bad track ") + std::to_string(track));
+
+	if (track <= 17) return 21;
+	if (track <= 24) return 19;
+	if (track <= 30) return 18;
+	return 17;
+}
+
+size_t offset(unsigned track, unsigned sector) {
+	if (sector >= sectors_per_track(track))
+		throw std::range_error(std::string("d64: bad sector ") + std::to_string(track) + "/" + std::to_string(sector));
+
+	size_t pos = 0;
+
+	for (unsigned t = 1; t < track; ++t)
+		pos += sectors_per_track(t);
+
+	return (pos + sector) * sector_size;
+}
+
+}
+
+DiskType disk_type(const std::string &path) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return DiskType::unknown;
+
+	char sig[8] = { 0 };
+	in.read(sig, sizeof sig);
+
+	if (!memcmp(sig, "GCR-1541", sizeof sig))
+		return DiskType::g64;
+
+	in.clear();
+	in.seekg(0, std::ios_base::end);
+	size_t size = in.tellg();
+
+	switch (size) {
+	case 174848: // 35 tracks
+	case 175531: // 35 tracks with error info
+	case 196608: // 40 tracks
+	case 197376: // 40 tracks with error info
+		return DiskType::d64;
+	case 819200:
+	case 822400: // with error info
+		return DiskType::d81;
+	default:
+		return DiskType::unknown;
+	}
+}
+
+const char *disk_type_name(DiskType t) {
+	switch (t) {
+	case DiskType::d64: return "D64";
+	case DiskType::g64: return "G64";
+	case DiskType::d81: return "D81";
+	default: return "unknown";
+	}
+}
+
+static uint8_t petscii(char ch) {
+	if (ch >= 'a' && ch <= 'z')
+		return ch - 'a' + 'A';
+
+	if (ch >= ' ' && ch <= ']')
+		return ch;
+
+	return '-';
+}
+
+static void put_name(uint8_t *dst, const std::string &name, unsigned max) {
+	memset(dst, 0xa0, max);
+
+	for (unsigned i = 0; i < max && i < name.size(); ++i)
+		dst[i] = petscii(name[i]);
+}
+
+D64Builder::D64Builder(const std::string &name, const std::string &id) : img(d64::image_size), files(0), dir_sector(1) {
+	uint8_t *bam = &img[d64::offset(d64::dir_track, 0)];
+
+	bam[0] = d64::dir_track;
+	bam[1] = 1;
+	bam[2] = 'A';
+
+	for (unsigned t = 1; t <= d64::tracks; ++t) {
+		unsigned spt = d64::sectors_per_track(t);
+		uint8_t *e = &bam[4 * t];
+
+		e[0] = spt;
+		e[1] = e[2] = e[3] = 0;
+
+		for (unsigned s = 0; s < spt; ++s)
+			e[1 + s / 8] |= 1 << (s % 8);
+	}
+
+	put_name(&bam[0x90], name, 16);
+	bam[0xa0] = bam[0xa1] = 0xa0;
+	put_name(&bam[0xa2], id, 2);
+	bam[0xa4] = 0xa0;
+	bam[0xa5] = '2';
+	bam[0xa6] = 'A';
+	memset(&bam[0xa7], 0xa0, 4);
+
+	allocate(d64::dir_track, 0);
+	allocate(d64::dir_track, 1);
+
+	// empty directory
+	uint8_t *dir = &img[d64::offset(d64::dir_track, 1)];
+	dir[0] = 0;
+	dir[1] = 0xff;
+}
+
+bool D64Builder::is_free(unsigned track, unsigned sector) const {
+	const uint8_t *e = &img[d64::offset(d64::dir_track, 0) + 4 * track];
+	return (e[1 + sector / 8] >> (sector % 8)) & 1;
+}
+
+void D64Builder::allocate(unsigned track, unsigned sector) {
+	uint8_t *e = &img[d64::offset(d64::dir_track, 0) + 4 * track];
+
+	e[1 + sector / 8] &= ~(1 << (sector % 8));
+	--e[0];
+}
+
+bool D64Builder::find_free(unsigned &track, unsigned &sector, unsigned interleave) const {
+	unsigned spt = d64::sectors_per_track(track);
+
+	// try current track first
+	for (unsigned i = 0; i < spt; ++i) {
+		unsigned s = (sector + interleave + i) % spt;
+
+		if (is_free(track, s)) {
+			sector = s;
+			return true;
+		}
+	}
+
+	if (track == d64::dir_track)
+		return false;
+
+	const uint8_t *it = std::find(std::begin(track_order), std::end(track_order), track);
+
+	for (++it; it != std::end(track_order); ++it) {
+		spt = d64::sectors_per_track(*it);
+
+		for (unsigned s = 0; s < spt; ++s) {
+			if (is_free(*it, s)) {
+				track = *it;
+				sector = s;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+unsigned D64Builder::free_blocks() const {
+	const uint8_t *bam = &img[d64::offset(d64::dir_track, 0)];
+	unsigned n = 0;
+
+	for (unsigned t = 1; t <= d64::tracks; ++t)
+		if (t != d64::dir_track)
+			n += bam[4 * t];
+
+	return n;
+}
+
+uint8_t *D64Builder::dir_entry() {
+	if (files >= d64::dir_entries)
+		throw std::runtime_error("d64: directory full");
+
+	if (files && files % 8 == 0) {
+		unsigned track = d64::dir_track, sector = dir_sector;
+
+		if (!find_free(track, sector, dir_interleave))
+			throw std::runtime_error("d64: directory full");
+
+		allocate(track, sector);
+
+		uint8_t *prev = &img[d64::offset(d64::dir_track, dir_sector)];
+		prev[0] = track;
+		prev[1] = sector;
+
+		uint8_t *dir = &img[d64::offset(track, sector)];
+		dir[0] = 0;
+		dir[1] = 0xff;
+
+		dir_sector = sector;
+	}
+
+	return &img[d64::offset(d64::dir_track, dir_sector) + 32 * (files % 8)];
+}
+
+void D64Builder::add(const std::string &name, const uint8_t *data, size_t size) {
+	if (img.empty())
+		throw std::runtime_error("d64: image already finished");
+
+	unsigned blocks = std::max<size_t>(1, (size + 253) / 254);
+
+	if (blocks > free_blocks())
+		throw std::runtime_error(std::string("d64: disk full, cannot add \"") + name + "\"");
+
+	uint8_t *e = dir_entry();
+
+	unsigned track = track_order[0], sector = 0;
+
+	// first free sector in allocation order
+	while (!is_free(track, sector)) {
+		if (!find_free(track, sector, file_interleave))
+			throw std::runtime_error("d64: disk full");
+	}
+
+	e[2] = 0x82; // closed PRG
+	e[3] = track;
+	e[4] = sector;
+	put_name(&e[5], name, 16);
+	e[0x1e] = blocks & 0xff;
+	e[0x1f] = blocks >> 8;
+
+	size_t pos = 0;
+
+	do {
+		allocate(track, sector);
+
+		uint8_t *blk = &img[d64::offset(track, sector)];
+		size_t n = std::min<size_t>(254, size - pos);
+
+		if (n)
+			memcpy(&blk[2], data + pos, n);
+
+		pos += n;
+
+		if (pos == size) {
+			blk[0] = 0;
+			blk[1] = n + 1;
+			break;
+		}
+
+		if (!find_free(track, sector, file_interleave))
+			throw std::runtime_error("d64: disk full");
+
+		blk[0] = track;
+		blk[1] = sector;
+	} while (true);
+
+	++files;
+}
+
+unsigned D64Builder::add_dir(const std::string &dir) {
+	std::vector<fs::path> paths;
+
+	for (const fs::directory_entry &e : fs::directory_iterator(dir)) {
+		if (!e.is_regular_file())
+			continue;
+
+		std::string ext(e.path().extension().string());
+		std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+		if (ext == ".prg")
+			paths.emplace_back(e.path());
+	}
+
+	std::sort(paths.begin(), paths.end());
+
+	std::vector<uint8_t> buf;
+
+	for (const fs::path &p : paths) {
+		std::ifstream in(p, std::ios::binary);
+		buf.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+		if (!in.eof() && in.fail())
+			throw std::runtime_error(std::string("d64: cannot read \"") + p.string() + "\"");
+
+		add(p.stem().string(), buf.data(), buf.size());
+	}
+
+	return paths.size();
+}
+
+std::vector<uint8_t> D64Builder::image() {
+	return std::move(img);
+}
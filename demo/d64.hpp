@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+/*
+ * 1541 disk image (D64) layout.
+ * 35 tracks with 17 to 21 sectors of 256 bytes each. Track 18 holds the BAM
+ * and the directory.
+ */
+namespace d64 {
+	constexpr unsigned tracks = 35;
+	constexpr unsigned sectors = 683;
+	constexpr unsigned sector_size = 256;
+	constexpr size_t image_size = sectors * sector_size;
+	constexpr unsigned dir_track = 18;
+	constexpr unsigned dir_entries = 144;
+
+	unsigned sectors_per_track(unsigned track);
+	/** Byte offset of \a track (1 based) and \a sector (0 based) in image. */
+	size_t offset(unsigned track, unsigned sector);
+}
+
+/** Disk image types supported by the Ultimate mount and run image commands. */
+enum class DiskType {
+	unknown,
+	d64,
+	g64,
+	d81,
+};
+
+/** Determine disk image type from size and signature. */
+DiskType disk_type(const std::string &path);
+const char *disk_type_name(DiskType t);
+
+/*
+ * Builds a D64 image in memory from PRG files. Files are laid out with the
+ * standard interleave of 10 and directory sectors with an interleave of 3, so
+ * the image loads at normal speed on a real drive.
+ */
+class D64Builder final {
+	std::vector<uint8_t> img;
+	unsigned files;
+	unsigned dir_sector; // last directory sector in use
+
+	bool is_free(unsigned track, unsigned sector) const;
+	void allocate(unsigned track, unsigned sector);
+	bool find_free(unsigned &track, unsigned &sector, unsigned interleave) const;
+	uint8_t *dir_entry();
+public:
+	explicit D64Builder(const std::string &name, const std::string &id="00");
+
+	unsigned free_blocks() const;
+	unsigned count() const noexcept { return files; }
+
+	/** Add PRG file. Name is converted to upper case PETSCII and truncated to 16 characters. */
+	void add(const std::string &name, const uint8_t *data, size_t size);
+	/** Add all .prg files in \a dir sorted by name. Returns number of files added. */
+	unsigned add_dir(const std::string &dir);
+
+	/** Finished image. The builder is empty afterwards. */
+	std::vector<uint8_t> image();
+};
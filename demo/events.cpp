@@ -0,0 +1,95 @@
+#include "events.hpp"
+#include "cpu.hpp"
+
+#include <utility>
+
+unsigned Scheduler::add(Device *d) {
+	devices.emplace_back(d);
+	pos.emplace_back(SIZE_MAX);
+
+	return (unsigned)devices.size() - 1;
+}
+
+void Scheduler::swap(size_t i, size_t j) {
+	std::swap(heap[i], heap[j]);
+	pos[heap[i].id] = i;
+	pos[heap[j].id] = j;
+}
+
+void Scheduler::up(size_t i) {
+	while (i && heap[i].due < heap[(i - 1) / 2].due) {
+		swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+void Scheduler::down(size_t i) {
+	for (;;) {
+		size_t min = i, l = 2 * i + 1, r = l + 1;
+
+		if (l < heap.size() && heap[l].due < heap[min].due)
+			min = l;
+
+		if (r < heap.size() && heap[r].due < heap[min].due)
+			min = r;
+
+		if (min == i)
+			return;
+
+		swap(i, min);
+		i = min;
+	}
+}
+
+void Scheduler::remove(size_t i) {
+	pos[heap[i].id] = SIZE_MAX;
+
+	if (i + 1 == heap.size()) {
+		heap.pop_back();
+		return;
+	}
+
+	unsigned id = heap.back().id;
+
+	heap[i] = heap.back();
+	heap.pop_back();
+	pos[id] = i;
+
+	up(i);
+	down(pos[id]);
+}
+
+void Scheduler::schedule(unsigned id, uint64_t due) {
+	size_t i = pos[id];
+
+	if (due == never) {
+		if (i != SIZE_MAX)
+			remove(i);
+
+		return;
+	}
+
+	if (i == SIZE_MAX) {
+		i = heap.size();
+		heap.emplace_back(Entry{ due, id });
+		pos[id] = i;
+	} else {
+		heap[i].due = due;
+	}
+
+	up(i);
+	down(pos[id]);
+
+	if (cpu)
+		cpu->yield(due);
+}
+
+void Scheduler::fire(uint64_t now) {
+	while (!heap.empty() && heap[0].due <= now) {
+		Entry e = heap[0];
+
+		// the device may schedule its next event right away
+		remove(0);
+		devices[e.id]->event(e.due);
+	}
+}
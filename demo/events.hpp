@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+class CPU;
+
+/*
+ * Events of the emulated chips. Every device has at most one pending event,
+ * the next cycle at which it has to act by itself, like a timer underflow
+ * that raises an interrupt. Between events a device does nothing: what the
+ * CPU reads from it is computed from the cycle counter when it is read.
+ *
+ * The events are kept in a binary heap ordered by cycle, which also knows
+ * where every device is in it, so rescheduling one is O(log n). The CPU runs
+ * in bursts up to the earliest event, and a device that schedules an earlier
+ * one while the CPU runs makes it yield there.
+ */
+class Scheduler final {
+public:
+	static constexpr uint64_t never = ~(uint64_t)0;
+
+	class Device {
+	public:
+		virtual ~Device() {}
+
+		/** Called at or after the cycle of its event, \a now is that cycle. The event is no longer pending. */
+		virtual void event(uint64_t now) = 0;
+	};
+private:
+	class Entry final {
+	public:
+		uint64_t due;
+		unsigned id;
+	};
+
+	std::vector<Device*> devices;
+	std::vector<Entry> heap;
+	std::vector<size_t> pos; // index in heap by id, SIZE_MAX if nothing is pending
+
+	void swap(size_t i, size_t j);
+	void up(size_t i);
+	void down(size_t i);
+	void remove(size_t i);
+public:
+	/** Made to yield when an event is scheduled within its run, may be nullptr. */
+	CPU *cpu;
+
+	Scheduler() : devices(), heap(), pos(), cpu(nullptr) {}
+
+	/** Register \a d and return its id. */
+	unsigned add(Device *d);
+	/** Set the event of device \a id to cycle \a due, replacing any pending one. never cancels it. */
+	void schedule(unsigned id, uint64_t due);
+
+	/** Cycle of the earliest event. */
+	uint64_t next() const noexcept { return heap.empty() ? never : heap[0].due; }
+	size_t pending() const noexcept { return heap.size(); }
+
+	/** Run the events due at \a now or before, earliest first. */
+	void fire(uint64_t now);
+};
@@ -0,0 +1,79 @@
+#include "hash.hpp"
+
+#include <cstring>
+
+// see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t prime3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t v, unsigned n) {
+	return (v << n) | (v >> (64 - n));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof v);
+	return v; // little endian host assumed
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static inline uint64_t lane(uint64_t acc, uint64_t v) {
+	return rotl(acc + v * prime2, 31) * prime1;
+}
+
+static inline uint64_t merge(uint64_t acc, uint64_t v) {
+	return (acc ^ lane(0, v)) * prime1 + prime4;
+}
+
+uint64_t xxh64(const void *data, size_t size, uint64_t seed) {
+	const uint8_t *p = (const uint8_t*)data, *end = p + size;
+	uint64_t h;
+
+	if (size >= 32) {
+		uint64_t v1 = seed + prime1 + prime2, v2 = seed + prime2, v3 = seed, v4 = seed - prime1;
+
+		for (; p + 32 <= end; p += 32) {
+			v1 = lane(v1, read64(p));
+			v2 = lane(v2, read64(p + 8));
+			v3 = lane(v3, read64(p + 16));
+			v4 = lane(v4, read64(p + 24));
+		}
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge(h, v1);
+		h = merge(h, v2);
+		h = merge(h, v3);
+		h = merge(h, v4);
+	} else {
+		h = seed + prime5;
+	}
+
+	h += size;
+
+	for (; p + 8 <= end; p += 8)
+		h = rotl(h ^ lane(0, read64(p)), 27) * prime1 + prime4;
+
+	if (p + 4 <= end) {
+		h = rotl(h ^ (read32(p) * prime1), 23) * prime2 + prime3;
+		p += 4;
+	}
+
+	for (; p < end; ++p)
+		h = rotl(h ^ (*p * prime5), 11) * prime1;
+
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+
+	return h;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * XXH64 non-cryptographic hash. Used to identify program contents: it is
+ * fast enough to hash a PRG on every load and collisions only matter for
+ * deliberately crafted files.
+ */
+uint64_t xxh64(const void *data, size_t size, uint64_t seed=0);
@@ -91,6 +91,7 @@ struct MemoryEditor
     ImU8            (*ReadFn)(const ImU8* data, size_t off);    // = 0      // optional handler to read bytes.
     void            (*WriteFn)(ImU8* data, size_t off, ImU8 d); // = 0      // optional handler to write bytes.
     bool            (*HighlightFn)(const ImU8* data, size_t off);//= 0      // optional handler to return Highlight property (to support non-contiguous highlighting).
+    ImU32           (*BgColorFn)(const ImU8* data, size_t off); // = 0      // optional handler to return background color of a byte, or 0 for none.
 
     // [Internal State]
     bool            ContentsWidthChanged;
@@ -123,6 +124,7 @@ struct MemoryEditor
         ReadFn = NULL;
         WriteFn = NULL;
         HighlightFn = NULL;
+        BgColorFn = NULL;
 
         // State/Internals
         ContentsWidthChanged = false;
@@ -282,6 +284,14 @@ struct MemoryEditor
                         byte_pos_x += (float)(n / OptMidColsCount) * s.SpacingBetweenMidCols;
                     ImGui::SameLine(byte_pos_x);
 
+                    // Draw background color
+                    ImU32 bg_color = BgColorFn ? BgColorFn(mem_data, addr) : 0;
+                    if (bg_color != 0)
+                    {
+                        ImVec2 pos = ImGui::GetCursorScreenPos();
+                        draw_list->AddRectFilled(pos, ImVec2(pos.x + s.HexCellWidth, pos.y + s.LineHeight), bg_color);
+                    }
+
                     // Draw highlight
                     bool is_highlight_from_user_range = (addr >= HighlightMin && addr < HighlightMax);
                     bool is_highlight_from_user_func = (HighlightFn && HighlightFn(mem_data, addr));
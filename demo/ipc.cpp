@@ -0,0 +1,319 @@
+#include "ipc.hpp"
+
+#if !_WIN32
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+#include <cstdio>
+
+#include <fstream>
+#include <stdexcept>
+
+std::vector<Command> IpcServer::diff(const Bytes &old, const Bytes &now) {
+	// a new frame costs a header and an address, so rewrite short unchanged gaps instead
+	constexpr size_t gap = Command::header_size + 2;
+	constexpr size_t max_chunk = Command::max_payload - 2;
+
+	std::vector<Command> cmds;
+	uint16_t base = now.at(0) | (now.at(1) << 8);
+	size_t i = 2, n = now.size();
+
+	while (i < n) {
+		if (i < old.size() && old[i] == now[i]) {
+			++i;
+			continue;
+		}
+
+		size_t start = i, end = i + 1, same = 0;
+
+		for (i = end; i < n && i - start < max_chunk; ++i) {
+			if (i < old.size() && old[i] == now[i]) {
+				if (++same > gap)
+					break;
+			} else {
+				same = 0;
+				end = i + 1;
+			}
+		}
+
+		i = end;
+		cmds.emplace_back(Command::write(base + start - 2, now.data() + start, end - start));
+	}
+
+	return cmds;
+}
+
+#if _WIN32
+IpcServer::IpcServer(const std::string &path) : path(path), fd(-1), running(false), m(), net(), inbox(), last(), requests(0), t() {
+	throw std::runtime_error("ipc: unix domain sockets not supported on this platform");
+}
+
+IpcServer::~IpcServer() {}
+
+void IpcServer::main() {}
+void IpcServer::serve(int) {}
+
+int push_main(int, char **) {
+	fprintf(stderr, "%s: unix domain sockets not supported on this platform\n", __func__);
+	return 1;
+}
+#else
+IpcServer::IpcServer(const std::string &path) : path(path), fd(-1), running(true), m(), net(), inbox(), last(), requests(0), t() {
+	struct sockaddr_un addr{};
+
+	if (path.size() >= sizeof addr.sun_path)
+		throw std::runtime_error(std::string("ipc: path too long: ") + path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		throw std::runtime_error(std::string("ipc: socket failed: ") + strerror(errno));
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	// remove stale socket from previous run
+	unlink(path.c_str());
+
+	if (bind(fd, (const sockaddr*)&addr, sizeof addr) || listen(fd, 4)) {
+		int err = errno;
+		close(fd);
+		throw std::runtime_error(std::string("ipc: cannot listen on ") + path + ": " + strerror(err));
+	}
+
+	t = std::thread(&IpcServer::main, this);
+}
+
+IpcServer::~IpcServer() {
+	running = false;
+	t.join();
+
+	close(fd);
+	unlink(path.c_str());
+}
+
+// wait until fd is readable or server is stopped
+static bool wait_readable(int fd, const std::atomic<bool> &running) {
+	struct pollfd p{ fd, POLLIN, 0 };
+
+	while (running) {
+		int r = poll(&p, 1, 200);
+
+		if (r > 0)
+			return true;
+
+		if (r < 0 && errno != EINTR)
+			return false;
+	}
+
+	return false;
+}
+
+static bool read_fully(int fd, void *dst, size_t size, const std::atomic<bool> &running) {
+	for (size_t got = 0; got < size;) {
+		if (!wait_readable(fd, running))
+			return false;
+
+		ssize_t in = read(fd, (char*)dst + got, size - got);
+
+		if (in <= 0)
+			return false;
+
+		got += in;
+	}
+
+	return true;
+}
+
+// returns false if the client has gone away. send instead of write, so that is not SIGPIPE
+static bool write_line(int fd, const std::string &s) {
+	std::string line(s + "\n");
+
+	for (size_t put = 0; put < line.size();) {
+		ssize_t out = send(fd, line.data() + put, line.size() - put, MSG_NOSIGNAL);
+
+		if (out < 0 && errno == EINTR)
+			continue;
+
+		if (out <= 0)
+			return false;
+
+		put += out;
+	}
+
+	return true;
+}
+
+void IpcServer::main() {
+	while (wait_readable(fd, running)) {
+		int client = accept(fd, NULL, NULL);
+
+		if (client < 0)
+			continue;
+
+		try {
+			serve(client);
+		} catch (const std::runtime_error &e) {
+			fprintf(stderr, "%s: %s\n", __func__, e.what());
+		}
+
+		close(client);
+	}
+}
+
+void IpcServer::serve(int client) {
+	uint8_t hdr[header_size];
+
+	while (read_fully(client, hdr, sizeof hdr, running)) {
+		uint8_t action = hdr[0];
+		size_t size = hdr[1] | (hdr[2] << 8) | (hdr[3] << 16) | ((size_t)hdr[4] << 24);
+
+		if (size < PRG::min_prg_size || size > PRG::max_prg_size) {
+			write_line(client, "error: bad prg size " + std::to_string(size));
+			return; // cannot resync, drop client
+		}
+
+		std::vector<uint8_t> buf(size);
+
+		if (!read_fully(client, buf.data(), size, running))
+			return;
+
+		std::unique_ptr<PRG> prg(new PRG("ipc:" + path, Bytes(std::move(buf))));
+
+		if (!write_line(client, handle(action, *prg)))
+			return;
+	}
+}
+
+std::string IpcServer::handle(uint8_t action, PRG &prg) {
+	std::lock_guard<std::mutex> lk(m);
+
+	if (action > delta)
+		return "error: unknown action " + std::to_string(action);
+
+	if (action != load) {
+		if (!net || !net->ok())
+			return "error: not connected";
+
+		if (action == run) {
+			net->deploy(prg.data, prg.hash);
+		} else if (last.size() < PRG::min_prg_size || last[0] != prg.data[0] || last[1] != prg.data[1]) {
+			net->upload(prg.data, prg.hash);
+		} else {
+			for (Command &cmd : diff(last, prg.data))
+				net->push(std::move(cmd));
+		}
+
+		last = prg.data.owned();
+	}
+
+	++requests;
+	inbox.reset(new PRG(std::move(prg)));
+	return "ok";
+}
+
+int push_main(int argc, char **argv) {
+	uint8_t action = IpcServer::load;
+	std::vector<const char*> args;
+
+	for (int i = 2; i < argc; ++i) {
+		if (!strcmp(argv[i], "--run"))
+			action = IpcServer::run;
+		else if (!strcmp(argv[i], "--delta"))
+			action = IpcServer::delta;
+		else
+			args.emplace_back(argv[i]);
+	}
+
+	if (args.empty()) {
+		fprintf(stderr, "usage: %s --push FILE.prg [--run|--delta] [SOCKET]\n", argv[0]);
+		return 1;
+	}
+
+	std::ifstream in(args[0], std::ios::binary);
+	std::vector<uint8_t> data;
+
+	if (in)
+		data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+	if (data.size() < PRG::min_prg_size) {
+		fprintf(stderr, "%s: cannot read \"%s\"\n", __func__, args[0]);
+		return 1;
+	}
+
+	struct sockaddr_un addr{};
+	std::string path(args.size() > 1 ? args[1] : "/tmp/c64mon.sock");
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof addr.sun_path - 1);
+
+	if (fd < 0 || connect(fd, (const sockaddr*)&addr, sizeof addr)) {
+		fprintf(stderr, "%s: cannot connect to %s: %s\n", __func__, path.c_str(), strerror(errno));
+		return 1;
+	}
+
+	size_t size = data.size();
+	uint8_t hdr[IpcServer::header_size] = { action, (uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24) };
+
+	data.insert(data.begin(), hdr, hdr + sizeof hdr);
+
+	for (size_t put = 0; put < data.size();) {
+		ssize_t out = send(fd, data.data() + put, data.size() - put, MSG_NOSIGNAL);
+
+		if (out <= 0) {
+			fprintf(stderr, "%s: write failed: %s\n", __func__, strerror(errno));
+			close(fd);
+			return 1;
+		}
+
+		put += out;
+	}
+
+	char reply[256];
+	ssize_t in_size = read(fd, reply, sizeof reply - 1);
+	close(fd);
+
+	if (in_size <= 0) {
+		fprintf(stderr, "%s: no reply\n", __func__);
+		return 1;
+	}
+
+	reply[in_size] = '\0';
+	fputs(reply, stdout);
+
+	return strncmp(reply, "ok", 2) ? 1 : 0;
+}
+#endif
+
+void IpcServer::attach(const std::shared_ptr<NetWorker> &net) {
+	std::lock_guard<std::mutex> lk(m);
+
+	if (this->net != net)
+		last = Bytes();
+
+	this->net = net;
+}
+
+bool IpcServer::poll(PRG &prg) {
+	std::lock_guard<std::mutex> lk(m);
+
+	if (!inbox)
+		return false;
+
+	prg = std::move(*inbox);
+	inbox.reset();
+	return true;
+}
+
+uint64_t IpcServer::count() {
+	std::lock_guard<std::mutex> lk(m);
+	return requests;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "prg.hpp"
+#include "worker.hpp"
+
+#include <cstdint>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Local endpoint for build tools to push PRG images without going through
+ * the file system or the UI. Clients connect to a Unix domain socket and send
+ * any number of requests:
+ *
+ *   u8      action: 0 = load, 1 = run, 2 = delta-reload
+ *   u32 le  size of PRG image, including the load address
+ *   ...     PRG image
+ *
+ * Every request is answered with a single line: "ok" or "error: <reason>".
+ *
+ * Load only replaces the PRG shown in the UI. Run also sends it to the device
+ * and starts it. Delta-reload writes only the byte ranges that differ from the
+ * image last sent through this endpoint, without restarting the program. It
+ * falls back to a full DMA load if there is no previous image or the load
+ * address changed.
+ */
+class IpcServer final {
+public:
+	enum Action : uint8_t {
+		load = 0,
+		run = 1,
+		delta = 2,
+	};
+
+	static constexpr unsigned header_size = 5;
+private:
+	std::string path;
+	int fd;
+	std::atomic<bool> running;
+	std::mutex m;
+	std::shared_ptr<NetWorker> net;
+	std::unique_ptr<PRG> inbox;
+	Bytes last; // image last sent to device
+	uint64_t requests;
+	std::thread t;
+
+	void main();
+	void serve(int client);
+	std::string handle(uint8_t action, PRG &prg);
+public:
+	explicit IpcServer(const std::string &path);
+	IpcServer(const IpcServer&) = delete;
+	~IpcServer();
+
+	const std::string &socket_path() const noexcept { return path; }
+
+	/** Set device connection used by run and delta-reload. May be nullptr. */
+	void attach(const std::shared_ptr<NetWorker> &net);
+
+	/** Take PRG received since last call, if any. */
+	bool poll(PRG &prg);
+
+	uint64_t count();
+
+	/** DMA write commands for the byte ranges in \a now that differ from \a old. Both images must have the same load address. */
+	static std::vector<Command> diff(const Bytes &old, const Bytes &now);
+};
+
+/** Entry point for `c64mon --push`: send PRG file to a running c64mon. */
+int push_main(int argc, char **argv);
@@ -0,0 +1,876 @@
+#include "jit.hpp"
+
+#include <cstring>
+
+#include <initializer_list>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(_WIN32)
+#define JIT_X64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define JIT_X64 0
+#endif
+
+static constexpr size_t code_size = 16 << 20;
+
+// the byte read, with bit 8 set if the CPU has to yield
+unsigned Jit::read(CPU *c, unsigned addr) {
+	uint64_t limit = c->limit;
+	unsigned v = c->read(addr);
+	return v | (c->limit != limit) << 8;
+}
+
+// compiled code leaves if the block may have been overwritten or the CPU has to yield
+bool Jit::write(CPU *c, unsigned addr, unsigned v) {
+	unsigned gen = c->blocks.gen;
+	uint64_t limit = c->limit;
+	c->write(addr, v);
+	return c->blocks.gen != gen || c->limit != limit;
+}
+
+bool Jit::rmw(CPU *c, unsigned addr, unsigned v, unsigned old) {
+	unsigned gen = c->blocks.gen;
+	uint64_t limit = c->limit;
+	c->write(addr, old);
+	c->write(addr, v);
+	return c->blocks.gen != gen || c->limit != limit;
+}
+
+bool Jit::interp(CPU *c, const MicroOp *u) {
+	unsigned gen = c->blocks.gen;
+	uint64_t limit = c->limit;
+	u->exec(*c, *u);
+	return c->blocks.gen != gen || c->jammed || c->limit != limit;
+}
+
+#if JIT_X64
+
+Jit::Jit(CPU &c) : c(c), code(nullptr), size(code_size), used(0), stale(false), map() {
+	void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p != MAP_FAILED)
+		code = (uint8_t*)p;
+
+	for (unsigned page = 0; page < map.size(); ++page)
+		map[page] = c.bus->direct(page);
+}
+
+Jit::~Jit() {
+	if (code)
+		munmap(code, size);
+}
+
+void Jit::collect() {
+	if (!stale)
+		return;
+
+	used = 0;
+	stale = false;
+
+	for (unsigned page = 0; page < map.size(); ++page)
+		map[page] = c.bus->direct(page);
+}
+
+namespace {
+
+enum Reg { rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15 };
+
+// condition codes
+enum Cond { co = 0, cno = 1, cc = 2, cnc = 3, cz = 4, cnz = 5, cbe = 6, ca = 7, cs = 8, cns = 9 };
+
+// 6510 registers while compiled code runs
+constexpr Reg ra = r13, rx = r14, ry = r15, rcycles = r12, rend = rbp, rcpu = rbx;
+
+/** Memory operand [base + index << shift + disp]. */
+class Mem final {
+public:
+	Reg base;
+	int index; // -1 if none
+	unsigned shift;
+	int32_t disp;
+
+	Mem(Reg base, int32_t disp=0) : base(base), index(-1), shift(0), disp(disp) {}
+	Mem(Reg base, Reg index, unsigned shift, int32_t disp=0) : base(base), index(index), shift(shift), disp(disp) {}
+};
+
+/** Minimal x86-64 assembler for what the compiler needs. Jumps always take a 32 bit offset. */
+class Asm final {
+public:
+	typedef size_t Label;
+
+	std::vector<uint8_t> buf;
+	std::vector<size_t> labels;
+	std::vector<std::pair<size_t, Label>> fixups;
+
+	Asm() : buf(), labels(), fixups() {}
+
+	void b(uint8_t v) { buf.emplace_back(v); }
+	void d(uint32_t v) { for (unsigned i = 0; i < 4; ++i) b(v >> 8 * i); }
+	void q(uint64_t v) { for (unsigned i = 0; i < 8; ++i) b(v >> 8 * i); }
+
+	Label label() { labels.emplace_back(SIZE_MAX); return labels.size() - 1; }
+	void bind(Label l) { labels[l] = buf.size(); }
+
+	void rex(bool w, int reg, int index, int base, bool force) {
+		uint8_t v = 0x40 | w << 3 | (reg >> 3 & 1) << 2 | (index >> 3 & 1) << 1 | (base >> 3 & 1);
+
+		if (v != 0x40 || force)
+			b(v);
+	}
+
+	// op reg, [mem]. byte forces a REX prefix so that SPL to DIL are not AH to BH
+	void mem(std::initializer_list<uint8_t> op, int reg, const Mem &m, bool w=false, bool byte=false, bool p66=false) {
+		if (p66)
+			b(0x66);
+
+		rex(w, reg, m.index < 0 ? 0 : m.index, m.base, byte && reg >= 4);
+
+		for (uint8_t v : op)
+			b(v);
+
+		if (m.index >= 0 || (m.base & 7) == rsp) {
+			b(0x80 | (reg & 7) << 3 | 4);
+			b(m.shift << 6 | ((m.index < 0 ? rsp : m.index) & 7) << 3 | (m.base & 7));
+		} else {
+			b(0x80 | (reg & 7) << 3 | (m.base & 7));
+		}
+
+		d(m.disp);
+	}
+
+	// op rm, reg
+	void rr(std::initializer_list<uint8_t> op, int reg, int rm, bool w=false, bool byte=false) {
+		rex(w, reg, 0, rm, byte && (reg >= 4 || rm >= 4));
+
+		for (uint8_t v : op)
+			b(v);
+
+		b(0xc0 | (reg & 7) << 3 | (rm & 7));
+	}
+
+	void mov64(Reg r, uint64_t v) { rex(true, 0, 0, r, false); b(0xb8 + (r & 7)); q(v); }
+	void mov32(Reg r, uint32_t v) { rex(false, 0, 0, r, false); b(0xb8 + (r & 7)); d(v); }
+	void mov32(Reg dst, Reg src) { rr({ 0x89 }, src, dst); }
+	void mov64(Reg dst, Reg src) { rr({ 0x89 }, src, dst, true); }
+	void load32(Reg dst, const Mem &m) { mem({ 0x8b }, dst, m); }
+	void load64(Reg dst, const Mem &m) { mem({ 0x8b }, dst, m, true); }
+	void load8(Reg dst, const Mem &m) { mem({ 0x8a }, dst, m, false, true); }
+	void store32(const Mem &m, Reg src) { mem({ 0x89 }, src, m); }
+	void store64(const Mem &m, Reg src) { mem({ 0x89 }, src, m, true); }
+	void store8(const Mem &m, Reg src) { mem({ 0x88 }, src, m, false, true); }
+	void store8(const Mem &m, uint8_t v) { mem({ 0xc6 }, 0, m); b(v); }
+	void store16(const Mem &m, uint16_t v) { mem({ 0xc7 }, 0, m, false, false, true); b(v); b(v >> 8); }
+	void movzx8(Reg dst, const Mem &m) { mem({ 0x0f, 0xb6 }, dst, m); }
+	void movzx8(Reg dst, Reg src) { rr({ 0x0f, 0xb6 }, dst, src, false, true); }
+	void movzx16(Reg dst, Reg src) { rr({ 0x0f, 0xb7 }, dst, src); }
+	void lea32(Reg dst, const Mem &m) { mem({ 0x8d }, dst, m); }
+	void lea64(Reg dst, const Mem &m) { mem({ 0x8d }, dst, m, true); }
+
+	// 8 bit ALU, digit is the /r of opcode 80 and op the r/m, reg opcode
+	enum Alu { add = 0, or_ = 1, adc = 2, sbb = 3, and_ = 4, sub = 5, xor_ = 6, cmp = 7 };
+	void alu8(Alu a, Reg dst, uint8_t v) { rr({ 0x80 }, a, dst, false, true); b(v); }
+	void alu8(Alu a, Reg dst, Reg src) { rr({ (uint8_t)(a << 3) }, src, dst, false, true); }
+	void cmp8(const Mem &m, uint8_t v) { mem({ 0x80 }, cmp, m); b(v); }
+	void alu32(Alu a, Reg dst, uint32_t v) { rr({ 0x81 }, a, dst); d(v); }
+	void alu32(Alu a, Reg dst, Reg src) { rr({ (uint8_t)(a << 3 | 1) }, src, dst); }
+	void add64(Reg dst, uint32_t v) { rr({ 0x81 }, add, dst, true); d(v); }
+	void sbb64(Reg dst, uint8_t v) { rr({ 0x83 }, sbb, dst, true); b(v); }
+
+	// shifts by one: rcl 2, rcr 3, shl 4, shr 5
+	void shift8(unsigned digit, Reg r) { rr({ 0xd0 }, digit, r, false, true); }
+	void shl32(Reg r, uint8_t n) { rr({ 0xc1 }, 4, r); b(n); }
+	void shr32(Reg r, uint8_t n) { rr({ 0xc1 }, 5, r); b(n); }
+	void inc8(Reg r) { rr({ 0xfe }, 0, r, false, true); }
+	void dec8(Reg r) { rr({ 0xfe }, 1, r, false, true); }
+	void inc8(const Mem &m) { mem({ 0xfe }, 0, m); }
+	void dec8(const Mem &m) { mem({ 0xfe }, 1, m); }
+	void inc64(Reg r) { rr({ 0xff }, 0, r, true); }
+	void test8(Reg a, Reg b) { rr({ 0x84 }, b, a, false, true); }
+	void test64(Reg a, Reg b) { rr({ 0x85 }, b, a, true); }
+	void cmp64(Reg a, Reg b) { rr({ 0x39 }, b, a, true); }
+	void set(Cond cc, const Mem &m) { mem({ 0x0f, (uint8_t)(0x90 + cc) }, 0, m); }
+
+	void push(Reg r) { rex(false, 0, 0, r, false); b(0x50 + (r & 7)); }
+	void pop(Reg r) { rex(false, 0, 0, r, false); b(0x58 + (r & 7)); }
+	void call(uint64_t fn) { mov64(rax, fn); rr({ 0xff }, 2, rax); }
+	void ret() { b(0xc3); }
+
+	void jmp(Label l) { b(0xe9); fixups.emplace_back(buf.size(), l); d(0); }
+	void j(Cond cc, Label l) { b(0x0f); b(0x80 + cc); fixups.emplace_back(buf.size(), l); d(0); }
+
+	void link() {
+		for (const auto &f : fixups) {
+			int32_t rel = (int32_t)(labels[f.second] - (f.first + 4));
+			memcpy(&buf[f.first], &rel, 4);
+		}
+	}
+};
+
+enum class Kind {
+	other, lda, ldx, ldy, sta, stx, sty, tax, tay, txa, tya, tsx, txs,
+	inx, iny, dex, dey, inc, dec, and_, ora, eor, adc, sbc, cmp, cpx, cpy, bit,
+	asl, lsr, rol, ror, clc, sec, cli, sei, clv, cld, sed, nop, pha, pla,
+	bcc, bcs, beq, bne, bmi, bpl, bvc, bvs, jmp,
+};
+
+Kind kind(const CPU::Opcode &o) {
+	static const char *const names[] = {
+		"", "LDA", "LDX", "LDY", "STA", "STX", "STY", "TAX", "TAY", "TXA", "TYA", "TSX", "TXS",
+		"INX", "INY", "DEX", "DEY", "INC", "DEC", "AND", "ORA", "EOR", "ADC", "SBC", "CMP", "CPX", "CPY", "BIT",
+		"ASL", "LSR", "ROL", "ROR", "CLC", "SEC", "CLI", "SEI", "CLV", "CLD", "SED", "NOP", "PHA", "PLA",
+		"BCC", "BCS", "BEQ", "BNE", "BMI", "BPL", "BVC", "BVS", "JMP",
+	};
+
+	// JMP ($nnnn) and undocumented opcodes are left to the interpreter
+	if (o.illegal || o.mode == CPU::ind)
+		return Kind::other;
+
+	for (unsigned i = 1; i < sizeof names / sizeof names[0]; ++i)
+		if (!strcmp(o.name, names[i]))
+			return (Kind)i;
+
+	return Kind::other;
+}
+
+/** Compiles one block. */
+class Compiler final {
+	CPU &c;
+	const Block &blk;
+	const std::array<uint8_t*, 256> &map;
+	const uint8_t *code_map;
+	Asm a;
+	Asm::Label body, epilogue;
+	unsigned pending; // cycles not yet added to rcycles
+	unsigned cur; // base cycles of the current instruction that are already in pending
+	int cross; // index register whose page crossing penalty is already in rcycles, -1 if none
+	bool reads; // whether the current instruction may read through the bus
+
+	class Stub final {
+	public:
+		Asm::Label l;
+		uint16_t pc;
+		unsigned cycles;
+	};
+
+	std::vector<Stub> stubs;
+public:
+	Compiler(CPU &c, const Block &blk, const std::array<uint8_t*, 256> &map, const uint8_t *code_map) : c(c), blk(blk), map(map), code_map(code_map), a(), body(), epilogue(), pending(0), cur(0), cross(-1), reads(false), stubs() {}
+
+	std::vector<uint8_t> run();
+private:
+	Mem field(const void *p) const { return Mem(rcpu, (int32_t)((const uint8_t*)p - (const uint8_t*)&c)); }
+	Mem flag(const uint8_t &f) const { return field(&f); }
+
+	void spill();
+	void reload();
+	void exit(uint16_t pc, unsigned cycles);
+	void loop(unsigned cycles);
+	void interp(const MicroOp &u, bool last);
+	void nz(const Mem &zero, const Mem &neg);
+	void nz(Reg r);
+
+	bool static_page(CPU::Mode mode, uint16_t arg) const;
+	void address(CPU::Mode mode, uint16_t arg, bool penalty);
+	void clock();
+	void read_at();
+	void write_at(const MicroOp &u, bool rmw);
+	void yielded(const MicroOp &u, unsigned cycles);
+	bool operand(CPU::Mode mode, uint16_t arg, bool penalty, uint8_t &imm);
+	bool native(const MicroOp &u, bool last);
+};
+
+void Compiler::spill() {
+	if (pending) {
+		a.add64(rcycles, pending);
+		pending = 0;
+	}
+
+	a.store64(field(&c.cycles), rcycles);
+	a.store8(field(&c.r.acc), ra);
+	a.store8(field(&c.r.x), rx);
+	a.store8(field(&c.r.y), ry);
+}
+
+void Compiler::reload() {
+	a.load64(rcycles, field(&c.cycles));
+	a.movzx8(ra, field(&c.r.acc));
+	a.movzx8(rx, field(&c.r.x));
+	a.movzx8(ry, field(&c.r.y));
+}
+
+// leave with PC at pc after adding cycles
+void Compiler::exit(uint16_t pc, unsigned cycles) {
+	if (cycles)
+		a.add64(rcycles, cycles);
+
+	a.store16(field(&c.r.pc), pc);
+	a.jmp(epilogue);
+}
+
+// jump back to the start of the block if another pass fits in the cycle limit
+void Compiler::loop(unsigned cycles) {
+	Asm::Label out = a.label();
+
+	if (cycles)
+		a.add64(rcycles, cycles);
+
+	a.lea64(rax, Mem(rcycles, (int32_t)blk.max_cycles));
+	a.cmp64(rax, rend);
+	a.j(ca, out);
+	a.jmp(body);
+	a.bind(out);
+	exit(blk.start, 0);
+}
+
+void Compiler::interp(const MicroOp &u, bool last) {
+	spill();
+	a.mov64(rdi, rcpu);
+	a.mov64(rsi, (uint64_t)(uintptr_t)&u);
+	a.call((uint64_t)(uintptr_t)&Jit::interp);
+	reload();
+
+	// the handler has set PC
+	if (last) {
+		a.jmp(epilogue);
+	} else {
+		a.test8(rax, rax);
+		a.j(cnz, epilogue);
+	}
+}
+
+// Z and N from the x86 flags of the last operation
+void Compiler::nz(const Mem &zero, const Mem &neg) {
+	a.set(cz, zero);
+	a.set(cs, neg);
+}
+
+void Compiler::nz(Reg r) {
+	a.test8(r, r);
+	nz(flag(c.r.zero), flag(c.r.neg));
+}
+
+// whether the page that mode accesses is known and direct
+bool Compiler::static_page(CPU::Mode mode, uint16_t arg) const {
+	switch (mode) {
+	case CPU::abs:
+		return map[arg >> 8] != nullptr;
+	case CPU::zp: case CPU::zpx: case CPU::zpy: case CPU::izx: case CPU::izy:
+		return map[0] != nullptr;
+	default:
+		return true;
+	}
+}
+
+// effective address to eax
+void Compiler::address(CPU::Mode mode, uint16_t arg, bool penalty) {
+	switch (mode) {
+	case CPU::zp:
+	case CPU::abs:
+		a.mov32(rax, arg);
+		break;
+	case CPU::zpx:
+	case CPU::zpy:
+		a.lea32(rax, Mem(mode == CPU::zpx ? rx : ry, arg));
+		a.movzx8(rax, rax);
+		break;
+	case CPU::abx:
+	case CPU::aby: {
+		Reg idx = mode == CPU::abx ? rx : ry;
+
+		if (penalty) {
+			Asm::Label same = a.label();
+
+			a.alu8(Asm::cmp, idx, 0xff - (arg & 0xff));
+			a.j(cbe, same);
+			a.inc64(rcycles);
+			a.bind(same);
+			cross = idx;
+		}
+
+		a.lea32(rax, Mem(idx, arg));
+		a.movzx16(rax, rax);
+		break;
+	}
+	case CPU::izx:
+		a.mov64(rdx, (uint64_t)(uintptr_t)map[0]);
+		a.lea32(rcx, Mem(rx, arg));
+		a.movzx8(rcx, rcx);
+		a.movzx8(rax, Mem(rdx, rcx, 0));
+		a.alu8(Asm::add, rcx, 1);
+		a.movzx8(rcx, rcx);
+		a.movzx8(rcx, Mem(rdx, rcx, 0));
+		a.shl32(rcx, 8);
+		a.alu32(Asm::or_, rax, rcx);
+		break;
+	case CPU::izy:
+		a.mov64(rdx, (uint64_t)(uintptr_t)map[0]);
+		a.movzx8(rax, Mem(rdx, arg));
+		a.movzx8(rcx, Mem(rdx, (arg + 1) & 0xff));
+		a.shl32(rcx, 8);
+		a.alu32(Asm::or_, rax, rcx);
+
+		if (penalty) {
+			Asm::Label same = a.label();
+
+			a.mov32(rcx, rax);
+			a.alu8(Asm::add, rcx, ry);
+			a.j(cnc, same);
+			a.inc64(rcycles);
+			a.bind(same);
+			cross = ry;
+		}
+
+		a.alu32(Asm::add, rax, ry);
+		a.movzx16(rax, rax);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Store the cycles at the start of the current instruction, which is what the
+ * interpreter has in CPU::cycles while it accesses the bus. I/O devices read
+ * the clock from there. rcycles already has the penalty if indexing crossed a
+ * page, which is the case if the low byte of address eax wrapped below the
+ * index.
+ */
+void Compiler::clock() {
+	a.lea64(rcx, Mem(rcycles, (int32_t)(pending - cur)));
+
+	if (cross >= 0) {
+		a.alu8(Asm::cmp, rax, (Reg)cross);
+		a.sbb64(rcx, 0);
+	}
+
+	a.store64(field(&c.cycles), rcx);
+}
+
+// eax = byte at address eax. a read that makes the CPU yield sets the flag at [rsp + 4]
+void Compiler::read_at() {
+	Asm::Label slow = a.label(), done = a.label();
+
+	a.mov32(rcx, rax);
+	a.shr32(rcx, 8);
+	a.mov64(rdx, (uint64_t)(uintptr_t)map.data());
+	a.load64(rdx, Mem(rdx, rcx, 3));
+	a.test64(rdx, rdx);
+	a.j(cz, slow);
+	a.movzx8(rcx, rax);
+	a.movzx8(rax, Mem(rdx, rcx, 0));
+	a.jmp(done);
+
+	a.bind(slow);
+	clock();
+	a.mov64(rdi, rcpu);
+	a.mov32(rsi, rax);
+	a.call((uint64_t)(uintptr_t)&Jit::read);
+	a.mov32(rcx, rax);
+	a.shr32(rcx, 8);
+	a.store8(Mem(rsp, 4), rcx);
+	a.movzx8(rax, rax);
+	a.bind(done);
+	reads = true;
+}
+
+// write r8b to address eax. rmw also writes the old value in r9b first, if it goes through the bus
+void Compiler::write_at(const MicroOp &u, bool rmw) {
+	Asm::Label slow = a.label(), done = a.label(), dropped = a.label();
+
+	a.mov32(rcx, rax);
+	a.shr32(rcx, 8);
+	a.mov64(rdx, (uint64_t)(uintptr_t)code_map);
+	a.cmp8(Mem(rdx, rcx, 0), 0);
+	a.j(cnz, slow);
+	a.mov64(rdx, (uint64_t)(uintptr_t)c.dirty.data());
+	a.store8(Mem(rdx, rcx, 0), 1);
+	a.mov64(rdx, (uint64_t)(uintptr_t)map.data());
+	a.load64(rdx, Mem(rdx, rcx, 3));
+	a.test64(rdx, rdx);
+	a.j(cz, slow);
+	a.movzx8(rcx, rax);
+	a.store8(Mem(rdx, rcx, 0), r8);
+	a.jmp(done);
+
+	a.bind(slow);
+	clock();
+	a.mov64(rdi, rcpu);
+	a.mov32(rsi, rax);
+	a.movzx8(rdx, r8);
+
+	if (rmw)
+		a.movzx8(rcx, r9);
+
+	a.call(rmw ? (uint64_t)(uintptr_t)&Jit::rmw : (uint64_t)(uintptr_t)&Jit::write);
+	a.test8(rax, rax);
+	a.j(cnz, dropped);
+	a.bind(done);
+
+	// the write may have dropped this block
+	stubs.push_back(Stub{ dropped, u.next, pending });
+}
+
+/*
+ * Leave after the instruction if one of its reads made the CPU yield. The
+ * read has happened by then, so it is not repeated like it would be if the
+ * block were left in the middle of the instruction.
+ */
+void Compiler::yielded(const MicroOp &u, unsigned cycles) {
+	if (!reads)
+		return;
+
+	Asm::Label l = a.label();
+
+	reads = false;
+	a.cmp8(Mem(rsp, 4), 0);
+	a.j(cnz, l);
+	stubs.push_back(Stub{ l, u.next, cycles });
+}
+
+// value to eax, or to imm if it is immediate. returns true if immediate
+bool Compiler::operand(CPU::Mode mode, uint16_t arg, bool penalty, uint8_t &imm) {
+	switch (mode) {
+	case CPU::imm:
+		// the block is dropped if its own code changes, so this is constant
+		imm = c.bus->peek(arg);
+		return true;
+	case CPU::zp:
+	case CPU::abs:
+		a.mov64(rdx, (uint64_t)(uintptr_t)(map[arg >> 8] + (arg & 0xff)));
+		a.movzx8(rax, Mem(rdx));
+		return false;
+	case CPU::zpx:
+	case CPU::zpy:
+		address(mode, arg, penalty);
+		a.mov64(rdx, (uint64_t)(uintptr_t)map[0]);
+		a.movzx8(rax, Mem(rdx, rax, 0));
+		return false;
+	default:
+		address(mode, arg, penalty);
+		read_at();
+		return false;
+	}
+}
+
+// compile u natively. returns false if the interpreter has to do it
+bool Compiler::native(const MicroOp &u, bool last) {
+	const CPU::Opcode &o = CPU::table[u.op];
+	Kind k = kind(o);
+	MOS6510 &r = c.r;
+	uint8_t imm = 0;
+	bool is_imm;
+
+	if (k == Kind::other || !static_page(o.mode, u.arg))
+		return false;
+
+	cur = 0;
+	cross = -1;
+	reads = false;
+
+	// decimal mode arithmetic is left to the interpreter at run time
+	if (k == Kind::adc || k == Kind::sbc) {
+		Asm::Label bin = a.label(), done = a.label();
+
+		spill();
+		a.cmp8(flag(r.dec), 0);
+		a.j(cz, bin);
+		interp(u, false);
+		a.jmp(done);
+
+		a.bind(bin);
+		is_imm = operand(o.mode, u.arg, o.penalty, imm);
+		a.load8(rcx, flag(r.carry));
+
+		if (k == Kind::adc) {
+			a.alu8(Asm::add, rcx, 0xff); // CF = C
+			is_imm ? a.alu8(Asm::adc, ra, imm) : a.alu8(Asm::adc, ra, rax);
+			a.set(cc, flag(r.carry));
+		} else {
+			a.alu8(Asm::cmp, rcx, 1); // CF = !C
+			is_imm ? a.alu8(Asm::sbb, ra, imm) : a.alu8(Asm::sbb, ra, rax);
+			a.set(cnc, flag(r.carry));
+		}
+
+		a.set(co, flag(r.of));
+		nz(flag(r.zero), flag(r.neg));
+		a.add64(rcycles, o.cycles);
+		yielded(u, 0);
+		a.bind(done);
+
+		if (last)
+			exit(u.next, 0);
+
+		return true;
+	}
+
+	pending += o.cycles;
+	cur = o.cycles;
+
+	switch (k) {
+	case Kind::lda:
+	case Kind::ldx:
+	case Kind::ldy: {
+		Reg dst = k == Kind::lda ? ra : k == Kind::ldx ? rx : ry;
+
+		if (operand(o.mode, u.arg, o.penalty, imm)) {
+			a.mov32(dst, imm);
+			a.store8(flag(r.zero), imm == 0);
+			a.store8(flag(r.neg), imm >> 7);
+		} else {
+			a.mov32(dst, rax);
+			nz(dst);
+		}
+		break;
+	}
+	case Kind::sta:
+	case Kind::stx:
+	case Kind::sty:
+		address(o.mode, u.arg, o.penalty);
+		a.mov32(r8, k == Kind::sta ? ra : k == Kind::stx ? rx : ry);
+		write_at(u, false);
+		break;
+	case Kind::tax: a.mov32(rx, ra); nz(rx); break;
+	case Kind::tay: a.mov32(ry, ra); nz(ry); break;
+	case Kind::txa: a.mov32(ra, rx); nz(ra); break;
+	case Kind::tya: a.mov32(ra, ry); nz(ra); break;
+	case Kind::tsx: a.movzx8(rx, field(&r.sp)); nz(rx); break;
+	case Kind::txs: a.store8(field(&r.sp), rx); break;
+	case Kind::inx: a.inc8(rx); nz(flag(r.zero), flag(r.neg)); break;
+	case Kind::iny: a.inc8(ry); nz(flag(r.zero), flag(r.neg)); break;
+	case Kind::dex: a.dec8(rx); nz(flag(r.zero), flag(r.neg)); break;
+	case Kind::dey: a.dec8(ry); nz(flag(r.zero), flag(r.neg)); break;
+	case Kind::and_:
+	case Kind::ora:
+	case Kind::eor: {
+		Asm::Alu op = k == Kind::and_ ? Asm::and_ : k == Kind::ora ? Asm::or_ : Asm::xor_;
+
+		is_imm = operand(o.mode, u.arg, o.penalty, imm);
+		is_imm ? a.alu8(op, ra, imm) : a.alu8(op, ra, rax);
+		nz(flag(r.zero), flag(r.neg));
+		break;
+	}
+	case Kind::cmp:
+	case Kind::cpx:
+	case Kind::cpy: {
+		Reg reg = k == Kind::cmp ? ra : k == Kind::cpx ? rx : ry;
+
+		is_imm = operand(o.mode, u.arg, o.penalty, imm);
+		is_imm ? a.alu8(Asm::cmp, reg, imm) : a.alu8(Asm::cmp, reg, rax);
+		a.set(cnc, flag(r.carry));
+		nz(flag(r.zero), flag(r.neg));
+		break;
+	}
+	case Kind::bit:
+		operand(o.mode, u.arg, o.penalty, imm);
+		a.test8(ra, rax);
+		a.set(cz, flag(r.zero));
+		a.mov32(rcx, rax);
+		a.shr32(rcx, 6);
+		a.alu32(Asm::and_, rcx, 1);
+		a.store8(flag(r.of), rcx);
+		a.shr32(rax, 7);
+		a.store8(flag(r.neg), rax);
+		break;
+	case Kind::asl:
+	case Kind::lsr:
+	case Kind::rol:
+	case Kind::ror:
+	case Kind::inc:
+	case Kind::dec: {
+		bool mem = o.mode != CPU::acc;
+		Reg v = mem ? rax : ra;
+
+		if (mem) {
+			address(o.mode, u.arg, o.penalty);
+			a.store32(Mem(rsp), rax);
+			read_at();
+			a.mov32(r9, rax);
+		}
+
+		if (k == Kind::rol || k == Kind::ror) {
+			a.load8(rcx, flag(r.carry));
+			a.alu8(Asm::add, rcx, 0xff);
+		}
+
+		switch (k) {
+		case Kind::asl: a.shift8(4, v); break;
+		case Kind::lsr: a.shift8(5, v); break;
+		case Kind::rol: a.shift8(2, v); break;
+		case Kind::ror: a.shift8(3, v); break;
+		case Kind::inc: a.inc8(v); break;
+		default: a.dec8(v); break;
+		}
+
+		if (k != Kind::inc && k != Kind::dec)
+			a.set(cc, flag(r.carry));
+
+		// RCL and RCR do not set Z and N
+		if (k == Kind::rol || k == Kind::ror)
+			nz(v);
+		else
+			nz(flag(r.zero), flag(r.neg));
+
+		if (mem) {
+			a.mov32(r8, rax);
+			a.load32(rax, Mem(rsp));
+			write_at(u, true);
+		}
+		break;
+	}
+	case Kind::clc: a.store8(flag(r.carry), 0); break;
+	case Kind::sec: a.store8(flag(r.carry), 1); break;
+	case Kind::cli: a.store8(flag(r.no_irq), 0); break;
+	case Kind::sei: a.store8(flag(r.no_irq), 1); break;
+	case Kind::clv: a.store8(flag(r.of), 0); break;
+	case Kind::cld: a.store8(flag(r.dec), 0); break;
+	case Kind::sed: a.store8(flag(r.dec), 1); break;
+	case Kind::nop: break;
+	case Kind::pha:
+		a.movzx8(rax, field(&r.sp));
+		a.dec8(field(&r.sp));
+		a.alu32(Asm::or_, rax, 0x100);
+		a.mov32(r8, ra);
+		write_at(u, false);
+		break;
+	case Kind::pla:
+		a.inc8(field(&r.sp));
+		a.movzx8(rax, field(&r.sp));
+		a.alu32(Asm::or_, rax, 0x100);
+		read_at();
+		a.mov32(ra, rax);
+		nz(ra);
+		break;
+	case Kind::bcc: case Kind::bcs: case Kind::beq: case Kind::bne:
+	case Kind::bmi: case Kind::bpl: case Kind::bvc: case Kind::bvs: {
+		static const std::pair<Kind, bool> when[] = {
+			{ Kind::bcc, false }, { Kind::bcs, true }, { Kind::beq, true }, { Kind::bne, false },
+			{ Kind::bmi, true }, { Kind::bpl, false }, { Kind::bvc, false }, { Kind::bvs, true },
+		};
+		const uint8_t *f[] = { &r.carry, &r.carry, &r.zero, &r.zero, &r.neg, &r.neg, &r.of, &r.of };
+		unsigned i = (unsigned)k - (unsigned)Kind::bcc;
+		Asm::Label taken = a.label();
+
+		a.cmp8(flag(*f[i]), 0);
+		a.j(when[i].second ? cnz : cz, taken);
+		exit(u.next, pending);
+
+		a.bind(taken);
+		unsigned cycles = pending + 1 + ((u.arg ^ u.next) >> 8 != 0);
+
+		if (u.arg == blk.start)
+			loop(cycles);
+		else
+			exit(u.arg, cycles);
+
+		pending = 0;
+		return true;
+	}
+	case Kind::jmp:
+		if (u.arg == blk.start)
+			loop(pending);
+		else
+			exit(u.arg, pending);
+
+		pending = 0;
+		return true;
+	default:
+		return false;
+	}
+
+	if (last) {
+		exit(u.next, pending);
+		pending = 0;
+	} else {
+		yielded(u, pending);
+	}
+
+	return true;
+}
+
+std::vector<uint8_t> Compiler::run() {
+	body = a.label();
+	epilogue = a.label();
+
+	// keep the stack 16 byte aligned for calls. the free slot is used as scratch and the yield flag
+	for (Reg r : { rbx, rbp, r12, r13, r14, r15 })
+		a.push(r);
+
+	a.rr({ 0x83 }, 5, rsp, true);
+	a.b(8);
+	a.store8(Mem(rsp, 4), 0);
+
+	a.mov64(rcpu, rdi);
+	a.mov64(rend, rsi);
+	reload();
+
+	a.bind(body);
+	pending = 0;
+
+	for (size_t i = 0; i < blk.ops.size(); ++i) {
+		const MicroOp &u = blk.ops[i];
+		bool last = i + 1 == blk.ops.size();
+
+		if (!native(u, last))
+			interp(u, last);
+	}
+
+	for (const Stub &s : stubs) {
+		a.bind(s.l);
+		exit(s.pc, s.cycles);
+	}
+
+	a.bind(epilogue);
+	a.store64(field(&c.cycles), rcycles);
+	a.store8(field(&c.r.acc), ra);
+	a.store8(field(&c.r.x), rx);
+	a.store8(field(&c.r.y), ry);
+	a.rr({ 0x83 }, 0, rsp, true);
+	a.b(8);
+
+	for (Reg r : { r15, r14, r13, r12, rbp, rbx })
+		a.pop(r);
+
+	a.ret();
+	a.link();
+	return a.buf;
+}
+
+}
+
+Block::Native Jit::compile(const Block &b) {
+	if (!code || full())
+		return nullptr;
+
+	std::vector<uint8_t> bin(Compiler(c, b, map, c.blocks.code_map()).run());
+
+	if (used + bin.size() > size)
+		return nullptr;
+
+	// only the pages that are written become writable
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t lo = used / page * page, hi = (used + bin.size() + page - 1) / page * page;
+
+	if (mprotect(code + lo, hi - lo, PROT_READ | PROT_WRITE))
+		return nullptr;
+
+	uint8_t *p = code + used;
+	memcpy(p, bin.data(), bin.size());
+
+	if (mprotect(code + lo, hi - lo, PROT_READ | PROT_EXEC))
+		return nullptr;
+
+	// keep entries 16 byte aligned
+	used = (used + bin.size() + 15) & ~(size_t)15;
+	return (Block::Native)(void*)p;
+}
+
+#else
+
+Jit::Jit(CPU &c) : c(c), code(nullptr), size(0), used(0), stale(false), map() {}
+Jit::~Jit() {}
+void Jit::collect() { stale = false; }
+Block::Native Jit::compile(const Block&) { return nullptr; }
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "cpu.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+
+/*
+ * Translates hot blocks to x86-64 code. A, X, Y and the cycle counter stay in
+ * host registers while a block runs, flags are kept in the MOS6510 bytes.
+ * Memory on pages that the bus reports as direct is accessed in place, other
+ * pages go through the bus, and writes to pages with cached code go through
+ * CPU::write so the cache is invalidated. In place writes mark CPU::dirty.
+ * Before a bus access CPU::cycles is brought up to date, so I/O devices see
+ * the same clock as with the interpreter. Compiled code leaves as soon as its
+ * own block may have been dropped or CPU::yield() was called.
+ *
+ * Instructions without a native translation, such as the undocumented ones,
+ * decimal mode arithmetic or instructions on I/O pages, call the interpreter
+ * handler of the block's micro-op from the compiled code, so every block can
+ * be compiled and results always match the interpreter.
+ *
+ * Only available on x86-64 with the System V calling convention. Elsewhere
+ * compile() always fails and CPU::Dispatch::jit runs like blocks.
+ */
+class Jit final {
+	CPU &c;
+	uint8_t *code;
+	size_t size, used;
+	bool stale;
+	std::array<uint8_t*, 256> map; // direct pages
+public:
+	/** Block entries before it is compiled. */
+	static constexpr unsigned threshold = 16;
+
+	explicit Jit(CPU &c);
+	~Jit();
+
+	Jit(const Jit&) = delete;
+	Jit &operator=(const Jit&) = delete;
+
+	/** Compile block. Returns nullptr if not supported or out of space. */
+	Block::Native compile(const Block &b);
+	/** Whether the code buffer has no room left. */
+	bool full() const noexcept { return code && used + 64 * 1024 > size; }
+
+	/**
+	 * Forget all compiled code. Only marks the code as stale, because this
+	 * can be called from compiled code through a bus write.
+	 */
+	void retire() noexcept { stale = true; }
+	/** Reuse code buffer and read direct pages again after retire(). Must not be called from compiled code. */
+	void collect();
+
+	// called from compiled code
+	static unsigned read(CPU *c, unsigned addr); // bit 8 set if the CPU has to yield
+	static bool write(CPU *c, unsigned addr, unsigned v);
+	static bool rmw(CPU *c, unsigned addr, unsigned v, unsigned old);
+	static bool interp(CPU *c, const MicroOp *u);
+};
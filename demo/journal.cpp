@@ -0,0 +1,192 @@
+#include "journal.hpp"
+#include "c64.hpp"
+#include "cpu.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static size_t pow2(size_t n) {
+	size_t v = 16;
+
+	while (v < n)
+		v <<= 1;
+
+	return v;
+}
+
+Journal::Journal(size_t pages, size_t checkpoints)
+	: saved(pow2(pages)), mask(saved.size() - 1), save_begin(0), save_end(0), seen(), gen(1), marks(), max_marks(checkpoints ? checkpoints : 1), machine(nullptr), mem(nullptr), states() {}
+
+Journal::Journal(Machine &machine, size_t pages, size_t checkpoints)
+	: saved(pow2(pages)), mask(saved.size() - 1), save_begin(0), save_end(0), seen(), gen(1), marks(), max_marks(checkpoints ? checkpoints : 1), machine(&machine), mem(machine.bus.ram.data()), states(max_marks) {}
+
+// out of line, where MachineState is complete
+Journal::~Journal() {}
+
+void Journal::overflow() {
+	++save_begin;
+
+	// these need the dropped page to go back
+	while (!marks.empty() && marks.front().saved < save_begin)
+		marks.pop_front();
+}
+
+// start saving every page again
+void Journal::next() {
+	if (++gen)
+		return;
+
+	std::fill(seen.begin(), seen.end(), 0);
+	gen = 1;
+}
+
+void Journal::save(uint8_t page, const uint8_t *direct, Bus &bus) {
+	if (save_end - save_begin > mask)
+		overflow();
+
+	Saved &s = saved[save_end++ & mask];
+	// on a machine, direct pages include colour RAM, which is not what is undone
+	const uint8_t *src = mem ? mem + (page << 8) : direct;
+
+	s.page = page;
+	seen[page] = gen;
+
+	if (src)
+		memcpy(s.old.data(), src, s.old.size());
+	else
+		for (unsigned i = 0; i < s.old.size(); ++i)
+			s.old[i] = bus.peek(page << 8 | i);
+}
+
+void Journal::mark(const CPU &cpu, bool irq) {
+	if (marks.size() == max_marks)
+		marks.pop_front();
+
+	// checkpoints are contiguous in states, so the one after the newest is free
+	size_t slot = marks.empty() ? 0 : (marks.back().slot + 1) % max_marks;
+
+	if (machine)
+		states[slot] = machine->state();
+
+	marks.push_back(Checkpoint{ cpu.r, cpu.jammed, irq, cpu.cycles, save_end, slot });
+	next();
+}
+
+void Journal::restore(CPU &cpu, const Checkpoint &c) {
+	while (save_end > c.saved) {
+		const Saved &s = saved[--save_end & mask];
+		uint8_t *dst = mem ? mem + (s.page << 8) : cpu.bus->direct(s.page);
+
+		if (dst)
+			memcpy(dst, s.old.data(), s.old.size());
+		else
+			for (unsigned i = 0; i < s.old.size(); ++i)
+				cpu.bus->write(s.page << 8 | i, s.old[i]);
+
+		cpu.changed(s.page);
+	}
+
+	cpu.r = c.r;
+	cpu.cycles = c.cycles;
+	cpu.jammed = c.jammed;
+
+	if (machine)
+		machine->restore(states[c.slot]);
+
+	// executing forward on a machine checkpoints interrupts again
+	drop_after(c.cycles + 1);
+	next();
+}
+
+void Journal::drop_after(uint64_t cycles) {
+	while (!marks.empty() && marks.back().cycles >= cycles)
+		marks.pop_back();
+}
+
+unsigned Journal::step(CPU &cpu) {
+	return machine ? machine->step() : cpu.step();
+}
+
+bool Journal::back(CPU &cpu) {
+	uint64_t target = cpu.cycles;
+
+	drop_after(target);
+
+	if (marks.empty())
+		return false;
+
+	const Checkpoint c = marks.back();
+
+	restore(cpu, c);
+
+	if (c.irq)
+		return true;
+
+	// count the instructions up to now, then run one less
+	unsigned n = 0;
+
+	for (; cpu.cycles < target && !cpu.jammed; ++n)
+		step(cpu);
+
+	restore(cpu, c);
+
+	for (; n > 1; --n)
+		step(cpu);
+
+	return true;
+}
+
+bool Journal::back_to(CPU &cpu, uint16_t addr) {
+	uint64_t target = cpu.cycles;
+
+	for (;;) {
+		drop_after(target);
+
+		if (marks.empty())
+			return false;
+
+		const Checkpoint c = marks.back();
+		uint64_t hit = UINT64_MAX;
+
+		restore(cpu, c);
+
+		if (c.irq) {
+			if (cpu.r.pc == addr)
+				hit = c.cycles;
+		} else {
+			// the last hit in this interval is the one closest to target
+			while (cpu.cycles < target && !cpu.jammed) {
+				if (cpu.r.pc == addr)
+					hit = cpu.cycles;
+
+				step(cpu);
+			}
+		}
+
+		restore(cpu, c);
+
+		if (hit != UINT64_MAX) {
+			while (cpu.cycles < hit)
+				step(cpu);
+
+			return true;
+		}
+
+		target = c.cycles;
+	}
+}
+
+void Journal::clear() noexcept {
+	save_begin = save_end = 0;
+	std::fill(seen.begin(), seen.end(), 0);
+	gen = 1;
+	marks.clear();
+}
+
+size_t Journal::bytes() const noexcept {
+	return (save_end - save_begin) * sizeof(Saved) + marks.size() * (sizeof(Checkpoint) + (machine ? sizeof(MachineState) : 0));
+}
+
+uint64_t Journal::depth(const CPU &cpu) const noexcept {
+	return marks.empty() ? 0 : cpu.cycles - marks.front().cycles;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "mos6510.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <deque>
+#include <vector>
+
+class Bus;
+class CPU;
+class Machine;
+class MachineState;
+
+/*
+ * Undo journal for reverse debugging. While attached to CPU::journal, a page
+ * is copied into a ring buffer before its first write since the last
+ * checkpoint, and run() takes a checkpoint of the registers every interval
+ * cycles and around interrupts. A table of the checkpoint each page was last
+ * copied in skips every later write to it, so most writes only cost a byte
+ * compare and recording costs a few percent even for code that fills memory.
+ * Code that writes a byte here and there on many pages uses more buffer
+ * than it would with single bytes, but far fewer copies.
+ *
+ * Going back puts back the pages down to the last checkpoint before the
+ * target and executes forward from there. The CPU is deterministic on a
+ * plain RAM bus, so this ends in exactly the state it was in. When the page
+ * buffer is full, the oldest pages are dropped together with the checkpoints
+ * that need them.
+ *
+ * On a Machine, pages are copied from and back into C64Bus::ram whatever is
+ * banked in, checkpoints also save the port, colour RAM and chips, and
+ * executing forward goes through Machine::step(), so events and interrupts
+ * happen again as they did.
+ */
+class Journal final {
+public:
+	/** Cycles between checkpoints. */
+	static constexpr unsigned interval = 1000;
+
+	/** Page as it was before its first write since a checkpoint. */
+	class Saved final {
+	public:
+		uint8_t page;
+		std::array<uint8_t, 256> old;
+	};
+
+	class Checkpoint final {
+	public:
+		MOS6510 r;
+		bool jammed;
+		/** Taken right before an interrupt, the next one right after it. */
+		bool irq;
+		uint64_t cycles;
+		uint64_t saved; // save_end when taken
+		size_t slot; // in states
+	};
+private:
+	std::vector<Saved> saved;
+	uint64_t mask;
+	// ring positions, both only ever grow and are masked on access
+	uint64_t save_begin, save_end;
+	std::array<uint8_t, 256> seen; // gen for every page copied since the last checkpoint
+	uint8_t gen;
+	std::deque<Checkpoint> marks; // oldest first
+	size_t max_marks;
+	Machine *machine; // nullptr for a CPU on another bus
+	uint8_t *mem; // RAM of machine
+	std::vector<MachineState> states; // one per checkpoint when on a machine
+
+	void overflow();
+	void next();
+	void restore(CPU &cpu, const Checkpoint &c);
+	void drop_after(uint64_t cycles);
+	unsigned step(CPU &cpu);
+public:
+	/** Room for \a pages copied pages, rounded up to a power of two, and \a checkpoints checkpoints. */
+	explicit Journal(size_t pages=1 << 14, size_t checkpoints=4096);
+	/** Journal of the CPU of \a machine, which undoes the chips as well. */
+	explicit Journal(Machine &machine, size_t pages=1 << 14, size_t checkpoints=4096);
+	Journal(const Journal&) = delete;
+	~Journal();
+
+	// called by CPU
+	/**
+	 * Whether a write to \a page must save it first. Going back only ever
+	 * needs the oldest contents since the last checkpoint, so every page is
+	 * saved once per checkpoint.
+	 */
+	bool wants(uint8_t page) const noexcept { return seen[page] != gen; }
+	/** Save \a page, which is \a direct if not nullptr, else read through \a bus. */
+	void save(uint8_t page, const uint8_t *direct, Bus &bus);
+
+	void mark(const CPU &cpu, bool irq=false);
+
+	/** Undo last instruction or interrupt. Returns false if there is nothing to undo. */
+	bool back(CPU &cpu);
+	/**
+	 * Go back to the last time the PC was \a addr, before the current
+	 * instruction. Returns false and stops at the oldest state if it was not.
+	 */
+	bool back_to(CPU &cpu, uint16_t addr);
+	void clear() noexcept;
+
+	/** Cycles that can be undone. */
+	uint64_t depth(const CPU &cpu) const noexcept;
+	/** Bytes used by saved pages and checkpoints. */
+	size_t bytes() const noexcept;
+};
@@ -0,0 +1,416 @@
+#include "library.hpp"
+#include "hash.hpp"
+#include "prg.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+static constexpr const char *index_magic = "c64mon library 1";
+
+void LibIndex::build() {
+	names.clear();
+	name_pos.clear();
+	name_pos.reserve(files.size());
+
+	for (const LibEntry &e : files) {
+		std::string name(fs::path(e.path).filename().string());
+		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+		name_pos.emplace_back(names.size());
+		names += name;
+		names += '\n';
+	}
+
+	by_hash.resize(files.size());
+	by_addr.resize(files.size());
+
+	for (uint32_t i = 0; i < files.size(); ++i)
+		by_hash[i] = by_addr[i] = i;
+
+	std::sort(by_hash.begin(), by_hash.end(), [this](uint32_t a, uint32_t b) { return files[a].hash < files[b].hash; });
+	std::stable_sort(by_addr.begin(), by_addr.end(), [this](uint32_t a, uint32_t b) { return files[a].load_address < files[b].load_address; });
+}
+
+std::vector<uint32_t> LibIndex::find_name(const std::string &text, size_t max) const {
+	std::string key(text);
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+	std::vector<uint32_t> found;
+
+	// names are separated by newlines, so a match never spans two names
+	if (key.find('\n') != std::string::npos)
+		return found;
+
+	// one search over all names is much faster than one search per name
+	std::boyer_moore_horspool_searcher search(key.begin(), key.end());
+
+	for (auto it = names.cbegin(); found.size() < max && (it = std::search(it, names.cend(), search)) != names.cend();) {
+		uint32_t i = std::upper_bound(name_pos.begin(), name_pos.end(), it - names.cbegin()) - name_pos.begin() - 1;
+
+		found.emplace_back(i);
+
+		// continue after this name
+		it = names.cbegin() + (i + 1 < name_pos.size() ? name_pos[i + 1] : names.size());
+	}
+
+	return found;
+}
+
+std::vector<uint32_t> LibIndex::find_hash(uint64_t hash) const {
+	auto lo = std::partition_point(by_hash.begin(), by_hash.end(), [&](uint32_t i) { return files[i].hash < hash; });
+	auto hi = std::partition_point(lo, by_hash.end(), [&](uint32_t i) { return files[i].hash == hash; });
+
+	return std::vector<uint32_t>(lo, hi);
+}
+
+std::vector<uint32_t> LibIndex::find_address(uint16_t addr) const {
+	auto lo = std::partition_point(by_addr.begin(), by_addr.end(), [&](uint32_t i) { return files[i].load_address < addr; });
+	auto hi = std::partition_point(lo, by_addr.end(), [&](uint32_t i) { return files[i].load_address == addr; });
+
+	return std::vector<uint32_t>(lo, hi);
+}
+
+Library::Library(const std::string &index_path) : index_path(index_path), root_dirs(), m(), saving(), idx(std::make_shared<LibIndex>()), last(), err(), scanning(false), stop(false), t() {
+	try {
+		load();
+	} catch (const std::runtime_error &e) {
+		err = e.what();
+	}
+}
+
+Library::~Library() {
+	stop = true;
+
+	if (t.joinable())
+		t.join();
+}
+
+void Library::load() {
+	std::ifstream in(index_path);
+
+	// no index yet
+	if (!in)
+		return;
+
+	std::string line;
+
+	if (!std::getline(in, line) || line != index_magic)
+		throw std::runtime_error(std::string("library: bad index \"") + index_path + "\"");
+
+	std::shared_ptr<LibIndex> index(std::make_shared<LibIndex>());
+
+	while (std::getline(in, line)) {
+		if (!line.compare(0, 5, "root\t")) {
+			root_dirs.emplace_back(line.substr(5));
+			continue;
+		}
+
+		LibEntry e;
+		unsigned size, addr;
+		long long mtime;
+		unsigned long long hash;
+		int n;
+
+		if (sscanf(line.c_str(), "file\t%lld\t%u\t%x\t%llx\t%n", &mtime, &size, &addr, &hash, &n) != 4)
+			throw std::runtime_error(std::string("library: bad line in \"") + index_path + "\": " + line);
+
+		e.path = line.substr(n);
+		e.size = size;
+		e.load_address = addr;
+		e.hash = hash;
+		e.mtime = mtime;
+
+		index->files.emplace_back(std::move(e));
+	}
+
+	std::sort(index->files.begin(), index->files.end(), [](const LibEntry &a, const LibEntry &b) { return a.path < b.path; });
+	index->build();
+	idx = index;
+}
+
+void Library::save(const LibIndex &index, const std::vector<std::string> &roots) {
+	std::string tmp(index_path + ".tmp");
+	FILE *f = fopen(tmp.c_str(), "w");
+
+	if (!f)
+		throw std::runtime_error(std::string("library: cannot write \"") + tmp + "\"");
+
+	fprintf(f, "%s\n", index_magic);
+
+	for (const std::string &r : roots)
+		fprintf(f, "root\t%s\n", r.c_str());
+
+	for (const LibEntry &e : index.files)
+		fprintf(f, "file\t%lld\t%u\t%04X\t%016llX\t%s\n", (long long)e.mtime, (unsigned)e.size, e.load_address, (unsigned long long)e.hash, e.path.c_str());
+
+	bool bad = ferror(f) != 0;
+
+	if (fclose(f) || bad)
+		throw std::runtime_error(std::string("library: cannot write \"") + tmp + "\"");
+
+	// replace old index in one step, so a crash never leaves half an index
+	std::error_code ec;
+	fs::rename(tmp, index_path, ec);
+
+	if (ec)
+		throw std::runtime_error(std::string("library: cannot replace \"") + index_path + "\": " + ec.message());
+}
+
+// write the index with the current roots. saves take turns, so the last one has the latest of both
+void Library::persist() {
+	std::lock_guard<std::mutex> lk(saving);
+	std::shared_ptr<const LibIndex> index;
+	std::vector<std::string> roots;
+
+	{
+		std::lock_guard<std::mutex> lk2(m);
+		index = idx;
+		roots = root_dirs;
+	}
+
+	save(*index, roots);
+}
+
+std::vector<std::string> Library::roots() {
+	std::lock_guard<std::mutex> lk(m);
+	return root_dirs;
+}
+
+void Library::add_root(const std::string &dir) {
+	{
+		std::lock_guard<std::mutex> lk(m);
+
+		if (std::find(root_dirs.begin(), root_dirs.end(), dir) != root_dirs.end())
+			return;
+
+		root_dirs.emplace_back(dir);
+	}
+
+	try {
+		persist();
+	} catch (const std::runtime_error &e) {
+		std::lock_guard<std::mutex> lk(m);
+		err = e.what();
+	}
+}
+
+void Library::remove_root(size_t i) {
+	{
+		std::lock_guard<std::mutex> lk(m);
+
+		if (i >= root_dirs.size())
+			return;
+
+		root_dirs.erase(root_dirs.begin() + i);
+	}
+
+	try {
+		persist();
+	} catch (const std::runtime_error &e) {
+		std::lock_guard<std::mutex> lk(m);
+		err = e.what();
+	}
+}
+
+void Library::rescan() {
+	if (scanning)
+		return;
+
+	if (t.joinable())
+		t.join();
+
+	std::lock_guard<std::mutex> lk(m);
+
+	scanning = true;
+	t = std::thread(&Library::scan, this, root_dirs, idx);
+}
+
+std::shared_ptr<const LibIndex> Library::index() {
+	std::lock_guard<std::mutex> lk(m);
+	return idx;
+}
+
+Library::ScanStats Library::stats() {
+	std::lock_guard<std::mutex> lk(m);
+	return last;
+}
+
+std::string Library::error() {
+	std::lock_guard<std::mutex> lk(m);
+	return err;
+}
+
+static bool is_prg(const fs::path &p) {
+	std::string ext(p.extension().string());
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext == ".prg";
+}
+
+// read file and fill in load address and hash. returns false if it is not a valid PRG
+static bool hash_file(LibEntry &e, std::vector<uint8_t> &buf) {
+	if (e.size < PRG::min_prg_size || e.size > PRG::max_prg_size)
+		return false;
+
+	std::ifstream in(e.path, std::ios::binary);
+	buf.resize(e.size);
+
+	if (!in || !in.read((char*)buf.data(), buf.size()))
+		return false;
+
+	e.load_address = buf[0] | (buf[1] << 8);
+	e.hash = xxh64(buf.data(), buf.size());
+	return true;
+}
+
+void Library::scan(std::vector<std::string> roots, std::shared_ptr<const LibIndex> old) {
+	auto start = std::chrono::steady_clock::now();
+	std::shared_ptr<LibIndex> index(std::make_shared<LibIndex>());
+	std::string error;
+
+	std::unordered_map<std::string, const LibEntry*> known;
+
+	for (const LibEntry &e : old->files)
+		known.emplace(e.path, &e);
+
+	/*
+	 * Directories still to walk, shared by all threads. A thread lists one
+	 * directory at a time, queues its subdirectories and hashes the files
+	 * that are new or changed since the last scan right away.
+	 */
+	std::mutex qm;
+	std::condition_variable qcv;
+	std::deque<fs::path> dirs(roots.begin(), roots.end());
+	unsigned walking = 0; // threads listing a directory, which may queue more
+	std::atomic<size_t> hashed(0);
+
+	unsigned n = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::vector<LibEntry>> found(n);
+
+	auto worker = [&](unsigned id) {
+		std::vector<uint8_t> buf;
+		std::unique_lock<std::mutex> lk(qm);
+
+		for (;;) {
+			qcv.wait(lk, [&]() { return stop || !dirs.empty() || !walking; });
+
+			// nothing queued and nobody to queue more
+			if (stop || dirs.empty())
+				break;
+
+			fs::path dir(std::move(dirs.front()));
+			std::vector<fs::path> sub;
+			std::error_code ec;
+
+			dirs.pop_front();
+			++walking;
+			lk.unlock();
+
+			for (fs::directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end; !ec && it != end && !stop; it.increment(ec)) {
+				// errors on single files must not stop the directory walk
+				std::error_code fe;
+
+				// links to directories are not followed, they could make a loop
+				if (it->is_directory(fe) && !it->is_symlink(fe)) {
+					sub.emplace_back(it->path());
+					continue;
+				}
+
+				if (!it->is_regular_file(fe) || !is_prg(it->path()))
+					continue;
+
+				LibEntry e;
+				e.path = it->path().string();
+				e.size = it->file_size(fe);
+				e.mtime = it->last_write_time(fe).time_since_epoch().count();
+				e.load_address = 0;
+				e.hash = 0;
+
+				if (fe)
+					continue;
+
+				auto k = known.find(e.path);
+
+				if (k != known.end() && k->second->size == e.size && k->second->mtime == e.mtime) {
+					found[id].emplace_back(*k->second);
+				} else {
+					++hashed;
+
+					if (hash_file(e, buf))
+						found[id].emplace_back(std::move(e));
+				}
+			}
+
+			lk.lock();
+			--walking;
+
+			if (ec && error.empty())
+				error = std::string("library: cannot scan \"") + dir.string() + "\": " + ec.message();
+
+			for (fs::path &p : sub)
+				dirs.emplace_back(std::move(p));
+
+			qcv.notify_all();
+		}
+
+		// the others wait for this one to be done
+		qcv.notify_all();
+	};
+
+	std::vector<std::thread> pool;
+
+	for (unsigned i = 1; i < n; ++i)
+		pool.emplace_back(worker, i);
+
+	worker(0);
+
+	for (std::thread &th : pool)
+		th.join();
+
+	if (stop) {
+		scanning = false;
+		return;
+	}
+
+	for (std::vector<LibEntry> &files : found)
+		for (LibEntry &e : files)
+			index->files.emplace_back(std::move(e));
+
+	std::sort(index->files.begin(), index->files.end(), [](const LibEntry &a, const LibEntry &b) { return a.path < b.path; });
+
+	// same file can be found through overlapping roots
+	index->files.erase(std::unique(index->files.begin(), index->files.end(), [](const LibEntry &a, const LibEntry &b) { return a.path == b.path; }), index->files.end());
+	index->build();
+
+	{
+		std::lock_guard<std::mutex> lk(m);
+
+		idx = index;
+		last.files = index->files.size();
+		last.hashed = hashed;
+		last.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		err = error;
+	}
+
+	// with the roots as they are now, they may have changed while scanning
+	try {
+		persist();
+	} catch (const std::runtime_error &e) {
+		std::lock_guard<std::mutex> lk(m);
+
+		if (err.empty())
+			err = e.what();
+	}
+
+	scanning = false;
+}
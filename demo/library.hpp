@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** PRG file known to the library. */
+class LibEntry final {
+public:
+	std::string path;
+	uint32_t size;
+	uint16_t load_address;
+	uint64_t hash; // xxh64 of whole file
+	int64_t mtime;
+};
+
+/*
+ * Immutable snapshot of the library with search tables. A new snapshot is
+ * built by every scan, so searching never has to lock anything.
+ */
+class LibIndex final {
+	std::string names; // lower case file names, each followed by '\n'
+	std::vector<uint32_t> name_pos;
+	std::vector<uint32_t> by_hash, by_addr;
+public:
+	std::vector<LibEntry> files; // sorted by path
+
+	/** Rebuild search tables after changing files. */
+	void build();
+
+	/** Files whose name contains \a text, ignoring case. At most \a max results. */
+	std::vector<uint32_t> find_name(const std::string &text, size_t max=1000) const;
+	std::vector<uint32_t> find_hash(uint64_t hash) const;
+	std::vector<uint32_t> find_address(uint16_t addr) const;
+};
+
+/*
+ * Index of all PRG files below a set of root directories. The index is kept
+ * in a text file and updated by rescan(), which only reads files whose size
+ * or modification time changed. Directories are walked and files hashed on
+ * all cores. Adding or removing a root writes the index right away.
+ */
+class Library final {
+public:
+	class ScanStats final {
+	public:
+		size_t files, hashed;
+		double ms;
+	};
+private:
+	std::string index_path;
+	std::vector<std::string> root_dirs;
+	std::mutex m;
+	std::mutex saving; // held while the index file is written
+	std::shared_ptr<const LibIndex> idx;
+	ScanStats last;
+	std::string err;
+	std::atomic<bool> scanning, stop;
+	std::thread t;
+
+	void scan(std::vector<std::string> roots, std::shared_ptr<const LibIndex> old);
+	void load();
+	void save(const LibIndex &index, const std::vector<std::string> &roots);
+	void persist();
+public:
+	explicit Library(const std::string &index_path);
+	Library(const Library&) = delete;
+	~Library();
+
+	std::vector<std::string> roots();
+	void add_root(const std::string &dir);
+	void remove_root(size_t i);
+
+	/** Start scanning all roots in the background. Does nothing if a scan is running. */
+	void rescan();
+	bool busy() const noexcept { return scanning; }
+
+	std::shared_ptr<const LibIndex> index();
+	ScanStats stats();
+	std::string error();
+};
@@ -0,0 +1,159 @@
+#include "loader.hpp"
+
+#include <chrono>
+
+PrgLoader::PrgLoader() : m(), cv(), jobs(), done(), watched(), running(true), loading(false), t() {
+	t = std::thread(&PrgLoader::main, this);
+}
+
+PrgLoader::~PrgLoader() {
+	{
+		std::lock_guard<std::mutex> lk(m);
+		running = false;
+	}
+
+	cv.notify_one();
+	t.join();
+}
+
+void PrgLoader::load(const std::string &path, const std::shared_ptr<NetWorker> &net, bool skip_unchanged) {
+	{
+		std::lock_guard<std::mutex> lk(m);
+		jobs.emplace_back(Job{ path, net, skip_unchanged, false, false, false });
+	}
+
+	cv.notify_one();
+}
+
+void PrgLoader::open(const std::string &path) {
+	{
+		std::lock_guard<std::mutex> lk(m);
+		jobs.emplace_back(Job{ path, nullptr, false, false, true, false });
+	}
+
+	cv.notify_one();
+}
+
+void PrgLoader::load_program(const std::string &path) {
+	{
+		std::lock_guard<std::mutex> lk(m);
+		jobs.emplace_back(Job{ path, nullptr, false, false, false, true });
+	}
+
+	cv.notify_one();
+}
+
+bool PrgLoader::poll(Result &r) {
+	std::lock_guard<std::mutex> lk(m);
+
+	if (done.empty())
+		return false;
+
+	r = std::move(done.front());
+	done.pop_front();
+	return true;
+}
+
+bool PrgLoader::busy() {
+	std::lock_guard<std::mutex> lk(m);
+	return loading || !jobs.empty();
+}
+
+void PrgLoader::publish(std::unique_ptr<Result> &&r) {
+	std::lock_guard<std::mutex> lk(m);
+
+	if (r->err.empty() && !r->box && !r->program)
+		watched = r->prg;
+	else if (r->watch)
+		watched = PRG();
+
+	// only a newer reload replaces one the UI has not taken, a user's load is always seen
+	if (r->watch && !done.empty() && done.back().watch)
+		done.back() = std::move(*r);
+	else
+		done.emplace_back(std::move(*r));
+
+	loading = false;
+}
+
+void PrgLoader::main() {
+	std::unique_lock<std::mutex> lk(m);
+	// identity of a change seen on the last poll, reloaded once it holds still
+	bool pending = false;
+	uintmax_t pend_size = 0;
+	int64_t pend_time = 0;
+
+	while (running) {
+		if (jobs.empty()) {
+			if (cv.wait_for(lk, std::chrono::milliseconds(watch_ms)) == std::cv_status::no_timeout || !running || !jobs.empty())
+				continue;
+
+			// stat file without holding the lock, network file systems can be slow
+			PRG w(watched);
+			lk.unlock();
+
+			uintmax_t size;
+			int64_t time;
+			bool changed = w.is_valid() && w.changed_on_disk(size, time);
+
+			lk.lock();
+
+			if (!changed || !jobs.empty()) {
+				pending = false;
+				continue;
+			}
+
+			// a build tool may still be writing, wait for one poll without change
+			if (!pending || size != pend_size || time != pend_time) {
+				pending = true;
+				pend_size = size;
+				pend_time = time;
+				continue;
+			}
+
+			jobs.emplace_back(Job{ w.path, nullptr, false, true, false, false });
+		}
+
+		Job job(std::move(jobs.front()));
+		jobs.pop_front();
+		loading = true;
+		pending = false;
+		lk.unlock();
+
+		std::unique_ptr<Result> r(new Result());
+		r->watch = job.watch;
+
+		try {
+			if (job.program) {
+				r->program.reset(new Program());
+				r->program->load(job.path);
+				publish(std::move(r));
+				lk.lock();
+				continue;
+			}
+
+			// only the directory of an image is read, files are decoded when picked
+			if (job.open && (r->box = Container::open(job.path))) {
+				publish(std::move(r));
+				lk.lock();
+				continue;
+			}
+
+			Container::load(r->prg, job.path);
+
+			if (!r->prg.is_valid())
+				throw std::runtime_error(std::string("prg: bad size for \"") + job.path + "\": " + std::to_string(r->prg.data.size()) + " bytes");
+
+			if (job.net && job.net->ok()) {
+				r->uploaded = job.net->deploy(r->prg.data, r->prg.hash, job.skip_unchanged);
+				r->started = true;
+			}
+		} catch (const std::runtime_error &e) {
+			r->err = e.what();
+			r->prg.path = job.path;
+		}
+
+		publish(std::move(r));
+		lk.lock();
+	}
+}
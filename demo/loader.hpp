@@ -0,0 +1,96 @@
+#pragma once
+
+#include "container.hpp"
+#include "prg.hpp"
+#include "program.hpp"
+#include "worker.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * Loads PRG files on a background thread, so a slow file system never
+ * stalls the UI. Finished loads are handed to the UI with poll(), which the
+ * UI calls once per frame to swap in the new PRG. If a load is requested
+ * with a device connection, the PRG is sent to the device from the loader
+ * thread as soon as it is loaded and validated. Program segment files are
+ * read on the same thread. Results are handed out in the order their loads
+ * finished, so one kind never hides another the UI has not taken yet.
+ *
+ * While idle, the loader also watches the last loaded file and reloads it
+ * when it changes on disk and then holds still for one more check, so a
+ * file that is still being written is not picked up half done. The UI never
+ * has to stat the file itself. A reload that fails, for example because the
+ * file was deleted, stops the watch until the next successful load. The
+ * watch is an addition to background loading that editing with an external
+ * assembler needed, not part of it.
+ */
+class PrgLoader final {
+public:
+	class Result final {
+	public:
+		PRG prg;
+		std::unique_ptr<Container> box; // image opened by open() instead of a PRG
+		std::unique_ptr<Program> program; // set by load_program(), empty if it failed
+		std::string err;
+		bool started; // sent to device by loader
+		bool uploaded; // false if device already had this PRG
+		bool watch; // reloaded because file changed on disk
+
+		Result() : prg(), box(), program(), err(), started(false), uploaded(false), watch(false) {}
+	};
+
+	/** How often the watched file is checked for changes. */
+	static constexpr unsigned watch_ms = 250;
+private:
+	class Job final {
+	public:
+		std::string path;
+		std::shared_ptr<NetWorker> net;
+		bool skip_unchanged;
+		bool watch;
+		bool open;
+		bool program;
+	};
+
+	std::mutex m;
+	std::condition_variable cv;
+	std::deque<Job> jobs;
+	std::deque<Result> done;
+	PRG watched;
+	bool running, loading;
+	std::thread t;
+
+	void main();
+	void publish(std::unique_ptr<Result> &&r);
+public:
+	PrgLoader();
+	PrgLoader(const PrgLoader&) = delete;
+	~PrgLoader();
+
+	/**
+	 * Load \a path, which may also refer to a file in a disk or tape image.
+	 * If \a net is not null, start the PRG on that device once it is valid.
+	 * The upload is skipped if \a skip_unchanged is set and the device
+	 * already has the same PRG.
+	 */
+	void load(const std::string &path, const std::shared_ptr<NetWorker> &net=nullptr, bool skip_unchanged=false);
+
+	/**
+	 * Open \a path as disk, tape or cartridge image and read its directory,
+	 * or load it as PRG if it is not an image.
+	 */
+	void open(const std::string &path);
+
+	/** Load program segments from \a path, see Program::load(). */
+	void load_program(const std::string &path);
+
+	/** Take finished load, if any. */
+	bool poll(Result &r);
+
+	bool busy();
+};
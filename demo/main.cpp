@@ -15,11 +15,15 @@
 #include <SDL_opengl.h>
 
 #include "net.hpp"
+#include "worker.hpp"
+#include "proxy.hpp"
+#include "ipc.hpp"
 
 #include <cassert>
 #include <cstdint>
 
 #include <array>
+#include <chrono>
 
 #include <memory>
 #include <optional>
@@ -37,38 +41,16 @@
 
 #include "ui.hpp"
 #include "prg.hpp"
-
-class MOS6510 final {
-public:
-	uint8_t acc;
-	uint8_t y;
-	uint8_t x;
-	uint16_t pc;
-	uint8_t sp;
-
-	unsigned carry : 1;
-	unsigned zero : 1;
-	unsigned no_irq : 1;
-	unsigned dec : 1;
-	unsigned brk : 1;
-	unsigned of : 1;
-	unsigned neg : 1;
-
-	unsigned psw() const noexcept {
-		unsigned v = 0;
-
-		if (carry) v |= 1 << 0;
-		if (zero) v |= 1 << 1;
-		if (no_irq) v |= 1 << 2;
-		if (dec) v |= 1 << 3;
-		if (brk) v |= 1 << 4;
-		v |= (1 << 5);
-		if (of) v |= 1 << 6;
-		if (neg) v |= 1 << 7;
-
-		return v;
-	}
-};
+#include "d64.hpp"
+#include "loader.hpp"
+#include "container.hpp"
+#include "library.hpp"
+#include "program.hpp"
+#include "c64.hpp"
+#include "cpu.hpp"
+#include "raster.hpp"
+#include "render.hpp"
+#include "snapshot.hpp"
 
 class U1541;
 
@@ -101,26 +83,69 @@ class U1541 final {
 	uint16_t poke_addr;
 	uint8_t poke_val;
 	bool autopoke;
-	std::unique_ptr<TcpSocket> sock;
-	std::vector<uint8_t> data;
+	std::shared_ptr<NetWorker> net;
 	char keybuf[6];
 
 	VIC vic;
 	ImGui::FileBrowser fb_prg;
 	PRG prg;
+	PrgLoader loader;
+	std::unique_ptr<Container> box;
+	Library lib;
+	ImGui::FileBrowser fb_libroot;
+	char lib_query[64];
+	std::shared_ptr<const LibIndex> lib_idx;
+	std::vector<uint32_t> lib_hits;
+	double lib_search_ms;
+	ImGui::FileBrowser fb_program;
+	Program program;
+	std::string program_err;
+	unsigned program_gap;
+	char program_gaps[256];
 	MemoryEditor prg_edit;
-	bool prg_view_raw, prg_align16;
+	bool prg_view_raw, prg_align16, prg_skip_unchanged;
+	std::string prg_err;
+	ImGui::FileBrowser fb_seq;
+	std::vector<Timed> seq;
+	std::string seq_path, seq_err;
+	float seq_delay;
+	ImGui::FileBrowser fb_img, fb_imgdir;
+	std::string img_path, img_dir, img_err;
+	DiskType img_type;
+	char cap_path[256];
+	std::string cap_err;
+	std::unique_ptr<IpcServer> ipc;
+	char ipc_path[108];
+	std::string ipc_err;
 public:
-	U1541() : buf_ip("192.168.178.229"), ip_port(64), poke_addr(0xd020), poke_val(0), autopoke(false), sock(), data(), keybuf(), vic(*this), fb_prg(), prg(), prg_edit(), prg_view_raw(true), prg_align16(true) {}
+	U1541() : buf_ip("192.168.178.229"), ip_port(64), poke_addr(0xd020), poke_val(0), autopoke(false), net(), keybuf(), vic(*this), fb_prg(), prg(), loader(), box(), lib("library.idx"), fb_libroot(ImGuiFileBrowserFlags_SelectDirectory), lib_query(), lib_idx(), lib_hits(), lib_search_ms(0), fb_program(), program(), program_err(), program_gap(64), program_gaps(), prg_edit(), prg_view_raw(true), prg_align16(true), prg_skip_unchanged(false), prg_err(), fb_seq(), seq(), seq_path(), seq_err(), seq_delay(100), fb_img(), fb_imgdir(ImGuiFileBrowserFlags_SelectDirectory), img_path(), img_dir(), img_err(), img_type(DiskType::unknown), cap_path("session.cap"), cap_err(), ipc(), ipc_path("/tmp/c64mon.sock"), ipc_err() {
+		fb_img.SetTitle("Disk image");
+		fb_img.SetTypeFilters({ ".d64", ".g64", ".d81" });
+		fb_imgdir.SetTitle("PRG directory");
+		fb_libroot.SetTitle("Library root");
+		fb_program.SetTitle("Program segments");
+		fb_program.SetTypeFilters({ ".hex", ".ihex", ".seg", ".prg" });
+	}
 
 	void show();
 	void show_connected(Frame&);
 
 	void show_prg_control();
+	void poll_prg();
+	void show_container(Frame&);
+	void show_library();
+	void search_library();
+	void show_program();
+	void show_scheduler();
+	void show_disk_control();
+	void show_capture(Frame&);
+	void show_ipc(Frame&);
 
 	void poke(uint16_t addr, uint8_t v);
 	void kbp(const char *str);
 
+	const PRG &current_prg() const noexcept { return prg; }
+
 	void send_prg();
 };
 
@@ -131,19 +156,62 @@ public:
 	void show();
 };
 
+/** What the profiler memory editor shows. */
+class HeatView final {
+public:
+	CPU *cpu;
+	const Profile *profile;
+	uint64_t peak;
+	bool written; // by the memory editor, which the journal cannot undo
+};
+
 class Engine final {
-	MOS6510 mpu;
+	C64Bus bus;
+	CPU cpu;
+	Pipeline pipeline; // draws what machine records while the screen is shown
+	Machine machine;
+	Renderer renderer;
+	std::vector<uint32_t> screen; // RGBA
+	GLuint screen_tex; // created on first use, freed with the GL context
+	Rewind rewind;
+	Journal journal;
+	Profile profile;
+	std::unique_ptr<Trace> trace;
+	Breakpoints breaks;
+	HeatView heat_view;
+	MemoryEditor heat_edit;
 	Net net;
 	U1541 u1541;
 	Dissassembler diss;
 	bool show_diss;
+	bool show_cpu;
+	bool show_profile;
+	bool show_breaks;
+	bool show_screen;
 	bool show_demo_window;
+	bool profiling; // attach profile to cpu
+	Profile::Order hot_by;
+	bool hot_reverse;
+	bool record; // take snapshot after every action in the CPU panel
+	bool undo; // attach journal to cpu
+	uint16_t back_addr;
+	bool tracing;
+	int break_kind;
+	uint16_t break_from, break_to;
+	char break_cond[64];
+	std::string cpu_err, break_err;
 public:
-	Engine() : mpu(), net(), u1541(), diss(), show_diss(false), show_demo_window(false) {}
+	Engine() : bus(), cpu(bus), pipeline(std::max(2u, std::thread::hardware_concurrency()) - 1), machine(bus, cpu), renderer(), screen(render::width * render::height), screen_tex(0), rewind(machine), journal(machine), profile(), trace(), breaks(), heat_view{ &cpu, &profile, 0, false }, heat_edit(), net(), u1541(), diss(), show_diss(false), show_cpu(false), show_profile(false), show_breaks(false), show_screen(false), show_demo_window(false), profiling(false), hot_by(Profile::Order::cycles), hot_reverse(false), record(false), undo(false), back_addr(0), tracing(false), break_kind(0), break_from(0), break_to(0), break_cond(), cpu_err(), break_err() {
+		bus.cpu = &cpu;
+	}
 
 	void display();
 	void show_menubar();
 	void show_mpu();
+	void show_profiler();
+	void show_breakpoints();
+	void show_picture();
+	void restart_journal();
 };
 
 void Engine::show_menubar() {
@@ -165,6 +233,10 @@ void Engine::show_menubar() {
 			auto m2 = mmb.menu("Work in progress widgets");
 			if (m2) {
 				m2->chkbox("Dissassembler", show_diss);
+				m2->chkbox("CPU", show_cpu);
+				m2->chkbox("Profiler", show_profile);
+				m2->chkbox("Breakpoints", show_breaks);
+				m2->chkbox("Screen", show_screen);
 				m2->chkbox("Demo window", show_demo_window);
 			}
 		}
@@ -208,6 +280,32 @@ void Dissassembler::show() {
 
 std::array<std::string, 16> vic_colors{ "black", "white", "red", "cyan", "magenta", "green", "blue", "yellow", "orange", "brown", "purple", "dark gray", "medium gray", "light green", "light blue", "light gray"};
 
+std::array<const char*, 5> cpu_dispatch{ "Table", "Switch", "Threaded", "Blocks", "JIT" };
+
+// from white for cold code to red for the hottest
+static ImVec4 heat_text(float heat) {
+	return ImVec4(1, 1 - heat, 1 - heat, 1);
+}
+
+static ImU8 heat_readfn(const ImU8 *ptr, size_t off) {
+	return ((const HeatView*)ptr)->cpu->bus->peek(off);
+}
+
+static void heat_writefn(ImU8 *ptr, size_t off, ImU8 v) {
+	CPU &cpu = *((HeatView*)ptr)->cpu;
+
+	cpu.bus->write(off, v);
+	cpu.changed(off >> 8);
+	((HeatView*)ptr)->written = true;
+}
+
+static ImU32 heat_bgcolorfn(const ImU8 *ptr, size_t off) {
+	const HeatView &v = *(const HeatView*)ptr;
+	float heat = v.profile->heat(off, v.peak);
+
+	return heat > 0 ? IM_COL32(255, 255 * (1 - heat), 0, 40 + 140 * heat) : 0;
+}
+
 std::array<const char*, 4> vic_banks{ "$0000-$3FFF", "$4000-$7FFF", "$8000-$BFFF", "$C000-$FFFF" };
 
 bool combo_vec(void *data, int idx, const char **out_text) {
@@ -343,26 +441,128 @@ static void prg_writefn(ImU8 *ptr, size_t off, ImU8 v) {
 	if (off < base || off >= base + prg.data.size() - 2)
 		return; // ignore write
 
-	prg.data.at(off - base + 2) = v;
+	prg.set(off - base + 2, v);
+}
+
+// raw and unaligned views also go through PRG, so edits copy the shared bytes first
+static ImU8 prg_raw_readfn(const ImU8 *ptr, size_t off) {
+	return ((const PRG*)ptr)->data.at(off);
+}
+
+static void prg_raw_writefn(ImU8 *ptr, size_t off, ImU8 v) {
+	((PRG*)ptr)->set(off, v);
+}
+
+static ImU8 prg_body_readfn(const ImU8 *ptr, size_t off) {
+	return ((const PRG*)ptr)->data.at(off + 2);
+}
+
+static void prg_body_writefn(ImU8 *ptr, size_t off, ImU8 v) {
+	((PRG*)ptr)->set(off + 2, v);
+}
+
+void U1541::poll_prg() {
+	PrgLoader::Result r;
+
+	// a mapped file that changed may be truncated, so nothing reads it until the watch reloads it
+	if (prg.is_valid() && prg.stale()) {
+		prg.data = Bytes();
+		prg_err = "prg: \"" + prg.path + "\" changed on disk";
+	}
+
+	if (!loader.poll(r))
+		return;
+
+	if (r.box) {
+		box = std::move(r.box);
+		prg_err.clear();
+		return;
+	}
+
+	if (r.program) {
+		if (r.err.empty())
+			program = std::move(*r.program);
+
+		program_err = r.err;
+		return;
+	}
+
+	if (!r.err.empty()) {
+		prg_err = r.err;
+		return;
+	}
+
+	// only follow file changes if the user has not edited the PRG or loaded another one
+	if (r.watch && (prg.path != r.prg.path || !prg.from_file()))
+		return;
+
+	prg = std::move(r.prg);
+	prg_err.clear();
+}
+
+void U1541::show_container(Frame &f) {
+	const std::vector<ContainerEntry> &files = box->entries();
+
+	ImGui::Text("%s image: %s (%u %s)", box->kind(), box->image_path().c_str(), (unsigned)files.size(), files.size() == 1 ? "file" : "files");
+
+	if (ImGui::BeginTable("container", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY, ImVec2(0, 150))) {
+		ImGui::TableSetupColumn("Name");
+		ImGui::TableSetupColumn("Type");
+		ImGui::TableSetupColumn("Size");
+		ImGui::TableHeadersRow();
+
+		for (size_t i = 0; i < files.size(); ++i) {
+			const ContainerEntry &e = files[i];
+
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::PushID((int)i);
+
+			if (ImGui::Selectable(e.name.c_str(), prg.path == box->entry_path(i), ImGuiSelectableFlags_SpanAllColumns))
+				loader.load(box->entry_path(i));
+
+			ImGui::PopID();
+			ImGui::TableNextColumn(); ImGui::TextUnformatted(e.type);
+			ImGui::TableNextColumn(); ImGui::Text("%u", (unsigned)e.size);
+		}
+
+		ImGui::EndTable();
+	}
+
+	if (dynamic_cast<const CrtImage*>(box.get())) {
+		if (f.btn("Run cartridge"))
+			net->push(Command(Command::run_crt, box->image_path()));
+
+		f.sl();
+	}
+
+	if (f.btn("Close image"))
+		box.reset();
 }
 
 void U1541::show_prg_control() {
 	Frame f("PRG control");
 
+	// swap in finished loads at frame boundary, so the editor never sees a partial PRG
+	poll_prg();
+
 	if (!f)
 		return;
 
-	if (prg.is_valid()) {
+	if (loader.busy()) {
+		ImGui::TextUnformatted("Loading...");
+	} else if (prg.is_valid()) {
 		if (f.btn("Reload PRG"))
-			prg.load(prg.path);
+			loader.load(prg.path);
 
 		f.sl();
 
-		if (f.btn("Reload and Start PRG")) {
-			prg.load(prg.path);
-			if (prg.is_valid())
-				send_prg();
-		}
+		// upload is started by loader as soon as the file is read
+		if (f.btn("Reload and Start PRG"))
+			loader.load(prg.path, net, prg_skip_unchanged);
+
+		f.sl();
+		ImGui::Checkbox("Skip upload if unchanged", &prg_skip_unchanged);
 	}
 
 	if (f.btn("Load PRG"))
@@ -371,10 +571,16 @@ void U1541::show_prg_control() {
 	fb_prg.Display();
 
 	if (fb_prg.HasSelected()) {
-		prg.load(fb_prg.GetSelected().string());
+		loader.open(fb_prg.GetSelected().string());
 		fb_prg.ClearSelected();
 	}
 
+	if (box)
+		show_container(f);
+
+	if (!prg_err.empty())
+		ImGui::TextWrapped("%s", prg_err.c_str());
+
 	if (prg.is_valid()) {
 		f.sl();
 
@@ -384,6 +590,7 @@ void U1541::show_prg_control() {
 		unsigned sz = prg.data.size();
 		ImGui::Text("Size   : %u %s ($%X)", sz, sz == 1 ? "byte" : "bytes", sz);
 		ImGui::Text("Load at: $%04X", prg.load_address());
+		ImGui::Text("Hash   : %016llX%s", (unsigned long long)prg.hash, net->is_deployed(prg.hash) ? " (on device)" : "");
 
 		ImGui::Checkbox("Raw PRG view", &prg_view_raw);
 
@@ -395,35 +602,419 @@ void U1541::show_prg_control() {
 		ImGui::TextUnformatted("PRG data:");
 		ImGui::Separator();
 
-		prg_edit.ReadFn = NULL;
-		prg_edit.WriteFn = NULL;
-
 		if (prg_view_raw) {
-			prg_edit.DrawContents(prg.data.data(), prg.data.size());
+			prg_edit.ReadFn = prg_raw_readfn;
+			prg_edit.WriteFn = prg_raw_writefn;
+			prg_edit.DrawContents(&prg, prg.data.size());
 		} else {
 			if (prg_align16) {
 				prg_edit.ReadFn = prg_readfn;
 				prg_edit.WriteFn = prg_writefn;
 				prg_edit.DrawContents(&prg, prg_align16_end(prg), prg_align16_base(prg));
 			} else {
-				prg_edit.DrawContents(prg.data.data() + 2, prg.data.size() - 2, prg.load_address());
+				prg_edit.ReadFn = prg_body_readfn;
+				prg_edit.WriteFn = prg_body_writefn;
+				prg_edit.DrawContents(&prg, prg.data.size() - 2, prg.load_address());
+			}
+		}
+	}
+}
+
+void U1541::search_library() {
+	auto start = std::chrono::steady_clock::now();
+	const char *q = lib_query;
+
+	lib_idx = lib.index();
+
+	// $0801 searches by load address, #hash by content hash and anything else by name
+	if (q[0] == '$')
+		lib_hits = lib_idx->find_address((uint16_t)strtoul(q + 1, NULL, 16));
+	else if (q[0] == '#')
+		lib_hits = lib_idx->find_hash(strtoull(q + 1, NULL, 16));
+	else
+		lib_hits = lib_idx->find_name(q);
+
+	lib_search_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void U1541::show_library() {
+	Frame f("PRG library");
+
+	if (!f)
+		return;
+
+	std::vector<std::string> roots(lib.roots());
+
+	for (size_t i = 0; i < roots.size(); ++i) {
+		ImGui::PushID((int)i);
+
+		if (f.btn("Remove"))
+			lib.remove_root(i);
+
+		f.sl();
+		ImGui::TextUnformatted(roots[i].c_str());
+		ImGui::PopID();
+	}
+
+	if (f.btn("Add root"))
+		fb_libroot.Open();
+
+	fb_libroot.Display();
+
+	if (fb_libroot.HasSelected()) {
+		lib.add_root(fb_libroot.GetSelected().string());
+		fb_libroot.ClearSelected();
+	}
+
+	f.sl();
+
+	if (lib.busy()) {
+		ImGui::TextUnformatted("Scanning...");
+	} else {
+		if (f.btn("Rescan"))
+			lib.rescan();
+
+		Library::ScanStats st(lib.stats());
+
+		if (st.files) {
+			f.sl();
+			ImGui::Text("%u files, %u hashed in %.0f ms", (unsigned)st.files, (unsigned)st.hashed, st.ms);
+		}
+	}
+
+	std::string err(lib.error());
+
+	if (!err.empty())
+		ImGui::TextWrapped("%s", err.c_str());
+
+	// search again when query changes or a scan finished
+	if (ImGui::InputText("Search", lib_query, sizeof lib_query) || lib_idx != lib.index())
+		search_library();
+
+	ImGui::Text("%u of %u files (%.3f ms)", (unsigned)lib_hits.size(), (unsigned)lib_idx->files.size(), lib_search_ms);
+
+	if (ImGui::BeginTable("library", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY, ImVec2(0, 250))) {
+		ImGui::TableSetupColumn("Path");
+		ImGui::TableSetupColumn("Load at");
+		ImGui::TableSetupColumn("Size");
+		ImGui::TableSetupColumn("Hash");
+		ImGui::TableHeadersRow();
+
+		// only draw visible rows, a search may match thousands of files
+		ImGuiListClipper clipper;
+		clipper.Begin((int)lib_hits.size());
+
+		while (clipper.Step()) {
+			for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+				uint32_t i = lib_hits[row];
+				const LibEntry &e = lib_idx->files[i];
+
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::PushID((int)i);
+
+				if (ImGui::Selectable(e.path.c_str(), prg.path == e.path, ImGuiSelectableFlags_SpanAllColumns))
+					loader.open(e.path);
+
+				ImGui::PopID();
+				ImGui::TableNextColumn(); ImGui::Text("$%04X", e.load_address);
+				ImGui::TableNextColumn(); ImGui::Text("%u", (unsigned)e.size);
+				ImGui::TableNextColumn(); ImGui::Text("%016llX", (unsigned long long)e.hash);
+			}
+		}
+
+		ImGui::EndTable();
+	}
+}
+
+void U1541::show_program() {
+	Frame f("Program segments");
+
+	if (!f)
+		return;
+
+	if (f.btn("Load segments"))
+		fb_program.Open();
+
+	fb_program.Display();
+
+	if (fb_program.HasSelected()) {
+		loader.load_program(fb_program.GetSelected().string());
+		fb_program.ClearSelected();
+	}
+
+	if (prg.is_valid()) {
+		// runs of equal bytes may be real data, so the user confirms every gap
+		if (f.btn("Find gaps"))
+			snprintf(program_gaps, sizeof program_gaps, "%s", Program::find_gaps(prg, program_gap).c_str());
+
+		f.sl();
+		ImGui::InputScalar("Min. gap", ImGuiDataType_U32, &program_gap);
+		program_gap = std::max(program_gap, 1u);
+
+		ImGui::InputText("Unused", program_gaps, sizeof program_gaps);
+		f.sl();
+
+		if (f.btn("Split PRG")) {
+			try {
+				program = Program::split(prg, program_gaps);
+				program_err.clear();
+			} catch (const std::runtime_error &e) {
+				program_err = e.what();
+			}
+		}
+	}
+
+	if (!program_err.empty())
+		ImGui::TextWrapped("%s", program_err.c_str());
+
+	if (program.segs.empty())
+		return;
+
+	ImGui::Text("%s: %u segments, %u bytes (padded %u bytes)", program.path.c_str(), (unsigned)program.segs.size(), (unsigned)program.payload(), (unsigned)program.span());
+	uint16_t step = 1;
+	ImGui::InputScalar("Entry", ImGuiDataType_U16, &program.entry, &step, NULL, "%04X");
+
+	if (ImGui::BeginTable("segments", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY, ImVec2(0, 150))) {
+		ImGui::TableSetupColumn("Start");
+		ImGui::TableSetupColumn("End");
+		ImGui::TableSetupColumn("Size");
+		ImGui::TableHeadersRow();
+
+		for (const Segment &s : program.segs) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn(); ImGui::Text("$%04X", s.addr);
+			ImGui::TableNextColumn(); ImGui::Text("$%04X", s.end() - 1);
+			ImGui::TableNextColumn(); ImGui::Text("%u", (unsigned)s.data.size());
+		}
+
+		ImGui::EndTable();
+	}
+
+	if (f.btn("Upload"))
+		for (Command &cmd : program.commands(false))
+			net->push(std::move(cmd));
+
+	f.sl();
+
+	if (f.btn("Upload and Start"))
+		for (Command &cmd : program.commands(true))
+			net->push(std::move(cmd));
+}
+
+void U1541::show_scheduler() {
+	Frame f("Scheduler");
+
+	if (!f)
+		return;
+
+	if (f.btn("Load sequence"))
+		fb_seq.Open();
+
+	fb_seq.Display();
+
+	if (fb_seq.HasSelected()) {
+		seq_path = fb_seq.GetSelected().string();
+		fb_seq.ClearSelected();
+
+		try {
+			seq = load_sequence(seq_path);
+			seq_err.clear();
+		} catch (const std::runtime_error &e) {
+			seq.clear();
+			seq_err = e.what();
+		}
+	}
+
+	if (!seq_err.empty())
+		ImGui::TextWrapped("%s", seq_err.c_str());
+
+	if (!seq.empty()) {
+		ImGui::Text("%s: %u %s", seq_path.c_str(), (unsigned)seq.size(), seq.size() == 1 ? "command" : "commands");
+		ImGui::InputFloat("Start delay (ms)", &seq_delay, 10, 100, "%.1f");
+
+		if (f.btn("Start sequence")) {
+			std::vector<Timed> copy(seq);
+			net->schedule(std::move(copy), (uint64_t)(std::max(seq_delay, 0.0f) * 1000));
+		}
+
+		f.sl();
+	}
+
+	if (f.btn("Cancel"))
+		net->cancel();
+
+	f.sl();
+
+	if (f.btn("Clear timing"))
+		net->reset_timing();
+
+	SchedStats st(net->timing());
+
+	ImGui::Text("Pending: %u", (unsigned)net->pending());
+	ImGui::Text("Fired  : %llu", (unsigned long long)st.fired);
+
+	if (!st.fired)
+		return;
+
+	ImGui::Text("Late   : min %lld us, max %lld us, mean %.1f us, stddev %.1f us", (long long)st.min_late, (long long)st.max_late, st.mean(), st.stddev());
+
+	if (ImGui::BeginTable("timing", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY, ImVec2(0, 200))) {
+		ImGui::TableSetupColumn("Planned (us)");
+		ImGui::TableSetupColumn("Achieved (us)");
+		ImGui::TableSetupColumn("Late (us)");
+		ImGui::TableHeadersRow();
+
+		// newest first
+		for (size_t i = 0, n = st.recent.size(); i < n; ++i) {
+			const SchedStats::Sample &s = st.recent[(st.recent_pos + n - 1 - i) % n];
+
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)s.planned);
+			ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)s.achieved);
+			ImGui::TableNextColumn(); ImGui::Text("%lld", (long long)s.late());
+		}
+
+		ImGui::EndTable();
+	}
+}
+
+void U1541::show_disk_control() {
+	Frame f("Disk image");
+
+	if (!f)
+		return;
+
+	if (f.btn("Select image"))
+		fb_img.Open();
+
+	f.sl();
+
+	if (f.btn("Select PRG directory"))
+		fb_imgdir.Open();
+
+	fb_img.Display();
+	fb_imgdir.Display();
+
+	if (fb_img.HasSelected()) {
+		img_path = fb_img.GetSelected().string();
+		img_type = disk_type(img_path);
+		fb_img.ClearSelected();
+		img_err.clear();
+	}
+
+	if (fb_imgdir.HasSelected()) {
+		img_dir = fb_imgdir.GetSelected().string();
+		fb_imgdir.ClearSelected();
+		img_err.clear();
+	}
+
+	if (!img_path.empty()) {
+		ImGui::Text("Image: %s (%s)", img_path.c_str(), disk_type_name(img_type));
+
+		if (img_type != DiskType::unknown) {
+			if (f.btn("Mount image"))
+				net->push(Command::image(img_path, false));
+
+			f.sl();
+
+			if (f.btn("Run image"))
+				net->push(Command::image(img_path, true));
+		}
+	}
+
+	if (!img_dir.empty()) {
+		ImGui::Text("PRG directory: %s", img_dir.c_str());
+
+		bool mount = f.btn("Mount as D64");
+		f.sl();
+		bool run = f.btn("Run as D64");
+
+		// the worker reads the files and builds the image
+		if (mount || run) {
+			net->push(Command::image_dir(img_dir, run));
+			img_err.clear();
+		}
+	}
+
+	std::string e;
+
+	if (net->poll_error(e))
+		img_err = e;
+
+	if (!img_err.empty())
+		ImGui::TextWrapped("%s", img_err.c_str());
+}
+
+void U1541::show_capture(Frame &f) {
+	bool capturing = net->capturing();
+
+	if (capturing) ImGui::BeginDisabled();
+	ImGui::InputText("Capture file", cap_path, sizeof cap_path);
+	if (capturing) ImGui::EndDisabled();
+
+	if (!capturing && f.btn("Start capture")) {
+		try {
+			net->capture(std::make_unique<CaptureWriter>(cap_path));
+			cap_err.clear();
+		} catch (const std::runtime_error &e) {
+			cap_err = e.what();
+		}
+	} else if (capturing) {
+		if (f.btn("Stop capture"))
+			net->capture(nullptr);
+
+		f.sl();
+		ImGui::Text("%llu frames captured", (unsigned long long)net->captured());
+	}
+
+	std::string e;
+
+	if (net->poll_capture_error(e))
+		cap_err = e;
+
+	if (!cap_err.empty())
+		ImGui::TextWrapped("%s", cap_err.c_str());
+}
+
+void U1541::show_ipc(Frame &f) {
+	if (ipc) {
+		ipc->attach(net);
+
+		// new PRG from build tool replaces current one
+		ipc->poll(prg);
+
+		ImGui::Text("IPC endpoint: %s (%llu requests)", ipc->socket_path().c_str(), (unsigned long long)ipc->count());
+		f.sl();
+
+		if (f.btn("Stop IPC"))
+			ipc.reset();
+	} else {
+		ImGui::InputText("IPC socket", ipc_path, sizeof ipc_path);
+		f.sl();
+
+		if (f.btn("Start IPC")) {
+			try {
+				ipc.reset(new IpcServer(ipc_path));
+				ipc_err.clear();
+			} catch (const std::runtime_error &e) {
+				ipc_err = e.what();
 			}
 		}
 	}
+
+	if (!ipc_err.empty())
+		ImGui::TextWrapped("%s", ipc_err.c_str());
 }
 
 void U1541::show_connected(Frame &f) {
-	if (f.btn("Disconnect"))
-		sock.reset();
+	if (f.btn("Disconnect")) {
+		net.reset();
+		return;
+	}
 
 	if (f.btn("Reset")) {
-		data.clear();
-		data.emplace_back(0xff04 & 0xff);
-		data.emplace_back(0xff04 >> 8);
-		data.emplace_back(0);
-		data.emplace_back(0);
-
-		sock->send_fully(data.data(), data.size());
+		net->push(Command::do_reset());
 		vic.reset();
 	}
 
@@ -460,8 +1051,14 @@ void U1541::show_connected(Frame &f) {
 		kbp(keybuf);
 	}
 
+	show_capture(f);
+
 	vic.show();
 	show_prg_control();
+	show_library();
+	show_program();
+	show_disk_control();
+	show_scheduler();
 }
 
 void U1541::show() {
@@ -472,19 +1069,25 @@ void U1541::show() {
 	uint16_t step = 1;
 	uint8_t step2 = 1;
 
-	bool connected = sock.get() != nullptr;
+	if (net && !net->ok()) {
+		fprintf(stderr, "%s: %s\n", __func__, net->error().c_str());
+		net.reset();
+	}
+
+	bool connected = net.get() != nullptr;
 
 	if (connected) ImGui::BeginDisabled();
 	ImGui::InputText("IP address", buf_ip, sizeof buf_ip);
 	ImGui::InputScalar("IP port", ImGuiDataType_U16, &ip_port, &step);
 	if (connected) ImGui::EndDisabled();
 
+	show_ipc(f);
+
 	if (connected) {
 		show_connected(f);
 	} else if (f.btn("Connect")) {
 		try {
-			sock.reset(new TcpSocket());
-			sock->connect(buf_ip, ip_port);
+			net.reset(new NetWorker(buf_ip, ip_port));
 		} catch (const std::runtime_error &e) {
 			fprintf(stderr, "%s: %s\n", __func__, e.what());
 		}
@@ -492,46 +1095,23 @@ void U1541::show() {
 }
 
 void U1541::poke(uint16_t addr, uint8_t val) {
-	data.clear();
-	data.emplace_back(0xff06 & 0xff);
-	data.emplace_back(0xff06 >> 8);
-
-	unsigned size = 3;
-
-	data.emplace_back(size & 0xff);
-	data.emplace_back(size >> 8);
-
-	// 3 bytes
-	data.emplace_back(addr & 0xff);
-	data.emplace_back(addr >> 8);
-	data.emplace_back(val);
-
-	sock->send_fully(data.data(), data.size());
+	net->push(Command::poke(addr, val));
 }
 
 void U1541::kbp(const char *str) {
-	data.clear();
-	data.emplace_back(0xff03 & 0xff);
-	data.emplace_back(0xff03 >> 8);
-
-	unsigned size = strlen(str);
-
-	data.emplace_back(size & 0xff);
-	data.emplace_back(size >> 8);
-
-	for (unsigned i = 0; i < size; ++i)
-		data.emplace_back(str[i]);
-
-	sock->send_fully(data.data(), data.size());
+	net->push(Command::type(str));
 }
 
 void U1541::send_prg() {
-	data.clear();
-	data.emplace_back(0xff02 & 0xff);
-	data.emplace_back(0xff02 >> 8);
+	net->deploy(prg.data, prg.hash);
+}
+
+void Engine::restart_journal() {
+	// the journal cannot undo what happened outside the cpu
+	journal.clear();
 
-	prg.store(data);
-	sock->send_fully(data.data(), data.size());
+	if (undo)
+		journal.mark(cpu);
 }
 
 void Engine::show_mpu() {
@@ -541,12 +1121,15 @@ void Engine::show_mpu() {
 
 	uint8_t step = 1;
 	uint16_t step2 = 1;
+	MOS6510 &mpu = cpu.r;
+	// edited registers are a state the journal did not record
+	bool changed = false, moved = false;
 
-	ImGui::InputScalar("Accumulator", ImGuiDataType_U8, &mpu.acc, &step, NULL, "%02X");
-	ImGui::InputScalar("X index", ImGuiDataType_U8, &mpu.x, &step, NULL, "%02X");
-	ImGui::InputScalar("Y index", ImGuiDataType_U8, &mpu.y, &step, NULL, "%02X");
-	ImGui::InputScalar("Stack Pointer", ImGuiDataType_U8, &mpu.sp, &step, NULL, "%02X");
-	ImGui::InputScalar("Program Counter", ImGuiDataType_U16, &mpu.pc, &step2, NULL, "%04X");
+	moved |= ImGui::InputScalar("Accumulator", ImGuiDataType_U8, &mpu.acc, &step, NULL, "%02X");
+	moved |= ImGui::InputScalar("X index", ImGuiDataType_U8, &mpu.x, &step, NULL, "%02X");
+	moved |= ImGui::InputScalar("Y index", ImGuiDataType_U8, &mpu.y, &step, NULL, "%02X");
+	moved |= ImGui::InputScalar("Stack Pointer", ImGuiDataType_U8, &mpu.sp, &step, NULL, "%02X");
+	moved |= ImGui::InputScalar("Program Counter", ImGuiDataType_U16, &mpu.pc, &step2, NULL, "%04X");
 
 	unsigned psw = mpu.psw();
 
@@ -560,6 +1143,347 @@ void Engine::show_mpu() {
 	if (f.btn(psw & (1 << 0) ? "C" : "c")) mpu.carry ^= 1; f.sl();
 
 	ImGui::Text("%02X", psw);
+
+	moved |= mpu.psw() != psw;
+
+	if (f.btn("Step")) {
+		machine.step();
+		changed = true;
+	}
+	f.sl();
+	if (f.btn("Run 1M cycles")) {
+		breaks.resume();
+
+		// in steps, so the run can be scrubbed through afterwards
+		for (unsigned i = 0; i < 20 && !cpu.jammed && !breaks.pending(); ++i) {
+			machine.run(50000);
+
+			if (record)
+				rewind.take();
+		}
+	}
+	f.sl();
+	if (f.btn("Reset")) {
+		machine.reset();
+		changed = moved = true;
+	}
+	f.sl();
+	if (f.btn("Load PRG")) {
+		changed = moved = true;
+
+		const PRG &prg = u1541.current_prg();
+
+		// run the PRG from its load address, like SYS would
+		if (prg.is_valid() && prg.data.size() > 2) {
+			bus.load(prg.load_address(), prg.data.data() + 2, prg.data.size() - 2);
+			mpu.pc = prg.load_address();
+			cpu.jammed = false;
+			cpu.flush();
+			cpu_err.clear();
+		} else {
+			cpu_err = "cpu: no PRG loaded";
+		}
+	}
+	f.sl();
+	if (f.btn("Load ROMs")) {
+		changed = moved = true;
+
+		try {
+			bus.load_roms("roms");
+			cpu_err.clear();
+		} catch (std::exception &e) {
+			cpu_err = e.what();
+		}
+	}
+
+	ImGui::Text("$01 = %02X, %u remaps", bus.port_value(), bus.remap_count());
+
+	if (!cpu_err.empty())
+		ImGui::TextUnformatted(cpu_err.c_str());
+
+	if (breaks.pending()) {
+		const Breakpoints::Stop &s = breaks.stop();
+
+		if (s.kind == Breakpoints::exec)
+			ImGui::Text("Stopped at breakpoint %zu", s.point);
+		else
+			ImGui::Text("Stopped after $%04X %s $%04X = $%02X", s.pc, s.kind == Breakpoints::read ? "read" : "wrote", s.addr, s.value);
+	}
+
+	if (ImGui::Checkbox("Record", &record)) {
+		rewind.clear();
+		changed = record;
+	}
+
+	if (changed && record)
+		rewind.take();
+
+	if (rewind.size()) {
+		int pos = (int)rewind.current();
+
+		ImGui::SameLine();
+		ImGui::Text("%zu snapshots, %zu KB", rewind.size(), rewind.bytes() / 1024);
+
+		if (ImGui::SliderInt("Rewind", &pos, 0, (int)rewind.size() - 1)) {
+			rewind.restore(pos);
+			moved = true;
+		}
+	}
+
+	if (ImGui::Checkbox("Undo", &undo)) {
+		cpu.journal = undo ? &journal : nullptr;
+		moved = true;
+	}
+
+	if (moved)
+		restart_journal();
+
+	if (undo) {
+		ImGui::SameLine();
+		ImGui::Text("%llu cycles, %zu KB", (unsigned long long)journal.depth(cpu), journal.bytes() / 1024);
+
+		if (f.btn("Step back"))
+			journal.back(cpu);
+		f.sl();
+		if (f.btn("Back to"))
+			journal.back_to(cpu, back_addr);
+		f.sl();
+		ImGui::InputScalar("##back", ImGuiDataType_U16, &back_addr, &step2, NULL, "%04X");
+	}
+
+	if (ImGui::Checkbox("Trace to cpu.trace", &tracing)) {
+		cpu.trace = nullptr;
+		trace.reset();
+
+		if (tracing) {
+			try {
+				trace.reset(new Trace("cpu.trace"));
+				cpu.trace = trace.get();
+			} catch (std::exception &e) {
+				cpu_err = e.what();
+				tracing = false;
+			}
+		}
+	}
+
+	if (trace) {
+		ImGui::SameLine();
+		ImGui::Text("%llu accesses", (unsigned long long)trace->count());
+	}
+
+	int dispatch = (int)cpu.dispatch;
+
+	if (ImGui::Combo("Dispatch", &dispatch, cpu_dispatch.data(), cpu_dispatch.size()))
+		cpu.dispatch = (CPU::Dispatch)dispatch;
+
+	ImGui::Text("Cycles: %llu%s", (unsigned long long)cpu.cycles, cpu.jammed ? " (jammed)" : "");
+	ImGui::Text("Cached blocks: %zu", cpu.cache().size());
+
+	// next few instructions, colored by the profile if there is one
+	uint16_t pc = mpu.pc;
+	uint64_t peak = profiling ? profile.peak() : 0;
+
+	for (unsigned i = 0; i < 8; ++i) {
+		unsigned len;
+		std::string line(cpu.disasm(pc, &len));
+
+		if (peak)
+			ImGui::TextColored(heat_text(profile.heat(pc, peak)), "%04X  %-14s %10llu", pc, line.c_str(), (unsigned long long)profile.cycles[pc]);
+		else
+			ImGui::Text("%04X  %s", pc, line.c_str());
+
+		pc += len;
+	}
+}
+
+std::array<const char*, 3> break_kinds{ "Execute", "Read", "Write" };
+
+void Engine::show_breakpoints() {
+	Frame f("Breakpoints");
+	if (!f)
+		return;
+
+	uint16_t step = 1;
+
+	ImGui::Combo("Kind", &break_kind, break_kinds.data(), break_kinds.size());
+	ImGui::InputScalar("From", ImGuiDataType_U16, &break_from, &step, NULL, "%04X");
+	ImGui::InputScalar("To", ImGuiDataType_U16, &break_to, &step, NULL, "%04X");
+	ImGui::InputText("Condition", break_cond, sizeof break_cond);
+
+	if (f.btn("Add")) {
+		try {
+			// a single address if to was left below from
+			breaks.add((Breakpoints::Kind)break_kind, break_from, std::max(break_from, break_to), break_cond);
+			break_err.clear();
+		} catch (std::exception &e) {
+			break_err = e.what();
+		}
+	}
+	f.sl();
+	if (f.btn("Remove all"))
+		breaks.clear();
+
+	if (!break_err.empty())
+		ImGui::TextUnformatted(break_err.c_str());
+
+	std::optional<size_t> drop;
+
+	if (ImGui::BeginTable("breakpoints", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY, ImVec2(0, 200))) {
+		ImGui::TableSetupColumn("On");
+		ImGui::TableSetupColumn("Kind");
+		ImGui::TableSetupColumn("Address");
+		ImGui::TableSetupColumn("Condition");
+		ImGui::TableSetupColumn("Hits");
+		ImGui::TableHeadersRow();
+
+		for (size_t i = 0; i < breaks.list().size(); ++i) {
+			const Breakpoints::Point &p = breaks.list()[i];
+			bool on = p.enabled;
+
+			ImGui::PushID((int)i);
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+
+			if (ImGui::Checkbox("##on", &on))
+				breaks.enable(i, on);
+
+			f.sl();
+			if (f.btn("X"))
+				drop = i;
+
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(break_kinds[p.kind]);
+			ImGui::TableNextColumn();
+
+			if (p.from == p.to)
+				ImGui::Text("$%04X", p.from);
+			else
+				ImGui::Text("$%04X-$%04X", p.from, p.to);
+
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(p.text.c_str());
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", (unsigned long long)p.hits);
+			ImGui::PopID();
+		}
+
+		ImGui::EndTable();
+	}
+
+	if (drop)
+		breaks.remove(*drop);
+
+	// disabled points cost nothing, so only attach when one is enabled
+	cpu.breaks = breaks.active() ? &breaks : nullptr;
+}
+
+void Engine::show_profiler() {
+	Frame f("Profiler");
+	if (!f)
+		return;
+
+	if (ImGui::Checkbox("Profile", &profiling))
+		cpu.profile = profiling ? &profile : nullptr;
+	f.sl();
+	if (f.btn("Clear"))
+		profile.clear();
+
+	uint64_t total = profile.total();
+	heat_view.peak = profile.peak();
+
+	ImGui::Text("%llu cycles", (unsigned long long)total);
+
+	if (ImGui::BeginTable("hotspots", 5, ImGuiTableFlags_Sortable | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY, ImVec2(0, 200))) {
+		ImGui::TableSetupColumn("Address", ImGuiTableColumnFlags_None, 0, (ImU32)Profile::Order::addr);
+		ImGui::TableSetupColumn("Instruction", ImGuiTableColumnFlags_None, 0, 100);
+		ImGui::TableSetupColumn("Count", ImGuiTableColumnFlags_PreferSortDescending, 0, (ImU32)Profile::Order::count);
+		ImGui::TableSetupColumn("Cycles", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_PreferSortDescending, 0, (ImU32)Profile::Order::cycles);
+		ImGui::TableSetupColumn("%", ImGuiTableColumnFlags_None, 0, 101);
+		ImGui::TableSetupScrollFreeze(0, 1);
+		ImGui::TableHeadersRow();
+
+		ImGuiTableSortSpecs *sort = ImGui::TableGetSortSpecs();
+
+		if (sort && sort->SpecsDirty && sort->SpecsCount > 0) {
+			const ImGuiTableColumnSortSpecs &spec = sort->Specs[0];
+
+			// the other columns do not sort
+			if (spec.ColumnUserID <= (ImU32)Profile::Order::cycles) {
+				hot_by = (Profile::Order)spec.ColumnUserID;
+				hot_reverse = spec.SortDirection != (hot_by == Profile::Order::addr ? ImGuiSortDirection_Ascending : ImGuiSortDirection_Descending);
+			}
+
+			sort->SpecsDirty = false;
+		}
+
+		std::vector<Profile::Spot> spots(profile.hot(hot_by, 256));
+
+		if (hot_reverse)
+			std::reverse(spots.begin(), spots.end());
+
+		for (const Profile::Spot &s : spots) {
+			char addr[8];
+
+			snprintf(addr, sizeof addr, "%04X", s.addr);
+
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+
+			// jump to it in the memory view
+			if (ImGui::Selectable(addr, false, ImGuiSelectableFlags_SpanAllColumns))
+				heat_edit.GotoAddrAndHighlight(s.addr, s.addr + 1);
+
+			ImGui::TableNextColumn();
+			ImGui::TextColored(heat_text(profile.heat(s.addr, heat_view.peak)), "%s", cpu.disasm(s.addr).c_str());
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", (unsigned long long)s.count);
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", (unsigned long long)s.cycles);
+			ImGui::TableNextColumn();
+			ImGui::Text("%5.1f", total ? 100.0 * s.cycles / total : 0.0);
+		}
+
+		ImGui::EndTable();
+	}
+
+	heat_edit.ReadFn = heat_readfn;
+	heat_edit.WriteFn = heat_writefn;
+	heat_edit.BgColorFn = heat_bgcolorfn;
+	heat_edit.DrawContents(&heat_view, 0x10000);
+
+	if (heat_view.written) {
+		heat_view.written = false;
+		restart_journal();
+	}
+}
+
+void Engine::show_picture() {
+	Frame f("Screen");
+	if (!f)
+		return;
+
+	if (!machine.recorder.recording())
+		machine.recorder.record(&pipeline);
+
+	// every line with the registers as they are now until a whole frame has been recorded
+	uint64_t frames = pipeline.picture(screen);
+
+	if (!frames)
+		renderer.frame(screen.data(), render::capture(machine), render::memory(bus));
+
+	if (!screen_tex) {
+		glGenTextures(1, &screen_tex);
+		glBindTexture(GL_TEXTURE_2D, screen_tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, render::width, render::height, 0, GL_RGBA, GL_UNSIGNED_BYTE, screen.data());
+	} else {
+		glBindTexture(GL_TEXTURE_2D, screen_tex);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, render::width, render::height, GL_RGBA, GL_UNSIGNED_BYTE, screen.data());
+	}
+
+	ImGui::Image((ImTextureID)(intptr_t)screen_tex, ImVec2(render::width * 2, render::height * 2));
+	ImGui::Text("raster line %u, frame %llu, %u threads, %s", VicII::raster(cpu.cycles), (unsigned long long)frames, pipeline.workers(), renderer.avx2() ? "avx2" : "scalar");
 }
 
 void Engine::display() {
@@ -569,17 +1493,43 @@ void Engine::display() {
 	if (show_diss)
 		diss.show();
 
-	//show_mpu();
+	if (show_cpu)
+		show_mpu();
+
+	if (show_profile)
+		show_profiler();
+
+	if (show_breaks)
+		show_breakpoints();
+
+	if (show_screen)
+		show_picture();
+	else if (machine.recorder.recording())
+		machine.recorder.record(nullptr);
 
 	if (show_demo_window)
 		ImGui::ShowDemoWindow(&show_demo_window);
 }
 
 // Main code
-int main(int, char**)
+int main(int argc, char **argv)
 {
 	int ret = 1;
 
+	// headless modes
+	if (argc > 1 && !strcmp(argv[1], "--proxy"))
+		return proxy_main(argc, argv);
+	if (argc > 1 && !strcmp(argv[1], "--replay"))
+		return replay_main(argc, argv);
+	if (argc > 1 && !strcmp(argv[1], "--sink"))
+		return sink_main(argc, argv);
+	if (argc > 1 && !strcmp(argv[1], "--push"))
+		return push_main(argc, argv);
+	if (argc > 1 && !strcmp(argv[1], "--bench"))
+		return cpu_bench_main(argc, argv);
+	if (argc > 1 && !strcmp(argv[1], "--trace"))
+		return trace_main(argc, argv);
+
 	// Setup SDL
 	// (Some versions of SDL before <2.0.10 appears to have performance/stalling issues on a minority of Windows systems,
 	// depending on whether SDL_INIT_GAMECONTROLLER is enabled or disabled.. updating to the latest version of SDL is recommended!)
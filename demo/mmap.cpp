@@ -0,0 +1,195 @@
+#include "mmap.hpp"
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if _WIN32
+MappedFile::MappedFile(const std::string &path) : ptr(nullptr), len(0), fh(INVALID_HANDLE_VALUE), mh(NULL) {
+	// https://docs.microsoft.com/en-us/windows/win32/memory/creating-a-file-mapping-object
+	fh = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fh == INVALID_HANDLE_VALUE)
+		throw std::runtime_error(std::string("mmap: cannot open \"") + path + "\": code " + std::to_string(GetLastError()));
+
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx(fh, &size)) {
+		CloseHandle(fh);
+		throw std::runtime_error(std::string("mmap: cannot stat \"") + path + "\": code " + std::to_string(GetLastError()));
+	}
+
+	len = (size_t)size.QuadPart;
+
+	if (!len)
+		return;
+
+	if (!(mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL)) || !(ptr = (const uint8_t*)MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0))) {
+		DWORD err = GetLastError();
+
+		if (mh)
+			CloseHandle(mh);
+		CloseHandle(fh);
+
+		throw std::runtime_error(std::string("mmap: cannot map \"") + path + "\": code " + std::to_string(err));
+	}
+}
+
+MappedFile::~MappedFile() {
+	if (ptr)
+		UnmapViewOfFile(ptr);
+	if (mh)
+		CloseHandle(mh);
+	CloseHandle(fh);
+}
+
+WritableMappedFile::WritableMappedFile(const std::string &path, size_t size) : ptr(nullptr), len(size), fh(INVALID_HANDLE_VALUE), mh(NULL) {
+	if (!size)
+		throw std::invalid_argument("mmap: cannot map empty file");
+
+	fh = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fh == INVALID_HANDLE_VALUE)
+		throw std::runtime_error(std::string("mmap: cannot open \"") + path + "\": code " + std::to_string(GetLastError()));
+
+	// the mapping sets the file size
+	if (!(mh = CreateFileMappingA(fh, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL)) || !(ptr = (uint8_t*)MapViewOfFile(mh, FILE_MAP_WRITE, 0, 0, size))) {
+		DWORD err = GetLastError();
+
+		if (mh)
+			CloseHandle(mh);
+		CloseHandle(fh);
+
+		throw std::runtime_error(std::string("mmap: cannot map \"") + path + "\": code " + std::to_string(err));
+	}
+}
+
+WritableMappedFile::~WritableMappedFile() {
+	UnmapViewOfFile(ptr);
+	CloseHandle(mh);
+	CloseHandle(fh);
+}
+
+void WritableMappedFile::sync() {
+	FlushViewOfFile(ptr, len);
+}
+#else
+MappedFile::MappedFile(const std::string &path) : ptr(nullptr), len(0) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error(std::string("mmap: cannot open \"") + path + "\": " + strerror(errno));
+
+	struct stat st;
+
+	if (fstat(fd, &st)) {
+		int err = errno;
+		close(fd);
+		throw std::runtime_error(std::string("mmap: cannot stat \"") + path + "\": " + strerror(err));
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		close(fd);
+		throw std::runtime_error(std::string("mmap: not a regular file: \"") + path + "\"");
+	}
+
+	len = st.st_size;
+
+	if (len) {
+		void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (p == MAP_FAILED) {
+			int err = errno;
+			close(fd);
+			throw std::runtime_error(std::string("mmap: cannot map \"") + path + "\": " + strerror(err));
+		}
+
+		ptr = (const uint8_t*)p;
+	}
+
+	// the mapping stays valid after closing the descriptor
+	close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (ptr)
+		munmap((void*)ptr, len);
+}
+
+WritableMappedFile::WritableMappedFile(const std::string &path, size_t size) : ptr(nullptr), len(size) {
+	if (!size)
+		throw std::invalid_argument("mmap: cannot map empty file");
+
+	int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		throw std::runtime_error(std::string("mmap: cannot open \"") + path + "\": " + strerror(errno));
+
+	if (ftruncate(fd, (off_t)size)) {
+		int err = errno;
+		close(fd);
+		throw std::runtime_error(std::string("mmap: cannot resize \"") + path + "\": " + strerror(err));
+	}
+
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (p == MAP_FAILED) {
+		int err = errno;
+		close(fd);
+		throw std::runtime_error(std::string("mmap: cannot map \"") + path + "\": " + strerror(err));
+	}
+
+	ptr = (uint8_t*)p;
+	close(fd);
+}
+
+WritableMappedFile::~WritableMappedFile() {
+	munmap(ptr, len);
+}
+
+void WritableMappedFile::sync() {
+	msync(ptr, len, MS_SYNC);
+}
+#endif
+
+Bytes Bytes::map_file(const std::string &path) {
+	auto map = std::make_shared<const MappedFile>(path);
+
+	if (!map->size())
+		return Bytes();
+
+	return Bytes(map);
+}
+
+Bytes Bytes::slice(size_t off, size_t n) const {
+	if (off > len || n > len - off)
+		throw std::out_of_range("bytes: slice out of range");
+
+	Bytes b(*this);
+
+	b.ptr += off;
+	b.len = n;
+
+	return b;
+}
+
+uint8_t *Bytes::edit() {
+	// only copy if someone else can see the bytes or this is a slice
+	if (!own || own.use_count() > 1 || ptr != own->data() || len != own->size()) {
+		own = std::make_shared<std::vector<uint8_t>>(begin(), end());
+		map.reset();
+		ptr = own->data();
+	}
+
+	return own->data();
+}
+
+void Bytes::set(size_t i, uint8_t v) {
+	if (i >= len)
+		throw std::out_of_range("bytes: index out of range");
+
+	edit()[i] = v;
+}
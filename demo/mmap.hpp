@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/** Read-only memory mapping of a whole file. */
+class MappedFile final {
+	const uint8_t *ptr;
+	size_t len;
+#if _WIN32
+	void *fh, *mh;
+#endif
+public:
+	explicit MappedFile(const std::string &path);
+	MappedFile(const MappedFile&) = delete;
+	~MappedFile();
+
+	const uint8_t *data() const noexcept { return ptr; }
+	size_t size() const noexcept { return len; }
+};
+
+/** Shared read-write memory mapping of a file that is created or resized to a fixed size. */
+class WritableMappedFile final {
+	uint8_t *ptr;
+	size_t len;
+#if _WIN32
+	void *fh, *mh;
+#endif
+public:
+	WritableMappedFile(const std::string &path, size_t size);
+	WritableMappedFile(const WritableMappedFile&) = delete;
+	~WritableMappedFile();
+
+	uint8_t *data() noexcept { return ptr; }
+	size_t size() const noexcept { return len; }
+
+	/** Write changed pages back to the file. */
+	void sync();
+};
+
+/*
+ * Immutable byte string that is cheap to copy. The bytes either live in a
+ * file mapping or in a shared vector. Copies share the same bytes, and the
+ * first write through set() or edit() makes a private copy, so mapped files
+ * are only copied once the user actually changes something.
+ *
+ * Reading a mapping raises SIGBUS once the file is truncated. Mapped bytes
+ * that are kept are only read while the file is unchanged on disk, see
+ * PRG::stale(), and anything queued for another thread takes owned() bytes.
+ */
+class Bytes final {
+	std::shared_ptr<const MappedFile> map;
+	std::shared_ptr<std::vector<uint8_t>> own;
+	const uint8_t *ptr;
+	size_t len;
+public:
+	Bytes() noexcept : map(), own(), ptr(nullptr), len(0) {}
+	Bytes(std::vector<uint8_t> &&v) : map(), own(std::make_shared<std::vector<uint8_t>>(std::move(v))), ptr(own->data()), len(own->size()) {}
+	explicit Bytes(const std::shared_ptr<const MappedFile> &map) noexcept : map(map), own(), ptr(map->data()), len(map->size()) {}
+	Bytes(const uint8_t *begin, const uint8_t *end) : Bytes(std::vector<uint8_t>(begin, end)) {}
+
+	/** Map \a path read-only. Empty files are not mapped. */
+	static Bytes map_file(const std::string &path);
+
+	const uint8_t *data() const noexcept { return ptr; }
+	size_t size() const noexcept { return len; }
+	bool empty() const noexcept { return !len; }
+	bool mapped() const noexcept { return map.get() != nullptr; }
+
+	const uint8_t *begin() const noexcept { return ptr; }
+	const uint8_t *end() const noexcept { return ptr + len; }
+
+	uint8_t operator[](size_t i) const noexcept { return ptr[i]; }
+
+	uint8_t at(size_t i) const {
+		if (i >= len)
+			throw std::out_of_range("bytes: index out of range");
+		return ptr[i];
+	}
+
+	/** Same bytes in memory that is not backed by a file. Only copies if mapped. */
+	Bytes owned() const { return mapped() ? Bytes(begin(), end()) : *this; }
+
+	/** Bytes \a off to \a off + \a n sharing the same storage. */
+	Bytes slice(size_t off, size_t n) const;
+
+	/** Writable pointer to private copy of the bytes. Invalidates pointers from data(). */
+	uint8_t *edit();
+	void set(size_t i, uint8_t v);
+
+	std::vector<uint8_t> vec() const { return std::vector<uint8_t>(begin(), end()); }
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Register model of the MOS 6510. Flags are kept as separate 0 or 1 bytes,
+ * which is cheaper to update than packing the status register after every
+ * instruction. psw() and set_psw() convert from and to the packed form.
+ */
+class MOS6510 final {
+public:
+	uint8_t acc;
+	uint8_t y;
+	uint8_t x;
+	uint16_t pc;
+	uint8_t sp;
+
+	uint8_t carry;
+	uint8_t zero;
+	uint8_t no_irq;
+	uint8_t dec;
+	uint8_t brk;
+	uint8_t of;
+	uint8_t neg;
+
+	unsigned psw() const noexcept {
+		unsigned v = 0;
+
+		if (carry) v |= 1 << 0;
+		if (zero) v |= 1 << 1;
+		if (no_irq) v |= 1 << 2;
+		if (dec) v |= 1 << 3;
+		if (brk) v |= 1 << 4;
+		v |= (1 << 5);
+		if (of) v |= 1 << 6;
+		if (neg) v |= 1 << 7;
+
+		return v;
+	}
+
+	void set_psw(unsigned v) noexcept {
+		carry = (v >> 0) & 1;
+		zero = (v >> 1) & 1;
+		no_irq = (v >> 2) & 1;
+		dec = (v >> 3) & 1;
+		brk = (v >> 4) & 1;
+		of = (v >> 6) & 1;
+		neg = (v >> 7) & 1;
+	}
+};
@@ -14,6 +14,10 @@
 #define SOCKET_ERROR (-1)
 #endif
 
+#if _WIN32 || !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
 #if _WIN32
 // process and throw error message. always throws
 static void wsa_generic_error(const char *prefix, int code) noexcept(false)
@@ -108,7 +112,7 @@ TcpSocket::~TcpSocket() {
 
 void TcpSocket::connect(const char *address, uint16_t port) {
 	const auto sock = s.load(std::memory_order_relaxed);
-	struct sockaddr_in dst{ 0 };
+	struct sockaddr_in dst{};
 
 	dst.sin_family = AF_INET;
 	dst.sin_addr.s_addr = inet_addr(address);
@@ -132,13 +136,82 @@ void TcpSocket::connect(const char *address, uint16_t port) {
 #endif
 }
 
+void TcpSocket::bind(const char *address, uint16_t port) {
+	const auto sock = s.load(std::memory_order_relaxed);
+	struct sockaddr_in src{};
+	int v = 1;
+
+	// allow restarting immediately while old connections are in TIME_WAIT
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&v, sizeof v);
+
+	src.sin_family = AF_INET;
+	src.sin_addr.s_addr = inet_addr(address);
+	src.sin_port = htons(port);
+
+	// https://docs.microsoft.com/en-us/windows/win32/api/winsock/nf-winsock-bind
+	if (::bind(sock, (const sockaddr *)&src, sizeof src) == 0)
+		return;
+
+#if _WIN32
+	throw std::runtime_error(std::string("wsa: bind failed: code ") + std::to_string(WSAGetLastError()));
+#else
+	throw std::runtime_error(std::string("net: bind failed: ") + strerror(errno));
+#endif
+}
+
+void TcpSocket::listen(int backlog) {
+	const auto sock = s.load(std::memory_order_relaxed);
+
+	// https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-listen
+	if (::listen(sock, backlog) == 0)
+		return;
+
+#if _WIN32
+	throw std::runtime_error(std::string("wsa: listen failed: code ") + std::to_string(WSAGetLastError()));
+#else
+	throw std::runtime_error(std::string("net: listen failed: ") + strerror(errno));
+#endif
+}
+
+std::unique_ptr<TcpSocket> TcpSocket::accept() {
+	const auto sock = s.load(std::memory_order_relaxed);
+
+	// https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-accept
+	SOCKET c = ::accept(sock, NULL, NULL);
+
+	if (c != INVALID_SOCKET)
+		return std::make_unique<TcpSocket>(c);
+
+#if _WIN32
+	throw std::runtime_error(std::string("wsa: accept failed: code ") + std::to_string(WSAGetLastError()));
+#else
+	throw std::runtime_error(std::string("net: accept failed: ") + strerror(errno));
+#endif
+}
+
+void TcpSocket::nodelay(bool enable) {
+	const auto sock = s.load(std::memory_order_relaxed);
+	int v = enable;
+
+	// https://docs.microsoft.com/en-us/windows/win32/api/winsock/nf-winsock-setsockopt
+	if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&v, sizeof v) == 0)
+		return;
+
+#if _WIN32
+	throw std::runtime_error(std::string("wsa: setsockopt failed: code ") + std::to_string(WSAGetLastError()));
+#else
+	throw std::runtime_error(std::string("net: setsockopt failed: ") + strerror(errno));
+#endif
+}
+
 int TcpSocket::try_send(const void *ptr, int len, unsigned tries) noexcept {
 	const auto sock = s.load(std::memory_order_relaxed);
 	int written = 0;
 
 	while (written < len) {
 		int rem = len - written;
-		int out = ::send(sock, (const char *)ptr + written, rem, 0);
+		// a peer that has gone away is an error, not SIGPIPE
+		int out = ::send(sock, (const char *)ptr + written, rem, MSG_NOSIGNAL);
 
 		if (out <= 0) {
 			if (!written)
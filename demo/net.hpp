@@ -14,6 +14,7 @@ typedef int SOCKET;
 
 #include <cstdint>
 #include <atomic>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <utility>
@@ -35,10 +36,21 @@ class TcpSocket final {
 	std::atomic<int> s;
 public:
 	TcpSocket();
+	/** Take ownership of existing socket. */
+	explicit TcpSocket(SOCKET sock) noexcept : s((int)sock) {}
 	~TcpSocket();
 
+	SOCKET fd() const noexcept { return (SOCKET)s.load(std::memory_order_relaxed); }
+
 	void connect(const char *address, uint16_t port);
 
+	// server side
+	void bind(const char *address, uint16_t port);
+	void listen(int backlog=16);
+	std::unique_ptr<TcpSocket> accept();
+	/** Disable Nagle's algorithm so small commands are sent immediately. */
+	void nodelay(bool enable);
+
 	// data exchange
 	// NOTE tries indicates number of attempts. use tries=0 for infinite retries.
 	// NOTE the template send/recv version use a different tries default value than the non-template versions. its value is chosen randomly.
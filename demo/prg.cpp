@@ -1,33 +1,77 @@
 #include "prg.hpp"
+#include "hash.hpp"
 
 #include <cstddef>
 #include <cstdio>
 
-#include <fstream>
+#include <filesystem>
 #include <stdexcept>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+static bool file_identity(const std::string &path, uintmax_t &size, int64_t &time) {
+	std::error_code ec;
+
+	size = fs::file_size(path, ec);
+	if (ec)
+		return false;
+
+	time = fs::last_write_time(path, ec).time_since_epoch().count();
+	return !ec;
+}
+
+PRG::PRG(const std::string &path, Bytes &&data) : path(path), data(std::move(data)), hash(0), file(false), file_size(0), file_time(0) {
+	hash = xxh64(this->data.data(), this->data.size());
+}
 
 void PRG::load(const std::string &path) {
 	//printf("prg path: %s\n", path.c_str());
 
-	try {
-		std::ifstream in(path, std::ios::binary);
-		in.exceptions(std::ifstream::failbit);
+	uintmax_t size;
+	int64_t time;
+
+	if (!file_identity(path, size, time))
+		throw std::runtime_error(std::string("prg: cannot open \"") + path + "\"");
 
-		in.seekg(0, std::ios_base::end);
-		size_t end = in.tellg();
-		in.seekg(0);
-		size_t begin = in.tellg();
+	// identity is taken before mapping, so a change in between is seen as changed on disk
+	Bytes bytes(Bytes::map_file(path));
 
-		size_t size = end - begin;
+	this->path = path;
+	this->data = std::move(bytes);
+	this->file = true;
+	this->file_size = size;
+	this->file_time = time;
+	this->hash = xxh64(data.data(), data.size());
+}
+
+void PRG::set(size_t i, uint8_t v) {
+	data.set(i, v);
+	file = false;
+	hash = xxh64(data.data(), data.size());
+}
+
+bool PRG::changed_on_disk(uintmax_t &size, int64_t &time) const {
+	size = file_size;
+	time = file_time;
 
-		//printf("prg size: %zu\n", size);
+	if (!file)
+		return false;
 
-		this->path = path;
-		this->data.resize(size);
-		in.read((char*)this->data.data(), size);
-	} catch (const std::runtime_error &e) {
-		fprintf(stderr, "%s: %s\n", __func__, e.what());
+	if (!file_identity(path, size, time)) {
+		size = 0;
+		time = 0;
+		return true;
 	}
+
+	return size != file_size || time != file_time;
+}
+
+bool PRG::stale() const {
+	uintmax_t size;
+	int64_t time;
+
+	return data.mapped() && changed_on_disk(size, time);
 }
 
 void PRG::store(std::vector<uint8_t> &out) {
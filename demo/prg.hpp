@@ -1,5 +1,7 @@
 #pragma once
 
+#include "mmap.hpp"
+
 #include <string>
 #include <vector>
 
@@ -9,22 +11,49 @@
  * Binary executable for Commodore 64.
  * The first two bytes indicate the store address.
  * The KERNAL will load the prg at that address.
+ *
+ * load() maps the file, and data is only copied by the first edit or when
+ * queued as a Command for another thread. A build tool that rewrites the
+ * file in place makes reading the mapping fault, so whoever keeps a loaded
+ * PRG checks stale() before reading data.
  */
 class PRG final {
 public:
 	std::string path;
-	std::vector<uint8_t> data;
+	Bytes data;
+	/** xxh64 of data, kept up to date by load() and set(). */
+	uint64_t hash;
 
 	static constexpr unsigned min_prg_size = 2;
 	// max size according to https://www.c64-wiki.com/wiki/Commodore_1541:
 	static constexpr unsigned max_prg_size = 2 + 202 * 256; // +2 for start address
 
-	PRG() : path(""), data() {}
+	PRG() : path(""), data(), hash(0), file(false), file_size(0), file_time(0) {}
+	/** PRG that is not backed by a file, e.g. decoded from a disk image. */
+	PRG(const std::string &path, Bytes &&data);
 
 	bool is_valid() const noexcept { return data.size() >= min_prg_size && data.size() <= max_prg_size; }
 
+	/** Map file at \a path. Throws if the file cannot be opened. */
 	void load(const std::string&);
 	void store(std::vector<uint8_t>&);
 
+	/** Change byte \a i of data and update hash. */
+	void set(size_t i, uint8_t v);
+
+	/** Whether data is still what load() read from path, i.e. not edited or decoded from an image. */
+	bool from_file() const noexcept { return file; }
+	/**
+	 * Check whether the file loaded has been changed on disk since. \a size
+	 * and \a time are set to what the file has now, or 0 if it is gone.
+	 */
+	bool changed_on_disk(uintmax_t &size, int64_t &time) const;
+	/** Whether data still maps the file and the file changed, so data must not be read. */
+	bool stale() const;
+
 	uint16_t load_address() const { return data.at(0) | (data.at(1) << 8); }
+private:
+	bool file;
+	uintmax_t file_size;
+	int64_t file_time;
 };
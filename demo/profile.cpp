@@ -0,0 +1,58 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void Profile::clear() {
+	std::fill(count.begin(), count.end(), 0);
+	std::fill(cycles.begin(), cycles.end(), 0);
+}
+
+uint64_t Profile::total() const noexcept {
+	uint64_t sum = 0;
+
+	for (uint64_t c : cycles)
+		sum += c;
+
+	return sum;
+}
+
+uint64_t Profile::peak() const noexcept {
+	return *std::max_element(cycles.begin(), cycles.end());
+}
+
+std::vector<Profile::Spot> Profile::hot(Order by, size_t max) const {
+	std::vector<Spot> spots;
+
+	for (unsigned addr = 0; addr < 0x10000; ++addr)
+		if (count[addr])
+			spots.push_back(Spot{ (uint16_t)addr, count[addr], cycles[addr] });
+
+	auto first = [by](const Spot &a, const Spot &b) {
+		switch (by) {
+		case Order::count:
+			return a.count > b.count || (a.count == b.count && a.addr < b.addr);
+		case Order::cycles:
+			return a.cycles > b.cycles || (a.cycles == b.cycles && a.addr < b.addr);
+		default:
+			return a.addr < b.addr;
+		}
+	};
+
+	// only the first few are shown, so there is no need to sort the rest
+	if (spots.size() > max) {
+		std::partial_sort(spots.begin(), spots.begin() + max, spots.end(), first);
+		spots.resize(max);
+	} else {
+		std::sort(spots.begin(), spots.end(), first);
+	}
+
+	return spots;
+}
+
+float Profile::heat(uint16_t addr, uint64_t peak) const noexcept {
+	if (!cycles[addr] || !peak)
+		return 0;
+
+	return (float)(std::log1p((double)cycles[addr]) / std::log1p((double)peak));
+}
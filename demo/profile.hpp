@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+/*
+ * Execution profile of a CPU. While attached to CPU::profile, run() counts
+ * every instruction and the cycles it took, including page crossing and
+ * branch penalties, at the address of its opcode. Both counters are flat
+ * arrays of 64K entries, so recording is two increments per instruction and
+ * needs no lookup.
+ *
+ * Interrupt sequences and instructions executed by step() are not counted.
+ */
+class Profile final {
+public:
+	/** Times the instruction at each address was executed. */
+	std::vector<uint64_t> count;
+	/** Cycles spent in the instruction at each address. */
+	std::vector<uint64_t> cycles;
+
+	/** One executed address. */
+	class Spot final {
+	public:
+		uint16_t addr;
+		uint64_t count, cycles;
+	};
+
+	enum class Order {
+		addr,
+		count,
+		cycles,
+	};
+
+	Profile() : count(0x10000), cycles(0x10000) {}
+
+	void clear();
+
+	/** Cycles spent in all instructions. */
+	uint64_t total() const noexcept;
+	/** Most cycles spent at a single address. */
+	uint64_t peak() const noexcept;
+
+	/**
+	 * Up to \a max executed addresses. Sorted by address from low to high or
+	 * by count or cycles from high to low, so the hottest come first.
+	 */
+	std::vector<Spot> hot(Order by, size_t max) const;
+
+	/**
+	 * How hot \a addr is, from 0 for never executed to 1 for \a peak cycles.
+	 * Log scaled, so code that runs once per frame still shows next to the
+	 * inner loops.
+	 */
+	float heat(uint16_t addr, uint64_t peak) const noexcept;
+};
@@ -0,0 +1,368 @@
+#include "program.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+Program::Program(const PRG &prg) : path(prg.path), segs(), entry(prg.load_address()) {
+	add(prg.load_address(), prg.data.slice(2, prg.data.size() - 2));
+}
+
+void Program::add(unsigned addr, Bytes &&data) {
+	if (data.empty())
+		return;
+
+	if (addr + data.size() > 0x10000) {
+		char buf[80];
+		snprintf(buf, sizeof buf, "program: segment at $%04X with %u bytes does not fit in memory", addr, (unsigned)data.size());
+		throw std::runtime_error(buf);
+	}
+
+	for (const Segment &s : segs) {
+		if (addr < s.end() && s.addr < addr + data.size()) {
+			char buf[100];
+			snprintf(buf, sizeof buf, "program: segment $%04X-$%04X overlaps segment $%04X-$%04X",
+				addr, (unsigned)(addr + data.size() - 1), s.addr, s.end() - 1);
+			throw std::runtime_error(buf);
+		}
+	}
+
+	segs.emplace_back(addr, std::move(data));
+}
+
+size_t Program::payload() const {
+	size_t n = 0;
+
+	for (const Segment &s : segs)
+		n += s.data.size();
+
+	return n;
+}
+
+size_t Program::span() const {
+	if (segs.empty())
+		return 0;
+
+	unsigned lo = 0xffff, hi = 0;
+
+	for (const Segment &s : segs) {
+		lo = std::min<unsigned>(lo, s.addr);
+		hi = std::max(hi, s.end());
+	}
+
+	return hi - lo;
+}
+
+std::vector<Command> Program::commands(bool start) const {
+	// the address takes 2 bytes of the payload
+	constexpr unsigned max_chunk = Command::max_payload - 2;
+
+	std::vector<Command> cmds;
+
+	for (const Segment &s : segs)
+		for (size_t off = 0; off < s.data.size(); off += max_chunk)
+			cmds.emplace_back(Command::write(s.addr + off, s.data.data() + off, std::min<size_t>(max_chunk, s.data.size() - off)));
+
+	if (start)
+		cmds.emplace_back(Command::start(entry));
+
+	return cmds;
+}
+
+static bool has_ext(const std::string &path, const char *ext) {
+	std::string e(fs::path(path).extension().string());
+	std::transform(e.begin(), e.end(), e.begin(), ::tolower);
+	return e == ext;
+}
+
+static unsigned hex_byte(const std::string &line, size_t pos) {
+	if (pos + 2 > line.size() || !isxdigit((unsigned char)line[pos]) || !isxdigit((unsigned char)line[pos + 1]))
+		throw std::runtime_error("bad hex digit");
+
+	return std::stoul(line.substr(pos, 2), nullptr, 16);
+}
+
+// see https://en.wikipedia.org/wiki/Intel_HEX
+static void load_ihex(Program &p, std::istream &in) {
+	std::vector<uint8_t> seg;
+	unsigned seg_addr = 0, base = 0;
+	std::string line;
+	unsigned lineno = 0;
+
+	auto flush = [&]() {
+		if (!seg.empty())
+			p.add(seg_addr, Bytes(std::move(seg)));
+
+		seg.clear();
+	};
+
+	while (std::getline(in, line)) {
+		++lineno;
+
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+
+		if (line.empty())
+			continue;
+
+		try {
+			if (line[0] != ':')
+				throw std::runtime_error("missing start code");
+
+			unsigned n = hex_byte(line, 1), addr = hex_byte(line, 3) << 8 | hex_byte(line, 5), type = hex_byte(line, 7);
+			unsigned sum = n + (addr >> 8) + (addr & 0xff) + type;
+			std::vector<uint8_t> data;
+
+			for (unsigned i = 0; i < n; ++i) {
+				data.emplace_back(hex_byte(line, 9 + 2 * i));
+				sum += data.back();
+			}
+
+			if (((sum + hex_byte(line, 9 + 2 * n)) & 0xff) != 0)
+				throw std::runtime_error("bad checksum");
+
+			switch (type) {
+			case 0: // data
+				addr += base;
+
+				if (addr > 0xffff)
+					throw std::runtime_error("address above $FFFF");
+
+				// start new segment unless record continues the current one
+				if (seg.empty() || seg_addr + seg.size() != addr) {
+					flush();
+					seg_addr = addr;
+				}
+
+				seg.insert(seg.end(), data.begin(), data.end());
+				break;
+			case 1: // end of file
+				flush();
+				return;
+			case 2: // extended segment address
+				if (n != 2) throw std::runtime_error("bad record length");
+				base = (data[0] << 8 | data[1]) << 4;
+				break;
+			case 3: // start segment address
+				if (n != 4) throw std::runtime_error("bad record length");
+				p.entry = data[2] << 8 | data[3];
+				break;
+			case 4: // extended linear address
+				if (n != 2) throw std::runtime_error("bad record length");
+				base = (data[0] << 8 | data[1]) << 16;
+				break;
+			case 5: // start linear address
+				if (n != 4) throw std::runtime_error("bad record length");
+				p.entry = data[2] << 8 | data[3];
+				break;
+			default:
+				throw std::runtime_error("unknown record type " + std::to_string(type));
+			}
+		} catch (const std::runtime_error &e) {
+			throw std::runtime_error(std::string("program: ") + p.path + ":" + std::to_string(lineno) + ": " + e.what());
+		}
+	}
+
+	flush();
+}
+
+static unsigned parse_addr(const std::string &s) {
+	const char *str = s.c_str();
+	int base = 10;
+
+	if (*str == '$') {
+		++str;
+		base = 16;
+	} else if (!strncmp(str, "0x", 2)) {
+		str += 2;
+		base = 16;
+	}
+
+	char *end;
+	unsigned long v = strtoul(str, &end, base);
+
+	if (*end || end == str || v > 0xffff)
+		throw std::runtime_error("bad address \"" + s + "\"");
+
+	return v;
+}
+
+/*
+ * Segment list. Every line has an address and a file, or just a PRG file that
+ * is loaded at its own address. Binary files are loaded as is, PRG files
+ * without their load address. Paths are relative to the list.
+ *
+ *   # comment
+ *   entry $0810
+ *   main.prg
+ *   $1000 music.bin
+ *   $2000 sprites.bin
+ */
+static void load_seg(Program &p, std::istream &in) {
+	fs::path dir(fs::path(p.path).parent_path());
+	std::string line;
+	unsigned lineno = 0;
+	bool has_entry = false;
+
+	while (std::getline(in, line)) {
+		++lineno;
+
+		std::istringstream words(line);
+		std::string w1, w2;
+
+		if (!(words >> w1) || w1[0] == '#')
+			continue;
+
+		try {
+			if (w1 == "entry") {
+				if (!(words >> w2))
+					throw std::runtime_error("missing entry address");
+
+				p.entry = parse_addr(w2);
+				has_entry = true;
+				continue;
+			}
+
+			std::string file(words >> w2 ? w2 : w1);
+			fs::path fp(fs::path(file).is_absolute() ? fs::path(file) : dir / file);
+
+			if (has_ext(file, ".prg")) {
+				PRG prg;
+				prg.load(fp.string());
+
+				if (!prg.is_valid())
+					throw std::runtime_error("bad PRG \"" + file + "\"");
+
+				unsigned addr = w2.empty() ? prg.load_address() : parse_addr(w1);
+
+				if (!has_entry && p.segs.empty())
+					p.entry = addr;
+
+				p.add(addr, prg.data.slice(2, prg.data.size() - 2));
+				continue;
+			}
+
+			if (w2.empty())
+				throw std::runtime_error("missing address for \"" + file + "\"");
+
+			unsigned addr = parse_addr(w1);
+
+			if (!has_entry && p.segs.empty())
+				p.entry = addr;
+
+			p.add(addr, Bytes::map_file(fp.string()).owned());
+		} catch (const std::runtime_error &e) {
+			throw std::runtime_error(std::string("program: ") + p.path + ":" + std::to_string(lineno) + ": " + e.what());
+		}
+	}
+}
+
+void Program::load(const std::string &path) {
+	Program p;
+	p.path = path;
+
+	if (has_ext(path, ".prg")) {
+		PRG prg;
+		prg.load(path);
+
+		if (!prg.is_valid())
+			throw std::runtime_error(std::string("program: bad PRG \"") + path + "\"");
+
+		p = Program(prg);
+	} else {
+		std::ifstream in(path);
+
+		if (!in)
+			throw std::runtime_error(std::string("program: cannot open \"") + path + "\"");
+
+		if (has_ext(path, ".seg"))
+			load_seg(p, in);
+		else
+			load_ihex(p, in);
+	}
+
+	*this = std::move(p);
+}
+
+std::string Program::find_gaps(const PRG &prg, unsigned min_gap) {
+	std::string gaps;
+	unsigned addr = prg.load_address();
+	const uint8_t *data = prg.data.data() + 2;
+	size_t n = prg.data.size() - 2, i = 0;
+
+	while (i < n) {
+		// measure run of equal bytes
+		size_t j = i + 1;
+
+		while (j < n && data[j] == data[i])
+			++j;
+
+		if (j - i >= min_gap) {
+			char buf[16];
+			snprintf(buf, sizeof buf, "%s$%04X-$%04X", gaps.empty() ? "" : " ", (unsigned)((addr + i) & 0xffff), (unsigned)((addr + j - 1) & 0xffff));
+			gaps += buf;
+		}
+
+		i = j;
+	}
+
+	return gaps;
+}
+
+Program Program::split(const PRG &prg, const std::string &gaps) {
+	Program p;
+	p.path = prg.path;
+	p.entry = prg.load_address();
+
+	size_t n = prg.data.size() - 2;
+	// bytes of the PRG that are kept
+	std::vector<bool> keep(n, true);
+	std::istringstream words(gaps);
+	std::string w;
+
+	while (words >> w) {
+		unsigned lo, hi;
+
+		try {
+			size_t dash = w.find('-');
+
+			if (dash == std::string::npos)
+				throw std::runtime_error("expected $start-$end");
+
+			lo = parse_addr(w.substr(0, dash));
+			hi = parse_addr(w.substr(dash + 1));
+
+			if (lo > hi)
+				throw std::runtime_error("end before start");
+		} catch (const std::runtime_error &e) {
+			throw std::runtime_error("program: bad gap \"" + w + "\": " + e.what());
+		}
+
+		for (unsigned a = std::max<unsigned>(lo, p.entry); a <= hi && a - p.entry < n; ++a)
+			keep[a - p.entry] = false;
+	}
+
+	size_t i = 0;
+
+	while (i < n) {
+		size_t j = i;
+
+		while (j < n && keep[j] == keep[i])
+			++j;
+
+		if (keep[i])
+			p.add(p.entry + i, prg.data.slice(2 + i, j - i));
+
+		i = j;
+	}
+
+	return p;
+}
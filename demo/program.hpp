@@ -0,0 +1,70 @@
+#pragma once
+
+#include "mmap.hpp"
+#include "prg.hpp"
+#include "ultimate.hpp"
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+/** Bytes that are loaded at \a addr. */
+class Segment final {
+public:
+	uint16_t addr;
+	Bytes data;
+
+	Segment(uint16_t addr, Bytes &&data) : addr(addr), data(std::move(data)) {}
+
+	unsigned end() const noexcept { return addr + (unsigned)data.size(); }
+};
+
+/*
+ * Program made of several segments at scattered addresses, such as code,
+ * music and graphics. Unlike a PRG, the gaps between segments are never
+ * stored or sent: every segment is written with its own DMA write.
+ */
+class Program final {
+public:
+	std::string path;
+	std::vector<Segment> segs;
+	uint16_t entry;
+
+	Program() : path(), segs(), entry(0) {}
+	/** Single segment program from PRG. Starts at its load address. */
+	explicit Program(const PRG &prg);
+
+	/**
+	 * Load segments from \a path. Supported are Intel HEX files (.hex, .ihex)
+	 * as written by 64tass --intel-hex, segment lists (.seg) and plain PRGs.
+	 */
+	void load(const std::string &path);
+
+	/**
+	 * Find runs of at least \a min_gap equal bytes in PRG and list them as
+	 * "$1000-$1FFF $4000-$47FF" for split(). Such runs may as well be real
+	 * data, e.g. cleared buffers or tables, so they are only suggestions.
+	 */
+	static std::string find_gaps(const PRG &prg, unsigned min_gap=64);
+	/**
+	 * Split PRG by leaving out the address ranges listed in \a gaps as
+	 * written by find_gaps(). Useful for builds that were padded into one
+	 * PRG. All bytes outside the listed ranges are kept.
+	 */
+	static Program split(const PRG &prg, const std::string &gaps);
+
+	/**
+	 * Add segment. Throws if it does not fit in 64K or overlaps another
+	 * segment, as only one of them could end up in memory.
+	 */
+	void add(unsigned addr, Bytes &&data);
+
+	/** Number of bytes that are uploaded, not counting command headers. */
+	size_t payload() const;
+	/** Number of bytes from lowest to highest address, as a padded PRG would need. */
+	size_t span() const;
+
+	/** DMA writes for all segments, optionally followed by starting at entry. */
+	std::vector<Command> commands(bool start) const;
+};
@@ -0,0 +1,250 @@
+#include "proxy.hpp"
+
+#if _WIN32
+#include <winsock2.h>
+
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <stdexcept>
+
+static uint64_t now_us() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Proxy::Proxy(const char *device, uint16_t device_port, const char *address, uint16_t port) : listener(), upstream(), clients(), next_id(1), owner(0), rr(0), total(), started(now_us()), buf(64 * 1024) {
+	upstream.connect(device, device_port);
+	upstream.nodelay(true);
+
+	listener.bind(address, port);
+	listener.listen();
+}
+
+void Proxy::accept_client() {
+	std::unique_ptr<TcpSocket> sock;
+
+	try {
+		sock = listener.accept();
+		sock->nodelay(true);
+	} catch (const std::runtime_error &e) {
+		// the client may already have given up, that is no reason to stop serving the others
+		fprintf(stderr, "%s: %s\n", __func__, e.what());
+		return;
+	}
+
+	clients.emplace_back(new Client(next_id++, std::move(sock), now_us()));
+	printf("proxy: client %u connected\n", clients.back()->id);
+	fflush(stdout);
+}
+
+bool Proxy::read_client(Client &c) {
+	int in = c.sock->try_recv(buf.data(), buf.size(), 1);
+
+	if (in <= 0)
+		return false;
+
+	c.parser.feed(buf.data(), in);
+
+	Frame f;
+	uint16_t op;
+	uint64_t now = now_us();
+
+	while (c.parser.next(f.data, op)) {
+		f.received = now;
+		c.queued += f.data.size();
+		c.q.emplace_back(std::move(f));
+	}
+
+	c.stats.max_queued = std::max(c.stats.max_queued, c.queued);
+	return true;
+}
+
+void Proxy::read_upstream() {
+	int in = upstream.recv(buf.data(), buf.size(), 1);
+
+	if (!in)
+		throw SocketClosedError("proxy: device closed connection");
+
+	for (auto &c : clients) {
+		if (c->id != owner || c->closed)
+			continue;
+
+		try {
+			c->sock->send_fully(buf.data(), in);
+		} catch (const std::runtime_error &e) {
+			// only this client is dropped, its queued frames are still forwarded
+			printf("proxy: client %u: %s\n", c->id, e.what());
+			fflush(stdout);
+			c->closed = true;
+		}
+
+		return;
+	}
+
+	// owner is gone, drop response
+}
+
+void Proxy::schedule() {
+	size_t n = clients.size();
+
+	for (size_t i = 0; i < n; ++i) {
+		Client &c = *clients[(rr + i) % n];
+
+		if (c.q.empty()) {
+			c.deficit = 0;
+			continue;
+		}
+
+		c.deficit += quantum;
+
+		while (!c.q.empty() && c.q.front().data.size() <= c.deficit) {
+			Frame &f = c.q.front();
+			size_t size = f.data.size();
+
+			upstream.send_fully(f.data.data(), size);
+			owner = c.id;
+
+			uint64_t wait = now_us() - f.received;
+
+			for (Stats *st : { &c.stats, &total }) {
+				++st->frames;
+				st->bytes += size;
+				st->wait_us += wait;
+				st->max_wait_us = std::max(st->max_wait_us, wait);
+			}
+
+			c.deficit -= size;
+			c.queued -= size;
+			c.q.pop_front();
+		}
+
+		if (c.q.empty())
+			c.deficit = 0;
+	}
+
+	if (n)
+		rr = (rr + 1) % n;
+}
+
+void Proxy::remove_closed() {
+	for (size_t i = 0; i < clients.size(); ++i) {
+		Client &c = *clients[i];
+
+		if (!c.closed || !c.q.empty())
+			continue;
+
+		char name[32];
+
+		snprintf(name, sizeof name, "client %u", c.id);
+		printf("proxy: %s disconnected, %zu bytes dropped\n", name, c.parser.pending());
+		print_stats(stdout, name, c.stats, now_us() - c.connected);
+		fflush(stdout);
+
+		clients.erase(clients.begin() + i);
+		--i;
+	}
+}
+
+void Proxy::print_stats(FILE *f, const char *name, const Stats &st, uint64_t elapsed_us) {
+	double s = elapsed_us / 1e6;
+
+	fprintf(f, "%-10s %10llu frames %12llu bytes %10.1f KiB/s  wait avg %8.1f us max %8llu us  max queued %zu\n",
+		name, (unsigned long long)st.frames, (unsigned long long)st.bytes,
+		s > 0 ? st.bytes / 1024.0 / s : 0.0,
+		st.frames ? (double)st.wait_us / st.frames : 0.0,
+		(unsigned long long)st.max_wait_us, st.max_queued);
+}
+
+void Proxy::print_stats(FILE *f) const {
+	uint64_t now = now_us();
+	char name[32];
+
+	for (const auto &c : clients) {
+		snprintf(name, sizeof name, "client %u", c->id);
+		print_stats(f, name, c->stats, now - c->connected);
+	}
+
+	print_stats(f, "total", total, now - started);
+	fflush(f);
+}
+
+void Proxy::run(unsigned report_interval) {
+	std::vector<pollfd> fds;
+	uint64_t next_report = now_us() + report_interval * 1000000ull;
+
+	while (true) {
+		fds.clear();
+		fds.push_back(pollfd{ listener.fd(), POLLIN, 0 });
+		fds.push_back(pollfd{ upstream.fd(), POLLIN, 0 });
+
+		bool busy = false;
+
+		for (const auto &c : clients) {
+			// stop reading from clients that are too far ahead, so tcp flow control slows them down
+			fds.push_back(pollfd{ c->closed ? INVALID_SOCKET : c->sock->fd(), (short)(c->queued < max_queued ? POLLIN : 0), 0 });
+			busy |= !c->q.empty();
+		}
+
+		if (poll(fds.data(), fds.size(), busy ? 0 : 1000) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			throw std::runtime_error(std::string("proxy: poll failed: ") + strerror(errno));
+		}
+
+		if (fds[1].revents & (POLLIN | POLLERR | POLLHUP))
+			read_upstream();
+
+		for (size_t i = 0; i < clients.size(); ++i) {
+			short ev = fds[2 + i].revents;
+
+			if ((ev & (POLLIN | POLLERR | POLLHUP)) && !read_client(*clients[i]))
+				clients[i]->closed = true;
+		}
+
+		if (fds[0].revents & POLLIN)
+			accept_client();
+
+		schedule();
+		remove_closed();
+
+		if (report_interval && now_us() >= next_report) {
+			print_stats(stdout);
+			next_report += report_interval * 1000000ull;
+		}
+	}
+}
+
+int proxy_main(int argc, char **argv) {
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s --proxy DEVICE_IP [DEVICE_PORT [LISTEN_PORT [LISTEN_IP]]]\n", argv[0]);
+		return 1;
+	}
+
+	const char *device = argv[2];
+	uint16_t device_port = argc > 3 ? atoi(argv[3]) : 64;
+	uint16_t port = argc > 4 ? atoi(argv[4]) : 6464;
+	const char *address = argc > 5 ? argv[5] : "127.0.0.1";
+
+	try {
+		Net net;
+		Proxy proxy(device, device_port, address, port);
+
+		printf("proxy: forwarding %s:%u to %s:%u\n", address, port, device, device_port);
+		proxy.run();
+	} catch (const std::runtime_error &e) {
+		fprintf(stderr, "%s: %s\n", __func__, e.what());
+		return 1;
+	}
+
+	return 0;
+}
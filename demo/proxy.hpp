@@ -0,0 +1,84 @@
+#pragma once
+
+#include "net.hpp"
+#include "ultimate.hpp"
+
+#include <cstdint>
+#include <cstdio>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Accepts any number of local clients and merges their commands into a
+ * single connection to the Ultimate. Frames are never split: the proxy only
+ * forwards complete frames and picks the next client using deficit round
+ * robin, so clients get an equal share of the upstream bandwidth no matter
+ * how large their frames are. Data sent back by the device is forwarded to
+ * the client whose frame was sent last.
+ */
+class Proxy final {
+public:
+	/** Bytes a client may send per scheduling round. */
+	static constexpr size_t quantum = 4096;
+	/** Stop reading from clients that have this many bytes queued. */
+	static constexpr size_t max_queued = 1 << 20;
+
+	class Stats final {
+	public:
+		uint64_t frames, bytes;
+		uint64_t wait_us, max_wait_us; // time between frame complete and sent upstream
+		size_t max_queued;
+
+		Stats() : frames(0), bytes(0), wait_us(0), max_wait_us(0), max_queued(0) {}
+	};
+private:
+	class Frame final {
+	public:
+		std::vector<uint8_t> data;
+		uint64_t received;
+	};
+
+	class Client final {
+	public:
+		unsigned id;
+		std::unique_ptr<TcpSocket> sock;
+		FrameParser parser;
+		std::deque<Frame> q;
+		size_t queued;
+		size_t deficit;
+		uint64_t connected;
+		bool closed; // queued frames are still forwarded after the client hung up
+		Stats stats;
+
+		Client(unsigned id, std::unique_ptr<TcpSocket> &&sock, uint64_t connected) : id(id), sock(std::move(sock)), parser(), q(), queued(0), deficit(0), connected(connected), closed(false), stats() {}
+	};
+
+	TcpSocket listener;
+	TcpSocket upstream;
+	std::vector<std::unique_ptr<Client>> clients;
+	unsigned next_id;
+	unsigned owner; // id of client that gets device responses
+	size_t rr; // round robin position
+	Stats total;
+	uint64_t started;
+	std::vector<uint8_t> buf;
+
+	void accept_client();
+	bool read_client(Client &c);
+	void read_upstream();
+	void schedule();
+	void remove_closed();
+	void print_stats(FILE *f) const;
+	static void print_stats(FILE *f, const char *name, const Stats &st, uint64_t elapsed_us);
+public:
+	Proxy(const char *device, uint16_t device_port, const char *address, uint16_t port);
+
+	/** Serve clients forever. Statistics are printed to stdout every \a report_interval seconds. */
+	void run(unsigned report_interval=10);
+};
+
+/** Entry point for `c64mon --proxy`. */
+int proxy_main(int argc, char **argv);
@@ -0,0 +1,305 @@
+#include "raster.hpp"
+#include "c64.hpp"
+
+#include <cstdio>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+
+const render::Regs &render::Snapshot::regs(unsigned line) const {
+	auto it = std::upper_bound(changes.begin(), changes.end(), line, [](unsigned l, const Change &c) { return l < c.line; });
+	return std::prev(it)->regs;
+}
+
+render::Memory render::Snapshot::memory() const {
+	return Memory{ ram.data(), has_chargen ? chargen.data() : nullptr, color.data() };
+}
+
+// lines first to last of the picture, not raster lines
+static void draw(Renderer &rd, uint32_t *out, const render::Snapshot &s, unsigned first, unsigned last) {
+	render::Memory mem = s.memory();
+
+	for (unsigned y = first; y < last; ++y)
+		rd.line(out + y * render::width, render::top + y, s.regs(render::top + y), mem);
+}
+
+Recorder::Recorder(Machine &m) : m(m), id(m.sched.add(this)), out(nullptr), cur(), start(0), dirty(0), frames(0) {}
+
+void Recorder::begin(uint64_t now) {
+	start = now - now % VicII::frame_cycles;
+	dirty = 0;
+
+	cur = std::make_unique<render::Snapshot>();
+	cur->changes.push_back(render::Snapshot::Change{ 0, render::capture(m) });
+	m.sched.schedule(id, start + VicII::frame_cycles);
+}
+
+void Recorder::finish(uint64_t now) {
+	if (dirty)
+		keep(dirty);
+
+	render::Snapshot &s = *cur;
+	const uint8_t *chargen = m.bus.char_image();
+
+	s.number = frames++;
+	s.ram = m.bus.ram;
+	s.color = m.bus.color;
+	s.has_chargen = chargen != nullptr;
+
+	if (chargen)
+		std::copy(chargen, chargen + s.chargen.size(), s.chargen.begin());
+
+	out->submit(std::move(cur));
+	begin(now);
+}
+
+void Recorder::keep(unsigned line) {
+	// a change in the last line shows from the first line of the next frame
+	if (line >= VicII::lines)
+		return;
+
+	render::Regs r = render::capture(m);
+	const render::Regs &prev = cur->changes.back().regs;
+
+	if (r.r != prev.r || r.bank != prev.bank)
+		cur->changes.push_back(render::Snapshot::Change{ line, r });
+}
+
+void Recorder::record(Pipeline *p) {
+	out = p;
+	m.vic.rec = m.cia2.rec = p ? this : nullptr;
+
+	if (p) {
+		begin(m.cpu.cycles);
+	} else {
+		cur.reset();
+		m.sched.schedule(id, Scheduler::never);
+	}
+}
+
+void Recorder::change(uint64_t now) {
+	if (!out)
+		return;
+
+	// the clock goes back when a snapshot is restored
+	if (now < start)
+		begin(now);
+	else if (now >= start + VicII::frame_cycles)
+		finish(now);
+
+	unsigned line = (unsigned)((now - start) / VicII::line_cycles);
+
+	// the registers as they are now are those after the writes in the line of the last change
+	if (dirty && dirty != line + 1)
+		keep(dirty);
+
+	dirty = line + 1;
+}
+
+void Recorder::event(uint64_t now) {
+	if (now < start)
+		begin(now);
+	else
+		finish(now);
+}
+
+Pipeline::Pipeline(unsigned workers, bool simd) : m(), work(), idle(), drawing(), queued(), last(), pixels(render::width * render::height), shown(render::width * render::height), taken(0), drawn(0), frames(0), running(true), simd(simd), own(simd), threads() {
+	for (unsigned i = 0; i < workers; ++i)
+		threads.emplace_back(&Pipeline::main, this);
+}
+
+Pipeline::~Pipeline() {
+	{
+		std::lock_guard<std::mutex> lk(m);
+		running = false;
+	}
+
+	work.notify_all();
+
+	for (std::thread &t : threads)
+		t.join();
+}
+
+// with m locked, after the last band of drawing
+void Pipeline::finish() {
+	pixels.swap(shown);
+	last = std::move(drawing);
+	++frames;
+
+	drawing = std::move(queued);
+	taken = drawn = 0;
+
+	if (drawing)
+		work.notify_all();
+
+	idle.notify_all();
+}
+
+void Pipeline::main() {
+	Renderer rd(simd);
+	std::unique_lock<std::mutex> lk(m);
+
+	for (;;) {
+		work.wait(lk, [this]() { return !running || (drawing && taken < bands); });
+
+		if (!running)
+			return;
+
+		// drawing and pixels stay until every band is drawn
+		unsigned b = taken++;
+		const render::Snapshot &s = *drawing;
+		uint32_t *out = pixels.data();
+
+		lk.unlock();
+		draw(rd, out, s, b * band, std::min(render::height, (b + 1) * band));
+		lk.lock();
+
+		if (++drawn == bands)
+			finish();
+	}
+}
+
+void Pipeline::submit(std::unique_ptr<render::Snapshot> &&s) {
+	if (threads.empty()) {
+		draw(own, pixels.data(), *s, 0, render::height);
+
+		std::lock_guard<std::mutex> lk(m);
+		drawing = std::move(s);
+		finish();
+		return;
+	}
+
+	std::unique_lock<std::mutex> lk(m);
+	idle.wait(lk, [this]() { return !queued; });
+
+	if (drawing) {
+		queued = std::move(s);
+	} else {
+		drawing = std::move(s);
+		work.notify_all();
+	}
+}
+
+void Pipeline::wait() {
+	std::unique_lock<std::mutex> lk(m);
+	idle.wait(lk, [this]() { return !drawing && !queued; });
+}
+
+uint64_t Pipeline::picture(std::vector<uint32_t> &out, render::Snapshot *s) const {
+	std::lock_guard<std::mutex> lk(m);
+
+	if (frames) {
+		out = shown;
+
+		if (s)
+			*s = *last;
+	}
+
+	return frames;
+}
+
+uint64_t Pipeline::finished() const {
+	std::lock_guard<std::mutex> lk(m);
+	return frames;
+}
+
+void raster_bench(double seconds) {
+	/*
+	 * Sets the background colour to the raster line, XSCROLL to its low bits,
+	 * switches between text and bitmap every 32 lines and moves the character
+	 * base every 2 lines, and counts the border colour up, all several times
+	 * per line. Two sprites are expanded on the screen.
+	 */
+	static const uint8_t code[] = {
+		0x78, 0xa9,0xff, 0x8d,0x15,0xd0, 0x8d,0x1d,0xd0,
+		0xa9,0x64, 0x8d,0x00,0xd0, 0x8d,0x01,0xd0, 0xa9,0xa0, 0x8d,0x02,0xd0, 0x8d,0x03,0xd0,
+		0xad,0x12,0xd0, 0x8d,0x21,0xd0, 0x29,0x07, 0x09,0x08, 0x8d,0x16,0xd0,
+		0xad,0x12,0xd0, 0x29,0x20, 0x09,0x1b, 0x8d,0x11,0xd0,
+		0xad,0x12,0xd0, 0x29,0x0e, 0x09,0x18, 0x8d,0x18,0xd0,
+		0xee,0x20,0xd0, 0x4c,0x19,0x10,
+	};
+
+	class Rig final {
+	public:
+		std::unique_ptr<C64Bus> bus;
+		CPU cpu;
+		Machine m;
+
+		Rig() : bus(std::make_unique<C64Bus>()), cpu(*bus), m(*bus, cpu) {
+			uint32_t seed = 0x6569;
+
+			auto rnd = [&seed]() {
+				seed = seed * 1103515245 + 12345;
+				return (uint8_t)(seed >> 16);
+			};
+
+			for (uint8_t &b : bus->ram)
+				b = rnd();
+
+			for (uint8_t &b : bus->color)
+				b = rnd();
+
+			bus->cpu = &cpu;
+			bus->load(0x1000, code, sizeof code);
+			cpu.r.pc = 0x1000;
+		}
+	};
+
+	unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+	bool same = true;
+
+	// every frame drawn by the workers against the same frame drawn by one thread and line by line
+	{
+		Rig a, b;
+		Pipeline serial(0), parallel(cores);
+		Renderer rd;
+		std::vector<uint32_t> pa, pb, direct(render::width * render::height);
+		auto s = std::make_unique<render::Snapshot>();
+
+		a.m.recorder.record(&serial);
+		b.m.recorder.record(&parallel);
+
+		for (unsigned f = 0; f < 20; ++f) {
+			a.m.run(VicII::frame_cycles);
+			b.m.run(VicII::frame_cycles);
+			parallel.wait();
+
+			uint64_t n = serial.picture(pa, s.get());
+
+			if (n != parallel.picture(pb)) {
+				same = false;
+			} else if (n) {
+				draw(rd, direct.data(), *s, 0, render::height);
+				same &= pa == pb && pa == direct;
+			}
+		}
+	}
+
+	double fps[2];
+	size_t changes = 0;
+
+	for (int i = 0; i < 2; ++i) {
+		Rig r;
+		Pipeline p(i ? cores : 0);
+		auto s = std::make_unique<render::Snapshot>();
+		std::vector<uint32_t> pix;
+		auto start = std::chrono::steady_clock::now();
+		double t;
+
+		r.m.recorder.record(&p);
+
+		do {
+			r.m.run(VicII::frame_cycles);
+			t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		} while (t < seconds / 2);
+
+		p.wait();
+		t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fps[i] = p.picture(pix, s.get()) / t;
+		changes = s->changes.size();
+	}
+
+	printf("raster   %2u threads %8.0f fps serial %8.0f fps %6.2fx  %3u changes per frame%s\n",
+		cores, fps[1], fps[0], fps[1] / fps[0], (unsigned)changes, same ? "" : "  MISMATCH");
+}
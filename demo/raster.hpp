@@ -0,0 +1,123 @@
+#pragma once
+
+#include "events.hpp"
+#include "render.hpp"
+
+#include <cstdint>
+
+#include <array>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Machine;
+class Pipeline;
+
+namespace render {
+	/** What a frame is drawn from: the registers of every raster line and the memory at its end. */
+	class Snapshot final {
+	public:
+		class Change final {
+		public:
+			unsigned line; // first line drawn with regs
+			Regs regs;
+		};
+
+		uint64_t number; // frames since recording started
+		std::vector<Change> changes; // by line, the first one at line 0
+		std::array<uint8_t, 0x10000> ram;
+		std::array<uint8_t, 0x400> color;
+		std::array<uint8_t, 0x1000> chargen;
+		bool has_chargen;
+
+		const Regs &regs(unsigned line) const;
+		Memory memory() const;
+	};
+}
+
+/*
+ * Records on the emulator thread what the raster lines of a frame are drawn
+ * with. The VIC-II and CIA 2 tell it before a register the picture depends
+ * on changes, and only then are the registers copied, so a frame costs one
+ * event at its end and one copy per line in which something changed, plus a
+ * copy of the memory when it is handed to a Pipeline.
+ *
+ * A line is drawn with the registers as they are when it starts, so a write
+ * shows from the next line on. Memory is as it is at the end of the frame.
+ */
+class Recorder final : public Scheduler::Device {
+	Machine &m;
+	unsigned id;
+	Pipeline *out;
+	std::unique_ptr<render::Snapshot> cur;
+	uint64_t start; // cycle at which cur starts
+	unsigned dirty; // line from which changes are not recorded yet, 0 if none
+	uint64_t frames;
+
+	void begin(uint64_t now);
+	void finish(uint64_t now);
+	void keep(unsigned line);
+public:
+	explicit Recorder(Machine &m);
+	Recorder(const Recorder&) = delete;
+
+	/** Hand every frame from now on to \a p, nullptr stops. */
+	void record(Pipeline *p);
+	bool recording() const noexcept { return out != nullptr; }
+
+	/** Called before a register the picture depends on changes at cycle \a now. */
+	void change(uint64_t now);
+	void event(uint64_t now) override;
+};
+
+/*
+ * Draws recorded frames on worker threads, each with its own Renderer. A
+ * frame is split in bands of lines that the workers take one at a time, and
+ * as every line only depends on its own registers and the memory of the
+ * snapshot, the picture is the same as when one renderer draws it from top
+ * to bottom. While the workers draw a frame the emulator records the next
+ * one, and it waits in submit() when it gets another frame ahead.
+ */
+class Pipeline final {
+	mutable std::mutex m;
+	std::condition_variable work, idle;
+	std::unique_ptr<render::Snapshot> drawing, queued, last; // last is what shown was drawn from
+	std::vector<uint32_t> pixels, shown;
+	unsigned taken, drawn; // bands of drawing
+	uint64_t frames;
+	bool running;
+	bool simd;
+	Renderer own; // draws in submit() without workers
+	std::vector<std::thread> threads;
+
+	void main();
+	void finish();
+public:
+	/** Lines a worker draws at once. */
+	static constexpr unsigned band = 16;
+	static constexpr unsigned bands = (render::height + band - 1) / band;
+
+	/** With \a workers threads, 0 draws on the thread that submits. */
+	explicit Pipeline(unsigned workers, bool simd=true);
+	Pipeline(const Pipeline&) = delete;
+	~Pipeline();
+
+	/** Draw \a s after the frame before it. Waits while another frame is already queued. */
+	void submit(std::unique_ptr<render::Snapshot> &&s);
+	/** Wait until every frame submitted is drawn. */
+	void wait();
+
+	/**
+	 * Copy the last frame drawn to \a out and the snapshot it was drawn from
+	 * to \a s, if not nullptr. Returns the number of frames drawn so far,
+	 * nothing is copied if 0.
+	 */
+	uint64_t picture(std::vector<uint32_t> &out, render::Snapshot *s=nullptr) const;
+	uint64_t finished() const;
+	unsigned workers() const noexcept { return (unsigned)threads.size(); }
+};
+
+/** Measure frames per second of recording and drawing a frame with raster effects, serial against all cores, and check both give the same pictures. */
+void raster_bench(double seconds);
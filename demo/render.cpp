@@ -0,0 +1,308 @@
+#include "render.hpp"
+#include "c64.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+static void scalar_cells(uint8_t *out, uint8_t *fg, const uint8_t *bits, const uint8_t *multi, const uint8_t *colours, size_t n) {
+	for (size_t i = 0; i < n; ++i, out += 8, fg += 8) {
+		unsigned b = bits[i];
+		const uint8_t *c = colours + 4 * i;
+
+		if (multi[i]) {
+			for (unsigned p = 0; p < 8; ++p) {
+				unsigned s = b >> (6 - (p & 6)) & 3;
+
+				out[p] = c[s];
+				fg[p] = s & 2 ? 0xff : 0;
+			}
+		} else {
+			for (unsigned p = 0; p < 8; ++p) {
+				unsigned s = b >> (7 - p) & 1;
+
+				out[p] = c[3 * s];
+				fg[p] = s ? 0xff : 0;
+			}
+		}
+	}
+}
+
+static void scalar_rgba(uint32_t *out, const uint8_t *index, size_t n, const uint32_t *palette) {
+	for (size_t i = 0; i < n; ++i)
+		out[i] = palette[index[i] & 15];
+}
+
+const render::Kernels *render::scalar() {
+	static const Kernels k{ scalar_cells, scalar_rgba };
+	return &k;
+}
+
+static const render::Kernels *best_kernels(bool simd) {
+#if __GNUC__ && (defined(__x86_64__) || defined(__i386__))
+	if (simd && __builtin_cpu_supports("avx2") && render::avx2())
+		return render::avx2();
+#endif
+
+	return render::scalar();
+}
+
+render::Memory render::memory(const C64Bus &bus) {
+	return Memory{ bus.ram.data(), bus.char_image(), bus.color.data() };
+}
+
+render::Regs render::capture(const Machine &m) {
+	Regs r;
+
+	std::copy(m.vic.registers().begin(), m.vic.registers().begin() + r.r.size(), r.r.begin());
+	r.bank = ~m.cia2.port_a() & 3;
+	return r;
+}
+
+// the character ROM shows at $1000 to $1FFF of banks 0 and 2
+static uint8_t fetch(const render::Memory &m, unsigned bank, unsigned addr) {
+	if (!(bank & 1) && (addr & 0x3000) == 0x1000 && m.chargen)
+		return m.chargen[addr & 0xfff];
+
+	return m.ram[bank << 14 | (addr & 0x3fff)];
+}
+
+Renderer::Renderer(bool simd) : k(best_kernels(simd)), index(), fg(), taken(), bits(), multi(), colours(), palette() {
+	static const uint8_t pepto[16][3] = {
+		{ 0x00, 0x00, 0x00 }, { 0xff, 0xff, 0xff }, { 0x68, 0x37, 0x2b }, { 0x70, 0xa4, 0xb2 },
+		{ 0x6f, 0x3d, 0x86 }, { 0x58, 0x8d, 0x43 }, { 0x35, 0x28, 0x79 }, { 0xb8, 0xc7, 0x6f },
+		{ 0x6f, 0x4f, 0x25 }, { 0x43, 0x39, 0x00 }, { 0x9a, 0x67, 0x59 }, { 0x44, 0x44, 0x44 },
+		{ 0x6c, 0x6c, 0x6c }, { 0x9a, 0xd2, 0x84 }, { 0x6c, 0x5e, 0xb5 }, { 0x95, 0x95, 0x95 },
+	};
+
+	for (unsigned i = 0; i < 16; ++i) {
+		uint8_t rgba[4] = { pepto[i][0], pepto[i][1], pepto[i][2], 0xff };
+		memcpy(&palette[i], rgba, sizeof rgba);
+	}
+}
+
+bool Renderer::avx2() const noexcept {
+	return k != render::scalar();
+}
+
+void Renderer::gather(unsigned dy, const render::Regs &regs, const render::Memory &m) {
+	const uint8_t *r = regs.r.data();
+	unsigned row = dy >> 3, y = dy & 7;
+	unsigned screen = (r[0x18] >> 4) << 10, chars = (r[0x18] & 0xe) << 10, bitmap = (r[0x18] & 8) << 10;
+	bool ecm = r[0x11] & 0x40, bmm = r[0x11] & 0x20, mcm = r[0x16] & 0x10;
+	uint8_t bg[4] = { (uint8_t)(r[0x21] & 15), (uint8_t)(r[0x22] & 15), (uint8_t)(r[0x23] & 15), (uint8_t)(r[0x24] & 15) };
+
+	for (unsigned c = 0; c < 40; ++c) {
+		unsigned cell = row * 40 + c;
+		uint8_t s = fetch(m, regs.bank, screen + cell), col = m.color[cell] & 15;
+		uint8_t *k = &colours[4 * c];
+
+		k[0] = k[1] = k[2] = k[3] = 0;
+		multi[c] = 0;
+
+		if (ecm && (bmm || mcm)) {
+			// invalid modes are black, but still have foreground pixels
+			bits[c] = bmm ? fetch(m, regs.bank, bitmap + cell * 8 + y) : fetch(m, regs.bank, chars + (s & 0x3f) * 8 + y);
+			multi[c] = mcm && (bmm || col & 8) ? 0xff : 0;
+		} else if (bmm) {
+			bits[c] = fetch(m, regs.bank, bitmap + cell * 8 + y);
+
+			if (mcm) {
+				multi[c] = 0xff;
+				k[0] = bg[0];
+				k[1] = s >> 4;
+				k[2] = s & 15;
+				k[3] = col;
+			} else {
+				k[0] = s & 15;
+				k[3] = s >> 4;
+			}
+		} else if (ecm) {
+			bits[c] = fetch(m, regs.bank, chars + (s & 0x3f) * 8 + y);
+			k[0] = bg[s >> 6];
+			k[3] = col;
+		} else {
+			bits[c] = fetch(m, regs.bank, chars + s * 8 + y);
+			k[0] = bg[0];
+
+			// in multicolour text mode, bit 3 of the colour selects multicolour for the cell
+			if (mcm && col & 8) {
+				multi[c] = 0xff;
+				k[1] = bg[1];
+				k[2] = bg[2];
+				k[3] = col & 7;
+			} else {
+				k[3] = mcm ? col & 7 : col;
+			}
+		}
+	}
+}
+
+void Renderer::sprites(unsigned raster, const render::Regs &regs, const render::Memory &m) {
+	const uint8_t *r = regs.r.data();
+	unsigned screen = (r[0x18] >> 4) << 10;
+	bool any = false;
+
+	// sprite 0 has the highest priority, so it takes its pixels first
+	for (unsigned n = 0; n < 8; ++n) {
+		bool yexp = r[0x17] >> n & 1, xexp = r[0x1d] >> n & 1, mc = r[0x1c] >> n & 1, behind = r[0x1b] >> n & 1;
+		int d = (int)raster - r[1 + 2 * n] - 1;
+
+		if (!(r[0x15] >> n & 1) || d < 0 || d >= (yexp ? 42 : 21))
+			continue;
+
+		if (!any) {
+			taken.fill(0);
+			any = true;
+		}
+
+		unsigned row = yexp ? d >> 1 : d;
+		unsigned data = fetch(m, regs.bank, screen + 0x3f8 + n) << 6 | row * 3;
+		uint32_t pattern = fetch(m, regs.bank, data) << 16 | fetch(m, regs.bank, data + 1) << 8 | fetch(m, regs.bank, data + 2);
+		uint8_t cols[4] = { 0, (uint8_t)(r[0x25] & 15), (uint8_t)(r[0x27 + n] & 15), (uint8_t)(r[0x26] & 15) };
+		unsigned x = (r[2 * n] | (r[0x10] >> n & 1) << 8) + 8, w = xexp ? 2 : 1;
+
+		for (unsigned p = 0; p < 24; ++p) {
+			unsigned s = mc ? pattern >> (22 - (p & ~1u)) & 3 : (pattern >> (23 - p) & 1) * 2;
+
+			if (!s)
+				continue;
+
+			for (unsigned i = 0; i < w; ++i) {
+				unsigned pos = x + p * w + i;
+
+				if (pos >= render::width || taken[pos])
+					continue;
+
+				taken[pos] = 1;
+
+				if (!behind || !fg[pos])
+					index[pos] = cols[s];
+			}
+		}
+	}
+}
+
+void Renderer::line(uint32_t *out, unsigned raster, const render::Regs &regs, const render::Memory &m) {
+	const uint8_t *r = regs.r.data();
+	uint8_t border = r[0x20] & 15;
+	bool rsel = r[0x11] & 8, csel = r[0x16] & 8;
+	unsigned first = rsel ? 51 : 55, last = rsel ? 251 : 247;
+
+	// the vertical border also covers sprites
+	if (!(r[0x11] & 0x10) || raster < first || raster >= last) {
+		std::fill(index.begin(), index.begin() + render::width, border);
+		k->rgba(out, index.data(), render::width, palette.data());
+		return;
+	}
+
+	std::fill(index.begin(), index.end(), r[0x21] & 15);
+	std::fill(fg.begin(), fg.end(), 0);
+
+	int dy = (int)raster - 0x30 - (r[0x11] & 7);
+
+	if (dy >= 0 && dy < 200) {
+		unsigned x = 32 + (r[0x16] & 7);
+
+		gather(dy, regs, m);
+		k->cells(&index[x], &fg[x], bits.data(), multi.data(), colours.data(), bits.size());
+	}
+
+	sprites(raster, regs, m);
+
+	unsigned left = csel ? 32 : 39, right = csel ? 352 : 343;
+
+	std::fill(index.begin(), index.begin() + left, border);
+	std::fill(index.begin() + right, index.begin() + render::width, border);
+	k->rgba(out, index.data(), render::width, palette.data());
+}
+
+void Renderer::frame(uint32_t *out, const render::Regs &r, const render::Memory &m) {
+	for (unsigned y = 0; y < render::height; ++y)
+		line(out + y * render::width, render::top + y, r, m);
+}
+
+void render_bench(double seconds) {
+	class Mode final {
+	public:
+		const char *name;
+		uint8_t d011, d016;
+	};
+
+	static const Mode modes[] = {
+		{ "text", 0x1b, 0x08 },
+		{ "mctext", 0x1b, 0x18 },
+		{ "bitmap", 0x3b, 0x08 },
+		{ "mcbitmap", 0x3b, 0x18 },
+		{ "ecm", 0x5b, 0x08 },
+	};
+
+	auto ram = std::make_unique<std::array<uint8_t, 0x10000>>();
+	std::array<uint8_t, 0x400> color;
+	uint32_t seed = 0x6569;
+
+	auto rnd = [&seed]() {
+		seed = seed * 1103515245 + 12345;
+		return (uint8_t)(seed >> 16);
+	};
+
+	for (uint8_t &b : *ram)
+		b = rnd();
+
+	for (uint8_t &b : color)
+		b = rnd();
+
+	render::Memory m{ ram->data(), nullptr, color.data() };
+	render::Regs r{};
+
+	// screen at $0400, characters and bitmap at $2000, all sprites on the screen in different modes
+	r.r[0x18] = 0x18;
+	r.r[0x15] = 0xff;
+	r.r[0x17] = 0x0f;
+	r.r[0x1b] = 0x33;
+	r.r[0x1c] = 0x55;
+	r.r[0x1d] = 0xf0;
+
+	for (unsigned n = 0; n < 8; ++n) {
+		r.r[2 * n] = (uint8_t)(24 + 36 * n);
+		r.r[2 * n + 1] = (uint8_t)(50 + 22 * n);
+	}
+
+	for (unsigned i = 0x20; i < r.r.size(); ++i)
+		r.r[i] = rnd();
+
+	std::vector<uint32_t> pix[2];
+
+	for (const Mode &mode : modes) {
+		double fps[2];
+		bool simd = false;
+
+		r.r[0x11] = mode.d011;
+		r.r[0x16] = mode.d016;
+
+		for (int i = 0; i < 2; ++i) {
+			Renderer rd(i);
+			unsigned frames = 0;
+			auto start = std::chrono::steady_clock::now();
+			double s;
+
+			pix[i].assign(render::width * render::height, 0);
+			simd |= rd.avx2();
+
+			do {
+				rd.frame(pix[i].data(), r, m);
+				++frames;
+				s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			} while (s < seconds / 2);
+
+			fps[i] = frames / s;
+		}
+
+		printf("render   %-8s %8.0f fps scalar %8.0f fps %-6s %6.2fx%s\n", mode.name, fps[0], fps[1], simd ? "avx2" : "scalar",
+			fps[1] / fps[0], pix[0] == pix[1] ? "" : "  MISMATCH");
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+
+class C64Bus;
+class Machine;
+
+namespace render {
+	/** Picture with borders in pixels, and the raster line of its top. */
+	constexpr unsigned width = 384, height = 272, top = 16;
+
+	/** Memory as the VIC-II reads it. */
+	class Memory final {
+	public:
+		const uint8_t *ram; // 64K
+		const uint8_t *chargen; // 4K, nullptr if not loaded
+		const uint8_t *color; // 1K, low nybbles
+	};
+
+	/** Registers $D000 to $D02E and the bank from CIA 2 that a raster line is drawn with. */
+	class Regs final {
+	public:
+		std::array<uint8_t, 0x2f> r;
+		uint8_t bank; // 0 to 3 for $0000 to $C000
+	};
+
+	/** Pixel kernels for one instruction set. */
+	class Kernels final {
+	public:
+		/**
+		 * Expand \a n cells of 8 pixels each, n a multiple of 4. Cell i has
+		 * pattern bits[i] and colours[4 * i] to colours[4 * i + 3]. If multi[i]
+		 * is $FF it shows bit pairs as wide pixels of the 4 colours, otherwise
+		 * set bits show the last colour and clear bits the first. Writes a
+		 * colour index per pixel to out, and $FF for foreground pixels, which
+		 * are those of bit pairs 10 and 11 or of set bits, to fg.
+		 */
+		void (*cells)(uint8_t *out, uint8_t *fg, const uint8_t *bits, const uint8_t *multi, const uint8_t *colours, size_t n);
+		/** Look up \a n colour indices in \a palette, n a multiple of 32. */
+		void (*rgba)(uint32_t *out, const uint8_t *index, size_t n, const uint32_t *palette);
+	};
+
+	const Kernels *scalar();
+	/** nullptr if not built with AVX2. Only run the kernels if the CPU supports it. */
+	const Kernels *avx2();
+
+	Memory memory(const C64Bus &bus);
+	/** Registers as they are now. */
+	Regs capture(const Machine &m);
+}
+
+/*
+ * Draws the PAL picture of a VIC-II one raster line at a time from the
+ * registers of that line: standard, multicolour and extended colour text,
+ * standard and multicolour bitmap, sprites and the borders. Per line the
+ * character, bitmap and colour bytes of the 40 cells are gathered, expanded
+ * to colour indices by a vector kernel that selects pixels with shuffles
+ * instead of branches, sprites and borders are drawn over them, and another
+ * kernel looks the indices up in the palette as RGBA.
+ *
+ * The row counters are computed from the raster line and YSCROLL, so tricks
+ * that play with the VIC's internal counters, like FLD or line crunching,
+ * and collisions are not shown. Sprites do not wrap around at the edges.
+ */
+class Renderer final {
+	const render::Kernels *k;
+	alignas(32) std::array<uint8_t, render::width + 16> index, fg;
+	std::array<uint8_t, render::width> taken; // by a sprite with higher priority
+	alignas(32) std::array<uint8_t, 40> bits, multi;
+	alignas(32) std::array<uint8_t, 160> colours;
+
+	void gather(unsigned dy, const render::Regs &r, const render::Memory &m);
+	void sprites(unsigned raster, const render::Regs &r, const render::Memory &m);
+public:
+	/** RGBA bytes in memory, the palette by Pepto. */
+	std::array<uint32_t, 16> palette;
+
+	/** With the AVX2 kernels if \a simd and the CPU supports them. */
+	explicit Renderer(bool simd=true);
+
+	bool avx2() const noexcept;
+
+	/** Draw raster line \a raster into \a out, render::width pixels. */
+	void line(uint32_t *out, unsigned raster, const render::Regs &r, const render::Memory &m);
+	/** Draw the picture into \a out with the same registers for every line. */
+	void frame(uint32_t *out, const render::Regs &r, const render::Memory &m);
+};
+
+/** Measure frames per second of every mode with and without the vector kernels. */
+void render_bench(double seconds);
@@ -0,0 +1,112 @@
+/*
+ * AVX2 kernels of Renderer. This file is built with -mavx2, so nothing in it
+ * may run before the caller has checked that the CPU supports AVX2.
+ */
+
+#include "render.hpp"
+
+#if __AVX2__
+
+#include <immintrin.h>
+
+namespace {
+
+// every byte of \a b repeated 8 times, one per 64 bit quarter
+__m256i spread(const uint8_t *b) {
+	const uint64_t ones = 0x0101010101010101ull;
+
+	return _mm256_setr_epi64x((long long)(b[0] * ones), (long long)(b[1] * ones), (long long)(b[2] * ones), (long long)(b[3] * ones));
+}
+
+/*
+ * Four cells, 32 pixels, at a time. The pixel bits are tested with one mask
+ * per pixel, which gives the selector of each pixel, 0 or 3 for hires and
+ * the bit pair for multicolour. A shuffle then looks the selectors up in the
+ * colours of their cell.
+ */
+void cells(uint8_t *out, uint8_t *fg, const uint8_t *bits, const uint8_t *multi, const uint8_t *colours, size_t n) {
+	const __m256i hires = _mm256_setr_epi8(
+		-128, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, -128, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+		-128, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, -128, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	const __m256i high = _mm256_setr_epi8(
+		-128, -128, 0x20, 0x20, 0x08, 0x08, 0x02, 0x02, -128, -128, 0x20, 0x20, 0x08, 0x08, 0x02, 0x02,
+		-128, -128, 0x20, 0x20, 0x08, 0x08, 0x02, 0x02, -128, -128, 0x20, 0x20, 0x08, 0x08, 0x02, 0x02);
+	const __m256i low = _mm256_setr_epi8(
+		0x40, 0x40, 0x10, 0x10, 0x04, 0x04, 0x01, 0x01, 0x40, 0x40, 0x10, 0x10, 0x04, 0x04, 0x01, 0x01,
+		0x40, 0x40, 0x10, 0x10, 0x04, 0x04, 0x01, 0x01, 0x40, 0x40, 0x10, 0x10, 0x04, 0x04, 0x01, 0x01);
+	// each 128 bit half shuffles from a copy of the colours of all four cells
+	const __m256i cell = _mm256_setr_epi8(
+		0, 0, 0, 0, 0, 0, 0, 0, 4, 4, 4, 4, 4, 4, 4, 4,
+		8, 8, 8, 8, 8, 8, 8, 8, 12, 12, 12, 12, 12, 12, 12, 12);
+	const __m256i one = _mm256_set1_epi8(1), two = _mm256_set1_epi8(2), three = _mm256_set1_epi8(3);
+
+	for (size_t i = 0; i < n; i += 4) {
+		__m256i b = spread(bits + i), m = spread(multi + i);
+
+		__m256i h = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(b, hires), hires), three);
+		__m256i mc = _mm256_or_si256(
+			_mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(b, high), high), two),
+			_mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(b, low), low), one));
+		__m256i sel = _mm256_blendv_epi8(h, mc, m);
+
+		__m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(colours + 4 * i)));
+
+		_mm256_storeu_si256((__m256i*)(out + 8 * i), _mm256_shuffle_epi8(table, _mm256_add_epi8(sel, cell)));
+		_mm256_storeu_si256((__m256i*)(fg + 8 * i), _mm256_cmpeq_epi8(_mm256_and_si256(sel, two), two));
+	}
+}
+
+/*
+ * 32 pixels at a time: a shuffle per byte of the colour looks up all 32
+ * indices at once, as there are only 16 colours, and unpacking interleaves
+ * the bytes to RGBA. Unpacking works within 128 bit halves, so the halves
+ * are put back in order at the end.
+ */
+void rgba(uint32_t *out, const uint8_t *index, size_t n, const uint32_t *palette) {
+	alignas(16) uint8_t planes[4][16];
+
+	for (unsigned i = 0; i < 16; ++i)
+		for (unsigned c = 0; c < 4; ++c)
+			planes[c][i] = ((const uint8_t*)&palette[i])[c];
+
+	__m256i t[4];
+
+	for (unsigned c = 0; c < 4; ++c)
+		t[c] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)planes[c]));
+
+	const __m256i nybble = _mm256_set1_epi8(15);
+
+	for (size_t i = 0; i < n; i += 32) {
+		__m256i x = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(index + i)), nybble);
+		__m256i r = _mm256_shuffle_epi8(t[0], x), g = _mm256_shuffle_epi8(t[1], x);
+		__m256i b = _mm256_shuffle_epi8(t[2], x), a = _mm256_shuffle_epi8(t[3], x);
+
+		__m256i rg_lo = _mm256_unpacklo_epi8(r, g), rg_hi = _mm256_unpackhi_epi8(r, g);
+		__m256i ba_lo = _mm256_unpacklo_epi8(b, a), ba_hi = _mm256_unpackhi_epi8(b, a);
+
+		// pixels 0-3 and 16-19, 4-7 and 20-23, 8-11 and 24-27, 12-15 and 28-31
+		__m256i p0 = _mm256_unpacklo_epi16(rg_lo, ba_lo), p1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);
+		__m256i p2 = _mm256_unpacklo_epi16(rg_hi, ba_hi), p3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);
+		__m256i *o = (__m256i*)(out + i);
+
+		_mm256_storeu_si256(o, _mm256_permute2x128_si256(p0, p1, 0x20));
+		_mm256_storeu_si256(o + 1, _mm256_permute2x128_si256(p2, p3, 0x20));
+		_mm256_storeu_si256(o + 2, _mm256_permute2x128_si256(p0, p1, 0x31));
+		_mm256_storeu_si256(o + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+	}
+}
+
+}
+
+const render::Kernels *render::avx2() {
+	static const Kernels k{ cells, rgba };
+	return &k;
+}
+
+#else
+
+const render::Kernels *render::avx2() {
+	return nullptr;
+}
+
+#endif
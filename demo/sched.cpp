@@ -0,0 +1,245 @@
+#include "sched.hpp"
+#include "prg.hpp"
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+void TimerWheel::add(Timed &&t) {
+	++count;
+	place(std::move(t));
+}
+
+void TimerWheel::place(Timed &&t) {
+	uint64_t tick = t.due / tick_us;
+
+	if (tick <= now) {
+		expired.emplace_back(std::move(t));
+		return;
+	}
+
+	uint64_t delta = tick - now;
+	unsigned level = 0;
+
+	while (level < levels - 1 && delta >= (uint64_t)1 << (slot_bits * (level + 1)))
+		++level;
+
+	// clamp timers beyond the range of the wheel. they are placed again on every cascade
+	if (delta >= (uint64_t)1 << (slot_bits * levels))
+		tick = now + ((uint64_t)1 << (slot_bits * levels)) - 1;
+
+	unsigned slot = (tick >> (slot_bits * level)) & (slots - 1);
+
+	wheel[level][slot].emplace_back(std::move(t));
+	used[level].set(slot);
+}
+
+void TimerWheel::cascade(unsigned level) {
+	unsigned slot = (now >> (slot_bits * level)) & (slots - 1);
+
+	if (!used[level].test(slot))
+		return;
+
+	std::vector<Timed> list(std::move(wheel[level][slot]));
+	wheel[level][slot].clear();
+	used[level].reset(slot);
+
+	for (Timed &t : list)
+		place(std::move(t));
+}
+
+uint64_t TimerWheel::due(unsigned level) const {
+	unsigned shift = slot_bits * level;
+	uint64_t base = now >> shift;
+
+	// a slot of a higher level is due when the wheel reaches its start and cascades it
+	for (unsigned i = 1; i <= slots; ++i)
+		if (used[level].test((base + i) & (slots - 1)))
+			return (base + i) << shift;
+
+	return UINT64_MAX;
+}
+
+void TimerWheel::advance(uint64_t tick, std::vector<Timed> &out) {
+	while (now < tick) {
+		// skip the ticks at which nothing expires or cascades
+		uint64_t next = tick;
+
+		for (unsigned level = 0; level < levels; ++level)
+			next = std::min(next, due(level));
+
+		now = next;
+
+		// cascade from the top so timers can trickle down multiple levels at once
+		for (unsigned level = levels - 1; level > 0; --level)
+			if (!(now & (((uint64_t)1 << (slot_bits * level)) - 1)))
+				cascade(level);
+
+		unsigned slot = now & (slots - 1);
+
+		if (used[0].test(slot)) {
+			for (Timed &t : wheel[0][slot])
+				expired.emplace_back(std::move(t));
+
+			wheel[0][slot].clear();
+			used[0].reset(slot);
+		}
+	}
+
+	count -= expired.size();
+
+	for (Timed &t : expired)
+		out.emplace_back(std::move(t));
+
+	expired.clear();
+}
+
+std::optional<uint64_t> TimerWheel::next_tick() const {
+	if (!expired.empty())
+		return now;
+
+	if (!count)
+		return std::nullopt;
+
+	// timers of higher levels may have to cascade to a level 0 slot before the next one in use
+	uint64_t next = UINT64_MAX;
+
+	for (unsigned level = 0; level < levels; ++level)
+		next = std::min(next, due(level));
+
+	return next;
+}
+
+void TimerWheel::clear() {
+	for (auto &level : wheel)
+		for (auto &slot : level)
+			slot.clear();
+
+	for (auto &u : used)
+		u.reset();
+
+	expired.clear();
+	count = 0;
+}
+
+void SchedStats::add(uint64_t planned, uint64_t achieved) {
+	int64_t late = (int64_t)(achieved - planned);
+
+	if (!fired++) {
+		min_late = max_late = late;
+	} else {
+		if (late < min_late) min_late = late;
+		if (late > max_late) max_late = late;
+	}
+
+	sum_late += late;
+	sum_late2 += (double)late * late;
+
+	if (recent.size() < max_recent) {
+		recent.emplace_back(Sample{ planned, achieved });
+	} else {
+		recent[recent_pos] = Sample{ planned, achieved };
+		recent_pos = (recent_pos + 1) % max_recent;
+	}
+}
+
+double SchedStats::stddev() const noexcept {
+	if (fired < 2)
+		return 0;
+
+	double m = mean();
+	double v = sum_late2 / fired - m * m;
+
+	return v > 0 ? sqrt(v) : 0;
+}
+
+static unsigned parse_hex(const std::string &s, unsigned max, unsigned line) {
+	const char *str = s.c_str();
+
+	if (*str == '$')
+		++str;
+
+	char *end;
+	unsigned long v = strtoul(str, &end, 16);
+
+	if (!*str || *end || v > max)
+		throw std::runtime_error(std::string("sequence: line ") + std::to_string(line) + ": bad value \"" + s + "\"");
+
+	return v;
+}
+
+static std::string unescape(const std::string &s) {
+	std::string out;
+
+	for (size_t i = 0; i < s.size(); ++i) {
+		if (s[i] != '\\' || i + 1 == s.size()) {
+			out += s[i];
+			continue;
+		}
+
+		switch (s[++i]) {
+		case 'r': out += '\r'; break;
+		case 'n': out += '\r'; break; // C64 uses carriage return only
+		case 's': out += ' '; break;
+		default: out += s[i]; break;
+		}
+	}
+
+	return out;
+}
+
+std::vector<Timed> load_sequence(const std::string &path) {
+	std::ifstream in(path);
+	if (!in)
+		throw std::runtime_error(std::string("sequence: cannot open \"") + path + "\"");
+
+	std::vector<Timed> seq;
+	std::string text;
+
+	for (unsigned lineno = 1; std::getline(in, text); ++lineno) {
+		std::istringstream line(text);
+		std::string cmd;
+		double ms;
+
+		if (!(line >> std::ws) || line.peek() == '#' || line.peek() == EOF)
+			continue;
+
+		if (!(line >> ms >> cmd) || ms < 0)
+			throw std::runtime_error(std::string("sequence: line ") + std::to_string(lineno) + ": expected time and command");
+
+		uint64_t due = (uint64_t)llround(ms * 1000.0);
+
+		if (cmd == "poke") {
+			std::string addr, val;
+			line >> addr >> val;
+			seq.emplace_back(due, Command::poke(parse_hex(addr, 0xffff, lineno), parse_hex(val, 0xff, lineno)));
+		} else if (cmd == "type") {
+			std::string str;
+			line >> std::ws;
+			std::getline(line, str);
+			seq.emplace_back(due, Command::type(unescape(str)));
+		} else if (cmd == "reset") {
+			seq.emplace_back(due, Command::do_reset());
+		} else if (cmd == "run") {
+			std::string prgpath;
+			line >> std::ws;
+			std::getline(line, prgpath);
+
+			PRG prg;
+			prg.load(prgpath);
+			if (!prg.is_valid())
+				throw std::runtime_error(std::string("sequence: line ") + std::to_string(lineno) + ": bad prg \"" + prgpath + "\"");
+
+			seq.emplace_back(due, Command(Command::dmarun, prg.data));
+		} else {
+			throw std::runtime_error(std::string("sequence: line ") + std::to_string(lineno) + ": unknown command \"" + cmd + "\"");
+		}
+	}
+
+	return seq;
+}
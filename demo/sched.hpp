@@ -0,0 +1,98 @@
+#pragma once
+
+#include "ultimate.hpp"
+
+#include <cstdint>
+
+#include <array>
+#include <bitset>
+#include <optional>
+#include <string>
+#include <vector>
+
+/** Command that has to be sent at a specific time. Times are in microseconds. */
+class Timed final {
+public:
+	uint64_t due;
+	Command cmd;
+
+	Timed() : due(0), cmd() {}
+	Timed(uint64_t due, Command &&cmd) : due(due), cmd(std::move(cmd)) {}
+};
+
+/*
+ * Hierarchical timer wheel. Level 0 has a resolution of tick_us and every next
+ * level covers slots times the range of the previous one. Timers are cascaded
+ * to a lower level when the wheel passes the slot they are in, so adding and
+ * expiring a timer is O(1) amortized regardless of how many are pending.
+ */
+class TimerWheel final {
+public:
+	static constexpr unsigned levels = 4;
+	static constexpr unsigned slot_bits = 8;
+	static constexpr unsigned slots = 1u << slot_bits;
+	static constexpr uint64_t tick_us = 100;
+private:
+	std::array<std::array<std::vector<Timed>, slots>, levels> wheel;
+	std::array<std::bitset<slots>, levels> used;
+	std::vector<Timed> expired;
+	uint64_t now; // last processed tick
+	size_t count;
+
+	void place(Timed &&t);
+	void cascade(unsigned level);
+	/** First tick after now at which \a level expires or cascades a slot. */
+	uint64_t due(unsigned level) const;
+public:
+	TimerWheel() : wheel(), used(), expired(), now(0), count(0) {}
+
+	size_t size() const noexcept { return count; }
+	bool empty() const noexcept { return !count; }
+	uint64_t tick() const noexcept { return now; }
+
+	void add(Timed &&t);
+	/** Advance wheel up to and including \a tick and append all timers that are due to \a out. */
+	void advance(uint64_t tick, std::vector<Timed> &out);
+	/** Earliest tick at which advance may return timers. */
+	std::optional<uint64_t> next_tick() const;
+	void clear();
+};
+
+/** Achieved versus planned timing for dispatched timers. */
+class SchedStats final {
+public:
+	static constexpr unsigned max_recent = 256;
+
+	class Sample final {
+	public:
+		uint64_t planned, achieved;
+
+		int64_t late() const noexcept { return (int64_t)(achieved - planned); }
+	};
+
+	uint64_t fired;
+	int64_t min_late, max_late;
+	double sum_late, sum_late2;
+	std::vector<Sample> recent; // ring buffer, oldest at recent_pos once full
+	unsigned recent_pos;
+
+	SchedStats() : fired(0), min_late(0), max_late(0), sum_late(0), sum_late2(0), recent(), recent_pos(0) {}
+
+	void add(uint64_t planned, uint64_t achieved);
+
+	double mean() const noexcept { return fired ? sum_late / fired : 0; }
+	double stddev() const noexcept;
+};
+
+/*
+ * Load timed command sequence. Every line has a time in milliseconds relative
+ * to the start of the sequence followed by a command:
+ *
+ *   poke ADDR VAL   write one byte (hexadecimal, optional $ prefix)
+ *   type TEXT       put TEXT in keyboard buffer. \r and \n are recognized
+ *   reset           reset the machine
+ *   run PATH        load and start PRG file
+ *
+ * Empty lines and lines starting with # are ignored. Returned timers are relative.
+ */
+std::vector<Timed> load_sequence(const std::string &path);
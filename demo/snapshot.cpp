@@ -0,0 +1,102 @@
+#include "snapshot.hpp"
+
+#include <cstring>
+
+Rewind::Rewind(CPU &cpu, size_t capacity) : cpu(cpu), machine(nullptr), ring(), capacity(capacity ? capacity : 1), pos(0), used(0), base() {}
+
+Rewind::Rewind(Machine &machine, size_t capacity) : cpu(machine.cpu), machine(&machine), ring(), capacity(capacity ? capacity : 1), pos(0), used(0), base() {}
+
+void Rewind::drop_back() {
+	used -= ring.back().fresh;
+	ring.pop_back();
+}
+
+void Rewind::take() {
+	while (ring.size() > pos + 1)
+		drop_back();
+
+	if (ring.size() == capacity) {
+		used -= ring.front().fresh;
+		ring.pop_front();
+
+		// the new oldest one owns what it shared with the dropped one
+		if (!ring.empty()) {
+			used += 256 - ring.front().fresh;
+			ring.front().fresh = 256;
+		}
+	}
+
+	ring.emplace_back();
+
+	Snapshot &s = ring.back();
+
+	s.r = cpu.r;
+	s.cycles = cpu.cycles;
+	s.jammed = cpu.jammed;
+	s.fresh = 0;
+
+	for (unsigned page = 0; page < 256; ++page) {
+		if (base[page] && !cpu.dirty[page]) {
+			s.pages[page] = base[page];
+			continue;
+		}
+
+		auto copy = std::make_shared<Page>();
+		const uint8_t *mem = machine ? &machine->bus.ram[page << 8] : cpu.bus->direct(page);
+
+		if (mem)
+			memcpy(copy->data(), mem, copy->size());
+		else
+			for (unsigned i = 0; i < copy->size(); ++i)
+				(*copy)[i] = cpu.bus->peek(page << 8 | i);
+
+		s.pages[page] = std::move(copy);
+		++s.fresh;
+	}
+
+	if (machine)
+		s.io = std::make_shared<const MachineState>(machine->state());
+
+	base = s.pages;
+	cpu.dirty.fill(0);
+	pos = ring.size() - 1;
+	used += s.fresh;
+}
+
+void Rewind::restore(size_t i) {
+	const Snapshot &s = ring.at(i);
+
+	for (unsigned page = 0; page < 256; ++page) {
+		if (base[page] == s.pages[page] && !cpu.dirty[page])
+			continue;
+
+		const Page &src = *s.pages[page];
+		uint8_t *mem = machine ? &machine->bus.ram[page << 8] : cpu.bus->direct(page);
+
+		if (mem)
+			memcpy(mem, src.data(), src.size());
+		else
+			for (unsigned j = 0; j < src.size(); ++j)
+				cpu.bus->write(page << 8 | j, src[j]);
+
+		cpu.changed(page);
+	}
+
+	cpu.r = s.r;
+	cpu.cycles = s.cycles;
+	cpu.jammed = s.jammed;
+
+	// may remap, which flushes the CPU and marks every page dirty, but memory is what base says
+	if (machine)
+		machine->restore(*s.io);
+
+	base = s.pages;
+	cpu.dirty.fill(0);
+	pos = i;
+}
+
+void Rewind::clear() {
+	ring.clear();
+	base = {};
+	pos = used = 0;
+}
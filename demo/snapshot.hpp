@@ -0,0 +1,75 @@
+#pragma once
+
+#include "c64.hpp"
+#include "cpu.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <deque>
+#include <memory>
+
+/** Contents of one page of memory in a snapshot. */
+typedef std::array<uint8_t, 256> Page;
+
+/** Registers, cycles and memory of a CPU at one point in time. */
+class Snapshot final {
+public:
+	MOS6510 r;
+	uint64_t cycles;
+	bool jammed;
+	/** Never modified, so snapshots share the pages that did not change. */
+	std::array<std::shared_ptr<const Page>, 256> pages;
+	/** Pages not shared with the previous snapshot. */
+	unsigned fresh;
+	/** Port and chips when taken from a Machine, otherwise nullptr. */
+	std::shared_ptr<const MachineState> io;
+};
+
+/*
+ * Rewind buffer of snapshots of a CPU and its bus. A new snapshot only copies
+ * the pages in CPU::dirty and shares all others with the previous one, so it
+ * takes time and memory for the pages written since then instead of the
+ * whole 64K. Restoring likewise only writes pages that differ from what is in
+ * memory. Direct pages are copied in place, others with Bus::peek and
+ * Bus::write.
+ *
+ * On a Machine the pages are copied from and to C64Bus::ram, whatever is
+ * banked in, and the port, colour RAM and chips are saved with
+ * Machine::state(), so nothing goes through Bus::write to reach ROM or the
+ * chip registers instead.
+ *
+ * Restoring keeps the later snapshots, so the buffer can be scrubbed back and
+ * forth. Taking a snapshot after a restore drops them, because execution has
+ * taken another path from there.
+ */
+class Rewind final {
+	CPU &cpu;
+	Machine *machine; // nullptr for a CPU on another bus
+	std::deque<Snapshot> ring;
+	size_t capacity, pos, used;
+	/** What memory contains, except for dirty pages. */
+	std::array<std::shared_ptr<const Page>, 256> base;
+
+	void drop_back();
+public:
+	explicit Rewind(CPU &cpu, size_t capacity=512);
+	explicit Rewind(Machine &machine, size_t capacity=512);
+
+	Rewind(const Rewind&) = delete;
+	Rewind &operator=(const Rewind&) = delete;
+
+	/** Take snapshot after the current one, dropping the oldest if full. */
+	void take();
+	/** Restore snapshot \a i, 0 is the oldest. */
+	void restore(size_t i);
+	void clear();
+
+	size_t size() const noexcept { return ring.size(); }
+	/** Index of the snapshot taken or restored last. */
+	size_t current() const noexcept { return pos; }
+	const Snapshot &at(size_t i) const { return ring.at(i); }
+	/** Bytes of page and chip memory in use by all snapshots. */
+	size_t bytes() const noexcept { return used * sizeof(Page) + (machine ? ring.size() * sizeof(MachineState) : 0); }
+};
@@ -0,0 +1,249 @@
+#include "trace.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+static size_t chunk_size(uint32_t records) {
+	return sizeof(trace::Chunk) + records * sizeof(trace::Record);
+}
+
+// at least two, so there is always a complete older chunk
+static uint32_t chunk_count(size_t size, uint32_t records) {
+	size_t n = (size - std::min(size, sizeof(trace::Header))) / chunk_size(records);
+
+	return (uint32_t)std::clamp<size_t>(n, 2, UINT32_MAX);
+}
+
+Trace::Trace(const std::string &path, size_t size, uint32_t records)
+	: map(path, sizeof(trace::Header) + chunk_count(size, std::max(records, 64u)) * chunk_size(std::max(records, 64u)))
+	, head((trace::Header*)map.data()), chunk(nullptr), recs(nullptr), per_chunk(std::max(records, 64u)), used(0), last(0), total(0)
+{
+	// an existing file may have any contents, so start over
+	memset(map.data(), 0, map.size());
+	memcpy(head->magic, trace::magic, sizeof head->magic);
+	head->records = per_chunk;
+	head->chunks = chunk_count(size, per_chunk);
+	head->next = 1;
+
+	next_chunk();
+}
+
+Trace::~Trace() {
+	flush();
+}
+
+void Trace::next_chunk() {
+	if (chunk)
+		chunk->used = used;
+
+	uint64_t seq = head->next++;
+
+	chunk = (trace::Chunk*)(map.data() + sizeof(trace::Header) + (seq - 1) % head->chunks * chunk_size(per_chunk));
+	recs = (trace::Record*)(chunk + 1);
+	used = 0;
+
+	// readers ignore the chunk while it is being reused
+	chunk->seq = 0;
+	chunk->used = 0;
+	chunk->cycles = last;
+	chunk->seq = seq;
+}
+
+void Trace::slow(trace::Kind k, uint16_t addr, uint8_t v, uint64_t cycles) {
+	uint64_t delta = cycles - last;
+
+	// new instructions never start within the last few records, so an instruction is never split unless it fills them all
+	if (used + 16 > per_chunk && (delta || used == per_chunk))
+		next_chunk();
+
+	while (delta > 63) {
+		uint64_t step = std::min<uint64_t>(delta, (1 << 30) - 1);
+
+		recs[used++] = trace::Record{ (uint16_t)step, (uint8_t)(step >> 16), (uint8_t)(trace::time << 6 | step >> 24) };
+		last += step;
+		delta -= step;
+
+		if (used == per_chunk)
+			next_chunk();
+	}
+
+	recs[used++] = trace::Record{ addr, v, (uint8_t)(k << 6 | delta) };
+	last = cycles;
+	++total;
+}
+
+void Trace::flush() {
+	chunk->used = used;
+	map.sync();
+}
+
+TraceReader::TraceReader(const std::string &path) : file(path), head((const trace::Header*)file.data()), chunks() {
+	if (file.size() < sizeof(trace::Header) || memcmp(head->magic, trace::magic, sizeof trace::magic))
+		throw std::runtime_error(std::string("trace: not a trace file: \"") + path + "\"");
+
+	size_t size = chunk_size(head->records);
+
+	if (!head->records || file.size() < sizeof(trace::Header) + (uint64_t)head->chunks * size)
+		throw std::runtime_error(std::string("trace: truncated file: \"") + path + "\"");
+
+	for (uint32_t i = 0; i < head->chunks; ++i) {
+		const trace::Chunk *c = (const trace::Chunk*)(file.data() + sizeof(trace::Header) + i * size);
+
+		if (c->seq && c->used <= head->records)
+			chunks.emplace_back(c);
+	}
+
+	std::sort(chunks.begin(), chunks.end(), [](const trace::Chunk *a, const trace::Chunk *b) { return a->seq < b->seq; });
+}
+
+uint64_t TraceReader::size() const noexcept {
+	uint64_t n = 0;
+
+	for (const trace::Chunk *c : chunks)
+		n += c->used;
+
+	return n;
+}
+
+bool TraceReader::last_write(uint16_t addr, trace::Access &a) const {
+	bool found = false;
+
+	// newest chunk first, the first one with a write has the last one
+	for (auto it = chunks.rbegin(); it != chunks.rend() && !found; ++it) {
+		decode(*it, records(*it), [&](const trace::Access &e) {
+			if (e.kind == trace::write && e.addr == addr) {
+				a = e;
+				found = true;
+			}
+		});
+	}
+
+	return found;
+}
+
+std::vector<trace::Access> TraceReader::writes(uint16_t from, uint16_t to, uint64_t begin, uint64_t end) const {
+	std::vector<trace::Access> list;
+
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		// every chunk ends where the next one starts
+		if (chunks[i]->cycles >= end || (i + 1 < chunks.size() && chunks[i + 1]->cycles < begin))
+			continue;
+
+		decode(chunks[i], records(chunks[i]), [&](const trace::Access &e) {
+			if (e.kind == trace::write && e.addr >= from && e.addr <= to && e.cycles >= begin && e.cycles < end)
+				list.emplace_back(e);
+		});
+	}
+
+	return list;
+}
+
+static bool parse_addr(const char *s, uint16_t &addr) {
+	char *end;
+
+	if (*s == '$')
+		++s;
+
+	unsigned long v = strtoul(s, &end, 16);
+
+	if (!*s || *end || v > 0xffff)
+		return false;
+
+	addr = (uint16_t)v;
+	return true;
+}
+
+static void print_access(const trace::Access &a) {
+	printf("%12llu  frame %6llu  $%04X  $%04X = $%02X\n", (unsigned long long)a.cycles,
+		(unsigned long long)(a.cycles / trace::frame_cycles), a.pc, a.addr, a.value);
+}
+
+int trace_main(int argc, char **argv) {
+	const char *usage =
+		"usage: %s --trace FILE info\n"
+		"       %s --trace FILE who ADDR\n"
+		"       %s --trace FILE writes FROM[-TO] [FRAME]\n";
+
+	if (argc < 4) {
+		fprintf(stderr, usage, argv[0], argv[0], argv[0]);
+		return 1;
+	}
+
+	try {
+		TraceReader in(argv[2]);
+		std::string cmd(argv[3]);
+		auto start = std::chrono::steady_clock::now();
+
+		if (cmd == "info" && argc == 4) {
+			uint64_t kinds[3] = { 0 }, first = 0, last = 0;
+			bool any = false;
+
+			in.scan([&](const trace::Access &a) {
+				if (!any)
+					first = a.cycles;
+
+				any = true;
+				last = a.cycles;
+				++kinds[a.kind];
+			});
+
+			printf("%zu chunks, %llu records\n", in.chunk_count(), (unsigned long long)in.size());
+			printf("%llu fetches, %llu reads, %llu writes\n", (unsigned long long)kinds[trace::fetch], (unsigned long long)kinds[trace::read], (unsigned long long)kinds[trace::write]);
+
+			if (any)
+				printf("cycles %llu to %llu\n", (unsigned long long)first, (unsigned long long)last);
+		} else if (cmd == "who" && argc == 5) {
+			uint16_t addr;
+			trace::Access a;
+
+			if (!parse_addr(argv[4], addr)) {
+				fprintf(stderr, "%s: bad address \"%s\"\n", __func__, argv[4]);
+				return 1;
+			}
+
+			if (!in.last_write(addr, a)) {
+				printf("$%04X not written\n", addr);
+				return 1;
+			}
+
+			print_access(a);
+		} else if (cmd == "writes" && (argc == 5 || argc == 6)) {
+			std::string range(argv[4]);
+			size_t dash = range.find('-');
+			uint16_t from, to;
+			uint64_t begin = 0, end = ~(uint64_t)0;
+
+			if (!parse_addr(range.substr(0, dash).c_str(), from) || !parse_addr(dash == std::string::npos ? range.c_str() : range.c_str() + dash + 1, to)) {
+				fprintf(stderr, "%s: bad address range \"%s\"\n", __func__, argv[4]);
+				return 1;
+			}
+
+			if (argc == 6) {
+				uint64_t frame = strtoull(argv[5], nullptr, 10);
+
+				begin = frame * trace::frame_cycles;
+				end = begin + trace::frame_cycles;
+			}
+
+			for (const trace::Access &a : in.writes(from, to, begin, end))
+				print_access(a);
+		} else {
+			fprintf(stderr, usage, argv[0], argv[0], argv[0]);
+			return 1;
+		}
+
+		double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		fprintf(stderr, "trace: %.3f s\n", s);
+	} catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "mmap.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+/*
+ * Memory access trace of a CPU in a file mapped ring buffer.
+ *
+ * The file starts with a 32 byte header, followed by chunks that are reused
+ * oldest first once the file is full:
+ *
+ *   header  u8[8] magic "C64MTRC\1", u32 records per chunk, u32 chunks,
+ *           u64 sequence number of the next chunk, u64 reserved
+ *   chunk   u64 cycles, u64 sequence number (0 if unused), u32 records used,
+ *           u32 reserved, then the records
+ *   record  u16 address, u8 value, u8 kind << 6 | cycle delta
+ *
+ * All numbers are little endian. Every access is stamped with the cycle its
+ * instruction started at, as a delta to the previous record or the start of
+ * the chunk. A time record stands for larger deltas: it adds its address,
+ * value << 16 and delta << 24 to the cycles. The first record of a chunk
+ * always starts an instruction, so each chunk can be decoded on its own, and
+ * the records of an instruction are its opcode fetch followed by any other
+ * accesses with the same cycles.
+ */
+namespace trace {
+	constexpr char magic[8] = { 'C', '6', '4', 'M', 'T', 'R', 'C', 1 };
+
+	/** Cycles of a PAL frame. */
+	constexpr uint64_t frame_cycles = 63 * 312;
+
+	enum Kind : uint8_t {
+		fetch, // instruction byte
+		read,
+		write,
+		time,
+	};
+
+	class Header final {
+	public:
+		char magic[8];
+		uint32_t records, chunks;
+		uint64_t next;
+		uint64_t reserved;
+	};
+
+	class Chunk final {
+	public:
+		uint64_t cycles, seq;
+		uint32_t used, reserved;
+	};
+
+	class Record final {
+	public:
+		uint16_t addr;
+		uint8_t value;
+		uint8_t info;
+	};
+
+	static_assert(sizeof(Header) == 32 && sizeof(Chunk) == 24 && sizeof(Record) == 4, "trace: unexpected padding");
+
+	/** Decoded access. */
+	class Access final {
+	public:
+		uint64_t cycles;
+		uint16_t pc; // opcode address of the instruction
+		uint16_t addr;
+		uint8_t value;
+		Kind kind;
+	};
+}
+
+/** Writes the trace while attached to CPU::trace. */
+class Trace final {
+	WritableMappedFile map;
+	trace::Header *head;
+	trace::Chunk *chunk;
+	trace::Record *recs;
+	uint32_t per_chunk, used;
+	uint64_t last; // cycles of last record
+	uint64_t total;
+
+	void next_chunk();
+	void slow(trace::Kind k, uint16_t addr, uint8_t v, uint64_t cycles);
+public:
+	/** Create or overwrite \a path with room for about \a size bytes. */
+	explicit Trace(const std::string &path, size_t size=64 << 20, uint32_t records=1 << 14);
+	Trace(const Trace&) = delete;
+	~Trace();
+
+	void access(trace::Kind k, uint16_t addr, uint8_t v, uint64_t cycles) {
+		uint64_t delta = cycles - last;
+
+		// new chunks start at an instruction, a few records before they are full
+		if (delta > 63 || used + 16 > per_chunk) {
+			slow(k, addr, v, cycles);
+			return;
+		}
+
+		recs[used++] = trace::Record{ addr, v, (uint8_t)(k << 6 | delta) };
+		last = cycles;
+		++total;
+	}
+
+	/** Write used counts and changed pages to the file. */
+	void flush();
+
+	/** Accesses recorded, including those that were overwritten. */
+	uint64_t count() const noexcept { return total; }
+};
+
+/** Decodes a trace file, which may still be written to. */
+class TraceReader final {
+	MappedFile file;
+	const trace::Header *head;
+	std::vector<const trace::Chunk*> chunks; // oldest first
+
+	const trace::Record *records(const trace::Chunk *c) const noexcept { return (const trace::Record*)(c + 1); }
+
+	template<class F> static void decode(const trace::Chunk *c, const trace::Record *r, F f);
+public:
+	explicit TraceReader(const std::string &path);
+	TraceReader(const TraceReader&) = delete;
+
+	/** Records in all chunks, including time records. */
+	uint64_t size() const noexcept;
+	size_t chunk_count() const noexcept { return chunks.size(); }
+
+	/** Call \a f for every access from oldest to newest. */
+	template<class F> void scan(F f) const {
+		for (const trace::Chunk *c : chunks)
+			decode(c, records(c), f);
+	}
+
+	/** Last write to \a addr. Returns false if there is none. */
+	bool last_write(uint16_t addr, trace::Access &a) const;
+	/** Writes to \a from to \a to inclusive in cycles \a begin to \a end exclusive, oldest first. */
+	std::vector<trace::Access> writes(uint16_t from, uint16_t to, uint64_t begin, uint64_t end) const;
+};
+
+template<class F> void TraceReader::decode(const trace::Chunk *c, const trace::Record *r, F f) {
+	uint64_t t = c->cycles, prev = ~(uint64_t)0;
+	uint16_t pc = 0;
+
+	for (const trace::Record *e = r + c->used; r != e; ++r) {
+		unsigned kind = r->info >> 6, delta = r->info & 63;
+
+		if (kind == trace::time) {
+			t += r->addr | (uint64_t)r->value << 16 | (uint64_t)delta << 24;
+			continue;
+		}
+
+		t += delta;
+
+		if (t != prev) {
+			pc = r->addr;
+			prev = t;
+		}
+
+		f(trace::Access{ t, pc, r->addr, r->value, (trace::Kind)kind });
+	}
+}
+
+/** Entry point for `c64mon --trace`: query a trace file. */
+int trace_main(int argc, char **argv);
@@ -0,0 +1,107 @@
+#include "ultimate.hpp"
+
+#include <stdexcept>
+
+unsigned Command::header(uint8_t out[max_header_size], size_t size) const {
+	if (size > max_size())
+		throw std::runtime_error("command: payload too big");
+
+	out[0] = op & 0xff;
+	out[1] = op >> 8;
+	out[2] = size & 0xff;
+	out[3] = (size >> 8) & 0xff;
+
+	if (!long_length(op))
+		return header_size;
+
+	out[4] = size >> 16;
+	return header_size + 1;
+}
+
+void Command::frame(std::vector<uint8_t> &out) const {
+	uint8_t hdr[max_header_size];
+	unsigned n = header(hdr, data.size());
+
+	out.insert(out.end(), hdr, hdr + n);
+	out.insert(out.end(), data.begin(), data.end());
+}
+
+Command Command::poke(uint16_t addr, uint8_t v) {
+	return write(addr, &v, 1);
+}
+
+Command Command::write(uint16_t addr, const uint8_t *ptr, unsigned size) {
+	std::vector<uint8_t> data;
+
+	data.reserve(2 + size);
+	data.emplace_back(addr & 0xff);
+	data.emplace_back(addr >> 8);
+	data.insert(data.end(), ptr, ptr + size);
+
+	return Command(dmawrite, std::move(data));
+}
+
+Command Command::type(const std::string &str) {
+	return Command(keyb, std::vector<uint8_t>(str.begin(), str.end()));
+}
+
+Command Command::do_reset() {
+	return Command(reset);
+}
+
+Command Command::start(uint16_t addr) {
+	// BASIC programs are loaded at $0801, everything else is started with SYS
+	return type(addr == 0x0801 ? std::string("RUN\r") : "SYS" + std::to_string(addr) + "\r");
+}
+
+Command Command::image(const std::string &path, bool run) {
+	return Command(run ? run_img : mount_img, path);
+}
+
+Command Command::image(std::vector<uint8_t> &&img, bool run) {
+	return Command(run ? run_img : mount_img, std::move(img));
+}
+
+Command Command::image_dir(const std::string &dir, bool run) {
+	Command cmd(run ? run_img : mount_img, dir);
+
+	cmd.pack = true;
+	return cmd;
+}
+
+void FrameParser::feed(const uint8_t *ptr, size_t n) {
+	// drop consumed bytes once they dominate the buffer
+	if (pos && pos >= buf.size() / 2) {
+		buf.erase(buf.begin(), buf.begin() + pos);
+		pos = 0;
+	}
+
+	buf.insert(buf.end(), ptr, ptr + n);
+}
+
+bool FrameParser::next(std::vector<uint8_t> &frame, uint16_t &op) {
+	size_t avail = buf.size() - pos;
+
+	if (avail < Command::header_size)
+		return false;
+
+	const uint8_t *p = &buf[pos];
+	uint16_t code = p[0] | (p[1] << 8);
+	size_t hdr = Command::header_size, size = p[2] | (p[3] << 8);
+
+	if (Command::long_length(code)) {
+		if (avail < ++hdr)
+			return false;
+
+		size |= (size_t)p[4] << 16;
+	}
+
+	if (avail < hdr + size)
+		return false;
+
+	frame.assign(p, p + hdr + size);
+	op = code;
+	pos += hdr + size;
+
+	return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "mmap.hpp"
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+/*
+ * Command for the Ultimate 1541 socket DMA service.
+ * On the wire every command is a 16 bit little endian opcode followed by a
+ * 16 bit little endian payload length and the payload itself. Disk image and
+ * cartridge commands use a 24 bit length instead.
+ */
+class Command final {
+public:
+	enum Op : uint16_t {
+		dma = 0xff01,
+		dmarun = 0xff02,
+		keyb = 0xff03,
+		reset = 0xff04,
+		wait = 0xff05,
+		dmawrite = 0xff06,
+		reuwrite = 0xff07,
+		kernalwrite = 0xff08,
+		dmajump = 0xff09,
+		mount_img = 0xff0a,
+		run_img = 0xff0b,
+		poweroff = 0xff0c,
+		run_crt = 0xff0d,
+		identify = 0xff0e,
+	};
+
+	static constexpr unsigned header_size = 4;
+	static constexpr unsigned max_header_size = 5;
+	static constexpr unsigned max_payload = 0xffff;
+	static constexpr unsigned max_long_payload = 0xffffff;
+
+	uint16_t op;
+	/** Payload. May share its bytes with a PRG, so uploads do not copy it, but never with a mapped file. */
+	Bytes data;
+	/** If not empty, the payload is streamed from this file instead of using data. */
+	std::string file;
+	/** If set, file is a directory whose PRG files are packed into a D64 image when the command is sent. */
+	bool pack;
+
+	Command() : op(0), data(), file(), pack(false) {}
+	explicit Command(uint16_t op) : op(op), data(), file(), pack(false) {}
+	Command(uint16_t op, std::vector<uint8_t> &&data) : op(op), data(std::move(data)), file(), pack(false) {}
+	/** Commands are queued for another thread, so mapped bytes are copied. */
+	Command(uint16_t op, const Bytes &data) : op(op), data(data.owned()), file(), pack(false) {}
+	Command(uint16_t op, const std::string &file) : op(op), data(), file(file), pack(false) {}
+
+	static constexpr bool long_length(uint16_t op) noexcept {
+		return op == mount_img || op == run_img || op == run_crt;
+	}
+
+	unsigned max_size() const noexcept { return long_length(op) ? max_long_payload : max_payload; }
+
+	/** Write header for a payload of \a size bytes to \a out and return its length. */
+	unsigned header(uint8_t out[max_header_size], size_t size) const;
+	/** Append header and payload to \a out. */
+	void frame(std::vector<uint8_t> &out) const;
+
+	static Command poke(uint16_t addr, uint8_t v);
+	static Command write(uint16_t addr, const uint8_t *ptr, unsigned size);
+	static Command type(const std::string &str);
+	static Command do_reset();
+	/** Start program already in memory at \a addr by typing RUN or SYS. */
+	static Command start(uint16_t addr);
+	/** Mount or run disk image. The image file is streamed when the command is sent. */
+	static Command image(const std::string &path, bool run);
+	static Command image(std::vector<uint8_t> &&img, bool run);
+	/** Mount or run the PRG files in \a dir as D64 image, which is built by the network worker. */
+	static Command image_dir(const std::string &dir, bool run);
+};
+
+/** Splits a byte stream into complete command frames. */
+class FrameParser final {
+	std::vector<uint8_t> buf;
+	size_t pos;
+public:
+	FrameParser() : buf(), pos(0) {}
+
+	void feed(const uint8_t *ptr, size_t n);
+
+	/** Bytes received that are not returned as frame yet. */
+	size_t pending() const noexcept { return buf.size() - pos; }
+
+	/**
+	 * Extract next complete frame including its header. Returns false if no
+	 * complete frame is available yet.
+	 */
+	bool next(std::vector<uint8_t> &frame, uint16_t &op);
+};
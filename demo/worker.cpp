@@ -0,0 +1,407 @@
+#include "worker.hpp"
+#include "d64.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+
+static const auto epoch = std::chrono::steady_clock::now();
+
+uint64_t NetWorker::now_us() noexcept {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+NetWorker::NetWorker(const char *address, uint16_t port) : sock(), m(), cv(), q(), wheel(), cancels(0), stats(), err(), cmd_err(), running(true), t(), buf(), cap(), cap_m(), cap_next(), cap_err(), cap_swap(false), cap_on(false), cap_count(0), dep_hash(0), dep_valid(false) {
+	sock.connect(address, port);
+	sock.nodelay(true);
+
+	t = std::thread(&NetWorker::main, this);
+}
+
+NetWorker::~NetWorker() {
+	{
+		std::lock_guard<std::mutex> lk(m);
+		running = false;
+	}
+
+	cv.notify_one();
+	t.join();
+}
+
+// whether typing the payload of \a cmd starts a program
+static bool runs(const Command &cmd) {
+	static const std::string words[] = { "RUN", "SYS" };
+
+	for (const std::string &w : words)
+		if (std::search(cmd.data.begin(), cmd.data.end(), w.begin(), w.end()) != cmd.data.end())
+			return true;
+
+	return false;
+}
+
+// forget deployed PRG if command may change memory or start it
+void NetWorker::invalidate(const Command &cmd) {
+	if (cmd.op == Command::keyb ? runs(cmd) : cmd.op != Command::wait && cmd.op != Command::identify)
+		dep_valid = false;
+}
+
+void NetWorker::push(Command &&cmd) {
+	{
+		std::lock_guard<std::mutex> lk(m);
+		invalidate(cmd);
+		q.emplace_back(std::move(cmd));
+	}
+
+	cv.notify_one();
+}
+
+void NetWorker::schedule(uint64_t due, Command &&cmd) {
+	{
+		std::lock_guard<std::mutex> lk(m);
+		invalidate(cmd);
+		wheel.add(Timed(due, std::move(cmd)));
+	}
+
+	cv.notify_one();
+}
+
+void NetWorker::schedule(std::vector<Timed> &&seq, uint64_t delay) {
+	uint64_t start = now_us() + delay;
+
+	{
+		std::lock_guard<std::mutex> lk(m);
+
+		for (Timed &tm : seq) {
+			invalidate(tm.cmd);
+			wheel.add(Timed(start + tm.due, std::move(tm.cmd)));
+		}
+	}
+
+	cv.notify_one();
+}
+
+bool NetWorker::deploy(const Bytes &prg, uint64_t hash, bool skip_unchanged) {
+	bool upload;
+
+	{
+		std::lock_guard<std::mutex> lk(m);
+
+		upload = !skip_unchanged || !dep_valid || dep_hash != hash;
+
+		if (upload) {
+			q.emplace_back(Command(Command::dmarun, prg));
+			dep_hash = hash;
+			dep_valid = true;
+		} else {
+			q.emplace_back(Command::start(prg.at(0) | (prg.at(1) << 8)));
+			dep_valid = false;
+		}
+	}
+
+	cv.notify_one();
+	return upload;
+}
+
+void NetWorker::upload(const Bytes &prg, uint64_t hash) {
+	{
+		std::lock_guard<std::mutex> lk(m);
+		q.emplace_back(Command(Command::dma, prg));
+		dep_hash = hash;
+		dep_valid = true;
+	}
+
+	cv.notify_one();
+}
+
+bool NetWorker::is_deployed(uint64_t hash) const {
+	std::lock_guard<std::mutex> lk(m);
+	return dep_valid && dep_hash == hash;
+}
+
+void NetWorker::cancel() {
+	std::lock_guard<std::mutex> lk(m);
+	wheel.clear();
+	++cancels;
+}
+
+size_t NetWorker::pending() const {
+	std::lock_guard<std::mutex> lk(m);
+	return q.size() + wheel.size();
+}
+
+SchedStats NetWorker::timing() const {
+	std::lock_guard<std::mutex> lk(m);
+	return stats;
+}
+
+void NetWorker::reset_timing() {
+	std::lock_guard<std::mutex> lk(m);
+	stats = SchedStats();
+}
+
+void NetWorker::capture(std::unique_ptr<CaptureWriter> &&w) {
+	{
+		std::lock_guard<std::mutex> lk(cap_m);
+		cap_on = w != nullptr;
+		cap_next = std::move(w);
+	}
+
+	{
+		// the worker may be streaming a payload into the current writer, so it swaps them itself
+		std::lock_guard<std::mutex> lk(m);
+		cap_swap = true;
+	}
+
+	cv.notify_one();
+}
+
+bool NetWorker::capturing() {
+	return cap_on;
+}
+
+uint64_t NetWorker::captured() {
+	return cap_count;
+}
+
+bool NetWorker::poll_capture_error(std::string &msg) {
+	std::lock_guard<std::mutex> lk(cap_m);
+
+	if (cap_err.empty())
+		return false;
+
+	msg = std::move(cap_err);
+	cap_err.clear();
+	return true;
+}
+
+void NetWorker::swap_capture() {
+	std::unique_ptr<CaptureWriter> old;
+
+	{
+		std::lock_guard<std::mutex> lk(cap_m);
+		old = std::move(cap);
+		cap = std::move(cap_next);
+	}
+
+	cap_count = 0;
+
+	if (old) {
+		old->flush();
+
+		if (!old->ok()) {
+			std::lock_guard<std::mutex> lk(cap_m);
+			cap_err = old->error();
+		}
+	}
+}
+
+// after a record. a capture that cannot be written is dropped, sending goes on without it
+void NetWorker::check_capture() {
+	if (cap->ok()) {
+		cap_count = cap->count();
+		return;
+	}
+
+	std::lock_guard<std::mutex> lk(cap_m);
+
+	cap_err = cap->error();
+	cap.reset();
+
+	// unless another capture was started since
+	if (!cap_next)
+		cap_on = false;
+}
+
+std::string NetWorker::error() const {
+	std::lock_guard<std::mutex> lk(m);
+	return err;
+}
+
+bool NetWorker::ok() const {
+	std::lock_guard<std::mutex> lk(m);
+	return err.empty();
+}
+
+bool NetWorker::poll_error(std::string &msg) {
+	std::lock_guard<std::mutex> lk(m);
+
+	if (cmd_err.empty())
+		return false;
+
+	msg = std::move(cmd_err);
+	cmd_err.clear();
+	return true;
+}
+
+void NetWorker::fail(const std::string &msg) {
+	std::lock_guard<std::mutex> lk(m);
+	cmd_err = msg;
+}
+
+void NetWorker::send(const Command &cmd) {
+	if (cmd.pack) {
+		send_packed(cmd);
+		return;
+	}
+
+	if (!cmd.file.empty()) {
+		send_file(cmd);
+		return;
+	}
+
+	if (cmd.data.size() < chunk_size) {
+		buf.clear();
+		cmd.frame(buf);
+		sock.send_fully(buf.data(), buf.size());
+	} else {
+		// large payload, send directly from command
+		uint8_t hdr[Command::max_header_size];
+		unsigned n = cmd.header(hdr, cmd.data.size());
+
+		sock.send_fully(hdr, n);
+		sock.send_fully(cmd.data.data(), cmd.data.size());
+	}
+
+	if (cap) {
+		cap->write(now_us(), cmd.op, cmd.data.data(), cmd.data.size());
+		check_capture();
+	}
+}
+
+void NetWorker::send_file(const Command &cmd) {
+	std::ifstream in(cmd.file, std::ios::binary);
+	if (!in) {
+		fail(std::string("worker: cannot open \"") + cmd.file + "\"");
+		return;
+	}
+
+	in.seekg(0, std::ios_base::end);
+	size_t size = in.tellg();
+	in.seekg(0);
+
+	uint8_t hdr[Command::max_header_size];
+	unsigned n = cmd.header(hdr, size);
+
+	sock.send_fully(hdr, n);
+	buf.resize(chunk_size);
+
+	if (cap)
+		cap->begin(now_us(), cmd.op, size);
+
+	for (size_t left = size; left;) {
+		size_t chunk = std::min<size_t>(left, chunk_size);
+
+		if (!in.read((char*)buf.data(), chunk))
+			throw std::runtime_error(std::string("worker: short read from \"") + cmd.file + "\"");
+
+		sock.send_fully(buf.data(), chunk);
+
+		if (cap)
+			cap->append(buf.data(), chunk);
+
+		left -= chunk;
+	}
+
+	if (cap)
+		check_capture();
+}
+
+// reading all files of the directory may take a while, so this is not done by the UI
+void NetWorker::send_packed(const Command &cmd) {
+	std::vector<uint8_t> img;
+
+	try {
+		D64Builder b(std::filesystem::path(cmd.file).filename().string());
+
+		if (!b.add_dir(cmd.file))
+			throw std::runtime_error(std::string("d64: no PRG files found in \"") + cmd.file + "\"");
+
+		img = b.image();
+	} catch (const std::runtime_error &e) {
+		// nothing has been sent yet
+		fail(e.what());
+		return;
+	}
+
+	send(Command(cmd.op, std::move(img)));
+}
+
+void NetWorker::main() {
+	std::vector<Timed> due;
+	std::unique_lock<std::mutex> lk(m);
+
+	try {
+		while (running) {
+			// only between commands, so a record is never split over two files
+			if (cap_swap) {
+				cap_swap = false;
+				lk.unlock();
+				swap_capture();
+				lk.lock();
+				continue;
+			}
+
+			if (!q.empty()) {
+				Command cmd(std::move(q.front()));
+				q.pop_front();
+
+				lk.unlock();
+				send(cmd);
+				lk.lock();
+				continue;
+			}
+
+			auto next = wheel.next_tick();
+
+			if (!next) {
+				cv.wait(lk);
+				continue;
+			}
+
+			uint64_t at = *next * TimerWheel::tick_us, now = now_us();
+
+			if (at > now + spin_us) {
+				cv.wait_until(lk, epoch + std::chrono::microseconds(at - spin_us));
+				continue;
+			}
+
+			lk.unlock();
+
+			while ((now = now_us()) < at)
+				;
+
+			lk.lock();
+			wheel.advance(now / TimerWheel::tick_us, due);
+			unsigned gen = cancels;
+			lk.unlock();
+
+			std::sort(due.begin(), due.end(), [](const Timed &a, const Timed &b) { return a.due < b.due; });
+
+			for (const Timed &tm : due) {
+				while (now_us() < tm.due)
+					;
+
+				// these have left the wheel, so clearing it misses them
+				if (cancels != gen)
+					break;
+
+				send(tm.cmd);
+
+				uint64_t achieved = now_us();
+
+				lk.lock();
+				stats.add(tm.due, achieved);
+				lk.unlock();
+			}
+
+			due.clear();
+			lk.lock();
+		}
+	} catch (const std::runtime_error &e) {
+		if (!lk.owns_lock())
+			lk.lock();
+
+		err = e.what();
+	}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "capture.hpp"
+#include "net.hpp"
+#include "sched.hpp"
+#include "ultimate.hpp"
+
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Sends commands to the Ultimate on a dedicated thread, so the UI never blocks
+ * on the socket. Commands are either sent as soon as possible or at a given
+ * time using a timer wheel. Timed commands are dispatched by sleeping until
+ * shortly before they are due and spinning for the remainder, which keeps
+ * jitter well below a millisecond.
+ */
+class NetWorker final {
+	TcpSocket sock;
+	mutable std::mutex m;
+	std::condition_variable cv;
+	std::deque<Command> q;
+	TimerWheel wheel;
+	std::atomic<unsigned> cancels; // counts cancel(), changed with m held
+	SchedStats stats;
+	std::string err, cmd_err;
+	bool running;
+	std::thread t;
+	std::vector<uint8_t> buf; // only used by worker thread
+	std::unique_ptr<CaptureWriter> cap; // only used by worker thread
+	std::mutex cap_m;
+	std::unique_ptr<CaptureWriter> cap_next; // replaces cap before the next command
+	std::string cap_err; // guarded by cap_m
+	bool cap_swap; // guarded by m
+	std::atomic<bool> cap_on;
+	std::atomic<uint64_t> cap_count;
+	uint64_t dep_hash;
+	bool dep_valid;
+
+	void invalidate(const Command &cmd);
+public:
+	/** Time to busy wait before a timed command is due. */
+	static constexpr uint64_t spin_us = 1000;
+	/** Chunk size for streamed payloads and threshold for sending a payload without copying it. */
+	static constexpr unsigned chunk_size = 64 * 1024;
+
+	NetWorker(const char *address, uint16_t port);
+	NetWorker(const NetWorker&) = delete;
+	~NetWorker();
+
+	/** Send as soon as possible. */
+	void push(Command &&cmd);
+	/** Send at \a due microseconds since now_us() epoch. */
+	void schedule(uint64_t due, Command &&cmd);
+	/** Schedule relative sequence starting \a delay microseconds from now. */
+	void schedule(std::vector<Timed> &&seq, uint64_t delay=0);
+	/** Drop all scheduled commands, also those that are due but not sent yet. */
+	void cancel();
+
+	/**
+	 * Upload and run PRG with content \a hash. If \a skip_unchanged is set
+	 * and the same PRG was the last one uploaded, and neither a start step,
+	 * typed RUN or SYS, nor a command that changes memory was sent since,
+	 * only the start step is sent. This trusts the program not to have
+	 * changed itself while it ran. Returns whether the PRG was uploaded.
+	 */
+	bool deploy(const Bytes &prg, uint64_t hash, bool skip_unchanged=false);
+	/** Upload PRG with content \a hash without running it. */
+	void upload(const Bytes &prg, uint64_t hash);
+	/** Check whether \a hash is the last PRG uploaded and nothing started it again or changed memory since. */
+	bool is_deployed(uint64_t hash) const;
+
+	size_t pending() const;
+	SchedStats timing() const;
+	void reset_timing();
+
+	/** Record every frame sent from now on. Pass nullptr to stop capturing. */
+	void capture(std::unique_ptr<CaptureWriter> &&w);
+	bool capturing();
+	uint64_t captured();
+	/** Take the error of a capture that could not be written. Capturing stops then, the connection stays up. */
+	bool poll_capture_error(std::string &msg);
+
+	/** Error message if the connection failed. The worker stops after the first error. */
+	std::string error() const;
+	bool ok() const;
+	/**
+	 * Take the error of the last command that failed before anything of it
+	 * was sent, like a missing image file. The connection stays up.
+	 */
+	bool poll_error(std::string &msg);
+
+	static uint64_t now_us() noexcept;
+private:
+	void main();
+	void send(const Command &cmd);
+	void send_file(const Command &cmd);
+	void send_packed(const Command &cmd);
+	void swap_capture();
+	void check_capture();
+	void fail(const std::string &msg);
+};